@@ -0,0 +1,142 @@
+// net_bench_compare: diffs two net_bench --json results, matching benchmarks
+// by name. Exits with 1 if any mean got slower by more than the threshold or
+// any benchmark allocates more per op than before.
+//
+//   net_bench_compare baseline.json current.json [--threshold 10]
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <string>
+
+struct BenchRecord
+{
+  double meanNs = 0.0;
+  double p99Ns = 0.0;
+  double allocsPerOp = 0.0;
+};
+
+static bool read_file(const char *path, std::string &text)
+{
+  FILE *file = fopen(path, "rb");
+  if (!file)
+    return false;
+  char chunk[4096];
+  size_t size = 0;
+  while ((size = fread(chunk, 1, sizeof(chunk), file)) > 0)
+    text.append(chunk, size);
+  fclose(file);
+  return true;
+}
+
+// The number after "key": in text, searching from pos up to the record's end
+static bool read_number(const std::string &text, size_t pos, size_t end, const char *key, double &value)
+{
+  const std::string quoted = std::string("\"") + key + "\"";
+  const size_t at = text.find(quoted, pos);
+  if (at == std::string::npos || at > end)
+    return false;
+  const size_t colon = text.find(':', at + quoted.size());
+  if (colon == std::string::npos || colon > end)
+    return false;
+  char *parsed = nullptr;
+  value = strtod(text.c_str() + colon + 1, &parsed);
+  return parsed != text.c_str() + colon + 1;
+}
+
+// Only what net_bench writes: one flat object per benchmark, with quotes and backslashes escaped in names
+static bool load_results(const char *path, std::map<std::string, BenchRecord> &records)
+{
+  std::string text;
+  if (!read_file(path, text))
+    return false;
+  size_t pos = text.find("\"benchmarks\"");
+  if (pos == std::string::npos)
+    return false;
+  while ((pos = text.find('{', pos)) != std::string::npos)
+  {
+    const size_t end = text.find('}', pos);
+    if (end == std::string::npos)
+      return false;
+    size_t nameAt = text.find("\"name\"", pos);
+    if (nameAt == std::string::npos || nameAt > end)
+      return false;
+    nameAt = text.find('"', text.find(':', nameAt + 6));
+    std::string name;
+    for (size_t i = nameAt + 1; i < end && text[i] != '"'; ++i)
+      name += text[i] == '\\' ? text[++i] : text[i];
+    BenchRecord record;
+    if (!read_number(text, pos, end, "mean_ns", record.meanNs) ||
+        !read_number(text, pos, end, "p99_ns", record.p99Ns) ||
+        !read_number(text, pos, end, "allocs_per_op", record.allocsPerOp))
+      return false;
+    records[name] = record;
+    pos = end + 1;
+  }
+  return true;
+}
+
+static double get_change(double before, double after)
+{
+  return before > 0.0 ? (after - before) / before * 100.0 : 0.0;
+}
+
+int main(int argc, const char **argv)
+{
+  double threshold = 10.0;
+  const char *paths[2] = {};
+  int pathCount = 0;
+  for (int i = 1; i < argc; ++i)
+  {
+    if (strcmp(argv[i], "--threshold") == 0 && i + 1 < argc)
+      threshold = atof(argv[++i]);
+    else if (pathCount < 2)
+      paths[pathCount++] = argv[i];
+  }
+  if (pathCount != 2)
+  {
+    printf("usage: net_bench_compare baseline.json current.json [--threshold percent]\n");
+    return 2;
+  }
+
+  std::map<std::string, BenchRecord> baseline;
+  std::map<std::string, BenchRecord> current;
+  for (int i = 0; i < 2; ++i)
+  {
+    if (!load_results(paths[i], i == 0 ? baseline : current))
+    {
+      printf("Cannot read results from %s\n", paths[i]);
+      return 2;
+    }
+  }
+
+  printf("%-44s %10s %10s %8s %8s %14s\n", "benchmark", "mean ns", "mean", "p99", "allocs", "");
+  int regressions = 0;
+  for (const auto &[name, after] : current)
+  {
+    auto it = baseline.find(name);
+    if (it == baseline.end())
+    {
+      printf("%-44s %10.1f %10s %8s %8.2f %14s\n", name.c_str(), after.meanNs, "", "", after.allocsPerOp, "new");
+      continue;
+    }
+    const BenchRecord &before = it->second;
+    const double meanChange = get_change(before.meanNs, after.meanNs);
+    const double p99Change = get_change(before.p99Ns, after.p99Ns);
+    // allocations are counted exactly, so any increase is a regression
+    const bool slower = meanChange > threshold;
+    const bool allocates = after.allocsPerOp > before.allocsPerOp + 0.005;
+    if (slower || allocates)
+      ++regressions;
+    printf("%-44s %10.1f %+9.1f%% %+7.1f%% %+8.2f %14s\n", name.c_str(), after.meanNs, meanChange, p99Change,
+           after.allocsPerOp - before.allocsPerOp,
+           slower && allocates ? "REGRESSED+ALLOC" : slower ? "REGRESSED" : allocates ? "ALLOCATES" :
+           meanChange < -threshold ? "faster" : "");
+  }
+  for (const auto &[name, before] : baseline)
+    if (current.find(name) == current.end())
+      printf("%-44s %10.1f %10s %8s %8.2f %14s\n", name.c_str(), before.meanNs, "", "", before.allocsPerOp, "missing");
+
+  printf("%d regression(s) beyond %.1f%%\n", regressions, threshold);
+  return regressions > 0 ? 1 : 0;
+}
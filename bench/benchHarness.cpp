@@ -0,0 +1,170 @@
+#include "benchHarness.h"
+#include <atomic>
+#include <cstdlib>
+#include <new>
+
+volatile uint32_t BenchSuite::sink = 0;
+
+// Every heap allocation of net_bench goes through these or through ENet's
+// callbacks below
+static std::atomic<uint64_t> allocationCount{ 0 };
+
+uint64_t get_allocation_count()
+{
+  return allocationCount.load(std::memory_order_relaxed);
+}
+
+void *operator new(size_t size)
+{
+  allocationCount.fetch_add(1, std::memory_order_relaxed);
+  if (void *ptr = malloc(size ? size : 1))
+    return ptr;
+  throw std::bad_alloc();
+}
+
+void *operator new[](size_t size)
+{
+  return operator new(size);
+}
+
+void operator delete(void *ptr) noexcept
+{
+  free(ptr);
+}
+
+void operator delete[](void *ptr) noexcept
+{
+  free(ptr);
+}
+
+void operator delete(void *ptr, size_t) noexcept
+{
+  free(ptr);
+}
+
+void operator delete[](void *ptr, size_t) noexcept
+{
+  free(ptr);
+}
+
+static void *counting_malloc(size_t size)
+{
+  allocationCount.fetch_add(1, std::memory_order_relaxed);
+  return malloc(size);
+}
+
+static void counting_free(void *ptr)
+{
+  free(ptr);
+}
+
+const ENetCallbacks *get_counting_enet_callbacks()
+{
+  static ENetCallbacks callbacks = { counting_malloc, counting_free, abort };
+  return &callbacks;
+}
+
+void BenchSuite::print(const BenchResult &result)
+{
+  printf("%-44s %10.1f ns %10.1f ns p99 %8.2f allocs\n", result.name.c_str(), result.meanNs, result.p99Ns,
+         result.allocsPerOp);
+}
+
+// Names are plain ASCII, only quotes and backslashes need escaping
+static void write_json_string(FILE *file, const std::string &str)
+{
+  fputc('"', file);
+  for (char c : str)
+  {
+    if (c == '"' || c == '\\')
+      fputc('\\', file);
+    fputc(c, file);
+  }
+  fputc('"', file);
+}
+
+bool BenchSuite::write_json(const char *path) const
+{
+  FILE *file = fopen(path, "w");
+  if (!file)
+    return false;
+  fprintf(file, "{\n  \"warmup_samples\": %u,\n  \"samples\": %u,\n  \"benchmarks\": [\n", options.warmupSamples,
+          options.samples);
+  for (size_t i = 0; i < results.size(); ++i)
+  {
+    const BenchResult &result = results[i];
+    fprintf(file, "    { \"name\": ");
+    write_json_string(file, result.name);
+    fprintf(file, ", \"mean_ns\": %.3f, \"p99_ns\": %.3f, \"allocs_per_op\": %.4f, \"ops_per_sample\": %u }%s\n",
+            result.meanNs, result.p99Ns, result.allocsPerOp, result.opsPerSample,
+            i + 1 < results.size() ? "," : "");
+  }
+  fprintf(file, "  ]\n}\n");
+  return fclose(file) == 0;
+}
+
+bool BenchLink::open(uint32_t timeoutMs)
+{
+  ENetAddress address;
+  enet_address_set_host(&address, "127.0.0.1");
+  address.port = 0; // any free one
+  // as many channels as any protocol uses, world transfers go on channel 2
+  constexpr size_t channels = 3;
+  server = enet_host_create(&address, 1, channels, 0, 0);
+  client = enet_host_create(nullptr, 1, channels, 0, 0);
+  if (!server || !client || enet_socket_get_address(server->socket, &address) < 0)
+    return false;
+  enet_address_set_host(&address, "127.0.0.1");
+  clientPeer = enet_host_connect(client, &address, channels, 0);
+  if (!clientPeer)
+    return false;
+
+  bool clientConnected = false;
+  bool serverConnected = false;
+  const uint32_t start = enet_time_get();
+  while (!(clientConnected && serverConnected) && enet_time_get() - start < timeoutMs)
+  {
+    ENetEvent event;
+    if (enet_host_service(client, &event, 1) > 0 && event.type == ENET_EVENT_TYPE_CONNECT)
+      clientConnected = true;
+    if (enet_host_service(server, &event, 1) > 0 && event.type == ENET_EVENT_TYPE_CONNECT)
+      serverConnected = true;
+  }
+  return clientConnected && serverConnected;
+}
+
+void BenchLink::close()
+{
+  if (client)
+    enet_host_destroy(client);
+  if (server)
+    enet_host_destroy(server);
+  client = server = nullptr;
+  clientPeer = nullptr;
+}
+
+size_t BenchLink::deliver(size_t count, std::vector<ENetPacket*> *packets, uint32_t timeoutMs)
+{
+  enet_host_flush(client);
+  size_t arrived = 0;
+  const uint32_t start = enet_time_get();
+  while (arrived < count && enet_time_get() - start < timeoutMs)
+  {
+    ENetEvent event;
+    while (enet_host_service(server, &event, 0) > 0)
+    {
+      if (event.type != ENET_EVENT_TYPE_RECEIVE)
+        continue;
+      ++arrived;
+      if (packets)
+        packets->push_back(event.packet);
+      else
+        enet_packet_destroy(event.packet);
+    }
+    // acks, so reliable sends keep going
+    while (enet_host_service(client, &event, 0) > 0)
+      if (event.type == ENET_EVENT_TYPE_RECEIVE)
+        enet_packet_destroy(event.packet);
+  }
+  return arrived;
+}
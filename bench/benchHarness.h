@@ -0,0 +1,221 @@
+#pragma once
+#include <enet/enet.h>
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstddef>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+// The harness of net_bench. A benchmark is one operation, called in samples of
+// opsPerSample calls each: opsPerSample is calibrated so a sample runs for
+// about sampleTargetNs, then come the warmup samples and the measured ones.
+// Every sample gives the mean time of a call within it, a benchmark reports
+// the mean and the 99th percentile of those, and the heap allocations per
+// call, counted by net_bench's operator new and by ENet's allocator.
+//
+// An operation returns a uint32_t that depends on its work, all of them are
+// summed into a volatile so the compiler can't drop the work.
+
+struct BenchOptions
+{
+  uint32_t warmupSamples = 20;
+  uint32_t samples = 200;
+  uint32_t sampleTargetNs = 50000;
+  // only benchmarks whose name contains it, all if null
+  const char *filter = nullptr;
+};
+
+struct BenchResult
+{
+  std::string name;
+  double meanNs = 0.0;
+  double p99Ns = 0.0;
+  double allocsPerOp = 0.0;
+  uint32_t samples = 0;
+  uint32_t opsPerSample = 0;
+};
+
+// Heap allocations so far, see benchHarness.cpp
+uint64_t get_allocation_count();
+// For enet_initialize_with_callbacks, so ENet's allocations count too
+const ENetCallbacks *get_counting_enet_callbacks();
+
+class BenchSuite
+{
+public:
+  explicit BenchSuite(const BenchOptions &options) : options(options) {}
+
+  bool is_selected(const std::string &name) const
+  {
+    return !options.filter || name.find(options.filter) != std::string::npos;
+  }
+
+  // After every sample, outside the timing, settle(ops) undoes what the ops of
+  // that sample left behind (queued packets, grown containers).
+  // maxOpsPerSample bounds how much that may be.
+  template<typename Op, typename Settle>
+  void run(const std::string &name, Op &&op, Settle &&settle, uint32_t maxOpsPerSample = ~0u)
+  {
+    if (!is_selected(name))
+      return;
+    uint32_t acc = 0;
+    uint32_t ops = 1;
+    while (ops < maxOpsPerSample && time_sample(op, ops, acc) < double(options.sampleTargetNs))
+    {
+      settle(ops);
+      // an op the compiler folded away never reaches the target, don't wrap around
+      ops = ops > maxOpsPerSample / 2 ? maxOpsPerSample : ops * 2;
+    }
+    settle(ops);
+    for (uint32_t i = 0; i < options.warmupSamples; ++i)
+    {
+      time_sample(op, ops, acc);
+      settle(ops);
+    }
+    std::vector<double> opNs(options.samples);
+    uint64_t allocations = 0;
+    for (double &ns : opNs)
+    {
+      const uint64_t allocationsBefore = get_allocation_count();
+      ns = time_sample(op, ops, acc) / ops;
+      allocations += get_allocation_count() - allocationsBefore;
+      settle(ops);
+    }
+    sink = sink + acc;
+
+    BenchResult result;
+    result.name = name;
+    result.samples = options.samples;
+    result.opsPerSample = ops;
+    result.allocsPerOp = double(allocations) / (double(ops) * options.samples);
+    for (double ns : opNs)
+      result.meanNs += ns / opNs.size();
+    std::sort(opNs.begin(), opNs.end());
+    result.p99Ns = opNs[std::min(opNs.size() - 1, opNs.size() * 99 / 100)];
+    print(result);
+    results.push_back(result);
+  }
+
+  template<typename Op>
+  void run(const std::string &name, Op &&op)
+  {
+    run(name, op, [](uint32_t) {});
+  }
+
+  const std::vector<BenchResult> &get_results() const { return results; }
+  bool write_json(const char *path) const;
+
+private:
+  // ns of ops calls
+  template<typename Op>
+  static double time_sample(Op &op, uint32_t ops, uint32_t &acc)
+  {
+    const auto start = std::chrono::steady_clock::now();
+    for (uint32_t i = 0; i < ops; ++i)
+      acc += op();
+    const auto end = std::chrono::steady_clock::now();
+    return std::chrono::duration<double, std::nano>(end - start).count();
+  }
+
+  static void print(const BenchResult &result);
+
+  static volatile uint32_t sink;
+  BenchOptions options;
+  std::vector<BenchResult> results;
+};
+
+// A client and a server host connected over loopback. Sends on the client's
+// peer arrive at the server the way they would over a network, so a send
+// benchmark pays for everything up to ENet's queue, and what arrives is what
+// the matching deserialize benchmark reads.
+class BenchLink
+{
+public:
+  ~BenchLink() { close(); }
+
+  // False if the hosts can't be created or don't connect within timeoutMs
+  bool open(uint32_t timeoutMs = 2000);
+  void close();
+
+  ENetPeer *get_client_peer() const { return clientPeer; }
+  ENetHost *get_server() const { return server; }
+
+  // Services both hosts until count packets sent on the client peer arrived,
+  // or timeoutMs passed. Arrived packets go to packets if given, the caller
+  // destroys them, otherwise they are destroyed. Returns how many arrived.
+  size_t deliver(size_t count, std::vector<ENetPacket*> *packets = nullptr, uint32_t timeoutMs = 200);
+
+private:
+  ENetHost *client = nullptr;
+  ENetHost *server = nullptr;
+  ENetPeer *clientPeer = nullptr;
+};
+
+// Packets of one message as they arrived at the server, for deserializing
+class ReceivedPackets
+{
+public:
+  ReceivedPackets() = default;
+  ReceivedPackets(const ReceivedPackets&) = delete;
+  ReceivedPackets &operator=(const ReceivedPackets&) = delete;
+  ~ReceivedPackets()
+  {
+    for (ENetPacket *packet : packets)
+      enet_packet_destroy(packet);
+  }
+
+  // Calls send() count times in batches the link takes without dropping
+  template<typename Send>
+  void collect(BenchLink &link, Send &&send, size_t count)
+  {
+    constexpr size_t batch = 64;
+    for (size_t done = 0; done < count; done += batch)
+    {
+      const size_t n = std::min(batch, count - done);
+      for (size_t i = 0; i < n; ++i)
+        send();
+      link.deliver(n, &packets);
+    }
+  }
+
+  size_t size() const { return packets.size(); }
+  // Cycles through the packets
+  ENetPacket *next() { return packets[cursor++ % packets.size()]; }
+
+private:
+  std::vector<ENetPacket*> packets;
+  size_t cursor = 0;
+};
+
+// A send benchmark named prefix/send_message and, over what that send put
+// through the link, a deserialize benchmark named prefix/deserialize_message.
+// send() sends one packet, deserialize(packet) returns some of what it read.
+template<typename Send, typename Deserialize>
+void run_message_pair(BenchSuite &suite, BenchLink &link, const std::string &prefix, const char *message,
+                      Send &&send, Deserialize &&deserialize)
+{
+  // ENet queues every packet sent, the link drains the queue between samples
+  constexpr uint32_t maxQueued = 64;
+  suite.run(prefix + "/send_" + message, [&]() { send(); return 1u; },
+            [&](uint32_t ops) { link.deliver(ops); }, maxQueued);
+  const std::string deserializeName = prefix + "/deserialize_" + message;
+  if (!suite.is_selected(deserializeName))
+    return;
+  ReceivedPackets received;
+  received.collect(link, send, 256);
+  if (received.size() == 0)
+  {
+    printf("%s: nothing arrived\n", deserializeName.c_str());
+    return;
+  }
+  suite.run(deserializeName, [&]() { return uint32_t(deserialize(received.next())); });
+}
+
+// The benchmarks of each part of the tree, netBench*.cpp
+void run_netcore_benchmarks(BenchSuite &suite);
+void run_w4_benchmarks(BenchSuite &suite, BenchLink &link);
+void run_w5_benchmarks(BenchSuite &suite, BenchLink &link);
+void run_w7_benchmarks(BenchSuite &suite, BenchLink &link);
+void run_w10_benchmarks(BenchSuite &suite, BenchLink &link);
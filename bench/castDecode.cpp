@@ -0,0 +1,53 @@
+#include "castDecode.h"
+#include "quantisation.h"
+#include <algorithm>
+
+namespace cast
+{
+static InputCmd unpack_input(uint8_t thrSteerPacked)
+{
+  static uint8_t neutralPackedValue = pack_float<uint8_t>(0.f, -1.f, 1.f, 4);
+  float4bitsQuantized thrPacked(thrSteerPacked >> 4);
+  float4bitsQuantized steerPacked(thrSteerPacked & 0x0f);
+  InputCmd cmd;
+  cmd.thr = thrPacked.packedVal == neutralPackedValue ? 0.f : thrPacked.unpack(-1.f, 1.f);
+  cmd.steer = steerPacked.packedVal == neutralPackedValue ? 0.f : steerPacked.unpack(-1.f, 1.f);
+  return cmd;
+}
+
+void deserialize_entity_input(ENetPacket *packet, uint16_t &eid, uint32_t &firstSeq, InputCmd *cmds, uint32_t &count)
+{
+  const size_t headerSize = sizeof(uint8_t) + sizeof(uint16_t) + sizeof(uint32_t) + sizeof(uint8_t);
+  count = 0;
+  if (packet->dataLength < headerSize)
+    return;
+  uint8_t *ptr = packet->data; ptr += sizeof(uint8_t);
+  eid = *(uint16_t*)(ptr); ptr += sizeof(uint16_t);
+  firstSeq = *(uint32_t*)(ptr); ptr += sizeof(uint32_t);
+  uint8_t packedCount = *(uint8_t*)(ptr); ptr += sizeof(uint8_t);
+  count = std::min<uint32_t>({ packedCount, inputWindowSize, uint32_t(packet->dataLength - headerSize) });
+  for (uint32_t i = 0; i < count; ++i)
+    cmds[i] = unpack_input(ptr[i]);
+}
+
+void deserialize_new_entity(ENetPacket *packet, Entity &ent)
+{
+  uint8_t *ptr = packet->data; ptr += sizeof(uint8_t);
+  ent = *(Entity*)(ptr); ptr += sizeof(Entity);
+}
+
+void deserialize_eid_token(ENetPacket *packet, uint16_t &eid, uint32_t &token)
+{
+  uint8_t *ptr = packet->data; ptr += sizeof(uint8_t);
+  eid = *(uint16_t*)(ptr); ptr += sizeof(uint16_t);
+  token = *(uint32_t*)(ptr); ptr += sizeof(uint32_t);
+}
+
+void deserialize_snapshot_ack(ENetPacket *packet, uint32_t &seq)
+{
+  if (packet->dataLength < sizeof(uint8_t) + sizeof(uint32_t))
+    return;
+  uint8_t *ptr = packet->data; ptr += sizeof(uint8_t);
+  seq = *(uint32_t*)(ptr); ptr += sizeof(uint32_t);
+}
+}
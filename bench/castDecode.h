@@ -0,0 +1,12 @@
+#pragma once
+#include "protocol.h"
+
+// w10's deserializers as they were before MessageView: pointer casts with no
+// length check, kept only as the baseline for decodeBench
+namespace cast
+{
+void deserialize_entity_input(ENetPacket *packet, uint16_t &eid, uint32_t &firstSeq, InputCmd *cmds, uint32_t &count);
+void deserialize_new_entity(ENetPacket *packet, Entity &ent);
+void deserialize_eid_token(ENetPacket *packet, uint16_t &eid, uint32_t &token);
+void deserialize_snapshot_ack(ENetPacket *packet, uint32_t &seq);
+}
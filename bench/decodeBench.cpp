@@ -0,0 +1,204 @@
+// Decode cost of w10's message schemas against the pointer casts they
+// replaced (castDecode.cpp), over pools of packets as the server and client
+// receive them, each in its own wire format. Each side picks the decoder by
+// the type byte the way its servers and clients do: the registry's dispatch,
+// and for the casts the switch it replaced. The casts are out of line in their
+// own file so they don't get inlined into the loop either.
+#include "protocol.h"
+#include "castDecode.h"
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <random>
+#include <vector>
+
+// Packets of one message, each in its own buffer like ENet hands them over
+struct PacketPool
+{
+  std::vector<std::vector<uint8_t>> buffers;
+  std::vector<ENetPacket> packets;
+
+  void add(const std::vector<uint8_t> &data)
+  {
+    buffers.push_back(data);
+  }
+
+  template<typename Schema>
+  void add(const Schema &schema, const typename Schema::Message &msg)
+  {
+    ENetPacket *packet = create_message_packet(schema, msg, 0);
+    buffers.emplace_back(packet->data, packet->data + packet->dataLength);
+    enet_packet_destroy(packet);
+  }
+
+  void finish()
+  {
+    packets.resize(buffers.size());
+    for (size_t i = 0; i < buffers.size(); ++i)
+    {
+      packets[i] = {};
+      packets[i].data = buffers[i].data();
+      packets[i].dataLength = buffers[i].size();
+    }
+  }
+};
+
+template<typename T>
+static void append(std::vector<uint8_t> &data, const T &value)
+{
+  const uint8_t *bytes = (const uint8_t*)&value;
+  data.insert(data.end(), bytes, bytes + sizeof(T));
+}
+
+static volatile uint32_t sink = 0;
+
+// Takes the fields of each message, what the casts hand back
+struct SumHandler
+{
+  template<typename Msg>
+  void operator()(const Msg &) {}
+
+  void operator()(const EntityInputMsg &msg)
+  {
+    InputCmd cmds[inputWindowSize];
+    sum += msg.eid + msg.firstSeq + unpack_entity_input(msg, cmds);
+  }
+  void operator()(const Entity &ent) { sum += ent.eid; }
+  void operator()(const ReattachMsg &msg) { sum += msg.eid + msg.token; }
+  void operator()(const SnapshotAckMsg &msg) { sum += msg.seq; }
+
+  uint32_t sum = 0;
+};
+
+// Returns the same sum as SumHandler
+struct CastSwitch
+{
+  uint32_t operator()(ENetPacket *packet) const
+  {
+    switch (get_packet_type(packet))
+    {
+    case E_CLIENT_TO_SERVER_INPUT:
+    {
+      uint16_t eid = 0; uint32_t firstSeq = 0, count = 0; InputCmd cmds[inputWindowSize];
+      cast::deserialize_entity_input(packet, eid, firstSeq, cmds, count);
+      return eid + firstSeq + count;
+    }
+    case E_SERVER_TO_CLIENT_NEW_ENTITY:
+    {
+      Entity ent;
+      cast::deserialize_new_entity(packet, ent);
+      return ent.eid;
+    }
+    case E_CLIENT_TO_SERVER_REATTACH:
+    {
+      uint16_t eid = 0; uint32_t token = 0;
+      cast::deserialize_eid_token(packet, eid, token);
+      return eid + token;
+    }
+    case E_CLIENT_TO_SERVER_SNAPSHOT_ACK:
+    {
+      uint32_t seq = 0;
+      cast::deserialize_snapshot_ack(packet, seq);
+      return seq;
+    }
+    default:
+      return 0;
+    }
+  }
+};
+
+template<typename Messages>
+struct DispatchSum
+{
+  uint32_t operator()(ENetPacket *packet) const
+  {
+    SumHandler handler;
+    Messages::dispatch(handler, packet);
+    return handler.sum;
+  }
+};
+
+// ns per packet of one pass over the pool
+template<typename Decode>
+static double time_pass(PacketPool &pool, Decode decode)
+{
+  constexpr int passes = 200;
+  uint32_t acc = 0;
+  const auto start = std::chrono::steady_clock::now();
+  for (int pass = 0; pass < passes; ++pass)
+    for (ENetPacket &packet : pool.packets)
+      acc += decode(&packet);
+  const auto end = std::chrono::steady_clock::now();
+  sink = sink + acc;
+  return std::chrono::duration<double, std::nano>(end - start).count() / (double(passes) * pool.packets.size());
+}
+
+// Best of a few runs each, alternating so both see the same machine state
+template<typename CastDecode, typename SchemaDecode>
+static void compare(const char *name, PacketPool &castPool, CastDecode castDecode, PacketPool &schemaPool,
+                    SchemaDecode schemaDecode)
+{
+  constexpr int runs = 9;
+  double castNs = 1e30, schemaNs = 1e30;
+  for (int run = 0; run < runs; ++run)
+  {
+    castNs = std::min(castNs, time_pass(castPool, castDecode));
+    schemaNs = std::min(schemaNs, time_pass(schemaPool, schemaDecode));
+  }
+  printf("%-14s cast %6.2f ns  schema %6.2f ns  (%+.0f%%)\n", name, castNs, schemaNs,
+         (schemaNs / castNs - 1.0) * 100.0);
+}
+
+int main()
+{
+  constexpr uint32_t poolSize = 4096;
+  std::mt19937 rng(1);
+  PacketPool castInputs, castEntities, castReattaches, castAcks;
+  PacketPool inputs, entities, reattaches, acks;
+  for (uint32_t i = 0; i < poolSize; ++i)
+  {
+    EntityInputMsg input;
+    input.eid = uint16_t(rng());
+    input.firstSeq = uint32_t(rng());
+    input.count = uint8_t(inputWindowSize);
+    for (uint8_t &packed : input.packedInputs)
+      packed = uint8_t(rng());
+    std::vector<uint8_t> data = { E_CLIENT_TO_SERVER_INPUT };
+    append(data, input.eid);
+    append(data, input.firstSeq);
+    append(data, input.count);
+    data.insert(data.end(), input.packedInputs, input.packedInputs + inputWindowSize);
+    castInputs.add(data);
+    inputs.add(entityInputSchema, input);
+
+    Entity ent;
+    ent.eid = uint16_t(rng());
+    ent.x = float(rng() % 100);
+    data = { E_SERVER_TO_CLIENT_NEW_ENTITY };
+    append(data, ent);
+    castEntities.add(data);
+    entities.add(newEntitySchema, ent);
+
+    const ReattachMsg reattach = { uint16_t(rng()), uint32_t(rng()) };
+    data = { E_CLIENT_TO_SERVER_REATTACH };
+    append(data, reattach.eid);
+    append(data, reattach.token);
+    castReattaches.add(data);
+    reattaches.add(reattachSchema, reattach);
+
+    const SnapshotAckMsg ack = { uint32_t(rng()) };
+    data = { E_CLIENT_TO_SERVER_SNAPSHOT_ACK };
+    append(data, ack.seq);
+    castAcks.add(data);
+    acks.add(snapshotAckSchema, ack);
+  }
+  for (PacketPool *pool : { &castInputs, &castEntities, &castReattaches, &castAcks,
+                            &inputs, &entities, &reattaches, &acks })
+    pool->finish();
+
+  compare("input", castInputs, CastSwitch(), inputs, DispatchSum<ClientToServerMessages>());
+  compare("new entity", castEntities, CastSwitch(), entities, DispatchSum<ServerToClientMessages>());
+  compare("reattach", castReattaches, CastSwitch(), reattaches, DispatchSum<ClientToServerMessages>());
+  compare("snapshot ack", castAcks, CastSwitch(), acks, DispatchSum<ClientToServerMessages>());
+  return 0;
+}
@@ -0,0 +1,188 @@
+// net_bench: the protocol and simulation hot paths of every part of the tree,
+// with the harness of benchHarness.h. Results go to stdout and, with --json,
+// to a file net_bench_compare diffs against another build's.
+//
+//   net_bench [--json results.json] [--filter w10/] [--samples 200] [--warmup 20]
+#include "benchHarness.h"
+#include "bitStream.h"
+#include "eidAllocator.h"
+#include "eidIndex.h"
+#include "netTelemetry.h"
+#include "profiler.h"
+#include "secureSession.h"
+#include "spscRing.h"
+#include "tripleBuffer.h"
+#include <cstdlib>
+#include <cstring>
+#include <random>
+
+void run_netcore_benchmarks(BenchSuite &suite)
+{
+  constexpr uint32_t values = 32;
+  constexpr uint32_t bits = 11;
+  uint8_t buffer[(values * bits + 7) / 8];
+  uint32_t input[values];
+  std::mt19937 rng(1);
+  for (uint32_t &v : input)
+    v = rng() & ((1u << bits) - 1);
+  suite.run("netcore/bitwriter_write_32x11", [&]()
+  {
+    BitWriter writer(buffer, sizeof(buffer));
+    for (uint32_t v : input)
+      writer.write(v, bits);
+    return uint32_t(buffer[0]);
+  });
+  suite.run("netcore/bitreader_read_32x11", [&]()
+  {
+    BitReader reader(buffer, sizeof(buffer));
+    uint32_t sum = 0;
+    for (uint32_t i = 0; i < values; ++i)
+      sum += reader.read(bits);
+    return sum;
+  });
+
+  EidIndex index;
+  std::vector<uint32_t> dense;
+  std::vector<uint16_t> eids;
+  for (uint16_t eid = 0; eid < 1024; ++eid)
+  {
+    index.insert(eid * 3);
+    dense.push_back(eid);
+    eids.push_back(uint16_t(rng() % (1024 * 3)));
+  }
+  size_t next = 0;
+  suite.run("netcore/eidindex_get_1024", [&]()
+  {
+    const uint32_t *value = index.get(dense, eids[next++ % eids.size()]);
+    return value ? *value : 0u;
+  });
+
+  // a despawn and a spawn among 1024 live entities, with the eid index and
+  // the dense array following along, what a join after a leave costs
+  EidAllocator allocator;
+  EidIndex churnIndex;
+  std::vector<uint32_t> churnDense;
+  std::vector<uint16_t> live;
+  for (uint32_t i = 0; i < 1024; ++i)
+  {
+    live.push_back(allocator.allocate());
+    churnIndex.insert(live.back());
+    churnDense.push_back(i);
+  }
+  suite.run("netcore/eid_churn_1024", [&]()
+  {
+    uint16_t &eid = live[next++ % live.size()];
+    allocator.free(eid);
+    churnIndex.erase(churnDense, eid);
+    eid = allocator.allocate();
+    churnIndex.insert(eid);
+    churnDense.push_back(eid);
+    return uint32_t(eid);
+  });
+
+  // what the send path of a w10 packet adds to count it
+  NetTelemetry telemetry;
+  uint8_t type = 0;
+  suite.run("netcore/telemetry_count", [&]()
+  {
+    type = uint8_t(type + 1) & 7;
+    telemetry.count(E_TELEMETRY_SENT, type & 1, type, 64);
+    return uint32_t(type);
+  });
+
+  // one profiler zone around nothing, what every zone in the tick loops costs
+  suite.run("netcore/profile_zone", [&]()
+  {
+    PROFILE_ZONE("bench");
+    return uint32_t(type);
+  });
+
+  // one message through a ring between threads and out again, on one thread
+  // so only the ring itself is timed, not the cache line moving over
+  SpscRing<uint64_t> ring(1024);
+  uint64_t pushed = 0;
+  suite.run("netcore/spsc_push_pop", [&]()
+  {
+    uint64_t popped = 0;
+    ring.push(pushed++);
+    ring.pop(popped);
+    return uint32_t(popped);
+  });
+
+  // a client's network thread publishing a view and its render thread taking it
+  TripleBuffer<uint64_t> views;
+  uint64_t published = 0;
+  suite.run("netcore/triple_buffer_publish_update", [&]()
+  {
+    views.get_back() = published++;
+    views.publish();
+    views.update();
+    return uint32_t(views.get_front());
+  });
+
+  // a sealed 64 byte packet opened by the other end, as every w10 packet is
+  uint8_t clientSecret[x25519KeySize];
+  uint8_t serverSecret[x25519KeySize];
+  generate_session_secret(clientSecret);
+  generate_session_secret(serverSecret);
+  SecureSession client;
+  SecureSession server;
+  client.start(clientSecret);
+  server.start(serverSecret);
+  if (!client.establish(server.get_public_key(), false, true) || !server.establish(client.get_public_key(), true, true))
+  {
+    printf("netcore/session: key exchange failed\n");
+    return;
+  }
+  uint8_t packet[64 + sealOverhead] = {};
+  suite.run("netcore/session_seal_open_64", [&]()
+  {
+    size_t size = client.seal(1, packet, 64);
+    return uint32_t(server.open(1, packet, size)) + uint32_t(size);
+  });
+}
+
+int main(int argc, const char **argv)
+{
+  BenchOptions options;
+  const char *jsonPath = nullptr;
+  for (int i = 1; i + 1 < argc; ++i)
+  {
+    if (strcmp(argv[i], "--json") == 0)
+      jsonPath = argv[++i];
+    else if (strcmp(argv[i], "--filter") == 0)
+      options.filter = argv[++i];
+    else if (strcmp(argv[i], "--samples") == 0)
+      options.samples = uint32_t(std::max(1, atoi(argv[++i])));
+    else if (strcmp(argv[i], "--warmup") == 0)
+      options.warmupSamples = uint32_t(std::max(0, atoi(argv[++i])));
+  }
+
+  if (enet_initialize_with_callbacks(ENET_VERSION, get_counting_enet_callbacks()) != 0)
+  {
+    printf("Cannot init ENet");
+    return 1;
+  }
+  BenchLink link;
+  if (!link.open())
+  {
+    printf("Cannot connect over loopback\n");
+    return 1;
+  }
+
+  BenchSuite suite(options);
+  run_netcore_benchmarks(suite);
+  run_w4_benchmarks(suite, link);
+  run_w5_benchmarks(suite, link);
+  run_w7_benchmarks(suite, link);
+  run_w10_benchmarks(suite, link);
+
+  link.close();
+  enet_deinitialize();
+  if (jsonPath && !suite.write_json(jsonPath))
+  {
+    printf("Cannot write %s\n", jsonPath);
+    return 1;
+  }
+  return 0;
+}
@@ -0,0 +1,180 @@
+// w10's protocol and simulation in namespace w10, see netBenchW4.cpp
+#include "benchHarness.h"
+#include <enet/enet.h>
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <cstddef>
+#include <cstring>
+#include <iostream>
+#include <limits>
+#include <math.h>
+#include <random>
+#include <vector>
+#include "archetype.h"
+#include "inputWindow.h"
+#include "messageSchema.h"
+#include "messageRegistry.h"
+#include "netTelemetry.h"
+#include "rangeCoder.h"
+#include "secureSession.h"
+#include "simdMath.h"
+#include "snapshotDelta.h"
+#include "worldTransfer.h"
+
+namespace w10
+{
+#include "../w10/protocol.cpp"
+#include "../w10/entity.cpp"
+}
+
+void run_w10_benchmarks(BenchSuite &suite, BenchLink &link)
+{
+  using namespace w10;
+  ENetPeer *peer = link.get_client_peer();
+
+  float values[64];
+  uint8_t packed[64];
+  std::mt19937 rng(1);
+  std::uniform_real_distribution<float> unit(-1.f, 1.f);
+  for (float &v : values)
+    v = unit(rng);
+  suite.run("w10/pack_float_64", [&]()
+  {
+    for (size_t i = 0; i < 64; ++i)
+      packed[i] = pack_float<uint8_t>(values[i], -1.f, 1.f, 4);
+    return uint32_t(packed[0]);
+  });
+  suite.run("w10/unpack_float_64", [&]()
+  {
+    float sum = 0.f;
+    for (uint8_t v : packed)
+      sum += unpack_float<uint8_t>(v, -1.f, 1.f, 4);
+    return uint32_t(sum);
+  });
+
+  // The client peer has no session, so these measure the messages alone,
+  // netcore/session_seal_open_64 what sealing adds to each
+  Entity ent;
+  ent.eid = 12;
+  ent.x = 5.f;
+  InputWindow<InputCmd, inputWindowSize> inputs;
+  uint32_t seq = 0;
+  uint8_t publicKey[x25519KeySize] = { 1, 2, 3 };
+  run_message_pair(suite, link, "w10", "join",
+    [&]() { send_join(peer); },
+    [&](ENetPacket *p) { return uint32_t(get_packet_type(p)); });
+  run_message_pair(suite, link, "w10", "new_entity",
+    [&]() { send_new_entity(peer, ent); },
+    [&](ENetPacket *p) { Entity e; read_message(newEntitySchema, p, e); return uint32_t(e.eid); });
+  run_message_pair(suite, link, "w10", "set_controlled_entity",
+    [&]() { send_set_controlled_entity(peer, ent.eid); },
+    [&](ENetPacket *p) { SetControlledEntityMsg msg; read_message(setControlledEntitySchema, p, msg); return uint32_t(msg.eid); });
+  run_message_pair(suite, link, "w10", "client_key",
+    [&]() { send_client_key(peer, publicKey); },
+    [&](ENetPacket *p) { ClientKeyMsg msg; return uint32_t(read_message(clientKeySchema, p, msg)); });
+  run_message_pair(suite, link, "w10", "server_key",
+    [&]() { send_server_key(peer, publicKey, true); },
+    [&](ENetPacket *p) { ServerKeyMsg msg; return uint32_t(read_message(serverKeySchema, p, msg)) + msg.sealed; });
+  run_message_pair(suite, link, "w10", "session_token",
+    [&]() { send_session_token(peer, ent.eid, 0x12345678); },
+    [&](ENetPacket *p) { SessionTokenMsg msg; read_message(sessionTokenSchema, p, msg); return msg.eid + msg.token; });
+  run_message_pair(suite, link, "w10", "reattach",
+    [&]() { send_reattach(peer, ent.eid, 0x12345678); },
+    [&](ENetPacket *p) { ReattachMsg msg; read_message(reattachSchema, p, msg); return msg.eid + msg.token; });
+  run_message_pair(suite, link, "w10", "entity_input",
+    [&]()
+    {
+      ++seq;
+      inputs.push(seq, { (seq % 3) * 0.5f - 0.5f, (seq % 5) * 0.5f - 1.f });
+      send_entity_input(peer, ent.eid, inputs);
+    },
+    [&](ENetPacket *p)
+    {
+      EntityInputMsg msg; InputCmd cmds[inputWindowSize];
+      read_message(entityInputSchema, p, msg);
+      return msg.eid + msg.firstSeq + unpack_entity_input(msg, cmds);
+    });
+  run_message_pair(suite, link, "w10", "snapshot_ack",
+    [&]() { send_snapshot_ack(peer, ++seq); },
+    [&](ENetPacket *p) { SnapshotAckMsg msg; read_message(snapshotAckSchema, p, msg); return msg.seq; });
+
+  // 64 moving entities, a tick after the baseline the client acked, plain and
+  // range coded. Every snapshot is coded from the baseline's model, so the
+  // model does not drift from one sample to the next.
+  std::vector<Entity> entities(1024);
+  for (size_t i = 0; i < entities.size(); ++i)
+  {
+    Entity &e = entities[i];
+    e.eid = uint16_t(i);
+    e.x = unit(rng) * 10.f;
+    e.y = unit(rng) * 5.f;
+    e.ori = unit(rng) * PI;
+    e.speed = 5.f;
+    e.thr = unit(rng);
+    e.steer = unit(rng);
+  }
+  std::vector<Entity> moving(entities.begin(), entities.begin() + 64);
+  ReplicatedSnapshot baseline;
+  ReplicatedSnapshot sent;
+  WorldSnapshot world;
+  make_world_snapshot(moving, world);
+  std::vector<uint8_t> buffer;
+  encode_world_snapshot(buffer, 1, 0, nullptr, world, true, baseline);
+  for (Entity &e : moving)
+    simulate_entity(e, 0.01f);
+  make_world_snapshot(moving, world);
+  for (bool coded : { false, true })
+  {
+    uint32_t snapshotSeq = 1;
+    run_message_pair(suite, link, "w10", coded ? "world_snapshot_coded_64" : "world_snapshot_delta_64",
+      [&]() { ++snapshotSeq; send_world_snapshot(peer, snapshotSeq, 1, &baseline, world, coded, sent); },
+      [&](ENetPacket *p)
+      {
+        static ReplicatedSnapshot received;
+        uint32_t s = 0, baselineSeq = 0;
+        read_world_snapshot_header(p, s, baselineSeq);
+        read_world_snapshot(p, &baseline, received);
+        return s + uint32_t(received.world.size());
+      });
+  }
+
+  // The world a client gets on joining, as one coded block, and one chunk of it
+  std::vector<Entity> sortedEntities = entities;
+  std::vector<uint8_t> worldState;
+  std::vector<Entity> decodedWorld;
+  suite.run("w10/encode_world_state_1024", [&]()
+  {
+    encode_world_state(sortedEntities, worldState);
+    return uint32_t(worldState.size());
+  });
+  suite.run("w10/decode_world_state_1024", [&]()
+  {
+    decode_world_state(worldState.data(), worldState.size(), decodedWorld);
+    return uint32_t(decodedWorld.size());
+  });
+  WorldTransferSender transfer;
+  transfer.start(1, worldState.data(), worldState.size());
+  WorldChunkMsg chunk;
+  transfer.next_chunk(chunk);
+  run_message_pair(suite, link, "w10", "world_chunk",
+    [&]() { send_world_chunk(peer, chunk); },
+    [&](ENetPacket *p) { static WorldChunkMsg c; read_message(worldChunkSchema, p, c); return uint32_t(c.size); });
+
+  suite.run("w10/simulate_entity_1024", [&]()
+  {
+    for (Entity &e : entities)
+      simulate_entity(e, 0.01f);
+    return uint32_t(entities[0].x);
+  });
+  // what the room steps, on the arrays of a ship archetype
+  typedef Archetype<NetId, PosX, PosY, Ori, Speed, Thr, Steer> Ship;
+  EntityWorld<Ship> ships;
+  for (const Entity &e : entities)
+    write_entity(ships.get_archetype<Ship>(), ships.get_row(ships.create<Ship>()), e);
+  suite.run("w10/simulate_entities_1024", [&]()
+  {
+    simulate_entities(ships, 0.01f);
+    return uint32_t(ships.get_archetype<Ship>().get<PosX>(0));
+  });
+}
@@ -0,0 +1,106 @@
+// w4's protocol and world, compiled into namespace w4 so they link next to the
+// other parts of the tree, whose functions share names. What their sources
+// include from outside w4 is included first, so inside the namespace only
+// w4's own code is declared.
+#include "benchHarness.h"
+#include <enet/enet.h>
+#include <cstdint>
+#include <cstddef>
+#include <cstring>
+#include <math.h>
+#include <stdio.h>
+#include <map>
+#include <random>
+#include <vector>
+#include "archetype.h"
+#include "checkpoint.h"
+#include "eidIndex.h"
+#include "entityHistory.h"
+#include "messageRegistry.h"
+#include "profiler.h"
+
+namespace w4
+{
+#include "../w4/protocol.cpp"
+#include "../w4/world.cpp"
+}
+
+void run_w4_benchmarks(BenchSuite &suite, BenchLink &link)
+{
+  using namespace w4;
+  ENetPeer *peer = link.get_client_peer();
+
+  // The snapshot schema alone, without a packet around it
+  uint8_t buffer[snapshotSchema.get_size()];
+  const SnapshotMsg fields = { 7, 1.f, 2.f, 3.f, 100 };
+  suite.run("w4/snapshot_schema_write", [&]()
+  {
+    snapshotSchema.write(buffer, sizeof(buffer), fields);
+    return uint32_t(buffer[0]);
+  });
+  suite.run("w4/snapshot_schema_read", [&]()
+  {
+    SnapshotMsg read;
+    snapshotSchema.read(buffer, sizeof(buffer), read);
+    return uint32_t(read.eid) + read.tick;
+  });
+
+  Entity ent;
+  ent.eid = 12;
+  ent.x = 5.f;
+  ent.size = 7.f;
+  uint32_t tick = 0;
+  run_message_pair(suite, link, "w4", "join",
+    [&]() { send_join(peer); },
+    [&](ENetPacket *p) { return uint32_t(get_packet_type(p)); });
+  run_message_pair(suite, link, "w4", "new_entity",
+    [&]() { send_new_entity(peer, ent); },
+    [&](ENetPacket *p) { Entity e; read_message(newEntitySchema, p, e); return uint32_t(e.eid); });
+  run_message_pair(suite, link, "w4", "set_controlled_entity",
+    [&]() { send_set_controlled_entity(peer, ent.eid); },
+    [&](ENetPacket *p) { SetControlledEntityMsg msg; read_message(setControlledEntitySchema, p, msg); return uint32_t(msg.eid); });
+  run_message_pair(suite, link, "w4", "entity_state",
+    [&]() { send_entity_state(peer, ent.eid, ent.x, ent.y, ent.size, ++tick, 100); },
+    [&](ENetPacket *p)
+    {
+      EntityStateMsg msg;
+      read_message(entityStateSchema, p, msg);
+      return msg.eid + msg.viewTick;
+    });
+  run_message_pair(suite, link, "w4", "entity_update",
+    [&]() { send_entity_update(peer, ent.eid, ent.x, ent.y, ent.size, ++tick); },
+    [&](ENetPacket *p)
+    {
+      EntityUpdateMsg msg;
+      read_message(entityUpdateSchema, p, msg);
+      return msg.eid + msg.tick;
+    });
+  run_message_pair(suite, link, "w4", "snapshot",
+    [&]() { send_snapshot(peer, ent.eid, ent.x, ent.y, ent.size, ++tick); },
+    [&](ENetPacket *p)
+    {
+      SnapshotMsg msg;
+      read_message(snapshotSchema, p, msg);
+      return msg.eid + msg.tick;
+    });
+  run_message_pair(suite, link, "w4", "player_score",
+    [&]() { send_player_score(peer, ent.eid, 3); },
+    [&](ENetPacket *p) { ScoreMsg msg; read_message(scoreSchema, p, msg); return msg.eid + uint32_t(msg.score); });
+  run_message_pair(suite, link, "w4", "session_token",
+    [&]() { send_session_token(peer, ent.eid, 0x12345678); },
+    [&](ENetPacket *p) { SessionTokenMsg msg; read_message(sessionTokenSchema, p, msg); return msg.eid + msg.token; });
+  run_message_pair(suite, link, "w4", "reattach",
+    [&]() { send_reattach(peer, ent.eid, 0x12345678); },
+    [&](ENetPacket *p) { ReattachMsg msg; read_message(reattachSchema, p, msg); return msg.eid + msg.token; });
+
+  // The collision pass of update_world over 256 AI sized entities. Entities
+  // that collide teleport, so the world stays busy however often it runs.
+  init_world(1);
+  while (entities.size() < 256)
+    create_random_entity(false);
+  suite.run("w4/collide_entities_256", [&]()
+  {
+    collide_entities(link.get_server());
+    return uint32_t(entities.get<Position>(entityHandles[0])->x);
+  });
+}
@@ -0,0 +1,89 @@
+// w5's protocol and simulation in namespace w5, see netBenchW4.cpp
+#include "benchHarness.h"
+#include <enet/enet.h>
+#include <algorithm>
+#include <cstdint>
+#include <cstddef>
+#include <cstring>
+#include <limits>
+#include <math.h>
+#include <random>
+#include <vector>
+#include "inputWindow.h"
+#include "messageRegistry.h"
+#include "simdMath.h"
+
+namespace w5
+{
+#include "../w5/protocol.cpp"
+#include "../w5/entity.cpp"
+}
+
+void run_w5_benchmarks(BenchSuite &suite, BenchLink &link)
+{
+  using namespace w5;
+  ENetPeer *peer = link.get_client_peer();
+
+  Entity ent;
+  ent.eid = 12;
+  ent.x = 5.f;
+  InputWindow<InputCmd, inputWindowSize> inputs;
+  uint32_t seq = 0;
+  uint32_t tick = 0;
+  run_message_pair(suite, link, "w5", "join",
+    [&]() { send_join(peer); },
+    [&](ENetPacket *p) { return uint32_t(get_packet_type(p)); });
+  run_message_pair(suite, link, "w5", "new_entity",
+    [&]() { send_new_entity(peer, ent); },
+    [&](ENetPacket *p) { Entity e; read_message(newEntitySchema, p, e); return uint32_t(e.eid); });
+  run_message_pair(suite, link, "w5", "set_controlled_entity",
+    [&]() { send_set_controlled_entity(peer, ent.eid); },
+    [&](ENetPacket *p) { SetControlledEntityMsg msg; read_message(setControlledEntitySchema, p, msg); return uint32_t(msg.eid); });
+  run_message_pair(suite, link, "w5", "entity_input",
+    [&]()
+    {
+      ++seq;
+      inputs.push(seq, { (seq % 3) * 0.5f - 0.5f, (seq % 5) * 0.5f - 1.f });
+      send_entity_input(peer, ent.eid, inputs);
+    },
+    [&](ENetPacket *p)
+    {
+      EntityInputMsg msg; InputCmd cmds[inputWindowSize];
+      read_message(entityInputSchema, p, msg);
+      return msg.eid + msg.firstSeq + unpack_entity_input(msg, cmds);
+    });
+  run_message_pair(suite, link, "w5", "snapshot",
+    [&]() { ++tick; send_snapshot(peer, ent.eid, ent.x, ent.y, ent.ori, ent.speed, tick, tick - 2); },
+    [&](ENetPacket *p)
+    {
+      SnapshotMsg msg;
+      read_message(snapshotSchema, p, msg);
+      return msg.eid + msg.tick + msg.ack;
+    });
+
+  std::mt19937 rng(1);
+  std::uniform_real_distribution<float> unit(-1.f, 1.f);
+  std::vector<Entity> entities(1024);
+  for (Entity &e : entities)
+  {
+    e.x = unit(rng) * 10.f;
+    e.y = unit(rng) * 10.f;
+    e.ori = unit(rng) * 3.14159f;
+    e.thr = unit(rng);
+    e.steer = unit(rng);
+  }
+  suite.run("w5/simulate_entity_1024", [&]()
+  {
+    for (Entity &e : entities)
+      simulate_entity(e, 0.01f);
+    return uint32_t(entities[0].x);
+  });
+  EntityBatch batch;
+  for (const Entity &e : entities)
+    batch.push(e);
+  suite.run("w5/simulate_entities_1024", [&]()
+  {
+    simulate_entities(batch, 0.01f);
+    return uint32_t(batch.x[0]);
+  });
+}
@@ -0,0 +1,105 @@
+// w7's protocol and simulation in namespace w7, see netBenchW4.cpp
+#include "benchHarness.h"
+#include <enet/enet.h>
+#include <algorithm>
+#include <cstdint>
+#include <cstddef>
+#include <cstring>
+#include <iostream>
+#include <limits>
+#include <math.h>
+#include <random>
+#include <vector>
+#include "inputWindow.h"
+#include "messageSchema.h"
+#include "messageRegistry.h"
+#include "snapshotDelta.h"
+
+namespace w7
+{
+#include "../w7/protocol.cpp"
+#include "../w7/entity.cpp"
+}
+
+void run_w7_benchmarks(BenchSuite &suite, BenchLink &link)
+{
+  using namespace w7;
+  ENetPeer *peer = link.get_client_peer();
+
+  Entity ent;
+  ent.eid = 12;
+  ent.x = 5.f;
+  InputWindow<InputCmd, inputWindowSize> inputs;
+  uint32_t seq = 0;
+  run_message_pair(suite, link, "w7", "join",
+    [&]() { send_join(peer); },
+    [&](ENetPacket *p) { return uint32_t(get_packet_type(p)); });
+  run_message_pair(suite, link, "w7", "new_entity",
+    [&]() { send_new_entity(peer, ent); },
+    [&](ENetPacket *p) { Entity e; read_message(newEntitySchema, p, e); return uint32_t(e.eid); });
+  run_message_pair(suite, link, "w7", "set_controlled_entity",
+    [&]() { send_set_controlled_entity(peer, ent.eid); },
+    [&](ENetPacket *p) { SetControlledEntityMsg msg; read_message(setControlledEntitySchema, p, msg); return uint32_t(msg.eid); });
+  run_message_pair(suite, link, "w7", "entity_input",
+    [&]()
+    {
+      ++seq;
+      inputs.push(seq, { (seq % 3) * 0.5f - 0.5f, (seq % 5) * 0.5f - 1.f });
+      send_entity_input(peer, ent.eid, inputs);
+    },
+    [&](ENetPacket *p)
+    {
+      EntityInputMsg msg; InputCmd cmds[inputWindowSize];
+      read_message(entityInputSchema, p, msg);
+      return msg.eid + msg.firstSeq + unpack_entity_input(msg, cmds);
+    });
+  run_message_pair(suite, link, "w7", "snapshot_ack",
+    [&]() { send_snapshot_ack(peer, ++seq); },
+    [&](ENetPacket *p) { SnapshotAckMsg msg; read_message(snapshotAckSchema, p, msg); return msg.seq; });
+
+  // 64 moving entities, a tick after the baseline the client acked
+  std::mt19937 rng(1);
+  std::uniform_real_distribution<float> unit(-1.f, 1.f);
+  std::vector<Entity> entities(1024);
+  for (size_t i = 0; i < entities.size(); ++i)
+  {
+    Entity &e = entities[i];
+    e.eid = uint16_t(i);
+    e.x = unit(rng) * 10.f;
+    e.y = unit(rng) * 5.f;
+    e.ori = unit(rng) * PI;
+    e.speed = 5.f;
+    e.thr = unit(rng);
+    e.steer = unit(rng);
+  }
+  std::vector<Entity> moving(entities.begin(), entities.begin() + 64);
+  WorldSnapshot baseline;
+  WorldSnapshot world;
+  make_world_snapshot(moving, baseline);
+  for (Entity &e : moving)
+    simulate_entity(e, 0.01f);
+  make_world_snapshot(moving, world);
+  uint32_t snapshotSeq = 1;
+  run_message_pair(suite, link, "w7", "world_snapshot_delta_64",
+    [&]() { ++snapshotSeq; send_world_snapshot(peer, snapshotSeq, 1, &baseline, world); },
+    [&](ENetPacket *p)
+    {
+      static WorldSnapshot received;
+      uint32_t s = 0, baselineSeq = 0;
+      read_world_snapshot_header(p, s, baselineSeq);
+      read_world_snapshot(p, &baseline, received);
+      return s + uint32_t(received.size());
+    });
+
+  suite.run("w7/make_world_snapshot_1024", [&]()
+  {
+    make_world_snapshot(entities, world);
+    return uint32_t(world.size());
+  });
+  suite.run("w7/simulate_entity_1024", [&]()
+  {
+    for (Entity &e : entities)
+      simulate_entity(e, 0.01f);
+    return uint32_t(entities[0].x);
+  });
+}
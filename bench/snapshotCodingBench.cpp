@@ -0,0 +1,124 @@
+// What range coding w10's snapshots saves against what it costs. Entities
+// drive around under random input, the server replicates the world to one
+// client every tick with the client's acks arriving ackLag ticks late and some
+// snapshots lost, once plain and once coded. Every decoded world is checked
+// against what was sent.
+#include "protocol.h"
+#include "mathUtils.h"
+#include "snapshotDelta.h"
+#include "sequenceRing.h"
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <random>
+#include <vector>
+
+struct CodingResult
+{
+  double bytes = 0.0;
+  double encodeNs = 0.0;
+  double decodeNs = 0.0;
+  uint32_t snapshots = 0;
+  uint32_t decoded = 0;
+  bool mismatch = false;
+};
+
+static CodingResult replicate(uint32_t entityCount, uint32_t ticks, uint32_t ackLag, float lossRate, bool coded)
+{
+  constexpr float dt = 0.01f;
+  std::mt19937 rng(entityCount);
+  std::uniform_real_distribution<float> unit(-1.f, 1.f);
+  std::vector<Entity> entities(entityCount);
+  for (uint32_t i = 0; i < entityCount; ++i)
+    entities[i] = { 0xff000000, unit(rng) * 15.f, unit(rng) * 7.f, 0.f, unit(rng) * PI, unit(rng), unit(rng),
+                    uint16_t(i) };
+
+  DeltaBaselines<ReplicatedSnapshot, snapshotHistorySize> server;
+  SequenceRing<ReplicatedSnapshot, snapshotHistorySize> client;
+  std::vector<uint32_t> pendingAcks;
+  std::vector<uint8_t> buffer;
+  WorldSnapshot world;
+  ReplicatedSnapshot sent;
+  ReplicatedSnapshot received;
+  CodingResult result;
+  server.reset();
+  for (uint32_t tick = 0; tick < ticks; ++tick)
+  {
+    for (Entity &e : entities)
+    {
+      if (rng() % 50 == 0)
+      {
+        e.thr = unit(rng);
+        e.steer = unit(rng);
+      }
+      simulate_entity(e, dt);
+      // keep them inside the quantized range so they never stop changing
+      e.x = e.x > 16.f ? e.x - 32.f : e.x < -16.f ? e.x + 32.f : e.x;
+      e.y = e.y > 8.f ? e.y - 16.f : e.y < -8.f ? e.y + 16.f : e.y;
+    }
+    make_world_snapshot(entities, world);
+
+    uint32_t baselineSeq = 0;
+    const ReplicatedSnapshot *baseline = server.get_baseline(baselineSeq);
+    const uint32_t seq = server.get_next_seq();
+    const auto encodeStart = std::chrono::steady_clock::now();
+    const size_t size = encode_world_snapshot(buffer, seq, baselineSeq, baseline, world, coded, sent);
+    const auto encodeEnd = std::chrono::steady_clock::now();
+    if (size == 0)
+      continue;
+    server.push(sent);
+    result.bytes += double(size);
+    result.encodeNs += std::chrono::duration<double, std::nano>(encodeEnd - encodeStart).count();
+    ++result.snapshots;
+    if (std::uniform_real_distribution<float>(0.f, 1.f)(rng) < lossRate)
+      continue;
+
+    ENetPacket packet = {};
+    packet.data = buffer.data();
+    packet.dataLength = size;
+    const ReplicatedSnapshot *clientBaseline = baselineSeq != 0 ? client.find(baselineSeq) : nullptr;
+    const auto decodeStart = std::chrono::steady_clock::now();
+    const bool decoded = read_world_snapshot(&packet, clientBaseline, received);
+    const auto decodeEnd = std::chrono::steady_clock::now();
+    result.decodeNs += std::chrono::duration<double, std::nano>(decodeEnd - decodeStart).count();
+    ++result.decoded;
+    bool same = decoded && received.world.size() == world.size() &&
+                memcmp(&received.model, &sent.model, sizeof(SnapshotModel)) == 0;
+    for (size_t i = 0; same && i < world.size(); ++i)
+      same = received.world[i].eid == world[i].eid && received.world[i].x == world[i].x &&
+             received.world[i].y == world[i].y && received.world[i].ori == world[i].ori;
+    result.mismatch = result.mismatch || !same;
+    client.insert(seq) = received;
+    pendingAcks.push_back(seq);
+
+    while (!pendingAcks.empty() && pendingAcks.front() + ackLag <= seq)
+    {
+      server.ack(pendingAcks.front());
+      pendingAcks.erase(pendingAcks.begin());
+    }
+  }
+  return result;
+}
+
+int main()
+{
+  constexpr uint32_t ticks = 3000;
+  constexpr uint32_t ackLag = 5;
+  constexpr float lossRate = 0.05f;
+  printf("%u ticks, acks %u ticks late, %.0f%% loss\n", ticks, ackLag, lossRate * 100.f);
+  printf("%8s %14s %14s %8s %12s %12s %12s %12s\n", "entities", "plain b/ent", "coded b/ent", "saved",
+         "plain enc", "coded enc", "plain dec", "coded dec");
+  for (uint32_t entityCount : { 16u, 64u, 256u, 1024u })
+  {
+    const CodingResult plain = replicate(entityCount, ticks, ackLag, lossRate, false);
+    const CodingResult coded = replicate(entityCount, ticks, ackLag, lossRate, true);
+    const double plainBits = plain.bytes * 8.0 / (double(plain.snapshots) * entityCount);
+    const double codedBits = coded.bytes * 8.0 / (double(coded.snapshots) * entityCount);
+    printf("%8u %14.2f %14.2f %7.0f%% %9.2f us %9.2f us %9.2f us %9.2f us%s\n", entityCount, plainBits, codedBits,
+           (1.0 - codedBits / plainBits) * 100.0,
+           plain.encodeNs / plain.snapshots * 1e-3, coded.encodeNs / coded.snapshots * 1e-3,
+           plain.decodeNs / plain.decoded * 1e-3, coded.decodeNs / coded.decoded * 1e-3,
+           plain.mismatch || coded.mismatch ? "  MISMATCH" : "");
+  }
+  return 0;
+}
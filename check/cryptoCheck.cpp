@@ -0,0 +1,223 @@
+// Known answers for netcore's ChaCha20-Poly1305, HChaCha20 and X25519: the
+// RFC 8439 and RFC 7748 test vectors, and sealed messages of every length up
+// to several block pairs against a plain one-block-at-a-time ChaCha20, so
+// the two-block (SSE2) path and its tail are covered. Exits 1 on a mismatch.
+#include "chacha20poly1305.h"
+#include "x25519.h"
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+static int failures = 0;
+
+static void check(bool ok, const char *name)
+{
+  if (!ok)
+  {
+    printf("FAILED %s\n", name);
+    ++failures;
+  }
+}
+
+// The bytes of a hex string, anything but hex digits is skipped
+static std::vector<uint8_t> from_hex(const char *hex)
+{
+  std::vector<uint8_t> bytes;
+  int high = -1;
+  for (const char *c = hex; *c; ++c)
+  {
+    int v = -1;
+    if (*c >= '0' && *c <= '9')
+      v = *c - '0';
+    else if (*c >= 'a' && *c <= 'f')
+      v = *c - 'a' + 10;
+    if (v < 0)
+      continue;
+    if (high < 0)
+      high = v;
+    else
+    {
+      bytes.push_back(uint8_t(high << 4 | v));
+      high = -1;
+    }
+  }
+  return bytes;
+}
+
+// RFC 8439 2.8.2
+static void check_aead_vector()
+{
+  const char plaintext[] = "Ladies and Gentlemen of the class of '99: If I could offer you only one tip for "
+                           "the future, sunscreen would be it.";
+  const std::vector<uint8_t> aad = from_hex("50 51 52 53 c0 c1 c2 c3 c4 c5 c6 c7");
+  const std::vector<uint8_t> key = from_hex("80 81 82 83 84 85 86 87 88 89 8a 8b 8c 8d 8e 8f"
+                                            "90 91 92 93 94 95 96 97 98 99 9a 9b 9c 9d 9e 9f");
+  const std::vector<uint8_t> nonce = from_hex("07 00 00 00 40 41 42 43 44 45 46 47");
+  const std::vector<uint8_t> ciphertext = from_hex(
+    "d3 1a 8d 34 64 8e 60 db 7b 86 af bc 53 ef 7e c2"
+    "a4 ad ed 51 29 6e 08 fe a9 e2 b5 a7 36 ee 62 d6"
+    "3d be a4 5e 8c a9 67 12 82 fa fb 69 da 92 72 8b"
+    "1a 71 de 0a 9e 06 0b 29 05 d6 a5 b6 7e cd 3b 36"
+    "92 dd bd 7f 2d 77 8b 8c 98 03 ae e3 28 09 1b 58"
+    "fa b3 24 e4 fa d6 75 94 55 85 80 8b 48 31 d7 bc"
+    "3f f4 de f0 8e 4b 7a 9d e5 76 d2 65 86 ce c6 4b"
+    "61 16");
+  const std::vector<uint8_t> tag = from_hex("1a e1 0b 59 4f 09 e2 6a 7e 90 2e cb d0 60 06 91");
+
+  std::vector<uint8_t> data(plaintext, plaintext + sizeof(plaintext) - 1);
+  uint8_t sealedTag[aeadTagSize];
+  aead_seal(key.data(), nonce.data(), aad.data(), aad.size(), data.data(), data.size(), sealedTag);
+  check(data == ciphertext, "rfc8439 2.8.2 ciphertext");
+  check(memcmp(sealedTag, tag.data(), aeadTagSize) == 0, "rfc8439 2.8.2 tag");
+
+  check(aead_open(key.data(), nonce.data(), aad.data(), aad.size(), data.data(), data.size(), tag.data()) &&
+          memcmp(data.data(), plaintext, data.size()) == 0,
+        "rfc8439 2.8.2 open");
+  std::vector<uint8_t> forged = ciphertext;
+  forged[57] ^= 1;
+  check(!aead_open(key.data(), nonce.data(), aad.data(), aad.size(), forged.data(), forged.size(), tag.data()) &&
+          forged[0] == ciphertext[0],
+        "rfc8439 2.8.2 forged ciphertext is rejected and left alone");
+}
+
+// draft-irtf-cfrg-xchacha 2.2.1
+static void check_hchacha20_vector()
+{
+  std::vector<uint8_t> key(32);
+  for (uint32_t i = 0; i < 32; ++i)
+    key[i] = uint8_t(i);
+  const std::vector<uint8_t> in = from_hex("00 00 00 09 00 00 00 4a 00 00 00 00 31 41 59 27");
+  const std::vector<uint8_t> expected = from_hex("82413b4227b27bfed30e42508a877d73a0f9e4d58a74a853c12ec41326d3ecdc");
+  uint8_t out[32];
+  hchacha20(out, key.data(), in.data());
+  check(memcmp(out, expected.data(), 32) == 0, "hchacha20");
+}
+
+// The RFC 8439 2.3 block function as written there, one block at a time
+static void reference_block(const uint8_t key[32], uint32_t counter, const uint8_t nonce[12], uint8_t out[64])
+{
+  auto load32 = [](const uint8_t *p) { return uint32_t(p[0]) | uint32_t(p[1]) << 8 | uint32_t(p[2]) << 16 | uint32_t(p[3]) << 24; };
+  auto rotl = [](uint32_t v, int n) { return (v << n) | (v >> (32 - n)); };
+  uint32_t state[16] = { 0x61707865, 0x3320646e, 0x79622d32, 0x6b206574 };
+  for (int i = 0; i < 8; ++i)
+    state[4 + i] = load32(key + 4 * i);
+  state[12] = counter;
+  for (int i = 0; i < 3; ++i)
+    state[13 + i] = load32(nonce + 4 * i);
+  uint32_t x[16];
+  memcpy(x, state, sizeof(x));
+  auto quarter = [&](int a, int b, int c, int d)
+  {
+    x[a] += x[b]; x[d] = rotl(x[d] ^ x[a], 16);
+    x[c] += x[d]; x[b] = rotl(x[b] ^ x[c], 12);
+    x[a] += x[b]; x[d] = rotl(x[d] ^ x[a], 8);
+    x[c] += x[d]; x[b] = rotl(x[b] ^ x[c], 7);
+  };
+  for (int i = 0; i < 10; ++i)
+  {
+    quarter(0, 4, 8, 12); quarter(1, 5, 9, 13); quarter(2, 6, 10, 14); quarter(3, 7, 11, 15);
+    quarter(0, 5, 10, 15); quarter(1, 6, 11, 12); quarter(2, 7, 8, 13); quarter(3, 4, 9, 14);
+  }
+  for (int i = 0; i < 16; ++i)
+  {
+    const uint32_t v = x[i] + state[i];
+    for (int b = 0; b < 4; ++b)
+      out[4 * i + b] = uint8_t(v >> (8 * b));
+  }
+}
+
+// The data of a sealed message is encrypted from block 1 on, block 0 keys
+// Poly1305. Every length up to 9 blocks starts and ends inside and on the
+// edges of the two-block batches.
+static void check_multi_block()
+{
+  uint8_t key[32], nonce[12];
+  for (uint32_t i = 0; i < 32; ++i)
+    key[i] = uint8_t(i * 7 + 3);
+  for (uint32_t i = 0; i < 12; ++i)
+    nonce[i] = uint8_t(0xa0 + i);
+  constexpr size_t maxSize = 9 * 64;
+  std::vector<uint8_t> keystream(maxSize);
+  for (uint32_t block = 0; block * 64 < maxSize; ++block)
+    reference_block(key, block + 1, nonce, keystream.data() + block * 64);
+
+  bool ciphertextOk = true, openOk = true;
+  for (size_t size = 0; size <= maxSize; ++size)
+  {
+    std::vector<uint8_t> data(size);
+    for (size_t i = 0; i < size; ++i)
+      data[i] = uint8_t(i * 31 + size);
+    const std::vector<uint8_t> plaintext = data;
+    uint8_t tag[aeadTagSize];
+    aead_seal(key, nonce, nullptr, 0, data.data(), size, tag);
+    for (size_t i = 0; i < size; ++i)
+      ciphertextOk &= data[i] == uint8_t(plaintext[i] ^ keystream[i]);
+    openOk &= aead_open(key, nonce, nullptr, 0, data.data(), size, tag) && data == plaintext;
+  }
+  check(ciphertextOk, "multi-block ciphertext against the one-block reference");
+  check(openOk, "multi-block seal/open round trip");
+}
+
+// RFC 7748 5.2, one vector and the iterated k = x25519(k, u), u = old k
+static void check_x25519_vectors()
+{
+  const std::vector<uint8_t> scalar = from_hex("a546e36bf0527c9d3b16154b82465edd62144c0ac1fc5a18506a2244ba449ac4");
+  const std::vector<uint8_t> u = from_hex("e6db6867583030db3594c1a424b15f7c726624ec26b3353b10a903a6d0ab1c4c");
+  const std::vector<uint8_t> expected = from_hex("c3da55379de9c6908e94ea4df28d084f32eccf03491c71f754b4075577a28552");
+  uint8_t out[x25519KeySize];
+  check(x25519(out, scalar.data(), u.data()) && memcmp(out, expected.data(), x25519KeySize) == 0, "rfc7748 5.2 vector");
+
+  const std::vector<uint8_t> after1 = from_hex("422c8e7a6227d7bca1350b3e2bb7279f7897b87bb6854b783c60e80311ae3079");
+  const std::vector<uint8_t> after1000 = from_hex("684cf59ba83309552800ef566f2f4d3c1c3887c49360e3875f2eb94d99532c51");
+  uint8_t k[x25519KeySize] = { 9 }, previous[x25519KeySize] = { 9 };
+  for (int i = 1; i <= 1000; ++i)
+  {
+    uint8_t next[x25519KeySize];
+    x25519(next, k, previous);
+    memcpy(previous, k, x25519KeySize);
+    memcpy(k, next, x25519KeySize);
+    if (i == 1)
+      check(memcmp(k, after1.data(), x25519KeySize) == 0, "rfc7748 5.2 1 iteration");
+  }
+  check(memcmp(k, after1000.data(), x25519KeySize) == 0, "rfc7748 5.2 1000 iterations");
+}
+
+// RFC 7748 6.1
+static void check_x25519_diffie_hellman()
+{
+  const std::vector<uint8_t> alicePrivate = from_hex("77076d0a7318a57d3c16c17251b26645df4c2f87ebc0992ab177fba51db92c2a");
+  const std::vector<uint8_t> alicePublic = from_hex("8520f0098930a754748b7ddcb43ef75a0dbf3a0d26381af4eba4a98eaa9b4e6a");
+  const std::vector<uint8_t> bobPrivate = from_hex("5dab087e624a8a4b79e17f8b83800ee66f3bb1292618b6fd1c2f8b27ff88e0eb");
+  const std::vector<uint8_t> bobPublic = from_hex("de9edb7d7b7dc1b4d35b61c2ece435373f8343c85b78674dadfc7e146f882b4f");
+  const std::vector<uint8_t> shared = from_hex("4a5d9d5ba4ce2de1728e3bf480350f25e07e21c947d19e3376f09b3c1e161742");
+
+  uint8_t key[x25519KeySize];
+  x25519_public_key(key, alicePrivate.data());
+  check(memcmp(key, alicePublic.data(), x25519KeySize) == 0, "rfc7748 6.1 alice public key");
+  x25519_public_key(key, bobPrivate.data());
+  check(memcmp(key, bobPublic.data(), x25519KeySize) == 0, "rfc7748 6.1 bob public key");
+  check(x25519(key, alicePrivate.data(), bobPublic.data()) && memcmp(key, shared.data(), x25519KeySize) == 0,
+        "rfc7748 6.1 alice shared secret");
+  check(x25519(key, bobPrivate.data(), alicePublic.data()) && memcmp(key, shared.data(), x25519KeySize) == 0,
+        "rfc7748 6.1 bob shared secret");
+
+  // a low order point gives an all zero secret, which x25519 refuses
+  const uint8_t zero[x25519KeySize] = {};
+  check(!x25519(key, alicePrivate.data(), zero), "x25519 refuses a low order point");
+}
+
+int main()
+{
+  check_aead_vector();
+  check_hchacha20_vector();
+  check_multi_block();
+  check_x25519_vectors();
+  check_x25519_diffie_hellman();
+  if (failures != 0)
+  {
+    printf("%d crypto checks failed\n", failures);
+    return 1;
+  }
+  printf("crypto checks ok\n");
+  return 0;
+}
@@ -0,0 +1,146 @@
+// w10's redundant input windows over a lossy link: a client pushes 10000
+// inputs through send_entity_input into a LinkConditioner with 20% bursty
+// loss, jitter, reordering and duplicates, and a server reads what arrives
+// into an InputBuffer and applies one input a tick the way Room does. Every
+// applied input must come in seq order with the values that were sent, and
+// nearly all of them must arrive and be applied. Exits 1 otherwise.
+#include "protocol.h"
+#include "inputBuffer.h"
+#include "linkConditioner.h"
+#include <cstdio>
+#include <vector>
+
+static constexpr uint32_t inputCount = 10000;
+static constexpr uint32_t tickMs = 10;
+// An input only gets lost on the link when all 8 packets carrying it are,
+// which at 20% loss in bursts of 2 happens to about 0.1% of them. The server
+// skips another 0.2% or so catching up after a late packet.
+static constexpr uint32_t minArrived = inputCount - inputCount / 200;
+static constexpr uint32_t minApplied = inputCount - inputCount / 100;
+
+static InputCmd make_input(uint32_t seq)
+{
+  // full throttle and straight ahead now and then, the rest spread over [-1, 1]
+  InputCmd cmd;
+  cmd.thr = seq % 5 == 0 ? 1.f : float(int32_t(seq * 37 % 201) - 100) * 0.01f;
+  cmd.steer = seq % 7 == 0 ? 0.f : float(int32_t(seq * 53 % 201) - 100) * 0.01f;
+  return cmd;
+}
+
+// cmd as the server gets it, sent alone in a window and read back
+static InputCmd quantize_input(const InputCmd &cmd)
+{
+  InputWindow<InputCmd, inputWindowSize> window;
+  window.push(1, cmd);
+  PacketOutbox outbox;
+  set_packet_outbox(&outbox);
+  send_entity_input(nullptr, 0, window);
+  set_packet_outbox(nullptr);
+  EntityInputMsg msg;
+  InputCmd cmds[inputWindowSize];
+  const bool read = read_message(entityInputSchema, outbox[0].packet, msg) && unpack_entity_input(msg, cmds) == 1;
+  enet_packet_destroy(outbox[0].packet);
+  return read ? cmds[0] : InputCmd{ 2.f, 2.f };
+}
+
+int main()
+{
+  std::vector<InputCmd> expected(inputCount + 1);
+  for (uint32_t seq = 1; seq <= inputCount; ++seq)
+    expected[seq] = quantize_input(make_input(seq));
+
+  LinkConditions conditions;
+  conditions.latencyMs = 50;
+  conditions.jitterMs = 30;
+  conditions.lossPercent = 20.f;
+  conditions.lossBurst = 2.f;
+  conditions.reorderPercent = 5.f;
+  conditions.duplicatePercent = 5.f;
+  LinkConditioner link(12345);
+  link.set_conditions(conditions);
+
+  const uint16_t eid = 1;
+  InputWindow<InputCmd, inputWindowSize> window;
+  InputBuffer<InputCmd> buffer;
+  PacketOutbox outbox;
+  set_packet_outbox(&outbox);
+
+  std::vector<bool> arrived(inputCount + 1);
+  uint32_t arrivedCount = 0, applied = 0, lastAppliedSeq = 0, outOfOrder = 0, wrongValue = 0, undecoded = 0;
+  auto receive = [&](uint32_t, const uint8_t *data, size_t size)
+  {
+    ENetPacket *packet = enet_packet_create(data, size, ENET_PACKET_FLAG_UNSEQUENCED);
+    EntityInputMsg msg;
+    if (read_message(entityInputSchema, packet, msg) && msg.eid == eid)
+    {
+      InputCmd cmds[inputWindowSize];
+      const uint32_t count = unpack_entity_input(msg, cmds);
+      for (uint32_t i = 0; i < count; ++i)
+      {
+        const uint32_t seq = msg.firstSeq + i;
+        if (seq <= inputCount && !arrived[seq])
+        {
+          arrived[seq] = true;
+          ++arrivedCount;
+        }
+        buffer.push(seq, cmds[i]);
+      }
+    }
+    else
+      ++undecoded;
+    enet_packet_destroy(packet);
+  };
+
+  // seqs start at 1, the client keeps sending its window a while after the
+  // last input like it would while idle
+  const uint32_t drainTicks = 100;
+  uint32_t now = 0;
+  for (uint32_t tick = 1; tick <= inputCount + drainTicks; ++tick, now += tickMs)
+  {
+    if (tick <= inputCount)
+      window.push(tick, make_input(tick));
+    send_entity_input(nullptr, eid, window);
+    for (const OutgoingPacket &out : outbox)
+    {
+      link.submit(now, out.packet->data, out.packet->dataLength, 0);
+      enet_packet_destroy(out.packet);
+    }
+    outbox.clear();
+
+    link.poll(now, receive);
+
+    // Room::apply_inputs
+    InputCmd cmd;
+    bool popped = buffer.pop(cmd);
+    while (popped && buffer.get_pending() > inputWindowSize)
+      buffer.pop(cmd);
+    if (!popped)
+      continue;
+    const uint32_t seq = buffer.get_last_applied();
+    outOfOrder += seq <= lastAppliedSeq;
+    wrongValue += seq > inputCount || cmd.thr != expected[seq].thr || cmd.steer != expected[seq].steer;
+    lastAppliedSeq = seq;
+    ++applied;
+  }
+  set_packet_outbox(nullptr);
+
+  printf("%u of %u inputs arrived, %u applied, %u packets of %u lost, %u reordered, %u duplicated\n", arrivedCount,
+         inputCount, applied, link.get_lost(), link.get_submitted(), link.get_reordered(), link.get_duplicated());
+  bool ok = true;
+  auto check = [&](bool pass, const char *name)
+  {
+    if (!pass)
+      printf("FAILED %s\n", name);
+    ok = ok && pass;
+  };
+  check(outOfOrder == 0, "inputs applied in seq order");
+  check(wrongValue == 0, "inputs applied with the values sent");
+  check(undecoded == 0, "every delivered packet decodes");
+  check(applied <= inputCount && lastAppliedSeq == inputCount, "the last input is applied");
+  check(arrivedCount >= minArrived, "no more than 0.5% of inputs lost on the link");
+  check(applied >= minApplied, "no more than 1% of inputs lost or skipped");
+  if (!ok)
+    return 1;
+  printf("input loss checks ok\n");
+  return 0;
+}
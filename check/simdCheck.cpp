@@ -0,0 +1,154 @@
+// A game's simulate_entities, SIMD lanes and the scalar tail after them,
+// against its simulate_entity over 1000 steps of random input. Built once
+// per game, with SIMD_CHECK_W10 for w10. The count isn't a multiple of any
+// lane width, and a few entities at each end sit on the edges: braking, thr
+// 0, speed already at its target and ori turning past +-PI, where w10 wraps
+// it and w5 lets it grow. Exits 1 if a position, speed or orientation
+// drifts past 2e-5.
+#include "entity.h"
+#include <cmath>
+#include <cstdio>
+#include <random>
+#include <vector>
+
+constexpr float PI = 3.141592654f;
+
+#ifdef SIMD_CHECK_W10
+// w10 steps plain arrays, its archetypes' components, w5 an EntityBatch
+struct EntityBatch
+{
+  std::vector<float> x, y, speed, ori, thr, steer;
+};
+
+static void simulate_entities(EntityBatch &batch, float dt)
+{
+  simulate_entities(EntityLanes{ batch.x.size(), batch.x.data(), batch.y.data(), batch.speed.data(),
+                                 batch.ori.data(), batch.thr.data(), batch.steer.data() }, dt);
+}
+#endif
+
+constexpr size_t entityCount = 1003;
+constexpr int steps = 1000;
+constexpr float dt = 0.02f;
+constexpr float tolerance = 2e-5f;
+
+struct Edge
+{
+  float speed, ori, thr, steer;
+};
+
+// Inputs stay as they are for these, the rest get new random ones each step
+static const Edge edges[] = {
+  { 5.f, 0.3f, -1.f, 0.f },          // braking forwards
+  { -2.f, -0.3f, 1.f, 0.f },         // braking backwards
+  { 0.f, 1.f, -0.5f, 0.2f },         // reversing from a standstill
+  { 4.f, 2.f, 0.f, 0.f },            // coasting, thr 0 never brakes
+  { 10.f, 0.f, 1.f, 0.f },           // at full speed already
+  { -3.f, 0.f, -0.3f, 0.f },         // at full reverse already
+  { 2.f, PI - 1e-4f, 0.f, 1.f },     // turning past +PI again and again
+  { 2.f, -PI + 1e-4f, 0.f, -1.f },   // and past -PI
+  { -2.f, PI - 1e-4f, 0.f, -1.f },   // backwards, past +PI
+};
+constexpr size_t edgeCount = sizeof(edges) / sizeof(edges[0]);
+
+// The edge cases sit in the first lanes and in the tail
+static bool is_edge(size_t i, size_t &edge)
+{
+  if (i < edgeCount)
+    edge = i;
+  else if (i >= entityCount - edgeCount)
+    edge = i - (entityCount - edgeCount);
+  else
+    return false;
+  return true;
+}
+
+// Orientation a against the reference b. Both step with the same float
+// math, only right at +-PI may w10 wrap one a whole turn and not the other.
+static float angle_error(float a, float b)
+{
+  const float d = fabsf(a - b);
+  return fabsf(fabsf(b) - PI) < tolerance ? fminf(d, fabsf(d - 2.f * PI)) : d;
+}
+
+int main()
+{
+  std::mt19937 rng(1);
+  std::uniform_real_distribution<float> unit(-1.f, 1.f);
+  // exactly -1, 0 or 1 now and then, anything in between otherwise
+  auto random_input = [&]()
+  {
+    const uint32_t pick = rng() % 8;
+    return pick < 3 ? float(int(pick) - 1) : unit(rng);
+  };
+
+  std::vector<Entity> reference(entityCount);
+  for (size_t i = 0; i < entityCount; ++i)
+  {
+    Entity &e = reference[i];
+    size_t edge = 0;
+    if (is_edge(i, edge))
+    {
+      e.speed = edges[edge].speed;
+      e.ori = edges[edge].ori;
+      e.thr = edges[edge].thr;
+      e.steer = edges[edge].steer;
+    }
+    else
+    {
+      e.x = unit(rng) * 10.f;
+      e.y = unit(rng) * 10.f;
+      e.speed = unit(rng) * 10.f;
+      e.ori = unit(rng) * PI;
+    }
+  }
+  EntityBatch batch;
+  for (const Entity &e : reference)
+  {
+    batch.x.push_back(e.x);
+    batch.y.push_back(e.y);
+    batch.speed.push_back(e.speed);
+    batch.ori.push_back(e.ori);
+    batch.thr.push_back(e.thr);
+    batch.steer.push_back(e.steer);
+  }
+
+  float maxError = 0.f;
+  size_t worst = 0;
+  for (int step = 0; step < steps; ++step)
+  {
+    for (size_t i = 0; i < entityCount; ++i)
+    {
+      size_t edge = 0;
+      if (!is_edge(i, edge))
+      {
+        reference[i].thr = random_input();
+        reference[i].steer = random_input();
+      }
+      batch.thr[i] = reference[i].thr;
+      batch.steer[i] = reference[i].steer;
+      simulate_entity(reference[i], dt);
+    }
+    simulate_entities(batch, dt);
+    for (size_t i = 0; i < entityCount; ++i)
+    {
+      const Entity &e = reference[i];
+      const float error = fmaxf(fmaxf(fabsf(batch.x[i] - e.x), fabsf(batch.y[i] - e.y)),
+                                fmaxf(fabsf(batch.speed[i] - e.speed), angle_error(batch.ori[i], e.ori)));
+      if (!(error <= maxError))
+      {
+        maxError = std::isnan(error) ? INFINITY : error;
+        worst = i;
+      }
+    }
+  }
+
+  printf("simulate_entities: largest difference %g (entity %zu) after %d steps of %zu entities\n", maxError,
+         worst, steps, entityCount);
+  if (!(maxError <= tolerance))
+  {
+    printf("FAILED, more than %g\n", tolerance);
+    return 1;
+  }
+  return 0;
+}
@@ -0,0 +1,33 @@
+#pragma once
+#include <cstdint>
+#include <cstddef>
+#include <cstring>
+#include <vector>
+#include <enet/enet.h>
+
+// A received packet of type FUZZ_MESSAGE with the fuzzer's bytes as its body,
+// in a buffer of exactly that size so the sanitizers catch any overread.
+struct FuzzPacket
+{
+  FuzzPacket(uint8_t type, const uint8_t *body, size_t size) : buffer(size + 1)
+  {
+    buffer[0] = type;
+    if (size > 0)
+      memcpy(buffer.data() + 1, body, size);
+    packet.data = buffer.data();
+    packet.dataLength = buffer.size();
+  }
+
+  std::vector<uint8_t> buffer;
+  ENetPacket packet = {};
+};
+
+// Decodes the packet with the registry of whichever end receives its type
+// and hands the message to handler, as a client or server would.
+template<typename ClientToServerMessages, typename ServerToClientMessages, typename Handler>
+bool dispatch_fuzz_packet(FuzzPacket &fuzz, Handler &handler)
+{
+  if (ClientToServerMessages::contains(fuzz.buffer[0]))
+    return ClientToServerMessages::dispatch(handler, &fuzz.packet);
+  return ServerToClientMessages::dispatch(handler, &fuzz.packet);
+}
@@ -0,0 +1,48 @@
+#include "fuzzMessage.h"
+#include "protocol.h"
+
+// A few entities for delta snapshots to apply to, whatever baseline they name
+static const ReplicatedSnapshot &get_baseline()
+{
+  static ReplicatedSnapshot baseline = { { { 1, 0.f, 0.f, 0.f }, { 7, 2.f, -1.f, 1.f }, { 300, -5.f, 3.f, -2.f } }, {} };
+  return baseline;
+}
+
+// Takes every message w10 receives, the ones with more to them than their
+// fields get the rest decoded as well
+struct FuzzHandler
+{
+  template<typename Msg>
+  void operator()(const Msg &) {}
+
+  void operator()(const EntityInputMsg &msg)
+  {
+    InputCmd cmds[inputWindowSize];
+    unpack_entity_input(msg, cmds);
+  }
+
+  void operator()(const WorldSnapshotMsg &msg)
+  {
+    uint32_t seq = 0, baselineSeq = 0;
+    if (!read_world_snapshot_header(msg.packet, seq, baselineSeq))
+      return;
+    ReplicatedSnapshot snapshot;
+    read_world_snapshot(msg.packet, baselineSeq != 0 ? &get_baseline() : nullptr, snapshot);
+  }
+
+  void operator()(const WorldChunkMsg &chunk)
+  {
+    // the chunk's bytes as a whole world, so the range decoder gets them too
+    std::vector<Entity> world;
+    decode_world_state(chunk.bytes, chunk.size, world);
+  }
+};
+
+// One binary per message type w10 receives, FUZZ_MESSAGE picks which
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size)
+{
+  FuzzPacket fuzz(FUZZ_MESSAGE, data, size);
+  FuzzHandler handler;
+  dispatch_fuzz_packet<ClientToServerMessages, ServerToClientMessages>(fuzz, handler);
+  return 0;
+}
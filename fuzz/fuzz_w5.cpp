@@ -0,0 +1,32 @@
+#include "fuzzMessage.h"
+#include "protocol.h"
+
+// Takes every message w5 receives, the ones with more to them than their
+// fields get the rest decoded as well
+struct FuzzHandler
+{
+  template<typename Msg>
+  void operator()(const Msg &) {}
+
+  void operator()(const EntityInputMsg &msg)
+  {
+    InputCmd cmds[inputWindowSize];
+    unpack_entity_input(msg, cmds);
+  }
+
+  void operator()(const WorldChunkMsg &chunk)
+  {
+    // the chunk's bytes as a whole world, so the range decoder gets them too
+    std::vector<Entity> world;
+    decode_world_state(chunk.bytes, chunk.size, world);
+  }
+};
+
+// One binary per message type w5 receives, FUZZ_MESSAGE picks which
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size)
+{
+  FuzzPacket fuzz(FUZZ_MESSAGE, data, size);
+  FuzzHandler handler;
+  dispatch_fuzz_packet<ClientToServerMessages, ServerToClientMessages>(fuzz, handler);
+  return 0;
+}
@@ -0,0 +1,334 @@
+#pragma once
+#include <cstdint>
+#include <cstddef>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+// A small archetype ECS. Entities with the same components live together in
+// an Archetype, every component in a dense array of its own, and a query
+// runs over those arrays in every archetype that has all it asks for. A pass
+// over positions reads positions and nothing else, however many other
+// components the entities carry, and a component only some entities need
+// costs the others nothing.
+//
+// A component is a type, stored as C::Value if it names one (so a plain
+// float can be a component of its own, an array SIMD loads as it is) and as
+// C itself otherwise. Handles stay valid while entities come and go, rows
+// don't: destroy() moves the last row of the archetype into the hole.
+//
+//   struct PosX { using Value = float; };
+//   struct PosY { using Value = float; };
+//   struct AiTarget { float x = 0.f; float y = 0.f; };
+//   typedef Archetype<PosX, PosY, AiTarget> Bot;
+//   typedef Archetype<PosX, PosY> Player;
+//   EntityWorld<Bot, Player> world;
+//   EntityHandle bot = world.create<Bot>();
+//   *world.get<PosX>(bot) = 1.f;
+//   world.each<PosX, AiTarget>([](float &x, AiTarget &target) { ... });      // bots only
+//   world.each_chunk<PosX, PosY>([](size_t count, float *x, float *y) { ... }); // every archetype
+
+template<typename C, typename = void>
+struct ComponentStorage
+{
+  using Type = C;
+};
+template<typename C>
+struct ComponentStorage<C, std::void_t<typename C::Value>>
+{
+  using Type = typename C::Value;
+};
+template<typename C>
+using component_t = typename ComponentStorage<C>::Type;
+
+// sizeof...(Ts) if T isn't one of Ts
+template<typename T, typename... Ts>
+constexpr size_t index_of_type()
+{
+  constexpr bool matches[] = { std::is_same_v<T, Ts>... };
+  for (size_t i = 0; i < sizeof...(Ts); ++i)
+    if (matches[i])
+      return i;
+  return sizeof...(Ts);
+}
+
+// One entity of an EntityWorld: a slot, and which of the entities that had
+// the slot it is
+struct EntityHandle
+{
+  static constexpr uint32_t invalid_index = ~0u;
+
+  uint32_t index = invalid_index;
+  uint32_t generation = 0;
+
+  bool is_valid() const { return index != invalid_index; }
+  bool operator==(const EntityHandle &) const = default;
+};
+
+template<typename... Components>
+class Archetype
+{
+public:
+  static_assert(sizeof...(Components) > 0);
+
+  template<typename C>
+  static constexpr bool has = index_of_type<C, Components...>() < sizeof...(Components);
+  template<typename... Cs>
+  static constexpr bool has_all = (has<Cs> && ...);
+
+  size_t size() const { return handles.size(); }
+  EntityHandle get_handle(uint32_t row) const { return handles[row]; }
+
+  template<typename C>
+  component_t<C> *data() { return get_column<C>().data(); }
+  template<typename C>
+  const component_t<C> *data() const { return const_cast<Archetype*>(this)->get_column<C>().data(); }
+  template<typename C>
+  component_t<C> &get(uint32_t row) { return get_column<C>()[row]; }
+  template<typename C>
+  const component_t<C> &get(uint32_t row) const { return const_cast<Archetype*>(this)->get_column<C>()[row]; }
+
+  // A row of default constructed components at the end, returns it
+  uint32_t push(EntityHandle handle)
+  {
+    handles.push_back(handle);
+    std::apply([](auto &...column) { (column.emplace_back(), ...); }, columns);
+    return uint32_t(handles.size() - 1);
+  }
+
+  // Moves the last row into row, returns the handle of the entity that moved
+  // (an invalid one if row was the last)
+  EntityHandle erase(uint32_t row)
+  {
+    const uint32_t last = uint32_t(handles.size() - 1);
+    EntityHandle moved;
+    if (row != last)
+    {
+      moved = handles[last];
+      handles[row] = moved;
+      std::apply([&](auto &...column) { ((column[row] = std::move(column[last])), ...); }, columns);
+    }
+    handles.pop_back();
+    std::apply([](auto &...column) { (column.pop_back(), ...); }, columns);
+    return moved;
+  }
+
+  void reserve(size_t count)
+  {
+    handles.reserve(count);
+    std::apply([&](auto &...column) { (column.reserve(count), ...); }, columns);
+  }
+
+  void clear()
+  {
+    handles.clear();
+    std::apply([](auto &...column) { (column.clear(), ...); }, columns);
+  }
+
+private:
+  template<typename C>
+  std::vector<component_t<C>> &get_column()
+  {
+    static_assert(has<C>, "the archetype has no such component");
+    return std::get<index_of_type<C, Components...>()>(columns);
+  }
+
+  std::vector<EntityHandle> handles;
+  std::tuple<std::vector<component_t<Components>>...> columns;
+};
+
+// Every entity of a simulation, in the archetypes it is made of. Creating and
+// destroying an entity is O(1): slots of destroyed entities are reused, with
+// their generation bumped so the handles of the old entity no longer match.
+template<typename... Archetypes>
+class EntityWorld
+{
+public:
+  static_assert(sizeof...(Archetypes) > 0 && sizeof...(Archetypes) < 255);
+
+  template<typename A>
+  static constexpr bool contains = index_of_type<A, Archetypes...>() < sizeof...(Archetypes);
+
+  // An entity of archetype A with default constructed components
+  template<typename A>
+  EntityHandle create()
+  {
+    static_assert(contains<A>, "the world has no such archetype");
+    uint32_t index = 0;
+    if (!freeSlots.empty())
+    {
+      index = freeSlots.back();
+      freeSlots.pop_back();
+    }
+    else
+    {
+      index = uint32_t(slots.size());
+      slots.emplace_back();
+    }
+    Slot &slot = slots[index];
+    slot.archetype = uint8_t(index_of_type<A, Archetypes...>());
+    const EntityHandle handle{ index, slot.generation };
+    slot.row = get_archetype<A>().push(handle);
+    ++count;
+    return handle;
+  }
+
+  // False if the entity is gone already
+  bool destroy(EntityHandle handle)
+  {
+    if (!is_alive(handle))
+      return false;
+    Slot &slot = slots[handle.index];
+    const uint32_t row = slot.row;
+    const EntityHandle moved = visit_archetype(slot.archetype, [&](auto &archetype) { return archetype.erase(row); });
+    if (moved.is_valid())
+      slots[moved.index].row = row;
+    free_slot(handle.index);
+    return true;
+  }
+
+  bool is_alive(EntityHandle handle) const
+  {
+    return handle.index < slots.size() && slots[handle.index].generation == handle.generation &&
+           slots[handle.index].archetype != freeArchetype;
+  }
+
+  // nullptr if the entity is gone or its archetype has no C
+  template<typename C>
+  component_t<C> *get(EntityHandle handle)
+  {
+    if (!is_alive(handle))
+      return nullptr;
+    const Slot &slot = slots[handle.index];
+    component_t<C> *component = nullptr;
+    visit_archetype(slot.archetype, [&](auto &archetype)
+    {
+      if constexpr (std::remove_reference_t<decltype(archetype)>::template has<C>)
+        component = &archetype.template get<C>(slot.row);
+    });
+    return component;
+  }
+  template<typename C>
+  const component_t<C> *get(EntityHandle handle) const
+  {
+    return const_cast<EntityWorld*>(this)->get<C>(handle);
+  }
+
+  template<typename A>
+  bool is_a(EntityHandle handle) const
+  {
+    return is_alive(handle) && slots[handle.index].archetype == index_of_type<A, Archetypes...>();
+  }
+  // where the entity is in the arrays of its archetype, until one is destroyed
+  uint32_t get_row(EntityHandle handle) const { return slots[handle.index].row; }
+
+  template<typename A>
+  A &get_archetype() { return std::get<index_of_type<A, Archetypes...>()>(archetypes); }
+  template<typename A>
+  const A &get_archetype() const { return std::get<index_of_type<A, Archetypes...>()>(archetypes); }
+
+  size_t size() const { return count; }
+
+  // Destroys every entity, none of the handles given out so far is alive after
+  void clear()
+  {
+    std::apply([](auto &...archetype) { (archetype.clear(), ...); }, archetypes);
+    // the last freed is reused first, so the lowest slots go first again
+    for (uint32_t i = uint32_t(slots.size()); i-- > 0;)
+      if (slots[i].archetype != freeArchetype)
+        free_slot(i);
+  }
+
+  // f(Cs &...) for every entity that has all of Cs, archetype by archetype
+  // in the order the world lists them, rows in order
+  template<typename... Cs, typename F>
+  void each(F &&f)
+  {
+    std::apply([&](auto &...archetype) { (each_row<Cs...>(archetype, f), ...); }, archetypes);
+  }
+  // the same with the entity's handle first, f(EntityHandle, Cs &...)
+  template<typename... Cs, typename F>
+  void each_entity(F &&f)
+  {
+    std::apply([&](auto &...archetype) { (each_entity_row<Cs...>(archetype, f), ...); }, archetypes);
+  }
+  // f(count, Cs *...) once for every archetype with all of Cs and entities,
+  // the arrays themselves for passes that go lanes at a time
+  template<typename... Cs, typename F>
+  void each_chunk(F &&f)
+  {
+    std::apply([&](auto &...archetype) { (each_chunk_of<Cs...>(archetype, f), ...); }, archetypes);
+  }
+
+private:
+  static constexpr uint8_t freeArchetype = 0xff;
+
+  struct Slot
+  {
+    uint32_t generation = 0;
+    uint32_t row = 0;
+    uint8_t archetype = freeArchetype;
+  };
+
+  void free_slot(uint32_t index)
+  {
+    Slot &slot = slots[index];
+    slot.archetype = freeArchetype;
+    ++slot.generation;
+    freeSlots.push_back(index);
+    --count;
+  }
+
+  template<size_t I = 0, typename F>
+  decltype(auto) visit_archetype(uint8_t index, F &&f)
+  {
+    if constexpr (I + 1 == sizeof...(Archetypes))
+      return f(std::get<I>(archetypes));
+    else
+      return index == I ? f(std::get<I>(archetypes)) : visit_archetype<I + 1>(index, f);
+  }
+
+  template<typename... Cs, typename A, typename F>
+  static void each_row(A &archetype, F &f)
+  {
+    if constexpr (A::template has_all<Cs...>)
+    {
+      const size_t rows = archetype.size();
+      auto run = [&](auto *...columns)
+      {
+        for (size_t row = 0; row < rows; ++row)
+          f(columns[row]...);
+      };
+      run(archetype.template data<Cs>()...);
+    }
+  }
+
+  template<typename... Cs, typename A, typename F>
+  static void each_entity_row(A &archetype, F &f)
+  {
+    if constexpr (A::template has_all<Cs...>)
+    {
+      const size_t rows = archetype.size();
+      auto run = [&](auto *...columns)
+      {
+        for (size_t row = 0; row < rows; ++row)
+          f(archetype.get_handle(uint32_t(row)), columns[row]...);
+      };
+      run(archetype.template data<Cs>()...);
+    }
+  }
+
+  template<typename... Cs, typename A, typename F>
+  static void each_chunk_of(A &archetype, F &f)
+  {
+    if constexpr (A::template has_all<Cs...>)
+      if (archetype.size() > 0)
+        f(archetype.size(), archetype.template data<Cs>()...);
+  }
+
+  std::tuple<Archetypes...> archetypes;
+  std::vector<Slot> slots;
+  std::vector<uint32_t> freeSlots;
+  size_t count = 0;
+};
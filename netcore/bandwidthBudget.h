@@ -0,0 +1,81 @@
+#pragma once
+#include <cstdint>
+#include <cstddef>
+#include <algorithm>
+#include <numeric>
+#include <vector>
+
+// Sending a peer no more than its link carries. Every tick the peer's budget
+// is refilled from what its link is measured to take, the things competing
+// for it are tried highest priority first, and what went out is spent.
+
+// Bytes a peer may be sent, refilled every tick. Unused bytes carry over for a
+// few ticks only, so a quiet peer can't save up for a burst, and a snapshot
+// bigger than its estimate is paid back out of the following ticks.
+class BandwidthBudget
+{
+public:
+  static constexpr float maxBurstTicks = 4.f;
+
+  void refill(float bytes)
+  {
+    allowance = std::min(allowance + bytes, bytes * maxBurstTicks);
+  }
+
+  void spend(size_t bytes) { allowance -= float(bytes); }
+
+  // may be negative after an overrun
+  float get_allowance() const { return allowance; }
+
+  void reset() { allowance = 0.f; }
+
+private:
+  float allowance = 0.f;
+};
+
+// Per peer priority of every entity, indexed like the entity array. Each tick
+// an entity gains its priority for that peer (closer, more relevant: more),
+// and loses it all once the peer is sent its state. An entity that keeps
+// missing the budget keeps gaining, until it outranks the ones that were just
+// sent, so nothing starves however tight the budget gets.
+class PriorityAccumulator
+{
+public:
+  // new entries start at 0
+  void resize(size_t count)
+  {
+    priorities.resize(count, 0.f);
+  }
+
+  void add(size_t index, float priority) { priorities[index] += priority; }
+  void clear(size_t index) { priorities[index] = 0.f; }
+  // Moves the last entry into index, as the rows it follows do when one goes
+  void erase(size_t index)
+  {
+    if (index >= priorities.size())
+      return;
+    priorities[index] = priorities.back();
+    priorities.pop_back();
+  }
+  float get(size_t index) const { return priorities[index]; }
+  size_t size() const { return priorities.size(); }
+
+  // Indices from the highest priority to the lowest
+  const std::vector<uint32_t> &sort()
+  {
+    order.resize(priorities.size());
+    std::iota(order.begin(), order.end(), 0u);
+    std::sort(order.begin(), order.end(),
+              [this](uint32_t a, uint32_t b) { return priorities[a] > priorities[b]; });
+    return order;
+  }
+
+  void reset()
+  {
+    priorities.clear();
+  }
+
+private:
+  std::vector<float> priorities;
+  std::vector<uint32_t> order;
+};
@@ -0,0 +1,159 @@
+#pragma once
+#include <bit>
+#include <cstdint>
+#include <cstddef>
+#include <cstring>
+
+// Bit granular writer and reader over a byte buffer. Values are stored least
+// significant bit first starting at bit 0 of byte 0, so a message that starts
+// with an 8 bit type still has the type in its first byte.
+//
+// Neither side ever touches memory past size: the writer drops the bits that
+// don't fit, the reader returns zeros, and both remember it in is_overflowed().
+//
+// set_context() is there so code writing through a BitWriter can also write
+// through an entropy coder (see rangeCoder.h), plain bits ignore it.
+class BitWriter
+{
+public:
+  BitWriter(uint8_t *data, size_t size) : data(data), size(size) {}
+
+  void set_context(uint32_t) {}
+
+  // bits <= 32, higher bits of value are ignored
+  void write(uint32_t value, uint32_t bits)
+  {
+    // a value touches at most 5 bytes, each is merged in whole
+    const uint32_t offset = uint32_t(bitPos & 7);
+    const uint64_t mask = ((uint64_t(1) << bits) - 1) << offset;
+    const uint64_t shifted = (uint64_t(value) << offset) & mask;
+    const size_t first = bitPos >> 3;
+    bitPos += bits;
+    const size_t end = (bitPos + 7) >> 3;
+    for (size_t byte = first; byte < end; ++byte)
+    {
+      const uint32_t shift = uint32_t(byte - first) * 8;
+      if (byte < size)
+        data[byte] = uint8_t((data[byte] & ~uint8_t(mask >> shift)) | uint8_t(shifted >> shift));
+      else
+        overflowed = true;
+    }
+  }
+
+  size_t get_bit_pos() const { return bitPos; }
+  size_t get_byte_count() const { return (bitPos + 7) >> 3; }
+  bool is_overflowed() const { return overflowed; }
+
+private:
+  uint8_t *data;
+  size_t size;
+  size_t bitPos = 0;
+  bool overflowed = false;
+};
+
+class BitReader
+{
+public:
+  BitReader(const uint8_t *data, size_t size) : data(data), size(size) {}
+
+  void set_context(uint32_t) {}
+
+  uint32_t read(uint32_t bits)
+  {
+    // gather the (at most 5) bytes the value lies in, then shift it out
+    const uint32_t offset = uint32_t(bitPos & 7);
+    const size_t first = bitPos >> 3;
+    bitPos += bits;
+    uint64_t window = 0;
+    if (std::endian::native == std::endian::little && first + 8 <= size)
+      memcpy(&window, data + first, 8);
+    else
+    {
+      const size_t end = (bitPos + 7) >> 3;
+      for (size_t byte = first; byte < end; ++byte)
+      {
+        if (byte < size)
+          window |= uint64_t(data[byte]) << ((byte - first) * 8);
+        else
+          overflowed = true;
+      }
+    }
+    return uint32_t((window >> offset) & ((uint64_t(1) << bits) - 1));
+  }
+
+  void skip(size_t bits)
+  {
+    bitPos += bits;
+    overflowed = overflowed || bitPos > size * 8;
+  }
+
+  size_t get_bit_pos() const { return bitPos; }
+  bool is_overflowed() const { return overflowed; }
+
+private:
+  const uint8_t *data;
+  size_t size;
+  size_t bitPos = 0;
+  bool overflowed = false;
+};
+
+// BitReader for a buffer known to hold every bit that will be read, a message
+// of at least its schema's size say. No bounds checks: each value is read
+// with loads of exactly the bytes it lies in, which for a schema's fields at
+// constant bit positions come down to what a pointer cast would load.
+class FittedBitReader
+{
+public:
+  explicit FittedBitReader(const uint8_t *data) : data(data) {}
+
+  void set_context(uint32_t) {}
+
+  uint32_t read(uint32_t bits)
+  {
+    const uint8_t *p = data + (bitPos >> 3);
+    const uint32_t offset = uint32_t(bitPos & 7);
+    const uint32_t span = offset + bits;
+    bitPos += bits;
+    uint64_t window = 0;
+    if (span <= 8)
+      window = p[0];
+    else if (span <= 16)
+      window = load16(p);
+    else if (span <= 24)
+      window = load16(p) | uint32_t(p[2]) << 16;
+    else if (span <= 32)
+      window = load32(p);
+    else
+      window = load32(p) | uint64_t(p[4]) << 32;
+    return uint32_t((window >> offset) & ((uint64_t(1) << bits) - 1));
+  }
+
+  void skip(size_t bits) { bitPos += bits; }
+
+  size_t get_bit_pos() const { return bitPos; }
+  bool is_overflowed() const { return false; }
+
+private:
+  static uint32_t load16(const uint8_t *p)
+  {
+    uint16_t value = 0;
+    if constexpr (std::endian::native == std::endian::little)
+      memcpy(&value, p, sizeof(value));
+    else
+      value = uint16_t(p[0] | p[1] << 8);
+    return value;
+  }
+
+  static uint32_t load32(const uint8_t *p)
+  {
+    uint32_t value = 0;
+    if constexpr (std::endian::native == std::endian::little)
+      memcpy(&value, p, sizeof(value));
+    else
+      value = uint32_t(p[0]) | uint32_t(p[1]) << 8 | uint32_t(p[2]) << 16 | uint32_t(p[3]) << 24;
+    return value;
+  }
+
+  const uint8_t *data;
+  size_t bitPos = 0;
+};
@@ -0,0 +1,363 @@
+#include "chacha20poly1305.h"
+#include <cstring>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define CHACHA_SSE2 1
+#endif
+
+static inline uint32_t load32(const uint8_t *p)
+{
+  return uint32_t(p[0]) | (uint32_t(p[1]) << 8) | (uint32_t(p[2]) << 16) | (uint32_t(p[3]) << 24);
+}
+
+static inline void store32(uint8_t *p, uint32_t v)
+{
+  p[0] = uint8_t(v);
+  p[1] = uint8_t(v >> 8);
+  p[2] = uint8_t(v >> 16);
+  p[3] = uint8_t(v >> 24);
+}
+
+static inline void store64(uint8_t *p, uint64_t v)
+{
+  store32(p, uint32_t(v));
+  store32(p + 4, uint32_t(v >> 32));
+}
+
+static void chacha_init(uint32_t state[16], const uint8_t key[32], uint32_t counter, const uint8_t nonce[12])
+{
+  state[0] = 0x61707865;
+  state[1] = 0x3320646e;
+  state[2] = 0x79622d32;
+  state[3] = 0x6b206574;
+  for (int i = 0; i < 8; ++i)
+    state[4 + i] = load32(key + 4 * i);
+  state[12] = counter;
+  for (int i = 0; i < 3; ++i)
+    state[13 + i] = load32(nonce + 4 * i);
+}
+
+// 20 rounds over state into out, with the state added back unless this is
+// HChaCha20. chacha_blocks2 does the blocks at counter and counter + 1 in one
+// loop: a block is one long dependency chain, two independent ones run in the
+// time of one, and a small packet needs exactly two (Poly1305 key + data).
+#if CHACHA_SSE2
+// One row of the 4x4 state per register, a double round is a column round,
+// a rotation of rows 1-3 that lines the diagonals up as columns, and another
+// column round.
+static inline __m128i rotl(__m128i v, int n)
+{
+  return _mm_or_si128(_mm_slli_epi32(v, n), _mm_srli_epi32(v, 32 - n));
+}
+
+static inline void quarter_rounds(__m128i &a, __m128i &b, __m128i &c, __m128i &d)
+{
+  a = _mm_add_epi32(a, b); d = rotl(_mm_xor_si128(d, a), 16);
+  c = _mm_add_epi32(c, d); b = rotl(_mm_xor_si128(b, c), 12);
+  a = _mm_add_epi32(a, b); d = rotl(_mm_xor_si128(d, a), 8);
+  c = _mm_add_epi32(c, d); b = rotl(_mm_xor_si128(b, c), 7);
+}
+
+static inline void double_round(__m128i &a, __m128i &b, __m128i &c, __m128i &d)
+{
+  quarter_rounds(a, b, c, d);
+  b = _mm_shuffle_epi32(b, 0x39);
+  c = _mm_shuffle_epi32(c, 0x4e);
+  d = _mm_shuffle_epi32(d, 0x93);
+  quarter_rounds(a, b, c, d);
+  b = _mm_shuffle_epi32(b, 0x93);
+  c = _mm_shuffle_epi32(c, 0x4e);
+  d = _mm_shuffle_epi32(d, 0x39);
+}
+
+static void chacha_rounds(const uint32_t state[16], uint32_t out[16], bool addState)
+{
+  const __m128i s0 = _mm_loadu_si128((const __m128i*)(state + 0));
+  const __m128i s1 = _mm_loadu_si128((const __m128i*)(state + 4));
+  const __m128i s2 = _mm_loadu_si128((const __m128i*)(state + 8));
+  const __m128i s3 = _mm_loadu_si128((const __m128i*)(state + 12));
+  __m128i a = s0, b = s1, c = s2, d = s3;
+  for (int i = 0; i < 10; ++i)
+    double_round(a, b, c, d);
+  if (addState)
+  {
+    a = _mm_add_epi32(a, s0);
+    b = _mm_add_epi32(b, s1);
+    c = _mm_add_epi32(c, s2);
+    d = _mm_add_epi32(d, s3);
+  }
+  _mm_storeu_si128((__m128i*)(out + 0), a);
+  _mm_storeu_si128((__m128i*)(out + 4), b);
+  _mm_storeu_si128((__m128i*)(out + 8), c);
+  _mm_storeu_si128((__m128i*)(out + 12), d);
+}
+
+static void chacha_blocks2(const uint32_t state[16], uint32_t out[32])
+{
+  const __m128i s0 = _mm_loadu_si128((const __m128i*)(state + 0));
+  const __m128i s1 = _mm_loadu_si128((const __m128i*)(state + 4));
+  const __m128i s2 = _mm_loadu_si128((const __m128i*)(state + 8));
+  const __m128i s3 = _mm_loadu_si128((const __m128i*)(state + 12));
+  const __m128i s3next = _mm_add_epi32(s3, _mm_set_epi32(0, 0, 0, 1));
+  __m128i a = s0, b = s1, c = s2, d = s3;
+  __m128i a2 = s0, b2 = s1, c2 = s2, d2 = s3next;
+  for (int i = 0; i < 10; ++i)
+  {
+    double_round(a, b, c, d);
+    double_round(a2, b2, c2, d2);
+  }
+  _mm_storeu_si128((__m128i*)(out + 0), _mm_add_epi32(a, s0));
+  _mm_storeu_si128((__m128i*)(out + 4), _mm_add_epi32(b, s1));
+  _mm_storeu_si128((__m128i*)(out + 8), _mm_add_epi32(c, s2));
+  _mm_storeu_si128((__m128i*)(out + 12), _mm_add_epi32(d, s3));
+  _mm_storeu_si128((__m128i*)(out + 16), _mm_add_epi32(a2, s0));
+  _mm_storeu_si128((__m128i*)(out + 20), _mm_add_epi32(b2, s1));
+  _mm_storeu_si128((__m128i*)(out + 24), _mm_add_epi32(c2, s2));
+  _mm_storeu_si128((__m128i*)(out + 28), _mm_add_epi32(d2, s3next));
+}
+#else
+static inline uint32_t rotl(uint32_t v, int n)
+{
+  return (v << n) | (v >> (32 - n));
+}
+
+static inline void quarter_round(uint32_t *x, int a, int b, int c, int d)
+{
+  x[a] += x[b]; x[d] = rotl(x[d] ^ x[a], 16);
+  x[c] += x[d]; x[b] = rotl(x[b] ^ x[c], 12);
+  x[a] += x[b]; x[d] = rotl(x[d] ^ x[a], 8);
+  x[c] += x[d]; x[b] = rotl(x[b] ^ x[c], 7);
+}
+
+static void chacha_rounds(const uint32_t state[16], uint32_t out[16], bool addState)
+{
+  uint32_t x[16];
+  memcpy(x, state, sizeof(x));
+  for (int i = 0; i < 10; ++i)
+  {
+    quarter_round(x, 0, 4, 8, 12);
+    quarter_round(x, 1, 5, 9, 13);
+    quarter_round(x, 2, 6, 10, 14);
+    quarter_round(x, 3, 7, 11, 15);
+    quarter_round(x, 0, 5, 10, 15);
+    quarter_round(x, 1, 6, 11, 12);
+    quarter_round(x, 2, 7, 8, 13);
+    quarter_round(x, 3, 4, 9, 14);
+  }
+  for (int i = 0; i < 16; ++i)
+    out[i] = addState ? x[i] + state[i] : x[i];
+}
+
+static void chacha_blocks2(const uint32_t state[16], uint32_t out[32])
+{
+  uint32_t next[16];
+  memcpy(next, state, sizeof(next));
+  ++next[12];
+  chacha_rounds(state, out, true);
+  chacha_rounds(next, out + 16, true);
+}
+#endif
+
+// Keystream of a key and nonce from block 0 on, two blocks at a time
+class Keystream
+{
+public:
+  Keystream(const uint8_t key[32], const uint8_t nonce[12]) { chacha_init(state, key, 0, nonce); }
+
+  void copy(uint8_t *out, size_t size)
+  {
+    consume(size, [&](const uint8_t *keys, size_t offset, size_t n) { memcpy(out + offset, keys, n); });
+  }
+
+  void skip(size_t size)
+  {
+    consume(size, [](const uint8_t*, size_t, size_t) {});
+  }
+
+  void xor_into(uint8_t *data, size_t size)
+  {
+    consume(size, [&](const uint8_t *keys, size_t offset, size_t n)
+    {
+      for (size_t i = 0; i < n; ++i)
+        data[offset + i] ^= keys[i];
+    });
+  }
+
+private:
+  // Hands out the next size bytes in runs of what is left of the buffer
+  template<typename Fn>
+  void consume(size_t size, Fn fn)
+  {
+    for (size_t done = 0; done < size;)
+    {
+      if (pos == sizeof(bytes))
+      {
+        uint32_t blocks[32];
+        chacha_blocks2(state, blocks);
+        state[12] += 2;
+        for (int i = 0; i < 32; ++i)
+          store32(bytes + 4 * i, blocks[i]);
+        pos = 0;
+      }
+      const size_t n = size - done < sizeof(bytes) - pos ? size - done : sizeof(bytes) - pos;
+      fn(bytes + pos, done, n);
+      pos += n;
+      done += n;
+    }
+  }
+
+  uint32_t state[16];
+  uint8_t bytes[128];
+  size_t pos = sizeof(bytes);
+};
+
+void hchacha20(uint8_t out[32], const uint8_t key[32], const uint8_t in[16])
+{
+  uint32_t state[16];
+  chacha_init(state, key, load32(in), in + 4);
+  uint32_t x[16];
+  chacha_rounds(state, x, false);
+  for (int i = 0; i < 4; ++i)
+  {
+    store32(out + 4 * i, x[i]);
+    store32(out + 16 + 4 * i, x[12 + i]);
+  }
+}
+
+// Poly1305 in 26 bit limbs, every product fits in 64 bits (poly1305-donna).
+struct Poly1305
+{
+  uint32_t r[5];
+  uint32_t h[5] = {};
+  uint32_t pad[4];
+
+  explicit Poly1305(const uint8_t key[32])
+  {
+    r[0] = (load32(key + 0)) & 0x3ffffff;
+    r[1] = (load32(key + 3) >> 2) & 0x3ffff03;
+    r[2] = (load32(key + 6) >> 4) & 0x3ffc0ff;
+    r[3] = (load32(key + 9) >> 6) & 0x3f03fff;
+    r[4] = (load32(key + 12) >> 8) & 0x00fffff;
+    for (int i = 0; i < 4; ++i)
+      pad[i] = load32(key + 16 + 4 * i);
+  }
+
+  void block(const uint8_t m[16], uint32_t hibit)
+  {
+    const uint32_t s1 = r[1] * 5, s2 = r[2] * 5, s3 = r[3] * 5, s4 = r[4] * 5;
+    uint32_t h0 = h[0] + ((load32(m + 0)) & 0x3ffffff);
+    uint32_t h1 = h[1] + ((load32(m + 3) >> 2) & 0x3ffffff);
+    uint32_t h2 = h[2] + ((load32(m + 6) >> 4) & 0x3ffffff);
+    uint32_t h3 = h[3] + ((load32(m + 9) >> 6) & 0x3ffffff);
+    uint32_t h4 = h[4] + ((load32(m + 12) >> 8) | hibit);
+
+    uint64_t d0 = uint64_t(h0) * r[0] + uint64_t(h1) * s4 + uint64_t(h2) * s3 + uint64_t(h3) * s2 + uint64_t(h4) * s1;
+    uint64_t d1 = uint64_t(h0) * r[1] + uint64_t(h1) * r[0] + uint64_t(h2) * s4 + uint64_t(h3) * s3 + uint64_t(h4) * s2;
+    uint64_t d2 = uint64_t(h0) * r[2] + uint64_t(h1) * r[1] + uint64_t(h2) * r[0] + uint64_t(h3) * s4 + uint64_t(h4) * s3;
+    uint64_t d3 = uint64_t(h0) * r[3] + uint64_t(h1) * r[2] + uint64_t(h2) * r[1] + uint64_t(h3) * r[0] + uint64_t(h4) * s4;
+    uint64_t d4 = uint64_t(h0) * r[4] + uint64_t(h1) * r[3] + uint64_t(h2) * r[2] + uint64_t(h3) * r[1] + uint64_t(h4) * r[0];
+
+    uint32_t c = uint32_t(d0 >> 26); h0 = uint32_t(d0) & 0x3ffffff;
+    d1 += c; c = uint32_t(d1 >> 26); h1 = uint32_t(d1) & 0x3ffffff;
+    d2 += c; c = uint32_t(d2 >> 26); h2 = uint32_t(d2) & 0x3ffffff;
+    d3 += c; c = uint32_t(d3 >> 26); h3 = uint32_t(d3) & 0x3ffffff;
+    d4 += c; c = uint32_t(d4 >> 26); h4 = uint32_t(d4) & 0x3ffffff;
+    h0 += c * 5; c = h0 >> 26; h0 &= 0x3ffffff;
+    h1 += c;
+
+    h[0] = h0; h[1] = h1; h[2] = h2; h[3] = h3; h[4] = h4;
+  }
+
+  // Whole blocks, the last one zero padded as the AEAD construction wants
+  void update_padded(const uint8_t *m, size_t size)
+  {
+    for (; size >= 16; m += 16, size -= 16)
+      block(m, 1u << 24);
+    if (size > 0)
+    {
+      uint8_t last[16] = {};
+      memcpy(last, m, size);
+      block(last, 1u << 24);
+    }
+  }
+
+  void finish(uint8_t tag[16])
+  {
+    uint32_t h0 = h[0], h1 = h[1], h2 = h[2], h3 = h[3], h4 = h[4];
+    uint32_t c = h1 >> 26; h1 &= 0x3ffffff;
+    h2 += c; c = h2 >> 26; h2 &= 0x3ffffff;
+    h3 += c; c = h3 >> 26; h3 &= 0x3ffffff;
+    h4 += c; c = h4 >> 26; h4 &= 0x3ffffff;
+    h0 += c * 5; c = h0 >> 26; h0 &= 0x3ffffff;
+    h1 += c;
+
+    // h - p, taken if it doesn't go negative
+    uint32_t g0 = h0 + 5; c = g0 >> 26; g0 &= 0x3ffffff;
+    uint32_t g1 = h1 + c; c = g1 >> 26; g1 &= 0x3ffffff;
+    uint32_t g2 = h2 + c; c = g2 >> 26; g2 &= 0x3ffffff;
+    uint32_t g3 = h3 + c; c = g3 >> 26; g3 &= 0x3ffffff;
+    uint32_t g4 = h4 + c - (1u << 26);
+    uint32_t mask = (g4 >> 31) - 1;
+    h0 = (h0 & ~mask) | (g0 & mask);
+    h1 = (h1 & ~mask) | (g1 & mask);
+    h2 = (h2 & ~mask) | (g2 & mask);
+    h3 = (h3 & ~mask) | (g3 & mask);
+    h4 = (h4 & ~mask) | (g4 & mask);
+
+    h0 = h0 | (h1 << 26);
+    h1 = (h1 >> 6) | (h2 << 20);
+    h2 = (h2 >> 12) | (h3 << 14);
+    h3 = (h3 >> 18) | (h4 << 8);
+
+    uint64_t f = uint64_t(h0) + pad[0]; store32(tag + 0, uint32_t(f));
+    f = uint64_t(h1) + pad[1] + (f >> 32); store32(tag + 4, uint32_t(f));
+    f = uint64_t(h2) + pad[2] + (f >> 32); store32(tag + 8, uint32_t(f));
+    f = uint64_t(h3) + pad[3] + (f >> 32); store32(tag + 12, uint32_t(f));
+  }
+};
+
+static void compute_tag(const uint8_t polyKey[32], const uint8_t *aad, size_t aadSize,
+                        const uint8_t *ciphertext, size_t size, uint8_t tag[16])
+{
+  Poly1305 poly(polyKey);
+  poly.update_padded(aad, aadSize);
+  poly.update_padded(ciphertext, size);
+  uint8_t sizes[16];
+  store64(sizes, aadSize);
+  store64(sizes + 8, size);
+  poly.block(sizes, 1u << 24);
+  poly.finish(tag);
+}
+
+// The one time Poly1305 key is the first half of keystream block 0, the data
+// is encrypted from block 1 on.
+void aead_seal(const uint8_t key[aeadKeySize], const uint8_t nonce[aeadNonceSize],
+               const uint8_t *aad, size_t aadSize, uint8_t *data, size_t size, uint8_t tag[aeadTagSize])
+{
+  Keystream keystream(key, nonce);
+  uint8_t polyKey[32];
+  keystream.copy(polyKey, sizeof(polyKey));
+  keystream.skip(32);
+  keystream.xor_into(data, size);
+  compute_tag(polyKey, aad, aadSize, data, size, tag);
+}
+
+bool aead_open(const uint8_t key[aeadKeySize], const uint8_t nonce[aeadNonceSize],
+               const uint8_t *aad, size_t aadSize, uint8_t *data, size_t size, const uint8_t tag[aeadTagSize])
+{
+  Keystream keystream(key, nonce);
+  uint8_t polyKey[32];
+  keystream.copy(polyKey, sizeof(polyKey));
+  keystream.skip(32);
+  uint8_t expected[aeadTagSize];
+  compute_tag(polyKey, aad, aadSize, data, size, expected);
+  // constant time, a timing difference would leak how much of a forged tag is right
+  uint8_t diff = 0;
+  for (size_t i = 0; i < aeadTagSize; ++i)
+    diff |= uint8_t(expected[i] ^ tag[i]);
+  if (diff != 0)
+    return false;
+  keystream.xor_into(data, size);
+  return true;
+}
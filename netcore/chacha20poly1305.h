@@ -0,0 +1,21 @@
+#pragma once
+#include <cstdint>
+#include <cstddef>
+
+// ChaCha20-Poly1305 AEAD as in RFC 8439: 32 byte key, 12 byte nonce, 16 byte
+// tag. A nonce must never be used twice with the same key.
+constexpr size_t aeadKeySize = 32;
+constexpr size_t aeadNonceSize = 12;
+constexpr size_t aeadTagSize = 16;
+
+// Encrypts data in place and writes the tag over aad and the ciphertext.
+void aead_seal(const uint8_t key[aeadKeySize], const uint8_t nonce[aeadNonceSize],
+               const uint8_t *aad, size_t aadSize, uint8_t *data, size_t size, uint8_t tag[aeadTagSize]);
+
+// Checks the tag first and only then decrypts data in place. Returns false,
+// leaving data untouched, if the tag doesn't match.
+bool aead_open(const uint8_t key[aeadKeySize], const uint8_t nonce[aeadNonceSize],
+               const uint8_t *aad, size_t aadSize, uint8_t *data, size_t size, const uint8_t tag[aeadTagSize]);
+
+// HChaCha20, derives a 32 byte key from a key and a 16 byte input.
+void hchacha20(uint8_t out[32], const uint8_t key[32], const uint8_t in[16]);
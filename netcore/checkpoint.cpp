@@ -0,0 +1,290 @@
+#include "checkpoint.h"
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+struct CheckpointFileHeader
+{
+  uint32_t magic;
+  uint16_t version;
+  uint16_t reserved;
+  uint64_t slotCapacity;
+};
+
+struct CheckpointSlotHeader
+{
+  uint64_t sequence; // 0 marks a slot that is being written
+  uint64_t size;
+  uint32_t checksum;
+  uint32_t reserved;
+};
+
+static uint32_t checkpoint_checksum(const uint8_t *data, size_t size)
+{
+  uint32_t hash = 2166136261u;
+  for (size_t i = 0; i < size; ++i)
+    hash = (hash ^ data[i]) * 16777619u;
+  return hash;
+}
+
+static void flush_mapping(uint8_t *mapped, size_t size)
+{
+#ifdef _WIN32
+  FlushViewOfFile(mapped, size);
+#else
+  msync(mapped, size, MS_SYNC);
+#endif
+}
+
+CheckpointFile::~CheckpointFile()
+{
+  close();
+}
+
+bool CheckpointFile::open(const char *path, size_t slotCapacity)
+{
+  close();
+  const size_t wantedSize = sizeof(CheckpointFileHeader) + 2 * (sizeof(CheckpointSlotHeader) + slotCapacity);
+  size_t fileSize = 0;
+#ifdef _WIN32
+  HANDLE file = CreateFileA(path, GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ, nullptr, OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+  if (file == INVALID_HANDLE_VALUE)
+    return false;
+  fileHandle = file;
+  LARGE_INTEGER existingSize;
+  GetFileSizeEx(file, &existingSize);
+  fileSize = size_t(existingSize.QuadPart);
+#else
+  fd = ::open(path, O_RDWR | O_CREAT, 0644);
+  if (fd < 0)
+    return false;
+  struct stat st;
+  if (fstat(fd, &st) != 0)
+  {
+    close();
+    return false;
+  }
+  fileSize = size_t(st.st_size);
+#endif
+
+  // Keep an existing file as long as its slots are big enough
+  CheckpointFileHeader header = {};
+  bool reuse = false;
+  if (fileSize >= sizeof(CheckpointFileHeader))
+  {
+#ifdef _WIN32
+    DWORD bytesRead = 0;
+    ReadFile(file, &header, sizeof(header), &bytesRead, nullptr);
+#else
+    if (pread(fd, &header, sizeof(header), 0) != ssize_t(sizeof(header)))
+      header = {};
+#endif
+    reuse = header.magic == checkpointMagic && header.version == checkpointVersion &&
+            header.slotCapacity >= slotCapacity &&
+            fileSize == sizeof(CheckpointFileHeader) + 2 * (sizeof(CheckpointSlotHeader) + header.slotCapacity);
+  }
+  capacity = reuse ? size_t(header.slotCapacity) : slotCapacity;
+  mappedSize = reuse ? fileSize : wantedSize;
+
+#ifdef _WIN32
+  if (!reuse)
+  {
+    LARGE_INTEGER newSize;
+    newSize.QuadPart = LONGLONG(mappedSize);
+    SetFilePointerEx(file, newSize, nullptr, FILE_BEGIN);
+    SetEndOfFile(file);
+  }
+  mappingHandle = CreateFileMappingA(file, nullptr, PAGE_READWRITE, 0, 0, nullptr);
+  if (!mappingHandle)
+  {
+    close();
+    return false;
+  }
+  mapped = (uint8_t*)MapViewOfFile(mappingHandle, FILE_MAP_ALL_ACCESS, 0, 0, mappedSize);
+#else
+  if (!reuse && (ftruncate(fd, 0) != 0 || ftruncate(fd, off_t(mappedSize)) != 0))
+  {
+    close();
+    return false;
+  }
+  void *ptr = mmap(nullptr, mappedSize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  mapped = ptr == MAP_FAILED ? nullptr : (uint8_t*)ptr;
+#endif
+  if (!mapped)
+  {
+    close();
+    return false;
+  }
+
+  if (!reuse)
+  {
+    memset(mapped, 0, mappedSize);
+    header = { checkpointMagic, checkpointVersion, 0, capacity };
+    memcpy(mapped, &header, sizeof(header));
+    flush_mapping(mapped, mappedSize);
+  }
+
+  current = newest_slot();
+  if (current >= 0)
+  {
+    CheckpointSlotHeader slotHeader;
+    memcpy(&slotHeader, slot_ptr(current), sizeof(slotHeader));
+    sequence = slotHeader.sequence;
+  }
+  return true;
+}
+
+void CheckpointFile::close()
+{
+#ifdef _WIN32
+  if (mapped)
+    UnmapViewOfFile(mapped);
+  if (mappingHandle)
+    CloseHandle(mappingHandle);
+  if (fileHandle)
+    CloseHandle(fileHandle);
+  mappingHandle = nullptr;
+  fileHandle = nullptr;
+#else
+  if (mapped)
+    munmap(mapped, mappedSize);
+  if (fd >= 0)
+    ::close(fd);
+  fd = -1;
+#endif
+  mapped = nullptr;
+  mappedSize = 0;
+  sequence = 0;
+  current = -1;
+}
+
+uint8_t *CheckpointFile::slot_ptr(int slot) const
+{
+  return mapped + sizeof(CheckpointFileHeader) + slot * (sizeof(CheckpointSlotHeader) + capacity);
+}
+
+int CheckpointFile::newest_slot() const
+{
+  int newest = -1;
+  uint64_t newestSequence = 0;
+  for (int slot = 0; slot < 2; ++slot)
+  {
+    CheckpointSlotHeader slotHeader;
+    memcpy(&slotHeader, slot_ptr(slot), sizeof(slotHeader));
+    if (slotHeader.sequence <= newestSequence || slotHeader.size > capacity)
+      continue;
+    const uint8_t *payload = slot_ptr(slot) + sizeof(CheckpointSlotHeader);
+    if (checkpoint_checksum(payload, size_t(slotHeader.size)) != slotHeader.checksum)
+      continue;
+    newest = slot;
+    newestSequence = slotHeader.sequence;
+  }
+  return newest;
+}
+
+bool CheckpointFile::load(std::vector<uint8_t> &state) const
+{
+  if (!mapped)
+    return false;
+  if (current < 0)
+    return false;
+  CheckpointSlotHeader slotHeader;
+  memcpy(&slotHeader, slot_ptr(current), sizeof(slotHeader));
+  const uint8_t *payload = slot_ptr(current) + sizeof(CheckpointSlotHeader);
+  state.assign(payload, payload + slotHeader.size);
+  return true;
+}
+
+bool CheckpointFile::store(const uint8_t *state, size_t size)
+{
+  if (!mapped || size > capacity)
+    return false;
+  // Overwrite the older slot, the newest one stays valid until this one is complete
+  int target = current == 0 ? 1 : 0;
+  uint8_t *slot = slot_ptr(target);
+
+  CheckpointSlotHeader slotHeader = {};
+  memcpy(slot, &slotHeader, sizeof(slotHeader));
+  memcpy(slot + sizeof(CheckpointSlotHeader), state, size);
+  flush_mapping(mapped, mappedSize);
+
+  slotHeader.sequence = ++sequence;
+  slotHeader.size = size;
+  slotHeader.checksum = checkpoint_checksum(state, size);
+  memcpy(slot, &slotHeader, sizeof(slotHeader));
+  flush_mapping(mapped, mappedSize);
+  current = target;
+  return true;
+}
+
+CheckpointWriter::~CheckpointWriter()
+{
+  stop();
+}
+
+bool CheckpointWriter::load(const char *path, size_t slotCapacity, std::vector<uint8_t> &state)
+{
+  if (!file.open(path, slotCapacity))
+    return false;
+  bool loaded = file.load(state);
+  file.close();
+  return loaded;
+}
+
+bool CheckpointWriter::start(const char *path, size_t slotCapacity)
+{
+  if (!file.open(path, slotCapacity))
+    return false;
+  quit = false;
+  thread = std::thread(&CheckpointWriter::run, this);
+  return true;
+}
+
+void CheckpointWriter::stop()
+{
+  if (!thread.joinable())
+    return;
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    quit = true;
+  }
+  cv.notify_one();
+  thread.join();
+  file.close();
+}
+
+void CheckpointWriter::submit(std::vector<uint8_t> &state)
+{
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (hasPending)
+      ++dropped;
+    pending.swap(state);
+    hasPending = true;
+  }
+  cv.notify_one();
+  state.clear();
+}
+
+void CheckpointWriter::run()
+{
+  while (true)
+  {
+    {
+      std::unique_lock<std::mutex> lock(mutex);
+      cv.wait(lock, [this]() { return hasPending || quit; });
+      if (!hasPending && quit)
+        return;
+      writing.swap(pending);
+      hasPending = false;
+    }
+    if (file.store(writing.data(), writing.size()))
+      ++written;
+  }
+}
+
@@ -0,0 +1,137 @@
+#pragma once
+#include <cstdint>
+#include <cstring>
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Crash-safe world checkpoints in a memory-mapped file.
+//
+// The file holds two slots, each with its own sequence number and checksum.
+// A new checkpoint always overwrites the older slot, so a crash in the middle
+// of a write leaves the previous checkpoint intact. Loading picks the newest
+// slot whose checksum matches.
+constexpr uint32_t checkpointMagic = 0x4b504b43; // "CKPK"
+constexpr uint16_t checkpointVersion = 1;
+
+class CheckpointFile
+{
+public:
+  CheckpointFile() = default;
+  CheckpointFile(const CheckpointFile &) = delete;
+  CheckpointFile &operator=(const CheckpointFile &) = delete;
+  ~CheckpointFile();
+
+  // Maps path, creating it if needed. An existing file with a smaller slot
+  // capacity is recreated (and its checkpoints dropped).
+  bool open(const char *path, size_t slotCapacity);
+  void close();
+
+  bool load(std::vector<uint8_t> &state) const;
+  bool store(const uint8_t *state, size_t size);
+
+private:
+  uint8_t *slot_ptr(int slot) const;
+  int newest_slot() const;
+
+  uint8_t *mapped = nullptr;
+  size_t mappedSize = 0;
+  size_t capacity = 0;
+  uint64_t sequence = 0;
+  int current = -1;
+#ifdef _WIN32
+  void *fileHandle = nullptr;
+  void *mappingHandle = nullptr;
+#else
+  int fd = -1;
+#endif
+};
+
+// Writes checkpoints on its own thread. The tick thread serializes the world
+// into a buffer it owns and swaps it in with submit(); the writer thread swaps
+// it out again, so neither side copies or allocates once the buffers are warm.
+// If the writer falls behind, only the newest submitted state is kept.
+class CheckpointWriter
+{
+public:
+  ~CheckpointWriter();
+
+  bool start(const char *path, size_t slotCapacity);
+  void stop();
+
+  // Loads the newest valid checkpoint, only valid before start().
+  bool load(const char *path, size_t slotCapacity, std::vector<uint8_t> &state);
+
+  // Takes the contents of state; state gets back a buffer to reuse next time.
+  void submit(std::vector<uint8_t> &state);
+
+  uint32_t get_written() const { return written; }
+  uint32_t get_dropped() const { return dropped; }
+
+private:
+  void run();
+
+  CheckpointFile file;
+  std::thread thread;
+  std::mutex mutex;
+  std::condition_variable cv;
+  std::vector<uint8_t> pending;
+  std::vector<uint8_t> writing;
+  bool hasPending = false;
+  bool quit = false;
+  std::atomic<uint32_t> written = 0;
+  std::atomic<uint32_t> dropped = 0;
+};
+
+// Helpers to (de)serialize POD world state into a checkpoint buffer.
+template<typename T>
+void checkpoint_write(std::vector<uint8_t> &buf, const T &val)
+{
+  const uint8_t *ptr = (const uint8_t*)&val;
+  buf.insert(buf.end(), ptr, ptr + sizeof(T));
+}
+
+template<typename T>
+void checkpoint_write(std::vector<uint8_t> &buf, const T *vals, size_t count)
+{
+  const uint8_t *ptr = (const uint8_t*)vals;
+  buf.insert(buf.end(), ptr, ptr + sizeof(T) * count);
+}
+
+class CheckpointReader
+{
+public:
+  CheckpointReader(const uint8_t *data, size_t size) : ptr(data), end(data + size) {}
+
+  template<typename T>
+  bool read(T &val)
+  {
+    if (size_t(end - ptr) < sizeof(T))
+      return false;
+    memcpy(&val, ptr, sizeof(T));
+    ptr += sizeof(T);
+    return true;
+  }
+
+  template<typename T>
+  bool read(T *vals, size_t count)
+  {
+    if (size_t(end - ptr) / sizeof(T) < count)
+      return false;
+    memcpy(vals, ptr, sizeof(T) * count);
+    ptr += sizeof(T) * count;
+    return true;
+  }
+
+  // Whether count values of T are left, for a count read from the data
+  // before anything is allocated for it
+  template<typename T>
+  bool has(size_t count) const { return size_t(end - ptr) / sizeof(T) >= count; }
+
+private:
+  const uint8_t *ptr;
+  const uint8_t *end;
+};
+
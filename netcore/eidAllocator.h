@@ -0,0 +1,137 @@
+#pragma once
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+
+// Network ids of entities, reused once their entity is despawned, so a long
+// running server neither runs out of 16 bit eids nor grows its eid lookups.
+// An eid is a slot (what EntityWorld calls an index) in the high slotBits and
+// the generation of that slot in the low generationBits. Freeing an eid bumps
+// the generation of its slot, so whatever still names the entity that had
+// the slot before (a late snapshot, a stale input, a reattach) matches no
+// live eid, and eids of few live entities stay small numbers.
+//
+// Freed slots are reused oldest first: the same eid only comes back once its
+// slot was freed 2^generationBits times, and every other free slot was used
+// in between. Both allocate() and free() are O(1).
+//
+//   EidAllocator eids;
+//   uint16_t eid = eids.allocate();   // invalid_eid when maxEntities are alive
+//   eids.free(eid);                   // false for an eid that isn't alive
+//   eids.is_alive(eid);               // false now
+class EidAllocator
+{
+public:
+  static constexpr uint32_t generationBits = 6;
+  static constexpr uint32_t slotBits = 16 - generationBits;
+  static constexpr uint32_t maxEntities = 1u << slotBits;
+  static constexpr uint16_t invalid_eid = uint16_t(-1);
+
+  uint16_t allocate()
+  {
+    uint32_t slot = 0;
+    if (freeCount > 0)
+    {
+      slot = freeSlots[freeHead];
+      freeHead = (freeHead + 1) % maxEntities;
+      --freeCount;
+    }
+    else if (slots.size() < maxEntities)
+    {
+      slot = uint32_t(slots.size());
+      slots.emplace_back();
+    }
+    else
+      return invalid_eid;
+    slots[slot].alive = true;
+    ++liveCount;
+    return make_eid(slot, slots[slot].generation);
+  }
+
+  bool free(uint16_t eid)
+  {
+    if (!is_alive(eid))
+      return false;
+    const uint32_t slot = get_slot(eid);
+    Slot &s = slots[slot];
+    s.alive = false;
+    s.generation = (s.generation + 1) & generationMask;
+    // the last slot's last generation would be invalid_eid
+    if (make_eid(slot, s.generation) == invalid_eid)
+      s.generation = 0;
+    push_free(slot);
+    --liveCount;
+    return true;
+  }
+
+  bool is_alive(uint16_t eid) const
+  {
+    const uint32_t slot = get_slot(eid);
+    return slot < slots.size() && slots[slot].alive && slots[slot].generation == (eid & generationMask);
+  }
+
+  // The live eids are the only ones that are alive afterwards, every other
+  // slot up to the highest of them is free. False (and nothing alive) if one
+  // is invalid or there twice, for eids of a checkpoint.
+  bool restore(const uint16_t *eids, size_t count)
+  {
+    clear();
+    for (size_t i = 0; i < count; ++i)
+    {
+      const uint32_t slot = get_slot(eids[i]);
+      if (slot >= slots.size())
+        slots.resize(slot + 1);
+      if (eids[i] == invalid_eid || slots[slot].alive)
+      {
+        clear();
+        return false;
+      }
+      slots[slot].alive = true;
+      slots[slot].generation = uint8_t(eids[i] & generationMask);
+    }
+    for (uint32_t slot = 0; slot < slots.size(); ++slot)
+      if (!slots[slot].alive)
+        push_free(slot);
+    liveCount = count;
+    return true;
+  }
+
+  // live eids
+  size_t size() const { return liveCount; }
+
+  void clear()
+  {
+    slots.clear();
+    freeHead = 0;
+    freeCount = 0;
+    liveCount = 0;
+  }
+
+  static uint32_t get_slot(uint16_t eid) { return eid >> generationBits; }
+
+private:
+  static constexpr uint32_t generationMask = (1u << generationBits) - 1;
+
+  struct Slot
+  {
+    uint8_t generation = 0;
+    bool alive = false;
+  };
+
+  static uint16_t make_eid(uint32_t slot, uint32_t generation) { return uint16_t((slot << generationBits) | generation); }
+
+  void push_free(uint32_t slot)
+  {
+    if (freeSlots.empty())
+      freeSlots.resize(maxEntities);
+    freeSlots[(freeHead + freeCount) % maxEntities] = uint16_t(slot);
+    ++freeCount;
+  }
+
+  std::vector<Slot> slots;
+  // a ring of the free slots, oldest first from freeHead
+  std::vector<uint16_t> freeSlots;
+  uint32_t freeHead = 0;
+  uint32_t freeCount = 0;
+  size_t liveCount = 0;
+};
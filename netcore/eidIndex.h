@@ -0,0 +1,89 @@
+#pragma once
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+// Sparse set from eid to a slot in a dense entity array.
+// The owner keeps its entities in a plain std::vector and mirrors every
+// insert/erase here, so lookup by eid is a single indexed load instead of
+// a linear scan over all entities.
+class EidIndex
+{
+public:
+  static constexpr uint32_t invalid_slot = ~0u;
+  static constexpr uint16_t invalid_eid = uint16_t(-1);
+
+  // Returns the slot for eid, appending it to the dense set if it is new.
+  // The caller must push_back the entity when the returned slot == size() - 1.
+  // invalid_eid gets invalid_slot, and nothing may be pushed for it.
+  uint32_t insert(uint16_t eid)
+  {
+    uint32_t slot = find(eid);
+    if (slot != invalid_slot || eid == invalid_eid)
+      return slot;
+    if (eid >= sparse.size())
+      sparse.resize(size_t(eid) + 1, invalid_slot);
+    slot = uint32_t(eids.size());
+    sparse[eid] = slot;
+    eids.push_back(eid);
+    return slot;
+  }
+
+  uint32_t find(uint16_t eid) const
+  {
+    return eid < sparse.size() ? sparse[eid] : invalid_slot;
+  }
+
+  bool contains(uint16_t eid) const { return find(eid) != invalid_slot; }
+
+  template<typename T>
+  T *get(std::vector<T> &dense, uint16_t eid) const
+  {
+    uint32_t slot = find(eid);
+    return slot < dense.size() ? &dense[slot] : nullptr;
+  }
+
+  template<typename T>
+  const T *get(const std::vector<T> &dense, uint16_t eid) const
+  {
+    uint32_t slot = find(eid);
+    return slot < dense.size() ? &dense[slot] : nullptr;
+  }
+
+  // Swap-and-pop removal, keeps both the index and the dense array compact.
+  // parallel are more arrays indexed like dense, their entries move along.
+  template<typename T, typename... Parallel>
+  bool erase(std::vector<T> &dense, uint16_t eid, std::vector<Parallel> &...parallel)
+  {
+    uint32_t slot = find(eid);
+    if (slot == invalid_slot)
+      return false;
+    uint32_t last = uint32_t(eids.size() - 1);
+    if (slot != last)
+    {
+      dense[slot] = std::move(dense[last]);
+      ((parallel[slot] = std::move(parallel[last])), ...);
+      eids[slot] = eids[last];
+      sparse[eids[slot]] = slot;
+    }
+    dense.pop_back();
+    (parallel.pop_back(), ...);
+    eids.pop_back();
+    sparse[eid] = invalid_slot;
+    return true;
+  }
+
+  uint16_t eid_at(uint32_t slot) const { return eids[slot]; }
+  size_t size() const { return eids.size(); }
+
+  void clear()
+  {
+    sparse.clear();
+    eids.clear();
+  }
+
+private:
+  std::vector<uint32_t> sparse;
+  std::vector<uint16_t> eids;
+};
+
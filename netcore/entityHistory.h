@@ -0,0 +1,113 @@
+#pragma once
+#include <cstdint>
+#include <vector>
+
+// Server side history of entity positions for lag compensation.
+//
+// Every entity slot owns a ring of the last numTicks ticks, stored as separate
+// x/y/radius arrays so a rewind touches only the floats it needs. All memory
+// is allocated up front for maxEntities slots; slots past that are simply not
+// recorded and sample() reports them as unavailable.
+//
+// A client reports the newest snapshot tick it has and how far behind it
+// renders; view_tick() turns that into the (fractional) tick the client was
+// actually looking at, and sample() returns where an entity was at that time.
+class EntityHistory
+{
+public:
+  EntityHistory(uint32_t maxEntities, uint32_t numTicks)
+    : maxEntities(maxEntities), numTicks(numTicks),
+      xs(size_t(maxEntities) * numTicks), ys(size_t(maxEntities) * numTicks),
+      radii(size_t(maxEntities) * numTicks), ticks(size_t(maxEntities) * numTicks, invalid_tick)
+  {
+  }
+
+  void record(uint32_t tick, uint32_t slot, float x, float y, float radius)
+  {
+    if (slot >= maxEntities)
+      return;
+    size_t idx = index(slot, tick);
+    xs[idx] = x;
+    ys[idx] = y;
+    radii[idx] = radius;
+    ticks[idx] = tick;
+    newestTick = tick > newestTick ? tick : newestTick;
+  }
+
+  // Forgets the past of a slot, e.g. after a teleport, so that nobody gets
+  // compensated against a position the entity has already left.
+  void clear(uint32_t slot)
+  {
+    if (slot >= maxEntities)
+      return;
+    for (uint32_t i = 0; i < numTicks; ++i)
+      ticks[size_t(slot) * numTicks + i] = invalid_tick;
+  }
+
+  // Mirrors a swap-and-pop in the dense entity array.
+  void move(uint32_t from, uint32_t to)
+  {
+    if (from >= maxEntities || to >= maxEntities)
+      return;
+    for (uint32_t i = 0; i < numTicks; ++i)
+    {
+      size_t src = size_t(from) * numTicks + i;
+      size_t dst = size_t(to) * numTicks + i;
+      xs[dst] = xs[src];
+      ys[dst] = ys[src];
+      radii[dst] = radii[src];
+      ticks[dst] = ticks[src];
+      ticks[src] = invalid_tick;
+    }
+  }
+
+  float view_tick(uint32_t snapshotTick, uint32_t interpDelayMs, uint32_t tickMs) const
+  {
+    float tick = float(snapshotTick) - float(interpDelayMs) / float(tickMs);
+    // Never rewind past what we still have, nor into the future
+    float oldest = newestTick >= numTicks ? float(newestTick - numTicks + 1) : 0.f;
+    return tick < oldest ? oldest : tick > float(newestTick) ? float(newestTick) : tick;
+  }
+
+  bool sample(uint32_t slot, float viewTick, float &x, float &y, float &radius) const
+  {
+    if (slot >= maxEntities || viewTick < 0.f)
+      return false;
+    uint32_t tick0 = uint32_t(viewTick);
+    float t = viewTick - float(tick0);
+    size_t idx0 = index(slot, tick0);
+    if (ticks[idx0] != tick0)
+      return false;
+    size_t idx1 = index(slot, tick0 + 1);
+    if (t <= 0.f || ticks[idx1] != tick0 + 1)
+    {
+      x = xs[idx0];
+      y = ys[idx0];
+      radius = radii[idx0];
+      return true;
+    }
+    x = xs[idx0] + (xs[idx1] - xs[idx0]) * t;
+    y = ys[idx0] + (ys[idx1] - ys[idx0]) * t;
+    radius = radii[idx0] + (radii[idx1] - radii[idx0]) * t;
+    return true;
+  }
+
+  uint32_t get_newest_tick() const { return newestTick; }
+
+private:
+  static constexpr uint32_t invalid_tick = ~0u;
+
+  size_t index(uint32_t slot, uint32_t tick) const
+  {
+    return size_t(slot) * numTicks + tick % numTicks;
+  }
+
+  uint32_t maxEntities;
+  uint32_t numTicks;
+  uint32_t newestTick = 0;
+  std::vector<float> xs;
+  std::vector<float> ys;
+  std::vector<float> radii;
+  std::vector<uint32_t> ticks;
+};
+
@@ -0,0 +1,62 @@
+#pragma once
+#include <cstdint>
+#include "sequenceRing.h"
+
+// Server side queue of sequenced client inputs for one controlled entity.
+// Inputs arrive unsequenced, so duplicates, late and reordered packets are
+// expected: anything at or below the last applied seq is dropped and the rest
+// is handed out in seq order. A missing input is skipped as soon as a later
+// one is available instead of stalling the entity. After a reset() the first
+// input pushed sets where the sequence starts, e.g. for a client reattaching
+// to its entity with a seq counter that kept running.
+template<typename Cmd, uint32_t Size = 64>
+class InputBuffer
+{
+public:
+  bool push(uint32_t seq, const Cmd &cmd)
+  {
+    if (!started && seq > 0)
+    {
+      lastApplied = newest = seq - 1;
+      started = true;
+    }
+    if (seq <= lastApplied || seq > lastApplied + Size)
+      return false;
+    if (inputs.find(seq))
+      return false;
+    inputs.insert(seq) = cmd;
+    newest = seq > newest ? seq : newest;
+    return true;
+  }
+
+  bool pop(Cmd &cmd)
+  {
+    for (uint32_t seq = lastApplied + 1; seq <= newest; ++seq)
+      if (const Cmd *next = inputs.find(seq))
+      {
+        cmd = *next;
+        inputs.erase(seq);
+        lastApplied = seq;
+        return true;
+      }
+    return false;
+  }
+
+  void reset()
+  {
+    inputs.clear();
+    lastApplied = 0;
+    newest = 0;
+    started = false;
+  }
+
+  uint32_t get_last_applied() const { return lastApplied; }
+  uint32_t get_pending() const { return newest - lastApplied; }
+
+private:
+  SequenceRing<Cmd, Size> inputs;
+  uint32_t lastApplied = 0;
+  uint32_t newest = 0;
+  bool started = false;
+};
+
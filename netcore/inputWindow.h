@@ -0,0 +1,31 @@
+#pragma once
+#include <cstdint>
+
+// Client side window of the last Size inputs, oldest to newest. Every input
+// packet carries the whole window on the unreliable channel, so an input is
+// only lost if Size packets in a row are lost, without the head-of-line
+// blocking of the reliable channel. The server dedupes by seq (InputBuffer).
+// Seqs pushed must be consecutive.
+template<typename Cmd, uint32_t Size = 8>
+class InputWindow
+{
+public:
+  void push(uint32_t seq, const Cmd &cmd)
+  {
+    cmds[seq % Size] = cmd;
+    newest = seq;
+    count = count < Size ? count + 1 : Size;
+  }
+
+  const Cmd &get(uint32_t seq) const { return cmds[seq % Size]; }
+  uint32_t get_first_seq() const { return newest - count + 1; }
+  uint32_t get_count() const { return count; }
+
+  static constexpr uint32_t size() { return Size; }
+
+private:
+  Cmd cmds[Size] = {};
+  uint32_t newest = 0;
+  uint32_t count = 0;
+};
+
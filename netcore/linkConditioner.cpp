@@ -0,0 +1,107 @@
+#include "linkConditioner.h"
+#include <cstdlib>
+#include <cstring>
+
+bool parse_link_condition(LinkConditions &conditions, const char *key, const char *value)
+{
+  if (strcmp(key, "latency") == 0)
+    conditions.latencyMs = strtoul(value, nullptr, 10);
+  else if (strcmp(key, "jitter") == 0)
+    conditions.jitterMs = strtoul(value, nullptr, 10);
+  else if (strcmp(key, "loss") == 0)
+    conditions.lossPercent = strtof(value, nullptr);
+  else if (strcmp(key, "burst") == 0)
+    conditions.lossBurst = strtof(value, nullptr);
+  else if (strcmp(key, "reorder") == 0)
+    conditions.reorderPercent = strtof(value, nullptr);
+  else if (strcmp(key, "duplicate") == 0)
+    conditions.duplicatePercent = strtof(value, nullptr);
+  else if (strcmp(key, "bandwidth") == 0)
+    conditions.bandwidthKbps = strtoul(value, nullptr, 10);
+  else if (strcmp(key, "queue") == 0)
+    conditions.queueMs = strtoul(value, nullptr, 10);
+  else
+    return false;
+  return true;
+}
+
+bool LinkConditioner::chance(float percent)
+{
+  return percent > 0.f && float(rng() % 1000000) < percent * 10000.f;
+}
+
+void LinkConditioner::submit(uint32_t now, const uint8_t *data, size_t size, uint32_t tag)
+{
+  ++submitted;
+
+  // Two state loss model: a burst starts with a probability picked so that
+  // the average loss matches, and ends after lossBurst packets on average.
+  const float burst = conditions.lossBurst < 1.f ? 1.f : conditions.lossBurst;
+  const float loss = conditions.lossPercent < 100.f ? conditions.lossPercent : 99.9f;
+  if (inLossBurst)
+    inLossBurst = !chance(100.f / burst);
+  else
+    inLossBurst = chance(loss / burst / (100.f - loss) * 100.f);
+  if (inLossBurst)
+  {
+    ++lost;
+    return;
+  }
+
+  // Bandwidth cap: the datagram waits for the link to be free, drop tail
+  // once the queue would hold it longer than queueMs.
+  uint32_t departAt = now;
+  if (conditions.bandwidthKbps > 0)
+  {
+    if (int32_t(linkFreeAt - now) > 0)
+      departAt = linkFreeAt;
+    if (departAt - now > conditions.queueMs)
+    {
+      ++dropped;
+      return;
+    }
+    // kbit/s is bit/ms, round up so tiny packets still cost something
+    const uint32_t bits = uint32_t(size * 8);
+    linkFreeAt = departAt + (bits + conditions.bandwidthKbps - 1) / conditions.bandwidthKbps;
+  }
+
+  schedule(departAt, data, size, tag);
+  if (chance(conditions.duplicatePercent))
+  {
+    ++duplicated;
+    schedule(departAt, data, size, tag);
+  }
+}
+
+void LinkConditioner::schedule(uint32_t now, const uint8_t *data, size_t size, uint32_t tag)
+{
+  uint32_t deliverAt = now + conditions.latencyMs;
+  if (conditions.jitterMs > 0)
+    deliverAt += rng() % (conditions.jitterMs + 1);
+
+  if (chance(conditions.reorderPercent))
+  {
+    // Held back by up to another jitter (at least a few ms) and not counted
+    // for ordering, so datagrams sent after it overtake it.
+    ++reordered;
+    deliverAt += 1 + rng() % (conditions.jitterMs + 20);
+  }
+  else
+  {
+    // Jitter alone doesn't reorder a stream, like a real queue
+    if (int32_t(lastDeliverAt - deliverAt) > 0)
+      deliverAt = lastDeliverAt;
+    lastDeliverAt = deliverAt;
+  }
+
+  pending.push({ deliverAt, nextOrder++, tag, std::vector<uint8_t>(data, data + size) });
+}
+
+uint32_t LinkConditioner::next_delivery(uint32_t now) const
+{
+  if (pending.empty())
+    return ~0u;
+  int32_t until = int32_t(pending.top().deliverAt - now);
+  return until > 0 ? uint32_t(until) : 0;
+}
+
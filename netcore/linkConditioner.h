@@ -0,0 +1,102 @@
+#pragma once
+#include <cstdint>
+#include <cstddef>
+#include <queue>
+#include <random>
+#include <utility>
+#include <vector>
+
+// Network conditions of one direction of a link. Loss comes in bursts
+// (Gilbert-Elliott): lossPercent is the long run average, lossBurst the average
+// number of packets lost in a row.
+struct LinkConditions
+{
+  uint32_t latencyMs = 0;
+  uint32_t jitterMs = 0;        // extra random delay in [0, jitterMs], order preserved
+  float lossPercent = 0.f;
+  float lossBurst = 1.f;
+  float reorderPercent = 0.f;   // chance a packet is held back past the ones after it
+  float duplicatePercent = 0.f;
+  uint32_t bandwidthKbps = 0;   // 0 is unlimited
+  uint32_t queueMs = 500;       // packets that would wait longer for bandwidth are dropped
+};
+
+// Parses key=value as used on the command line (--loss 5) and in scenario
+// files (loss=5). Returns false for an unknown key.
+bool parse_link_condition(LinkConditions &conditions, const char *key, const char *value);
+
+// Delays, drops, duplicates and reorders datagrams of one direction.
+// Time is in ms of any monotonic clock (enet_time_get). Every datagram is
+// submitted with a tag that is handed back on delivery, e.g. which session
+// of a proxy it belongs to.
+class LinkConditioner
+{
+public:
+  explicit LinkConditioner(uint32_t seed = 1) : rng(seed) {}
+
+  void set_conditions(const LinkConditions &c) { conditions = c; }
+  const LinkConditions &get_conditions() const { return conditions; }
+
+  void submit(uint32_t now, const uint8_t *data, size_t size, uint32_t tag);
+
+  // Calls deliver(tag, data, size) for every datagram due at now, in delivery
+  // order. deliver may submit() more, those due at now go out in this poll.
+  template<typename Fn>
+  void poll(uint32_t now, Fn deliver)
+  {
+    while (!pending.empty() && int32_t(pending.top().deliverAt - now) <= 0)
+    {
+      // only the payload is moved out, what the queue is ordered by stays
+      Datagram datagram = std::move(const_cast<Datagram&>(pending.top()));
+      pending.pop();
+      ++delivered;
+      deliver(datagram.tag, datagram.data.data(), datagram.data.size());
+    }
+  }
+
+  // ms until the next datagram is due, or ~0u if nothing is pending.
+  uint32_t next_delivery(uint32_t now) const;
+
+  uint32_t get_submitted() const { return submitted; }
+  uint32_t get_delivered() const { return delivered; }
+  uint32_t get_lost() const { return lost; }
+  uint32_t get_dropped() const { return dropped; }
+  uint32_t get_duplicated() const { return duplicated; }
+  uint32_t get_reordered() const { return reordered; }
+
+private:
+  struct Datagram
+  {
+    uint32_t deliverAt;
+    uint64_t order; // keeps datagrams due at the same ms in submission order
+    uint32_t tag;
+    std::vector<uint8_t> data;
+  };
+  struct LaterFirst
+  {
+    bool operator()(const Datagram &a, const Datagram &b) const
+    {
+      int32_t diff = int32_t(a.deliverAt - b.deliverAt);
+      return diff != 0 ? diff > 0 : a.order > b.order;
+    }
+  };
+
+  bool chance(float percent);
+  void schedule(uint32_t now, const uint8_t *data, size_t size, uint32_t tag);
+
+  LinkConditions conditions;
+  std::minstd_rand rng;
+  std::priority_queue<Datagram, std::vector<Datagram>, LaterFirst> pending;
+  uint64_t nextOrder = 0;
+  bool inLossBurst = false;
+  uint32_t linkFreeAt = 0;
+  uint32_t lastDeliverAt = 0;
+
+  uint32_t submitted = 0;
+  uint32_t delivered = 0;
+  uint32_t lost = 0;
+  uint32_t dropped = 0;
+  uint32_t duplicated = 0;
+  uint32_t reordered = 0;
+};
+
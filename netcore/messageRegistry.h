@@ -0,0 +1,138 @@
+#pragma once
+#include <enet/enet.h>
+#include "messageSchema.h"
+#include <array>
+#include <cstdint>
+#include <cstddef>
+#include <type_traits>
+#include <variant>
+
+// Packets from message schemas, and dispatch of received packets to
+// handlers. A protocol declares each message's fields once, as a schema; the
+// packet size, the writer and the reader all come from it, and a registry of
+// the schemas one end receives picks the decoder and the handler of a packet
+// from a table indexed by its type byte.
+//
+//   struct ReattachMsg { uint16_t eid = invalid_entity; uint32_t token = 0; };
+//   inline constexpr auto reattachSchema = make_message_schema<ReattachMsg>(E_CLIENT_TO_SERVER_REATTACH,
+//     bits_field(&ReattachMsg::eid, 16),
+//     bits_field(&ReattachMsg::token, 32));
+//   typedef MessageRegistry<joinSchema, reattachSchema, inputSchema> ClientToServerMessages;
+//
+//   struct ClientMessageHandler
+//   {
+//     void operator()(const ReattachMsg &msg) { ... }  // one for every message of the registry
+//   };
+//   ClientToServerMessages::dispatch(handler, packet);
+
+// A packet of exactly the bytes msg takes
+template<typename Schema>
+ENetPacket *create_message_packet(const Schema &schema, const typename Schema::Message &msg, uint32_t flags)
+{
+  ENetPacket *packet = enet_packet_create(nullptr, schema.get_size(), flags);
+  const size_t size = schema.write(packet->data, packet->dataLength, msg);
+  if (size < packet->dataLength)
+    enet_packet_resize(packet, size);
+  return packet;
+}
+
+// Returns false, leaving msg untouched, if the packet is of another type or too short
+template<typename Schema>
+bool read_message(const Schema &schema, const ENetPacket *packet, typename Schema::Message &msg)
+{
+  return schema.read(packet->data, packet->dataLength, msg);
+}
+
+// A message with framing of its own, that no schema describes: a registry
+// hands its handler the packet as it arrived.
+template<uint8_t Type>
+struct RawMessage
+{
+  ENetPacket *packet = nullptr;
+};
+
+template<uint8_t Type>
+struct RawMessageSchema
+{
+  using Message = RawMessage<Type>;
+
+  constexpr uint8_t get_type() const { return Type; }
+};
+
+template<uint8_t Type>
+constexpr RawMessageSchema<Type> make_raw_message_schema()
+{
+  return {};
+}
+
+template<uint8_t Type>
+bool read_message(const RawMessageSchema<Type> &, ENetPacket *packet, RawMessage<Type> &msg)
+{
+  msg.packet = packet;
+  return true;
+}
+
+template<size_t N>
+constexpr bool has_unique_message_types(const std::array<uint8_t, N> &types)
+{
+  for (size_t i = 0; i < N; ++i)
+    for (size_t j = i + 1; j < N; ++j)
+      if (types[i] == types[j])
+        return false;
+  return true;
+}
+
+// The schemas (constexpr objects, MessageSchema or RawMessageSchema) of every
+// message one end of a protocol receives.
+template<const auto &...Schemas>
+class MessageRegistry
+{
+public:
+  static_assert(sizeof...(Schemas) > 0);
+  static_assert(has_unique_message_types(std::array<uint8_t, sizeof...(Schemas)>{ Schemas.get_type()... }),
+                "every message of a registry needs a type of its own");
+
+  static constexpr bool contains(uint8_t type) { return ((Schemas.get_type() == type) || ...); }
+
+  // Any one decoded message of the registry, to hand it to another thread
+  // than the one that received it. A handler taking every message visits it.
+  using MessageVariant = std::variant<typename std::remove_cvref_t<decltype(Schemas)>::Message...>;
+
+  // Decodes packet with the schema of its type and calls handler(message).
+  // Returns false without calling it if no schema has that type or the
+  // packet doesn't decode. Handler must take every message of the registry.
+  template<typename Handler>
+  static bool dispatch(Handler &handler, ENetPacket *packet)
+  {
+    if (packet->dataLength == 0)
+      return false;
+    const Entry<Handler> entry = table<Handler>[packet->data[0]];
+    return entry != nullptr && entry(handler, packet);
+  }
+
+private:
+  template<typename Handler>
+  using Entry = bool (*)(Handler &, ENetPacket *);
+
+  template<typename Handler, const auto &Schema>
+  static bool read_and_handle(Handler &handler, ENetPacket *packet)
+  {
+    typename std::remove_cvref_t<decltype(Schema)>::Message msg{};
+    if (!read_message(Schema, packet, msg))
+      return false;
+    handler(msg);
+    return true;
+  }
+
+  template<typename Handler>
+  static constexpr std::array<Entry<Handler>, 256> make_table()
+  {
+    std::array<Entry<Handler>, 256> entries{};
+    ((entries[Schemas.get_type()] = &read_and_handle<Handler, Schemas>), ...);
+    return entries;
+  }
+
+  // one per handler type, built at compile time
+  template<typename Handler>
+  static constexpr std::array<Entry<Handler>, 256> table = make_table<Handler>();
+};
@@ -0,0 +1,420 @@
+#pragma once
+#include "bitStream.h"
+#include <bit>
+#include <cstdint>
+#include <cstddef>
+#include <tuple>
+#include <utility>
+
+// Compile-time description of a message: which members of a plain struct go
+// on the wire, in which order, with how many bits. Sender and receiver encode
+// and decode with the same schema object, so the layout is written down once
+// and both ends always agree on it bit for bit.
+//
+//   struct SnapshotMsg { uint16_t eid; float x; float y; float ori; };
+//   constexpr auto snapshotSchema = make_message_schema<SnapshotMsg>(E_SERVER_TO_CLIENT_SNAPSHOT,
+//     bits_field(&SnapshotMsg::eid, 16),
+//     range_field(&SnapshotMsg::x, -16.f, 16.f, 11), ...);
+//   static_assert(snapshotSchema.is_valid());
+//   ENetPacket *packet = create_message_packet(snapshotSchema, msg, flags); // messageRegistry.h
+
+// Every field has get() and set() of its wire value, so it can also be sent
+// as a delta. deltaBits > 0 lets a changed value go as a signed difference of
+// that many bits when it is close enough to the old one.
+//
+// Fields are written through any writer with the BitWriter interface, the
+// range coder's too. Before each value the writer is told its context, one of
+// contextsPerField per field: whether it changed, whether the delta is small,
+// the delta, the full value. An entropy coder learns each of them apart.
+constexpr uint32_t contextsPerField = 4;
+
+// Unsigned integer member stored in its low `bits` bits
+template<typename Msg, typename T>
+struct BitsField
+{
+  static constexpr bool fixedSize = true;
+  T Msg::*member;
+  uint32_t bits;
+  uint32_t deltaBits;
+
+  constexpr uint32_t get_bits() const { return bits; }
+  constexpr bool is_valid() const { return bits > 0 && bits <= 32 && bits <= sizeof(T) * 8 && deltaBits < bits; }
+
+  uint32_t get(const Msg &msg) const { return uint32_t(msg.*member); }
+  void set(Msg &msg, uint32_t value) const { msg.*member = T(value); }
+  template<typename Writer>
+  void write(Writer &writer, const Msg &msg) const { writer.write(get(msg), bits); }
+  template<typename Reader>
+  void read(Reader &reader, Msg &msg) const { set(msg, reader.read(bits)); }
+};
+
+// float member clamped to [lo, hi] and rounded to the nearest of 2^bits evenly
+// spaced values, both ends included, so the error is at most half a step.
+template<typename Msg>
+struct RangeField
+{
+  static constexpr bool fixedSize = true;
+  float Msg::*member;
+  float lo;
+  float hi;
+  uint32_t bits;
+  uint32_t deltaBits;
+
+  constexpr uint32_t get_bits() const { return bits; }
+  // 24 bits is all a float can count exactly
+  constexpr bool is_valid() const { return bits > 0 && bits <= 24 && lo < hi && deltaBits < bits; }
+  constexpr float get_step() const { return (hi - lo) / float((1u << bits) - 1); }
+
+  uint32_t quantize(float v) const
+  {
+    // written so that NaN ends up at lo
+    const float t = !(v > lo) ? 0.f : !(v < hi) ? 1.f : (v - lo) / (hi - lo);
+    return uint32_t(t * float((1u << bits) - 1) + 0.5f);
+  }
+  float dequantize(uint32_t q) const { return lo + float(q) * get_step(); }
+
+  uint32_t get(const Msg &msg) const { return quantize(msg.*member); }
+  void set(Msg &msg, uint32_t value) const { msg.*member = dequantize(value); }
+  template<typename Writer>
+  void write(Writer &writer, const Msg &msg) const { writer.write(get(msg), bits); }
+  template<typename Reader>
+  void read(Reader &reader, Msg &msg) const { set(msg, reader.read(bits)); }
+};
+
+// float member sent as its 32 bits, exactly as it is
+template<typename Msg>
+struct FloatField
+{
+  static constexpr bool fixedSize = true;
+  static constexpr uint32_t bits = 32;
+  static constexpr uint32_t deltaBits = 0;
+  float Msg::*member;
+
+  constexpr uint32_t get_bits() const { return bits; }
+  constexpr bool is_valid() const { return true; }
+
+  uint32_t get(const Msg &msg) const { return std::bit_cast<uint32_t>(msg.*member); }
+  void set(Msg &msg, uint32_t value) const { msg.*member = std::bit_cast<float>(value); }
+  template<typename Writer>
+  void write(Writer &writer, const Msg &msg) const { writer.write(get(msg), bits); }
+  template<typename Reader>
+  void read(Reader &reader, Msg &msg) const { set(msg, reader.read(bits)); }
+};
+
+// Fixed size byte array member, a key say. Whole messages only, it has no
+// single value to send as a delta.
+template<typename Msg, size_t N>
+struct BytesField
+{
+  static constexpr bool fixedSize = true;
+  uint8_t (Msg::*member)[N];
+
+  constexpr uint32_t get_bits() const { return uint32_t(N * 8); }
+  constexpr bool is_valid() const { return N > 0; }
+
+  template<typename Writer>
+  void write(Writer &writer, const Msg &msg) const
+  {
+    for (uint8_t byte : msg.*member)
+      writer.write(byte, 8);
+  }
+  template<typename Reader>
+  void read(Reader &reader, Msg &msg) const
+  {
+    for (uint8_t &byte : msg.*member)
+      byte = uint8_t(reader.read(8));
+  }
+};
+
+// Up to N unsigned integers of `bits` bits each, preceded by their count.
+// Only the first count items of the member go on the wire, a count over N
+// (sent or received) is cut to N. Whole messages only, like BytesField.
+template<typename Msg, typename T, size_t N, typename CountT>
+struct ArrayField
+{
+  static constexpr bool fixedSize = false;
+  static constexpr uint32_t countBits = uint32_t(std::bit_width(N));
+  T (Msg::*items)[N];
+  CountT Msg::*count;
+  uint32_t bits;
+
+  // the most it takes, with all N items
+  constexpr uint32_t get_bits() const { return countBits + uint32_t(N) * bits; }
+  constexpr bool is_valid() const { return N > 0 && bits > 0 && bits <= 32 && bits <= sizeof(T) * 8; }
+
+  template<typename Writer>
+  void write(Writer &writer, const Msg &msg) const
+  {
+    const uint32_t n = msg.*count < N ? uint32_t(msg.*count) : uint32_t(N);
+    writer.write(n, countBits);
+    for (uint32_t i = 0; i < n; ++i)
+      writer.write(uint32_t((msg.*items)[i]), bits);
+  }
+  template<typename Reader>
+  void read(Reader &reader, Msg &msg) const
+  {
+    const uint32_t received = reader.read(countBits);
+    const uint32_t n = received < N ? received : uint32_t(N);
+    for (uint32_t i = 0; i < n; ++i)
+      (msg.*items)[i] = T(reader.read(bits));
+    msg.*count = CountT(n);
+  }
+};
+
+template<typename Msg, typename T>
+constexpr BitsField<Msg, T> bits_field(T Msg::*member, uint32_t bits, uint32_t deltaBits = 0)
+{
+  return { member, bits, deltaBits };
+}
+
+template<typename Msg>
+constexpr RangeField<Msg> range_field(float Msg::*member, float lo, float hi, uint32_t bits, uint32_t deltaBits = 0)
+{
+  return { member, lo, hi, bits, deltaBits };
+}
+
+template<typename Msg>
+constexpr FloatField<Msg> float_field(float Msg::*member)
+{
+  return { member };
+}
+
+template<typename Msg, size_t N>
+constexpr BytesField<Msg, N> bytes_field(uint8_t (Msg::*member)[N])
+{
+  return { member };
+}
+
+template<typename Msg, typename T, size_t N, typename CountT>
+constexpr ArrayField<Msg, T, N, CountT> array_field(T (Msg::*items)[N], CountT Msg::*count, uint32_t bits)
+{
+  return { items, count, bits };
+}
+
+// A changed bit, then for a changed value a small-delta bit (if the field has
+// deltaBits) and either the two's complement difference or the full value.
+// context is the first of the field's contextsPerField contexts.
+template<typename Writer, typename Field, typename Msg>
+void write_field_delta(Writer &writer, const Field &field, const Msg &baseline, const Msg &msg, uint32_t context = 0)
+{
+  const uint32_t from = field.get(baseline);
+  const uint32_t to = field.get(msg);
+  writer.set_context(context);
+  writer.write(to != from, 1);
+  if (to == from)
+    return;
+  if (field.deltaBits > 0)
+  {
+    const int64_t delta = int64_t(to) - int64_t(from);
+    const int64_t half = int64_t(1) << (field.deltaBits - 1);
+    const bool small = delta >= -half && delta < half;
+    writer.set_context(context + 1);
+    writer.write(small, 1);
+    if (small)
+    {
+      writer.set_context(context + 2);
+      writer.write(uint32_t(delta), field.deltaBits);
+      return;
+    }
+  }
+  writer.set_context(context + 3);
+  writer.write(to, field.bits);
+}
+
+// Bits write_field_delta writes
+template<typename Field, typename Msg>
+uint32_t get_field_delta_bits(const Field &field, const Msg &baseline, const Msg &msg)
+{
+  const uint32_t from = field.get(baseline);
+  const uint32_t to = field.get(msg);
+  if (to == from)
+    return 1;
+  if (field.deltaBits > 0)
+  {
+    const int64_t delta = int64_t(to) - int64_t(from);
+    const int64_t half = int64_t(1) << (field.deltaBits - 1);
+    return delta >= -half && delta < half ? 2 + field.deltaBits : 2 + field.bits;
+  }
+  return 1 + field.bits;
+}
+
+template<typename Reader, typename Field, typename Msg>
+void read_field_delta(Reader &reader, const Field &field, const Msg &baseline, Msg &msg, uint32_t context = 0)
+{
+  const uint32_t from = field.get(baseline);
+  uint32_t to = from;
+  reader.set_context(context);
+  if (reader.read(1))
+  {
+    bool small = false;
+    if (field.deltaBits > 0)
+    {
+      reader.set_context(context + 1);
+      small = reader.read(1) != 0;
+    }
+    if (small)
+    {
+      // sign extend, then wrap into the field so garbage can't go out of range
+      // (masked only for fields without deltas, which never get here)
+      const uint32_t shift = (32 - field.deltaBits) & 31;
+      reader.set_context(context + 2);
+      const int32_t delta = int32_t(reader.read(field.deltaBits) << shift) >> shift;
+      to = uint32_t(from + delta);
+    }
+    else
+    {
+      reader.set_context(context + 3);
+      to = reader.read(field.bits);
+    }
+  }
+  field.set(msg, field.bits < 32 ? to & ((1u << field.bits) - 1) : to);
+}
+
+// A message is its 8 bit type followed by the fields, with no padding in
+// between, padded with zero bits to whole bytes at the end.
+template<typename Msg, typename... Fields>
+class MessageSchema
+{
+public:
+  using Message = Msg;
+
+  constexpr MessageSchema(uint8_t type, Fields... fields) : type(type), fields(fields...) {}
+
+  constexpr uint8_t get_type() const { return type; }
+  constexpr uint32_t get_field_bits() const
+  {
+    return std::apply([](const auto &...f) { return (0u + ... + f.get_bits()); }, fields);
+  }
+  constexpr uint32_t get_bits() const { return 8 + get_field_bits(); }
+  // exact packet size, the largest one for a message with an ArrayField
+  constexpr size_t get_size() const { return (get_bits() + 7) / 8; }
+  constexpr bool is_valid() const
+  {
+    return std::apply([](const auto &...f) { return (true && ... && f.is_valid()); }, fields);
+  }
+  // Upper bound of write_delta_fields
+  constexpr uint32_t get_max_delta_bits() const
+  {
+    return std::apply([](const auto &...f) { return (0u + ... + (2 + f.get_bits())); }, fields);
+  }
+  // Contexts the fields set on the writer, 0 .. get_context_count() - 1
+  static constexpr uint32_t get_context_count() { return uint32_t(sizeof...(Fields)) * contextsPerField; }
+
+  // data must hold get_size() bytes. Returns the bytes written, get_size()
+  // unless an ArrayField isn't full.
+  size_t write(uint8_t *data, size_t size, const Msg &msg) const
+  {
+    BitWriter writer(data, size);
+    writer.write(type, 8);
+    write_fields(writer, msg);
+    // padding bits of the last byte are zeroed too, nothing uninitialized goes out
+    writer.write(0, uint32_t(writer.get_byte_count() * 8 - writer.get_bit_pos()));
+    return writer.get_byte_count();
+  }
+
+  // Returns false, leaving msg untouched, if data is too short or of another type
+  bool read(const uint8_t *data, size_t size, Msg &msg) const
+  {
+    if (size == 0 || data[0] != type)
+      return false;
+    // room for every field whatever an ArrayField's count says, the usual case
+    if (size >= get_size())
+    {
+      FittedBitReader reader(data);
+      reader.skip(8);
+      read_fields(reader, msg);
+      return true;
+    }
+    if constexpr ((Fields::fixedSize && ...))
+      return false;
+    BitReader reader(data, size);
+    reader.skip(8);
+    Msg decoded = msg;
+    read_fields(reader, decoded);
+    if (reader.is_overflowed())
+      return false;
+    msg = decoded;
+    return true;
+  }
+
+  // Fields only, to pack several messages into one packet. A full value has
+  // the same context as in a delta.
+  template<typename Writer>
+  void write_fields(Writer &writer, const Msg &msg) const
+  {
+    for_each_field([&](const auto &f, uint32_t context)
+    {
+      writer.set_context(context + 3);
+      f.write(writer, msg);
+    });
+  }
+
+  template<typename Reader>
+  void read_fields(Reader &reader, Msg &msg) const
+  {
+    for_each_field([&](const auto &f, uint32_t context)
+    {
+      reader.set_context(context + 3);
+      f.read(reader, msg);
+    });
+  }
+
+  // Rounds every field to what the other end decodes, so a copy kept by the
+  // sender is bit for bit the copy kept by the receiver.
+  void quantize(Msg &msg) const
+  {
+    std::apply([&](const auto &...f) { (f.set(msg, f.get(msg)), ...); }, fields);
+  }
+
+  // True if msg would go on the wire differently than baseline
+  bool differs(const Msg &baseline, const Msg &msg) const
+  {
+    return std::apply([&](const auto &...f) { return (false || ... || (f.get(baseline) != f.get(msg))); }, fields);
+  }
+
+  // Only the fields that changed since baseline, see write_field_delta
+  template<typename Writer>
+  void write_delta_fields(Writer &writer, const Msg &baseline, const Msg &msg) const
+  {
+    for_each_field([&](const auto &f, uint32_t context) { write_field_delta(writer, f, baseline, msg, context); });
+  }
+
+  // Bits write_delta_fields writes, to budget before writing
+  uint32_t get_delta_bits(const Msg &baseline, const Msg &msg) const
+  {
+    uint32_t bits = 0;
+    for_each_field([&](const auto &f, uint32_t) { bits += get_field_delta_bits(f, baseline, msg); });
+    return bits;
+  }
+
+  // msg may be the same object as baseline
+  template<typename Reader>
+  void read_delta_fields(Reader &reader, const Msg &baseline, Msg &msg) const
+  {
+    const Msg from = baseline;
+    for_each_field([&](const auto &f, uint32_t context) { read_field_delta(reader, f, from, msg, context); });
+  }
+
+private:
+  // fn(field, first context of the field) for every field in order
+  template<typename Fn>
+  void for_each_field(Fn &&fn) const
+  {
+    for_each_field(fn, std::index_sequence_for<Fields...>());
+  }
+
+  template<typename Fn, size_t... I>
+  void for_each_field(Fn &fn, std::index_sequence<I...>) const
+  {
+    (fn(std::get<I>(fields), uint32_t(I) * contextsPerField), ...);
+  }
+
+  uint8_t type;
+  std::tuple<Fields...> fields;
+};
+
+template<typename Msg, typename... Fields>
+constexpr MessageSchema<Msg, Fields...> make_message_schema(uint8_t type, Fields... fields)
+{
+  return MessageSchema<Msg, Fields...>(type, fields...);
+}
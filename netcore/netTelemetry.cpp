@@ -0,0 +1,186 @@
+#include "netTelemetry.h"
+#include <cstdarg>
+#include <cstdio>
+
+static const char *directionNames[E_TELEMETRY_DIRECTION_COUNT] = { "sent", "received" };
+
+NetTelemetry::NetTelemetry(size_t historySize)
+  : counters(size_t(E_TELEMETRY_DIRECTION_COUNT) * maxChannels * typeCount),
+    history(historySize > 0 ? historySize : 1)
+{
+}
+
+uint64_t NetTelemetry::get_messages(TelemetryDirection direction, uint8_t channel, uint8_t type) const
+{
+  return get_counters(direction, channel, type).messages.load(std::memory_order_relaxed);
+}
+
+uint64_t NetTelemetry::get_bytes(TelemetryDirection direction, uint8_t channel, uint8_t type) const
+{
+  return get_counters(direction, channel, type).bytes.load(std::memory_order_relaxed);
+}
+
+uint64_t NetTelemetry::get_drops(TelemetryDirection direction, uint8_t channel, uint8_t type) const
+{
+  return get_counters(direction, channel, type).drops.load(std::memory_order_relaxed);
+}
+
+void NetTelemetry::sample(const ENetHost *host, uint32_t timeMs)
+{
+  TelemetrySample &s = history[(historyStart + historyCount) % history.size()];
+  if (historyCount < history.size())
+    ++historyCount;
+  else
+    historyStart = (historyStart + 1) % history.size();
+
+  s.timeMs = timeMs;
+  s.intervalMs = sampled ? timeMs - lastSampleMs : 0;
+  lastSampleMs = timeMs;
+  sampled = true;
+  for (uint32_t d = 0; d < E_TELEMETRY_DIRECTION_COUNT; ++d)
+  {
+    uint64_t messages = 0, bytes = 0, drops = 0;
+    for (size_t i = size_t(d) * maxChannels * typeCount; i < size_t(d + 1) * maxChannels * typeCount; ++i)
+    {
+      messages += counters[i].messages.load(std::memory_order_relaxed);
+      bytes += counters[i].bytes.load(std::memory_order_relaxed);
+      drops += counters[i].drops.load(std::memory_order_relaxed);
+    }
+    s.messages[d] = uint32_t(messages - sampledMessages[d]);
+    s.bytes[d] = uint32_t(bytes - sampledBytes[d]);
+    s.drops[d] = uint32_t(drops - sampledDrops[d]);
+    sampledMessages[d] = messages;
+    sampledBytes[d] = bytes;
+    sampledDrops[d] = drops;
+  }
+  const uint64_t tickCount = ticks.load(std::memory_order_relaxed);
+  s.ticks = uint32_t(tickCount - sampledTicks);
+  sampledTicks = tickCount;
+
+  s.peers.clear();
+  for (size_t i = 0; host && i < host->peerCount; ++i)
+  {
+    const ENetPeer &peer = host->peers[i];
+    if (peer.state != ENET_PEER_STATE_CONNECTED)
+      continue;
+    PeerTelemetry p;
+    p.peer = uint32_t(i);
+    p.host = peer.address.host;
+    p.port = peer.address.port;
+    p.rttMs = peer.roundTripTime;
+    p.rttVarianceMs = peer.roundTripTimeVariance;
+    p.lossPercent = float(peer.packetLoss) * 100.f / float(ENET_PEER_PACKET_LOSS_SCALE);
+    p.throttle = float(peer.packetThrottle) / float(ENET_PEER_PACKET_THROTTLE_SCALE);
+    s.peers.push_back(p);
+  }
+}
+
+const TelemetrySample &NetTelemetry::get_history(size_t i) const
+{
+  return history[(historyStart + i) % history.size()];
+}
+
+static void append(std::string &out, const char *format, ...)
+{
+  char line[256];
+  va_list args;
+  va_start(args, format);
+  const int n = vsnprintf(line, sizeof(line), format, args);
+  va_end(args);
+  if (n > 0)
+    out.append(line, size_t(n) < sizeof(line) ? size_t(n) : sizeof(line) - 1);
+}
+
+void NetTelemetry::write_text(std::string &out) const
+{
+  for (uint32_t d = 0; d < E_TELEMETRY_DIRECTION_COUNT; ++d)
+    for (uint32_t ch = 0; ch < maxChannels; ++ch)
+      for (uint32_t type = 0; type < typeCount; ++type)
+      {
+        const Counters &c = get_counters(TelemetryDirection(d), uint8_t(ch), uint8_t(type));
+        const uint64_t messages = c.messages.load(std::memory_order_relaxed);
+        const uint64_t drops = c.drops.load(std::memory_order_relaxed);
+        if (messages == 0 && drops == 0)
+          continue;
+        char labels[64];
+        snprintf(labels, sizeof(labels), "direction=\"%s\",channel=\"%u\",type=\"%u\"", directionNames[d], ch, type);
+        append(out, "net_messages_total{%s} %llu\n", labels, (unsigned long long)messages);
+        append(out, "net_bytes_total{%s} %llu\n", labels, (unsigned long long)c.bytes.load(std::memory_order_relaxed));
+        append(out, "net_drops_total{%s} %llu\n", labels, (unsigned long long)drops);
+      }
+  append(out, "net_ticks_total %llu\n", (unsigned long long)ticks.load(std::memory_order_relaxed));
+  for (uint32_t d = 0; d < E_TELEMETRY_DIRECTION_COUNT; ++d)
+  {
+    append(out, "net_queue_waits_total{direction=\"%s\"} %llu\n", directionNames[d],
+           (unsigned long long)queueWaits[d].load(std::memory_order_relaxed));
+    append(out, "net_queue_drops_total{direction=\"%s\"} %llu\n", directionNames[d],
+           (unsigned long long)queueDrops[d].load(std::memory_order_relaxed));
+  }
+  if (historyCount == 0)
+    return;
+  const TelemetrySample &last = get_history(historyCount - 1);
+  for (const PeerTelemetry &p : last.peers)
+  {
+    append(out, "net_peer_rtt_ms{peer=\"%u\"} %u\n", p.peer, p.rttMs);
+    append(out, "net_peer_rtt_variance_ms{peer=\"%u\"} %u\n", p.peer, p.rttVarianceMs);
+    append(out, "net_peer_loss_percent{peer=\"%u\"} %.2f\n", p.peer, p.lossPercent);
+    append(out, "net_peer_throttle{peer=\"%u\"} %.3f\n", p.peer, p.throttle);
+  }
+}
+
+void NetTelemetry::write_json(std::string &out) const
+{
+  out += "{\n  \"counters\": [";
+  const char *separator = "\n";
+  for (uint32_t d = 0; d < E_TELEMETRY_DIRECTION_COUNT; ++d)
+    for (uint32_t ch = 0; ch < maxChannels; ++ch)
+      for (uint32_t type = 0; type < typeCount; ++type)
+      {
+        const Counters &c = get_counters(TelemetryDirection(d), uint8_t(ch), uint8_t(type));
+        const uint64_t messages = c.messages.load(std::memory_order_relaxed);
+        const uint64_t drops = c.drops.load(std::memory_order_relaxed);
+        if (messages == 0 && drops == 0)
+          continue;
+        append(out, "%s    { \"direction\": \"%s\", \"channel\": %u, \"type\": %u, \"messages\": %llu, "
+               "\"bytes\": %llu, \"drops\": %llu }", separator, directionNames[d], ch, type,
+               (unsigned long long)messages, (unsigned long long)c.bytes.load(std::memory_order_relaxed),
+               (unsigned long long)drops);
+        separator = ",\n";
+      }
+  append(out, "\n  ],\n  \"ticks\": %llu,\n  \"queues\": {", (unsigned long long)ticks.load(std::memory_order_relaxed));
+  for (uint32_t d = 0; d < E_TELEMETRY_DIRECTION_COUNT; ++d)
+    append(out, "%s \"%s\": { \"waits\": %llu, \"drops\": %llu }", d > 0 ? "," : "", directionNames[d],
+           (unsigned long long)queueWaits[d].load(std::memory_order_relaxed),
+           (unsigned long long)queueDrops[d].load(std::memory_order_relaxed));
+  out += " },\n  \"peers\": [";
+  separator = "\n";
+  if (historyCount > 0)
+    for (const PeerTelemetry &p : get_history(historyCount - 1).peers)
+    {
+      append(out, "%s    { \"peer\": %u, \"address\": \"%u.%u.%u.%u:%u\", \"rtt_ms\": %u, \"rtt_variance_ms\": %u, "
+             "\"loss_percent\": %.2f, \"throttle\": %.3f }", separator, p.peer,
+             p.host & 0xff, (p.host >> 8) & 0xff, (p.host >> 16) & 0xff, p.host >> 24, p.port,
+             p.rttMs, p.rttVarianceMs, p.lossPercent, p.throttle);
+      separator = ",\n";
+    }
+  out += "\n  ],\n  \"history\": [";
+  separator = "\n";
+  for (size_t i = 0; i < historyCount; ++i)
+  {
+    const TelemetrySample &s = get_history(i);
+    append(out, "%s    { \"time_ms\": %u, \"interval_ms\": %u, \"ticks\": %u, ", separator, s.timeMs, s.intervalMs,
+           s.ticks);
+    append(out, "\"sent\": { \"messages\": %u, \"bytes\": %u, \"drops\": %u }, ",
+           s.messages[E_TELEMETRY_SENT], s.bytes[E_TELEMETRY_SENT], s.drops[E_TELEMETRY_SENT]);
+    append(out, "\"received\": { \"messages\": %u, \"bytes\": %u, \"drops\": %u } }",
+           s.messages[E_TELEMETRY_RECEIVED], s.bytes[E_TELEMETRY_RECEIVED], s.drops[E_TELEMETRY_RECEIVED]);
+    separator = ",\n";
+  }
+  out += "\n  ]\n}\n";
+}
+
+NetTelemetry &get_net_telemetry()
+{
+  static NetTelemetry telemetry;
+  return telemetry;
+}
@@ -0,0 +1,141 @@
+#pragma once
+#include <enet/enet.h>
+#include <atomic>
+#include <cstdint>
+#include <cstddef>
+#include <string>
+#include <vector>
+
+// What goes over the network: messages, bytes and drops for every message
+// type, direction and channel, counted as packets are sent and received, and
+// sampled now and then together with what ENet measures of every peer.
+//
+// Counting is a relaxed atomic load and store, no locked instruction, so a
+// count is a few ns. That leaves one thread counting each direction (the one
+// sending, the one receiving); any thread may read. sample() reads the peers,
+// so it belongs to the thread running the host.
+//
+//   get_net_telemetry().count(E_TELEMETRY_SENT, channel, packet->data[0], packet->dataLength);
+//   get_net_telemetry().sample(host, enet_time_get()); // about once a second
+enum TelemetryDirection : uint8_t
+{
+  E_TELEMETRY_SENT = 0,
+  E_TELEMETRY_RECEIVED,
+  E_TELEMETRY_DIRECTION_COUNT
+};
+
+// One peer as ENet sees it
+struct PeerTelemetry
+{
+  uint32_t peer = 0;        // index into the host's peers
+  uint32_t host = 0;        // address, network byte order
+  uint16_t port = 0;
+  uint32_t rttMs = 0;
+  uint32_t rttVarianceMs = 0;
+  float lossPercent = 0.f;
+  float throttle = 1.f;     // share of unreliable packets ENet lets through
+};
+
+// Counts between two samples
+struct TelemetrySample
+{
+  uint32_t timeMs = 0;
+  uint32_t intervalMs = 0;
+  uint32_t ticks = 0;
+  uint32_t messages[E_TELEMETRY_DIRECTION_COUNT] = {};
+  uint32_t bytes[E_TELEMETRY_DIRECTION_COUNT] = {};
+  uint32_t drops[E_TELEMETRY_DIRECTION_COUNT] = {};
+  std::vector<PeerTelemetry> peers;
+};
+
+class NetTelemetry
+{
+public:
+  // channels past the last count as the last
+  static constexpr uint32_t maxChannels = 4;
+  static constexpr uint32_t typeCount = 256;
+
+  explicit NetTelemetry(size_t historySize = 60);
+
+  void count(TelemetryDirection direction, uint8_t channel, uint8_t type, size_t bytes)
+  {
+    Counters &c = get_counters(direction, channel, type);
+    add(c.messages, 1);
+    add(c.bytes, bytes);
+  }
+  void count_drop(TelemetryDirection direction, uint8_t channel, uint8_t type)
+  {
+    add(get_counters(direction, channel, type).drops, 1);
+  }
+  // once per simulation tick, for messages per tick
+  void count_tick() { add(ticks, 1); }
+  // A message that found the bounded queue between the thread running the
+  // host and the simulating one full: waited for room, or dropped. Counted by
+  // the thread pushing, the simulation's for sent, the host's for received.
+  void count_queue_full(TelemetryDirection direction, bool dropped)
+  {
+    add(dropped ? queueDrops[direction] : queueWaits[direction], 1);
+  }
+
+  uint64_t get_messages(TelemetryDirection direction, uint8_t channel, uint8_t type) const;
+  uint64_t get_bytes(TelemetryDirection direction, uint8_t channel, uint8_t type) const;
+  uint64_t get_drops(TelemetryDirection direction, uint8_t channel, uint8_t type) const;
+  uint64_t get_queue_waits(TelemetryDirection direction) const { return queueWaits[direction].load(std::memory_order_relaxed); }
+  uint64_t get_queue_drops(TelemetryDirection direction) const { return queueDrops[direction].load(std::memory_order_relaxed); }
+
+  // Adds the counts since the last sample and the connected peers of host
+  // (may be null) to the history, the oldest sample goes once it is full.
+  void sample(const ENetHost *host, uint32_t timeMs);
+  // oldest first
+  size_t get_history_size() const { return historyCount; }
+  const TelemetrySample &get_history(size_t i) const;
+
+  // Totals per type, direction and channel, the peers and the history, as
+  // Prometheus style text or as JSON
+  void write_text(std::string &out) const;
+  void write_json(std::string &out) const;
+
+private:
+  struct Counters
+  {
+    std::atomic<uint64_t> messages{ 0 };
+    std::atomic<uint64_t> bytes{ 0 };
+    std::atomic<uint64_t> drops{ 0 };
+  };
+
+  // only its one writer changes a counter, so no read-modify-write is needed
+  static void add(std::atomic<uint64_t> &counter, uint64_t n)
+  {
+    counter.store(counter.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+  }
+
+  Counters &get_counters(TelemetryDirection direction, uint8_t channel, uint8_t type)
+  {
+    const uint32_t ch = channel < maxChannels ? channel : maxChannels - 1;
+    return counters[(size_t(direction) * maxChannels + ch) * typeCount + type];
+  }
+  const Counters &get_counters(TelemetryDirection direction, uint8_t channel, uint8_t type) const
+  {
+    return const_cast<NetTelemetry*>(this)->get_counters(direction, channel, type);
+  }
+
+  std::vector<Counters> counters;
+  std::atomic<uint64_t> ticks{ 0 };
+  std::atomic<uint64_t> queueWaits[E_TELEMETRY_DIRECTION_COUNT] = {};
+  std::atomic<uint64_t> queueDrops[E_TELEMETRY_DIRECTION_COUNT] = {};
+
+  // totals at the last sample, the history stores the differences
+  uint64_t sampledMessages[E_TELEMETRY_DIRECTION_COUNT] = {};
+  uint64_t sampledBytes[E_TELEMETRY_DIRECTION_COUNT] = {};
+  uint64_t sampledDrops[E_TELEMETRY_DIRECTION_COUNT] = {};
+  uint64_t sampledTicks = 0;
+  uint32_t lastSampleMs = 0;
+  bool sampled = false;
+
+  std::vector<TelemetrySample> history;
+  size_t historyStart = 0;
+  size_t historyCount = 0;
+};
+
+// The process wide counters the protocols count into
+NetTelemetry &get_net_telemetry();
@@ -0,0 +1,129 @@
+#include "profiler.h"
+#include <chrono>
+#include <cstdio>
+#include <mutex>
+#include <vector>
+
+struct ClockOrigin
+{
+  uint64_t ticks;
+  std::chrono::steady_clock::time_point time;
+};
+
+static const ClockOrigin &get_clock_origin()
+{
+  static const ClockOrigin origin = { profile_clock(), std::chrono::steady_clock::now() };
+  return origin;
+}
+
+// Rings are never freed, a thread that has exited still shows in traces
+static std::mutex ringsMutex;
+static std::vector<ProfileRing*> rings;
+
+double profile_clock_to_us(uint64_t ticks)
+{
+#ifdef PROFILE_HAS_TSC
+  // the TSC rate is whatever it did since the origin, good to well under a
+  // percent once the process has run for a second
+  const ClockOrigin &origin = get_clock_origin();
+  const uint64_t elapsedTicks = profile_clock() - origin.ticks;
+  const double elapsedUs =
+    std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - origin.time).count();
+  return elapsedTicks > 0 ? double(ticks) * elapsedUs / double(elapsedTicks) : 0.0;
+#else
+  return double(ticks) * 1e6 * std::chrono::steady_clock::period::num / std::chrono::steady_clock::period::den;
+#endif
+}
+
+ProfileRing *register_profile_ring()
+{
+  get_clock_origin();
+  ProfileRing *ring = new ProfileRing;
+  std::lock_guard<std::mutex> lock(ringsMutex);
+  ring->threadId = uint32_t(rings.size() + 1);
+  snprintf(ring->threadName, sizeof(ring->threadName), "thread %u", ring->threadId);
+  rings.push_back(ring);
+  return ring;
+}
+
+void set_profile_thread_name(const char *name)
+{
+  ProfileRing &ring = get_profile_ring();
+  std::lock_guard<std::mutex> lock(ringsMutex);
+  snprintf(ring.threadName, sizeof(ring.threadName), "%s", name);
+}
+
+void write_chrome_trace(std::string &out, uint32_t lastMs)
+{
+  const ClockOrigin &origin = get_clock_origin();
+  const uint64_t now = profile_clock();
+  // microseconds per clock tick, measured once for the whole trace
+  const double usPerTick = now != origin.ticks ? profile_clock_to_us(now - origin.ticks) / double(now - origin.ticks) : 0.0;
+  const double cutoffUs = lastMs > 0 ? double(int64_t(now - origin.ticks)) * usPerTick - lastMs * 1000.0 : -1e300;
+
+  std::vector<ProfileEvent> events;
+  char line[256];
+  const char *separator = "\n";
+  out += "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+  std::lock_guard<std::mutex> lock(ringsMutex);
+  for (ProfileRing *ring : rings)
+  {
+    snprintf(line, sizeof(line), "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%u,\"args\":{\"name\":\"%s\"}}",
+             separator, ring->threadId, ring->threadName);
+    out += line;
+    separator = ",\n";
+
+    // The owner keeps pushing while its ring is copied, whatever it may have
+    // overwritten meanwhile is left out
+    const uint64_t written = ring->written.load(std::memory_order_acquire);
+    const uint64_t first = written > ProfileRing::capacity ? written - ProfileRing::capacity : 0;
+    events.clear();
+    for (uint64_t i = first; i < written; ++i)
+    {
+      ProfileEvent e;
+      if (ring->read(i, e))
+        events.push_back(e);
+    }
+    for (const ProfileEvent &e : events)
+    {
+      const double beginUs = double(int64_t(e.begin - origin.ticks)) * usPerTick;
+      const double durUs = double(e.end - e.begin) * usPerTick;
+      if (beginUs + durUs < cutoffUs)
+        continue;
+      snprintf(line, sizeof(line), ",\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%u,\"ts\":%.3f,\"dur\":%.3f}",
+               e.name, ring->threadId, beginUs, durUs);
+      out += line;
+    }
+  }
+  out += "\n]}\n";
+}
+
+bool save_chrome_trace(const char *path, uint32_t lastMs)
+{
+  std::string trace;
+  write_chrome_trace(trace, lastMs);
+  FILE *f = fopen(path, "wb");
+  if (!f)
+    return false;
+  const bool written = fwrite(trace.data(), 1, trace.size(), f) == trace.size();
+  return fclose(f) == 0 && written;
+}
+
+bool SlowTickTrace::end(uint32_t nowMs)
+{
+#ifdef NETWORKED_PROFILER
+  const uint64_t now = profile_clock();
+  get_profile_ring().push("tick", tickStart, now);
+  if (!path || thresholdMs <= 0.f)
+    return false;
+  tickMs = float(profile_clock_to_us(now - tickStart) * 0.001);
+  if (tickMs <= thresholdMs || (saved && nowMs - lastSavedMs < minIntervalMs))
+    return false;
+  saved = true;
+  lastSavedMs = nowMs;
+  return save_chrome_trace(path, traceMs);
+#else
+  (void)nowMs;
+  return false;
+#endif
+}
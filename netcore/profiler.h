@@ -0,0 +1,164 @@
+#pragma once
+#include <atomic>
+#include <cstdint>
+#include <cstddef>
+#include <string>
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+#include <intrin.h>
+#define PROFILE_HAS_TSC 1
+#elif defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define PROFILE_HAS_TSC 1
+#else
+#include <chrono>
+#endif
+
+// Scoped zones that show which phase of a tick made it slow.
+//
+//   PROFILE_ZONE("simulate"); // from here to the end of the scope
+//
+// A zone reads the TSC twice and stores itself into a ring of its thread's
+// last zones: no locks, no allocation after the thread's first zone. The rings
+// are written out as Chrome trace JSON (chrome://tracing, ui.perfetto.dev) on
+// demand, or by SlowTickTrace when a tick takes too long. Without
+// NETWORKED_PROFILER (Release builds, see the top CMakeLists.txt) zones
+// compile to nothing and traces come out empty.
+#ifdef NETWORKED_PROFILER
+#define PROFILE_CONCAT_(a, b) a##b
+#define PROFILE_CONCAT(a, b) PROFILE_CONCAT_(a, b)
+#define PROFILE_ZONE(name) ProfileZone PROFILE_CONCAT(profileZone, __LINE__)(name)
+#else
+#define PROFILE_ZONE(name) ((void)0)
+#endif
+
+// TSC where there is one, steady_clock ticks elsewhere
+inline uint64_t profile_clock()
+{
+#ifdef PROFILE_HAS_TSC
+  return __rdtsc();
+#else
+  return uint64_t(std::chrono::steady_clock::now().time_since_epoch().count());
+#endif
+}
+
+// profile_clock() ticks in microseconds, measured against steady_clock since
+// the process started
+double profile_clock_to_us(uint64_t ticks);
+
+struct ProfileEvent
+{
+  const char *name = nullptr; // a string literal, zones keep only the pointer
+  uint64_t begin = 0;
+  uint64_t end = 0;
+};
+
+// One event of a ring, every field an atomic so the ring's thread can
+// overwrite it while another copies it. seq is the index of the push it
+// holds plus one, 0 while a push is writing it.
+struct ProfileSlot
+{
+  std::atomic<uint64_t> seq{ 0 };
+  std::atomic<const char *> name{ nullptr };
+  std::atomic<uint64_t> begin{ 0 };
+  std::atomic<uint64_t> end{ 0 };
+};
+
+// The last zones of one thread. Only that thread writes it, any thread may
+// read it: written counts every zone ever pushed, and each slot's seq tells a
+// reader whether the event it copied was overwritten meanwhile.
+struct ProfileRing
+{
+  static constexpr size_t capacity = 1 << 14;
+
+  void push(const char *name, uint64_t begin, uint64_t end)
+  {
+    const uint64_t n = written.load(std::memory_order_relaxed);
+    ProfileSlot &slot = slots[n & (capacity - 1)];
+    // a reader that copies any of the new fields sees seq no longer n + 1
+    // when it looks again, release and acquire are plain moves on x86
+    slot.seq.store(0, std::memory_order_relaxed);
+    slot.name.store(name, std::memory_order_release);
+    slot.begin.store(begin, std::memory_order_release);
+    slot.end.store(end, std::memory_order_release);
+    slot.seq.store(n + 1, std::memory_order_release);
+    written.store(n + 1, std::memory_order_release);
+  }
+
+  // Copies push number n (counting from 0), false if it isn't in the ring
+  // (any more) or was being overwritten while it was copied
+  bool read(uint64_t n, ProfileEvent &e) const
+  {
+    const ProfileSlot &slot = slots[n & (capacity - 1)];
+    if (slot.seq.load(std::memory_order_acquire) != n + 1)
+      return false;
+    e.name = slot.name.load(std::memory_order_acquire);
+    e.begin = slot.begin.load(std::memory_order_acquire);
+    e.end = slot.end.load(std::memory_order_acquire);
+    return slot.seq.load(std::memory_order_relaxed) == n + 1;
+  }
+
+  ProfileSlot slots[capacity];
+  std::atomic<uint64_t> written{ 0 };
+  uint32_t threadId = 0;
+  char threadName[32] = {};
+};
+
+// The ring of the calling thread, made on its first zone and kept to the end
+// of the process so a trace still shows threads that have exited
+ProfileRing *register_profile_ring();
+inline ProfileRing &get_profile_ring()
+{
+  thread_local ProfileRing *ring = register_profile_ring();
+  return *ring;
+}
+
+// Names the calling thread in traces
+void set_profile_thread_name(const char *name);
+
+class ProfileZone
+{
+public:
+  explicit ProfileZone(const char *name) : name(name), begin(profile_clock()) {}
+  ~ProfileZone() { get_profile_ring().push(name, begin, profile_clock()); }
+  ProfileZone(const ProfileZone &) = delete;
+  ProfileZone &operator=(const ProfileZone &) = delete;
+
+private:
+  const char *name;
+  uint64_t begin;
+};
+
+// Every thread's zones that ended in the last lastMs (0 is all the rings
+// hold) as Chrome trace JSON
+void write_chrome_trace(std::string &out, uint32_t lastMs = 0);
+bool save_chrome_trace(const char *path, uint32_t lastMs = 0);
+
+// Records every tick as a zone named "tick" and saves the trace of the last
+// traceMs to path when one takes longer than thresholdMs. Writing it is a slow
+// tick of its own, so it happens at most once every minIntervalMs. A null path
+// or a threshold of 0 saves none.
+//
+//   slowTicks.begin();
+//   ... the tick ...
+//   slowTicks.end(enet_time_get());
+class SlowTickTrace
+{
+public:
+  SlowTickTrace(const char *path, float thresholdMs, uint32_t traceMs = 1000, uint32_t minIntervalMs = 10000)
+    : path(path), thresholdMs(thresholdMs), traceMs(traceMs), minIntervalMs(minIntervalMs) {}
+
+  void begin() { tickStart = profile_clock(); }
+  // true if the tick was slow and its trace saved
+  bool end(uint32_t nowMs);
+  float get_tick_ms() const { return tickMs; }
+
+private:
+  const char *path;
+  float thresholdMs;
+  uint32_t traceMs;
+  uint32_t minIntervalMs;
+  uint64_t tickStart = 0;
+  float tickMs = 0.f;
+  uint32_t lastSavedMs = 0;
+  bool saved = false;
+};
@@ -0,0 +1,248 @@
+#pragma once
+#include <cstdint>
+#include <cstddef>
+
+// Adaptive binary range coder, the one from LZMA: every bit is coded with the
+// probability its model gives, and the model moves towards what was coded, so
+// a bit that is almost always the same costs a small fraction of a bit.
+//
+// RangeBitWriter and RangeBitReader put it behind the BitWriter / BitReader
+// interface, so the schema and world delta code write through it unchanged.
+// set_context() picks which kind of value comes next (an eid, a field's
+// delta, ...), every kind has its own probabilities.
+
+constexpr uint32_t rangeProbBits = 11;
+constexpr uint16_t rangeProbInit = 1 << (rangeProbBits - 1);
+// adaptation speed, higher is slower and more precise
+constexpr uint32_t rangeMoveBits = 5;
+// No bit codes to more than this many: a model never gets below 31 / 2048
+// for either value, which is log2(2048 / 31) = 6.05 bits
+constexpr uint32_t rangeMaxBitsPerBit = 7;
+
+class RangeEncoder
+{
+public:
+  RangeEncoder(uint8_t *data, size_t size) : data(data), size(size) {}
+
+  void encode(uint16_t &prob, uint32_t bit)
+  {
+    const uint32_t bound = (range >> rangeProbBits) * prob;
+    if (bit == 0)
+    {
+      range = bound;
+      prob = uint16_t(prob + (((1u << rangeProbBits) - prob) >> rangeMoveBits));
+    }
+    else
+    {
+      low += bound;
+      range -= bound;
+      prob = uint16_t(prob - (prob >> rangeMoveBits));
+    }
+    while (range < topValue)
+    {
+      range <<= 8;
+      shift_low();
+    }
+  }
+
+  // Flushes what is still pending, returns the byte count. The decoder reads
+  // zeros past the end, so zero bytes the flush would end with are left out.
+  size_t finish()
+  {
+    const size_t coded = pos;
+    for (int i = 0; i < 5; ++i)
+      shift_low();
+    while (pos > coded && pos <= size && data[pos - 1] == 0)
+      --pos;
+    return pos;
+  }
+
+  bool is_overflowed() const { return pos > size; }
+
+private:
+  static constexpr uint32_t topValue = 1u << 24;
+
+  void shift_low()
+  {
+    if (uint32_t(low) < 0xff000000u || (low >> 32) != 0)
+    {
+      const uint8_t carry = uint8_t(low >> 32);
+      uint8_t byte = cache;
+      do
+      {
+        put(uint8_t(byte + carry));
+        byte = 0xff;
+      } while (--cacheSize != 0);
+      cache = uint8_t(low >> 24);
+    }
+    ++cacheSize;
+    low = (low & 0x00ffffffu) << 8;
+  }
+
+  void put(uint8_t byte)
+  {
+    // the very first byte is always 0, nobody needs to see it
+    if (first)
+    {
+      first = false;
+      return;
+    }
+    if (pos < size)
+      data[pos] = byte;
+    ++pos;
+  }
+
+  uint8_t *data;
+  size_t size;
+  size_t pos = 0;
+  uint64_t low = 0;
+  uint32_t range = 0xffffffffu;
+  uint64_t cacheSize = 1;
+  uint8_t cache = 0;
+  bool first = true;
+};
+
+class RangeDecoder
+{
+public:
+  RangeDecoder(const uint8_t *data, size_t size) : data(data), size(size)
+  {
+    for (int i = 0; i < 4; ++i)
+      code = (code << 8) | get();
+  }
+
+  uint32_t decode(uint16_t &prob)
+  {
+    const uint32_t bound = (range >> rangeProbBits) * prob;
+    uint32_t bit;
+    if (code < bound)
+    {
+      range = bound;
+      prob = uint16_t(prob + (((1u << rangeProbBits) - prob) >> rangeMoveBits));
+      bit = 0;
+    }
+    else
+    {
+      code -= bound;
+      range -= bound;
+      prob = uint16_t(prob - (prob >> rangeMoveBits));
+      bit = 1;
+    }
+    while (range < topValue)
+    {
+      range <<= 8;
+      code = (code << 8) | get();
+    }
+    return bit;
+  }
+
+  // A valid stream only runs past its end by the zeros finish() left out,
+  // reading further means the data was cut short or made up.
+  bool is_overflowed() const { return pos > size + maxZeroTail; }
+
+private:
+  static constexpr uint32_t topValue = 1u << 24;
+  static constexpr size_t maxZeroTail = 5;
+
+  uint8_t get()
+  {
+    const uint8_t byte = pos < size ? data[pos] : 0;
+    ++pos;
+    return byte;
+  }
+
+  const uint8_t *data;
+  size_t size;
+  size_t pos = 0;
+  uint32_t range = 0xffffffffu;
+  uint32_t code = 0;
+};
+
+// Probabilities of values written bit by bit, most significant first, for
+// Contexts kinds of value of up to 32 bits. Each bit position has two: one
+// for while every bit so far equals the first, one for after. That run is
+// what small unsigned values and small two's complement deltas look like,
+// so their leading bits get cheap.
+template<uint32_t Contexts>
+struct BitValueModel
+{
+  uint16_t probs[Contexts][32][2];
+
+  BitValueModel() { reset(); }
+
+  void reset()
+  {
+    for (auto &context : probs)
+      for (auto &position : context)
+        position[0] = position[1] = rangeProbInit;
+  }
+
+  static constexpr uint32_t get_context_count() { return Contexts; }
+};
+
+template<uint32_t Contexts>
+class RangeBitWriter
+{
+public:
+  RangeBitWriter(RangeEncoder &encoder, BitValueModel<Contexts> &model) : encoder(encoder), model(model) {}
+
+  void set_context(uint32_t newContext) { context = newContext < Contexts ? newContext : Contexts - 1; }
+
+  // bits <= 32, higher bits of value are ignored
+  void write(uint32_t value, uint32_t bits)
+  {
+    uint16_t (*probs)[2] = model.probs[context];
+    uint32_t firstBit = 0;
+    uint32_t run = 1;
+    for (uint32_t i = 0; i < bits; ++i)
+    {
+      const uint32_t bit = (value >> (bits - 1 - i)) & 1;
+      encoder.encode(probs[i][run], bit);
+      if (i == 0)
+        firstBit = bit;
+      else
+        run &= uint32_t(bit == firstBit);
+    }
+  }
+
+  bool is_overflowed() const { return encoder.is_overflowed(); }
+
+private:
+  RangeEncoder &encoder;
+  BitValueModel<Contexts> &model;
+  uint32_t context = 0;
+};
+
+template<uint32_t Contexts>
+class RangeBitReader
+{
+public:
+  RangeBitReader(RangeDecoder &decoder, BitValueModel<Contexts> &model) : decoder(decoder), model(model) {}
+
+  void set_context(uint32_t newContext) { context = newContext < Contexts ? newContext : Contexts - 1; }
+
+  uint32_t read(uint32_t bits)
+  {
+    uint16_t (*probs)[2] = model.probs[context];
+    uint32_t value = 0;
+    uint32_t firstBit = 0;
+    uint32_t run = 1;
+    for (uint32_t i = 0; i < bits; ++i)
+    {
+      const uint32_t bit = decoder.decode(probs[i][run]);
+      value = (value << 1) | bit;
+      if (i == 0)
+        firstBit = bit;
+      else
+        run &= uint32_t(bit == firstBit);
+    }
+    return value;
+  }
+
+  bool is_overflowed() const { return decoder.is_overflowed(); }
+
+private:
+  RangeDecoder &decoder;
+  BitValueModel<Contexts> &model;
+  uint32_t context = 0;
+};
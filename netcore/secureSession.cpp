@@ -0,0 +1,99 @@
+#include "secureSession.h"
+#include <cstring>
+#include <random>
+
+static void make_nonce(uint8_t nonce[aeadNonceSize], uint32_t channel, uint32_t counter)
+{
+  memset(nonce, 0, aeadNonceSize);
+  memcpy(nonce, &channel, sizeof(uint32_t));
+  memcpy(nonce + sizeof(uint32_t), &counter, sizeof(uint32_t));
+}
+
+void SecureSession::start(const uint8_t newSecret[x25519KeySize])
+{
+  memcpy(secret, newSecret, x25519KeySize);
+  x25519_public_key(publicKey, secret);
+  for (uint32_t i = 0; i < secureChannels; ++i)
+  {
+    sendCounters[i] = 0;
+    receiveWindows[i].reset();
+  }
+  established = false;
+}
+
+bool SecureSession::establish(const uint8_t otherPublicKey[x25519KeySize], bool isServer, bool sealed)
+{
+  uint8_t shared[x25519KeySize];
+  if (!x25519(shared, secret, otherPublicKey))
+    return false;
+  // the direction, and in the last byte whether packets are sealed
+  uint8_t clientToServer[16] = { 'c', 'l', 'i', 'e', 'n', 't', '-', '>', 's', 'e', 'r', 'v', 'e', 'r', ':', 0 };
+  uint8_t serverToClient[16] = { 's', 'e', 'r', 'v', 'e', 'r', '-', '>', 'c', 'l', 'i', 'e', 'n', 't', ':', 0 };
+  clientToServer[15] = serverToClient[15] = uint8_t(sealed);
+  hchacha20(sendKey, shared, isServer ? serverToClient : clientToServer);
+  hchacha20(receiveKey, shared, isServer ? clientToServer : serverToClient);
+  memset(shared, 0, sizeof(shared));
+  established = true;
+  return true;
+}
+
+size_t SecureSession::seal(uint32_t channel, uint8_t *data, size_t size)
+{
+  if (!enabled || channel >= secureChannels || size == 0)
+    return size;
+  const uint32_t counter = ++sendCounters[channel];
+  uint8_t nonce[aeadNonceSize];
+  make_nonce(nonce, channel, counter);
+
+  uint8_t *payload = data + 1;
+  const size_t payloadSize = size - 1;
+  memmove(payload + sizeof(uint32_t), payload, payloadSize);
+  memcpy(payload, &counter, sizeof(uint32_t));
+  uint8_t *ciphertext = payload + sizeof(uint32_t);
+  aead_seal(sendKey, nonce, data, 1, ciphertext, payloadSize, ciphertext + payloadSize);
+  return size + sealOverhead;
+}
+
+bool SecureSession::open(uint32_t channel, uint8_t *data, size_t &size)
+{
+  if (!enabled)
+    return true;
+  uint32_t counter = 0;
+  if (channel >= secureChannels || size < 1 + sealOverhead)
+  {
+    ++rejected;
+    return false;
+  }
+  memcpy(&counter, data + 1, sizeof(uint32_t));
+  // cheap check first, the tag is only verified for counters we would accept
+  if (!receiveWindows[channel].is_new(counter))
+  {
+    ++rejected;
+    return false;
+  }
+  uint8_t nonce[aeadNonceSize];
+  make_nonce(nonce, channel, counter);
+  uint8_t *ciphertext = data + 1 + sizeof(uint32_t);
+  const size_t payloadSize = size - 1 - sealOverhead;
+  if (!aead_open(receiveKey, nonce, data, 1, ciphertext, payloadSize, ciphertext + payloadSize))
+  {
+    ++rejected;
+    return false;
+  }
+  receiveWindows[channel].accept(counter);
+  memmove(data + 1, ciphertext, payloadSize);
+  size = 1 + payloadSize;
+  return true;
+}
+
+void generate_session_secret(uint8_t secret[x25519KeySize])
+{
+  // the OS generator (getrandom, /dev/urandom, RtlGenRandom) with the
+  // compilers we build with, unlike any seeded engine
+  std::random_device device;
+  for (uint32_t i = 0; i < x25519KeySize; i += sizeof(uint32_t))
+  {
+    const uint32_t value = device();
+    memcpy(secret + i, &value, sizeof(uint32_t));
+  }
+}
@@ -0,0 +1,99 @@
+#pragma once
+#include <cstdint>
+#include <cstddef>
+#include "chacha20poly1305.h"
+#include "x25519.h"
+
+// Last 64 packet counters seen on a channel. A counter is new if it is newer
+// than all of them or inside the window and not seen yet; a replayed packet or
+// one that fell behind the window is rejected. Counters start at 1.
+class ReplayWindow
+{
+public:
+  bool is_new(uint32_t counter) const
+  {
+    if (counter > newest)
+      return true;
+    const uint32_t age = newest - counter;
+    return counter != 0 && age < 64 && ((seen >> age) & 1) == 0;
+  }
+
+  // Only for packets that passed authentication, forged counters must not move the window
+  void accept(uint32_t counter)
+  {
+    if (counter > newest)
+    {
+      const uint32_t shift = counter - newest;
+      seen = shift < 64 ? (seen << shift) | 1 : 1;
+      newest = counter;
+    }
+    else
+      seen |= uint64_t(1) << (newest - counter);
+  }
+
+  void reset()
+  {
+    seen = 0;
+    newest = 0;
+  }
+
+private:
+  uint64_t seen = 0; // bit i is newest - i
+  uint32_t newest = 0;
+};
+
+// A sealed packet is [type][4: counter][ciphertext][16: tag]. The type stays
+// in the clear so packets can be dispatched before opening, it is
+// authenticated along with the rest.
+constexpr size_t sealOverhead = sizeof(uint32_t) + aeadTagSize;
+// Every ENet channel has its own counter and replay window, so reliable
+// packets held back by retransmission are never behind the window of the
+// unreliable ones.
+constexpr uint32_t secureChannels = 3;
+
+// Keys of one connection. Both sides start() with a fresh secret and send
+// each other the public key, establish() with the other side's key then
+// derives one ChaCha20-Poly1305 key per direction with HChaCha20. Whether
+// packets are sealed goes into the derivation too, so sides that were told
+// different things about it end up with different keys.
+//
+// The exchange isn't authenticated: it keeps other players and anyone
+// listening from reading or forging traffic, not a man in the middle.
+class SecureSession
+{
+public:
+  // Drops any previous keys
+  void start(const uint8_t secret[x25519KeySize]);
+  const uint8_t *get_public_key() const { return publicKey; }
+
+  // False if the other side's key is unusable
+  bool establish(const uint8_t otherPublicKey[x25519KeySize], bool isServer, bool sealed);
+  bool is_established() const { return established; }
+
+  // Off sends and accepts packets in the clear, to measure what sealing costs
+  void set_enabled(bool on) { enabled = on; }
+  bool is_enabled() const { return enabled; }
+
+  // data holds [type][payload] of size bytes with room for sealOverhead more,
+  // returns the sealed size.
+  size_t seal(uint32_t channel, uint8_t *data, size_t size);
+  // Opens a sealed packet in place to [type][payload]. False for a forged,
+  // corrupted, replayed or too old packet.
+  bool open(uint32_t channel, uint8_t *data, size_t &size);
+
+  uint32_t get_rejected() const { return rejected; }
+
+private:
+  uint8_t secret[x25519KeySize] = {};
+  uint8_t publicKey[x25519KeySize] = {};
+  uint8_t sendKey[aeadKeySize] = {};
+  uint8_t receiveKey[aeadKeySize] = {};
+  uint32_t sendCounters[secureChannels] = {};
+  ReplayWindow receiveWindows[secureChannels];
+  uint32_t rejected = 0;
+  bool established = false;
+  bool enabled = true;
+};
+
+// 32 bytes from the OS random source, for start()
+void generate_session_secret(uint8_t secret[x25519KeySize]);
@@ -0,0 +1,55 @@
+#pragma once
+#include <cstdint>
+
+// Fixed-size ring addressed by a monotonically growing sequence or tick number.
+// Every slot remembers which sequence it holds, so a lookup of a sequence that
+// was already overwritten (or never written) fails instead of returning stale data.
+template<typename T, uint32_t Size>
+class SequenceRing
+{
+public:
+  T &insert(uint32_t seq)
+  {
+    Entry &entry = entries[seq % Size];
+    entry.seq = seq;
+    entry.valid = true;
+    return entry.value;
+  }
+
+  T *find(uint32_t seq)
+  {
+    Entry &entry = entries[seq % Size];
+    return entry.valid && entry.seq == seq ? &entry.value : nullptr;
+  }
+
+  const T *find(uint32_t seq) const
+  {
+    const Entry &entry = entries[seq % Size];
+    return entry.valid && entry.seq == seq ? &entry.value : nullptr;
+  }
+
+  void erase(uint32_t seq)
+  {
+    Entry &entry = entries[seq % Size];
+    if (entry.seq == seq)
+      entry.valid = false;
+  }
+
+  void clear()
+  {
+    for (Entry &entry : entries)
+      entry.valid = false;
+  }
+
+  static constexpr uint32_t size() { return Size; }
+
+private:
+  struct Entry
+  {
+    uint32_t seq = 0;
+    bool valid = false;
+    T value = {};
+  };
+  Entry entries[Size];
+};
+
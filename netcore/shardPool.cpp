@@ -0,0 +1,84 @@
+#include "shardPool.h"
+#include "profiler.h"
+#include <cstdio>
+
+ShardPool::~ShardPool()
+{
+  stop();
+}
+
+void ShardPool::start(uint32_t threadsWanted, uint32_t shards)
+{
+  stop();
+  shardCount = shards;
+  threadCount = threadsWanted < 1 ? 1 : threadsWanted > shards && shards > 0 ? shards : threadsWanted;
+  quit = false;
+  for (uint32_t t = 1; t < threadCount; ++t)
+    threads.emplace_back(&ShardPool::work, this, t);
+}
+
+void ShardPool::stop()
+{
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    quit = true;
+  }
+  started.notify_all();
+  for (std::thread &thread : threads)
+    thread.join();
+  threads.clear();
+  threadCount = 1;
+}
+
+void ShardPool::run(const std::function<void(uint32_t)> &job)
+{
+  if (threadCount > 1)
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    current = &job;
+    running = threadCount - 1;
+    ++generation;
+  }
+  started.notify_all();
+  run_shards(0, job);
+  if (threadCount > 1)
+  {
+    std::unique_lock<std::mutex> lock(mutex);
+    finished.wait(lock, [this]() { return running == 0; });
+    current = nullptr;
+  }
+}
+
+void ShardPool::run_shards(uint32_t thread, const std::function<void(uint32_t)> &job) const
+{
+  for (uint32_t shard = thread; shard < shardCount; shard += threadCount)
+    job(shard);
+}
+
+void ShardPool::work(uint32_t thread)
+{
+  char name[32];
+  snprintf(name, sizeof(name), "shard %u", thread);
+  set_profile_thread_name(name);
+  uint64_t seen = 0;
+  while (true)
+  {
+    const std::function<void(uint32_t)> *job = nullptr;
+    {
+      std::unique_lock<std::mutex> lock(mutex);
+      started.wait(lock, [&]() { return quit || generation != seen; });
+      if (quit)
+        return;
+      seen = generation;
+      job = current;
+    }
+    run_shards(thread, *job);
+    bool last = false;
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      last = --running == 0;
+    }
+    if (last)
+      finished.notify_one();
+  }
+}
@@ -0,0 +1,48 @@
+#pragma once
+#include <cstdint>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// A fixed set of threads that run one job over many shards and wait for it:
+// run(job) calls job(shard) for every shard and returns once all are done.
+// Shard i always runs on thread i % threads, the calling thread being thread
+// 0, so what a shard touches stays with one thread and shards that share no
+// mutable state need no locks.
+//
+//   pool.start(4, uint32_t(rooms.size()));
+//   pool.run([&](uint32_t shard) { rooms[shard].update(now); });
+class ShardPool
+{
+public:
+  ShardPool() = default;
+  ~ShardPool();
+  ShardPool(const ShardPool &) = delete;
+  ShardPool &operator=(const ShardPool &) = delete;
+
+  // Starts threads - 1 threads, the caller of run() is the first. threads is
+  // at least 1 and at most shards.
+  void start(uint32_t threads, uint32_t shards);
+  void stop();
+
+  void run(const std::function<void(uint32_t)> &job);
+
+  uint32_t get_thread_count() const { return threadCount; }
+
+private:
+  void run_shards(uint32_t thread, const std::function<void(uint32_t)> &job) const;
+  void work(uint32_t thread);
+
+  std::vector<std::thread> threads;
+  std::mutex mutex;
+  std::condition_variable started;
+  std::condition_variable finished;
+  const std::function<void(uint32_t)> *current = nullptr;
+  uint64_t generation = 0;
+  uint32_t running = 0;
+  uint32_t threadCount = 1;
+  uint32_t shardCount = 0;
+  bool quit = false;
+};
@@ -0,0 +1,111 @@
+#pragma once
+#include <cstddef>
+
+// Minimal float SIMD layer for batch kernels over SoA arrays.
+//
+// simd_float is 8 lanes with AVX2, 4 with SSE2 and a plain float otherwise.
+// Every operation also has a float overload, so a kernel written as a template
+// over the lane type handles the tail of an array with exactly the same math.
+#if defined(__AVX2__)
+#include <immintrin.h>
+using simd_float = __m256;
+constexpr size_t simd_width = 8;
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+using simd_float = __m128;
+constexpr size_t simd_width = 4;
+#else
+using simd_float = float;
+constexpr size_t simd_width = 1;
+#endif
+
+inline float simd_load(const float *p, float) { return *p; }
+inline void simd_store(float *p, float v) { *p = v; }
+inline float simd_set(float v, float) { return v; }
+inline float simd_add(float a, float b) { return a + b; }
+inline float simd_sub(float a, float b) { return a - b; }
+inline float simd_mul(float a, float b) { return a * b; }
+inline float simd_min(float a, float b) { return a < b ? a : b; }
+inline float simd_max(float a, float b) { return a > b ? a : b; }
+inline float simd_abs(float a) { return a < 0.f ? -a : a; }
+inline float simd_round(float a) { return float(int(a + (a < 0.f ? -0.5f : 0.5f))); }
+inline bool simd_lt(float a, float b) { return a < b; }
+inline bool simd_gt(float a, float b) { return a > b; }
+inline bool simd_ne(float a, float b) { return a != b; }
+inline bool simd_and(bool a, bool b) { return a && b; }
+inline bool simd_or(bool a, bool b) { return a || b; }
+inline bool simd_not(bool a) { return !a; }
+inline float simd_select(bool mask, float a, float b) { return mask ? a : b; }
+
+#if defined(__AVX2__)
+inline __m256 simd_load(const float *p, __m256) { return _mm256_loadu_ps(p); }
+inline void simd_store(float *p, __m256 v) { _mm256_storeu_ps(p, v); }
+inline __m256 simd_set(float v, __m256) { return _mm256_set1_ps(v); }
+inline __m256 simd_add(__m256 a, __m256 b) { return _mm256_add_ps(a, b); }
+inline __m256 simd_sub(__m256 a, __m256 b) { return _mm256_sub_ps(a, b); }
+inline __m256 simd_mul(__m256 a, __m256 b) { return _mm256_mul_ps(a, b); }
+inline __m256 simd_min(__m256 a, __m256 b) { return _mm256_min_ps(a, b); }
+inline __m256 simd_max(__m256 a, __m256 b) { return _mm256_max_ps(a, b); }
+inline __m256 simd_abs(__m256 a) { return _mm256_andnot_ps(_mm256_set1_ps(-0.f), a); }
+inline __m256 simd_round(__m256 a) { return _mm256_round_ps(a, _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC); }
+inline __m256 simd_lt(__m256 a, __m256 b) { return _mm256_cmp_ps(a, b, _CMP_LT_OQ); }
+inline __m256 simd_gt(__m256 a, __m256 b) { return _mm256_cmp_ps(a, b, _CMP_GT_OQ); }
+inline __m256 simd_ne(__m256 a, __m256 b) { return _mm256_cmp_ps(a, b, _CMP_NEQ_UQ); }
+inline __m256 simd_and(__m256 a, __m256 b) { return _mm256_and_ps(a, b); }
+inline __m256 simd_or(__m256 a, __m256 b) { return _mm256_or_ps(a, b); }
+inline __m256 simd_not(__m256 a) { return _mm256_xor_ps(a, _mm256_castsi256_ps(_mm256_set1_epi32(-1))); }
+inline __m256 simd_select(__m256 mask, __m256 a, __m256 b) { return _mm256_blendv_ps(b, a, mask); }
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+inline __m128 simd_load(const float *p, __m128) { return _mm_loadu_ps(p); }
+inline void simd_store(float *p, __m128 v) { _mm_storeu_ps(p, v); }
+inline __m128 simd_set(float v, __m128) { return _mm_set1_ps(v); }
+inline __m128 simd_add(__m128 a, __m128 b) { return _mm_add_ps(a, b); }
+inline __m128 simd_sub(__m128 a, __m128 b) { return _mm_sub_ps(a, b); }
+inline __m128 simd_mul(__m128 a, __m128 b) { return _mm_mul_ps(a, b); }
+inline __m128 simd_min(__m128 a, __m128 b) { return _mm_min_ps(a, b); }
+inline __m128 simd_max(__m128 a, __m128 b) { return _mm_max_ps(a, b); }
+inline __m128 simd_abs(__m128 a) { return _mm_andnot_ps(_mm_set1_ps(-0.f), a); }
+// Default MXCSR rounding is round to nearest, fine for the small values kernels reduce
+inline __m128 simd_round(__m128 a) { return _mm_cvtepi32_ps(_mm_cvtps_epi32(a)); }
+inline __m128 simd_lt(__m128 a, __m128 b) { return _mm_cmplt_ps(a, b); }
+inline __m128 simd_gt(__m128 a, __m128 b) { return _mm_cmpgt_ps(a, b); }
+inline __m128 simd_ne(__m128 a, __m128 b) { return _mm_cmpneq_ps(a, b); }
+inline __m128 simd_and(__m128 a, __m128 b) { return _mm_and_ps(a, b); }
+inline __m128 simd_or(__m128 a, __m128 b) { return _mm_or_ps(a, b); }
+inline __m128 simd_not(__m128 a) { return _mm_xor_ps(a, _mm_castsi128_ps(_mm_set1_epi32(-1))); }
+inline __m128 simd_select(__m128 mask, __m128 a, __m128 b) { return _mm_or_ps(_mm_and_ps(mask, a), _mm_andnot_ps(mask, b)); }
+#endif
+
+// sin and cos of the same angle, for any lane type. Cody-Waite reduction to
+// [-pi/4, pi/4] and the Cephes minimax polynomials, within ~2e-7 of sinf/cosf
+// for the angles a simulation produces (|x| up to a few thousand radians).
+template<typename F>
+inline void simd_sincos(F x, F &s, F &c)
+{
+  const F quadrant = simd_round(simd_mul(x, simd_set(0.636619772f, x)));
+  F r = simd_sub(x, simd_mul(quadrant, simd_set(1.5703125f, x)));
+  r = simd_sub(r, simd_mul(quadrant, simd_set(4.837512969970703125e-4f, x)));
+  r = simd_sub(r, simd_mul(quadrant, simd_set(7.54978995489188216e-8f, x)));
+  const F r2 = simd_mul(r, r);
+
+  F sinr = simd_add(simd_mul(simd_set(-1.9515295891e-4f, x), r2), simd_set(8.3321608736e-3f, x));
+  sinr = simd_add(simd_mul(sinr, r2), simd_set(-1.6666654611e-1f, x));
+  sinr = simd_add(simd_mul(simd_mul(sinr, r2), r), r);
+
+  F cosr = simd_add(simd_mul(simd_set(2.443315711809948e-5f, x), r2), simd_set(-1.388731625493765e-3f, x));
+  cosr = simd_add(simd_mul(cosr, r2), simd_set(4.166664568298827e-2f, x));
+  cosr = simd_add(simd_mul(simd_mul(cosr, r2), r2), simd_sub(simd_set(1.f, x), simd_mul(r2, simd_set(0.5f, x))));
+
+  // quadrant mod 4, computed in float: floor(q / 4) == round(q / 4 - 0.375) for integer q
+  const F q = simd_sub(quadrant, simd_mul(simd_round(simd_sub(simd_mul(quadrant, simd_set(0.25f, x)), simd_set(0.375f, x))), simd_set(4.f, x)));
+  const auto q1 = simd_and(simd_gt(q, simd_set(0.5f, x)), simd_lt(q, simd_set(1.5f, x)));
+  const auto q2 = simd_and(simd_gt(q, simd_set(1.5f, x)), simd_lt(q, simd_set(2.5f, x)));
+  const auto q3 = simd_gt(q, simd_set(2.5f, x));
+  const auto swap = simd_or(q1, q3);
+  s = simd_select(swap, cosr, sinr);
+  c = simd_select(swap, sinr, cosr);
+  const F zero = simd_set(0.f, x);
+  s = simd_select(simd_or(q2, q3), simd_sub(zero, s), s);
+  c = simd_select(simd_or(q1, q2), simd_sub(zero, c), c);
+}
+
@@ -0,0 +1,59 @@
+#pragma once
+#include <cstdint>
+#include "sequenceRing.h"
+
+// Client side jitter buffer of one entity's snapshots, keyed by server tick.
+// Snapshots may arrive late, duplicated or not at all; they are stored by the
+// tick they were taken at, so a render time can always be bracketed by the
+// closest snapshots around it regardless of arrival order.
+template<typename State, uint32_t Size = 32>
+class SnapshotBuffer
+{
+public:
+  bool push(uint32_t tick, const State &state)
+  {
+    if (tick + Size <= newest || snapshots.find(tick))
+      return false;
+    snapshots.insert(tick) = state;
+    newest = tick > newest ? tick : newest;
+    return true;
+  }
+
+  // Newest snapshot at or before tick, tick is left untouched if there is none.
+  const State *find_before(uint32_t &tick) const
+  {
+    uint32_t from = tick < newest ? tick : newest;
+    for (uint32_t age = 0; age < Size && age <= from; ++age)
+      if (const State *state = snapshots.find(from - age))
+      {
+        tick = from - age;
+        return state;
+      }
+    return nullptr;
+  }
+
+  // Oldest snapshot after tick.
+  const State *find_after(uint32_t &tick) const
+  {
+    for (uint32_t t = tick + 1; t <= newest; ++t)
+      if (const State *state = snapshots.find(t))
+      {
+        tick = t;
+        return state;
+      }
+    return nullptr;
+  }
+
+  uint32_t get_newest_tick() const { return newest; }
+
+  void clear()
+  {
+    snapshots.clear();
+    newest = 0;
+  }
+
+private:
+  SequenceRing<State, Size> snapshots;
+  uint32_t newest = 0;
+};
+
@@ -0,0 +1,199 @@
+#pragma once
+#include <cstdint>
+#include <vector>
+#include "bitStream.h"
+#include "sequenceRing.h"
+
+// Delta replication of a whole world: a world snapshot is the schema message
+// of every entity (anything with an eid member), sorted by eid and quantized
+// with the schema. The server sends each client only what differs from the
+// newest snapshot that client acknowledged (the baseline); the client keeps
+// the snapshots it received, rebuilds the full world from the baseline and
+// acks it. When nothing changed nothing is sent at all.
+//
+// A world delta is a list of records in eid order, each
+//   [1: more][16: eid][1: present]
+// followed, for a present entity, by its delta fields against the baseline
+// or by all of its fields if the baseline doesn't have it. Not present means
+// the entity is gone. A 0 more bit ends the list.
+//
+// Both ends take any writer / reader with the BitWriter interface. The record
+// bits use the worldDeltaContexts contexts right after the schema's.
+constexpr uint32_t worldDeltaContexts = 3;
+// more, eid, present
+constexpr uint32_t worldDeltaRecordBits = 1 + 16 + 1;
+
+template<typename Schema>
+constexpr uint32_t get_world_delta_context_count(const Schema &schema)
+{
+  return schema.get_context_count() + worldDeltaContexts;
+}
+
+// Server side, per client: the ring of snapshots sent and which one was acked.
+// A baseline older than Size snapshots is dropped, the client then gets full
+// state until it acks a newer one.
+template<typename Snapshot, uint32_t Size = 32>
+class DeltaBaselines
+{
+public:
+  // seq is left untouched if there is no usable baseline
+  const Snapshot *get_baseline(uint32_t &seq) const
+  {
+    if (acked == 0 || nextSeq - acked >= Size)
+      return nullptr;
+    const Snapshot *baseline = sent.find(acked);
+    if (baseline)
+      seq = acked;
+    return baseline;
+  }
+
+  uint32_t get_next_seq() const { return nextSeq; }
+
+  // Remembers snapshot as sent with get_next_seq()
+  void push(const Snapshot &snapshot)
+  {
+    sent.insert(nextSeq++) = snapshot;
+  }
+
+  void ack(uint32_t seq)
+  {
+    if (seq < nextSeq && seq > acked)
+      acked = seq;
+  }
+
+  void reset()
+  {
+    sent.clear();
+    nextSeq = 1;
+    acked = 0;
+  }
+
+  static constexpr uint32_t size() { return Size; }
+
+private:
+  SequenceRing<Snapshot, Size> sent;
+  uint32_t nextSeq = 1; // 0 is "no baseline" on the wire
+  uint32_t acked = 0;
+};
+
+// Writes the records that turn baseline (nullptr for none) into world.
+// Returns the number of records, 0 means the client already has world.
+template<typename Writer, typename Schema, typename Msg>
+uint32_t write_world_delta(Writer &writer, const Schema &schema, const std::vector<Msg> *baseline,
+                           const std::vector<Msg> &world)
+{
+  static const std::vector<Msg> empty;
+  const std::vector<Msg> &from = baseline ? *baseline : empty;
+  const uint32_t context = schema.get_context_count();
+  auto writeRecord = [&](uint16_t eid, bool present)
+  {
+    writer.set_context(context);
+    writer.write(1, 1);
+    writer.set_context(context + 1);
+    writer.write(eid, 16);
+    writer.set_context(context + 2);
+    writer.write(present, 1);
+  };
+  uint32_t records = 0;
+  size_t i = 0;
+  size_t j = 0;
+  while (i < from.size() || j < world.size())
+  {
+    const bool gone = j == world.size() || (i < from.size() && from[i].eid < world[j].eid);
+    const bool added = !gone && (i == from.size() || world[j].eid < from[i].eid);
+    if (gone)
+    {
+      writeRecord(from[i].eid, false);
+      ++records;
+      ++i;
+    }
+    else if (added)
+    {
+      writeRecord(world[j].eid, true);
+      schema.write_fields(writer, world[j]);
+      ++records;
+      ++j;
+    }
+    else
+    {
+      if (schema.differs(from[i], world[j]))
+      {
+        writeRecord(world[j].eid, true);
+        schema.write_delta_fields(writer, from[i], world[j]);
+        ++records;
+      }
+      ++i;
+      ++j;
+    }
+  }
+  writer.set_context(context);
+  writer.write(0, 1);
+  return records;
+}
+
+// Upper bound in bits of write_world_delta, to size the buffer
+template<typename Schema>
+size_t get_max_world_delta_bits(const Schema &schema, size_t baselineCount, size_t worldCount)
+{
+  return (baselineCount + worldCount) * (worldDeltaRecordBits + schema.get_max_delta_bits()) + 1;
+}
+
+// Bits of the record write_world_delta writes for msg against the baseline's
+// copy of it (nullptr if the baseline doesn't have it), 0 if none is needed
+template<typename Schema, typename Msg>
+uint32_t get_world_delta_record_bits(const Schema &schema, const Msg *baseline, const Msg &msg)
+{
+  if (!baseline)
+    return worldDeltaRecordBits + schema.get_field_bits();
+  if (!schema.differs(*baseline, msg))
+    return 0;
+  return worldDeltaRecordBits + schema.get_delta_bits(*baseline, msg);
+}
+
+// Rebuilds world from baseline (nullptr for none) and the records. Returns
+// false on a malformed or truncated delta, world is garbage then.
+template<typename Reader, typename Schema, typename Msg>
+bool read_world_delta(Reader &reader, const Schema &schema, const std::vector<Msg> *baseline,
+                      std::vector<Msg> &world)
+{
+  static const std::vector<Msg> empty;
+  const std::vector<Msg> &from = baseline ? *baseline : empty;
+  const uint32_t context = schema.get_context_count();
+  world.clear();
+  size_t i = 0;
+  uint32_t lastEid = 0;
+  bool first = true;
+  while (true)
+  {
+    reader.set_context(context);
+    if (!reader.read(1))
+      break;
+    reader.set_context(context + 1);
+    const uint16_t eid = uint16_t(reader.read(16));
+    reader.set_context(context + 2);
+    const bool present = reader.read(1) != 0;
+    if (reader.is_overflowed() || (!first && eid <= lastEid))
+      return false;
+    first = false;
+    lastEid = eid;
+    // unchanged entities before this one
+    for (; i < from.size() && from[i].eid < eid; ++i)
+      world.push_back(from[i]);
+    const bool inBaseline = i < from.size() && from[i].eid == eid;
+    if (present)
+    {
+      Msg msg = {};
+      if (inBaseline)
+        schema.read_delta_fields(reader, from[i], msg);
+      else
+        schema.read_fields(reader, msg);
+      msg.eid = eid;
+      world.push_back(msg);
+    }
+    if (inBaseline)
+      ++i;
+  }
+  for (; i < from.size(); ++i)
+    world.push_back(from[i]);
+  return !reader.is_overflowed();
+}
@@ -0,0 +1,76 @@
+#pragma once
+#include <atomic>
+#include <cstddef>
+#include <utility>
+#include <vector>
+
+// A bounded queue between exactly two threads, one pushing and one popping,
+// without locks. The capacity is fixed when it is made (rounded up to a
+// power of two), push() fails when it is full and the producer decides what
+// to do with what doesn't fit.
+//
+// Each side keeps its own index on a cache line of its own and a copy of the
+// other's, so it only reads the other side's index (and takes that cache
+// miss) when its copy says the ring looks full or empty.
+template<typename T>
+class SpscRing
+{
+public:
+  explicit SpscRing(size_t capacity)
+  {
+    size_t size = 1;
+    while (size < capacity)
+      size *= 2;
+    items.resize(size);
+    mask = size - 1;
+  }
+  SpscRing(const SpscRing &) = delete;
+  SpscRing &operator=(const SpscRing &) = delete;
+
+  // producer only
+  bool push(T &&value)
+  {
+    const size_t t = tail.load(std::memory_order_relaxed);
+    if (t - producerHead > mask)
+    {
+      producerHead = head.load(std::memory_order_acquire);
+      if (t - producerHead > mask)
+        return false;
+    }
+    items[t & mask] = std::move(value);
+    tail.store(t + 1, std::memory_order_release);
+    return true;
+  }
+  bool push(const T &value)
+  {
+    T copy = value;
+    return push(std::move(copy));
+  }
+
+  // consumer only
+  bool pop(T &value)
+  {
+    const size_t h = head.load(std::memory_order_relaxed);
+    if (h == consumerTail)
+    {
+      consumerTail = tail.load(std::memory_order_acquire);
+      if (h == consumerTail)
+        return false;
+    }
+    value = std::move(items[h & mask]);
+    head.store(h + 1, std::memory_order_release);
+    return true;
+  }
+
+  size_t get_capacity() const { return mask + 1; }
+  // exact only on a side that holds still, a hint anywhere else
+  size_t size() const { return tail.load(std::memory_order_acquire) - head.load(std::memory_order_acquire); }
+
+private:
+  std::vector<T> items;
+  size_t mask = 0;
+  alignas(64) std::atomic<size_t> head{ 0 };
+  size_t consumerTail = 0;
+  alignas(64) std::atomic<size_t> tail{ 0 };
+  size_t producerHead = 0;
+};
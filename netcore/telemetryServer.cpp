@@ -0,0 +1,124 @@
+#include "telemetryServer.h"
+#include "profiler.h"
+
+constexpr size_t maxClients = 8;
+constexpr size_t maxRequestSize = 4096;
+constexpr uint32_t clientTimeoutMs = 1000;
+
+TelemetryServer::~TelemetryServer()
+{
+  for (Client &client : clients)
+    enet_socket_destroy(client.socket);
+  if (listener != ENET_SOCKET_NULL)
+    enet_socket_destroy(listener);
+}
+
+bool TelemetryServer::start(uint16_t port)
+{
+  ENetAddress address;
+  if (enet_address_set_host_ip(&address, "127.0.0.1") != 0)
+    return false;
+  address.port = port;
+  listener = enet_socket_create(ENET_SOCKET_TYPE_STREAM);
+  if (listener == ENET_SOCKET_NULL)
+    return false;
+  enet_socket_set_option(listener, ENET_SOCKOPT_REUSEADDR, 1);
+  if (enet_socket_set_option(listener, ENET_SOCKOPT_NONBLOCK, 1) < 0 ||
+      enet_socket_bind(listener, &address) < 0 ||
+      enet_socket_listen(listener, int(maxClients)) < 0)
+  {
+    enet_socket_destroy(listener);
+    listener = ENET_SOCKET_NULL;
+    return false;
+  }
+  return true;
+}
+
+void TelemetryServer::poll(const NetTelemetry &telemetry, uint32_t now)
+{
+  if (listener == ENET_SOCKET_NULL)
+    return;
+  while (clients.size() < maxClients)
+  {
+    ENetSocket socket = enet_socket_accept(listener, nullptr);
+    if (socket == ENET_SOCKET_NULL)
+      break;
+    enet_socket_set_option(socket, ENET_SOCKOPT_NONBLOCK, 1);
+    Client client;
+    client.socket = socket;
+    client.acceptedAt = now;
+    clients.push_back(std::move(client));
+  }
+  for (size_t i = 0; i < clients.size();)
+  {
+    if (update(clients[i], telemetry, now))
+    {
+      ++i;
+      continue;
+    }
+    enet_socket_destroy(clients[i].socket);
+    clients[i] = std::move(clients.back());
+    clients.pop_back();
+  }
+}
+
+bool TelemetryServer::update(Client &client, const NetTelemetry &telemetry, uint32_t now)
+{
+  if (now - client.acceptedAt > clientTimeoutMs)
+    return false;
+  if (client.response.empty())
+  {
+    char chunk[1024];
+    ENetBuffer buffer;
+    buffer.data = chunk;
+    buffer.dataLength = sizeof(chunk);
+    // 0 is both "nothing yet" and a closed connection, the timeout sorts that out
+    const int received = enet_socket_receive(client.socket, nullptr, &buffer, 1);
+    if (received < 0)
+      return false;
+    client.request.append(chunk, size_t(received));
+    if (client.request.find("\r\n\r\n") == std::string::npos)
+      return client.request.size() < maxRequestSize;
+    respond(client, telemetry);
+  }
+  ENetBuffer buffer;
+  buffer.data = client.response.data() + client.sent;
+  buffer.dataLength = client.response.size() - client.sent;
+  const int sent = enet_socket_send(client.socket, nullptr, &buffer, 1);
+  if (sent < 0)
+    return false;
+  client.sent += size_t(sent);
+  return client.sent < client.response.size();
+}
+
+void TelemetryServer::respond(Client &client, const NetTelemetry &telemetry)
+{
+  const char *status = "200 OK";
+  const char *contentType = "text/plain; version=0.0.4";
+  std::string body;
+  const std::string &request = client.request;
+  const size_t pathEnd = request.find(' ', 4);
+  const std::string path = request.compare(0, 4, "GET ") == 0 && pathEnd != std::string::npos ?
+    request.substr(4, pathEnd - 4) : std::string();
+  if (path == "/" || path == "/metrics")
+    telemetry.write_text(body);
+  else if (path == "/json")
+  {
+    contentType = "application/json";
+    telemetry.write_json(body);
+  }
+  else if (path == "/trace")
+  {
+    contentType = "application/json";
+    write_chrome_trace(body);
+  }
+  else
+  {
+    status = path.empty() ? "400 Bad Request" : "404 Not Found";
+    contentType = "text/plain";
+    body = "try /, /json or /trace\n";
+  }
+  client.response = std::string("HTTP/1.0 ") + status + "\r\nContent-Type: " + contentType +
+    "\r\nContent-Length: " + std::to_string(body.size()) + "\r\nConnection: close\r\n\r\n" + body;
+  client.sent = 0;
+}
@@ -0,0 +1,49 @@
+#pragma once
+#include <enet/enet.h>
+#include <cstdint>
+#include <cstddef>
+#include <string>
+#include <vector>
+#include "netTelemetry.h"
+
+// A tiny HTTP endpoint on localhost for NetTelemetry, polled from the loop
+// that runs the host so it never blocks it:
+//
+//   curl localhost:10180/         Prometheus style text
+//   curl localhost:10180/json     JSON, with the sampled history
+//   curl localhost:10180/trace    the profiler's zones as Chrome trace JSON
+//
+// Only GET, one request per connection.
+class TelemetryServer
+{
+public:
+  TelemetryServer() = default;
+  ~TelemetryServer();
+  TelemetryServer(const TelemetryServer &) = delete;
+  TelemetryServer &operator=(const TelemetryServer &) = delete;
+
+  // Listens on 127.0.0.1:port, false if it can't
+  bool start(uint16_t port);
+  bool is_started() const { return listener != ENET_SOCKET_NULL; }
+
+  // Accepts new connections and answers the ones whose request is complete.
+  // now is enet_time_get(), connections that stall for long are closed.
+  void poll(const NetTelemetry &telemetry, uint32_t now);
+
+private:
+  struct Client
+  {
+    ENetSocket socket = ENET_SOCKET_NULL;
+    uint32_t acceptedAt = 0;
+    std::string request;
+    std::string response;
+    size_t sent = 0;
+  };
+
+  void respond(Client &client, const NetTelemetry &telemetry);
+  // false once the client is done with, either way
+  bool update(Client &client, const NetTelemetry &telemetry, uint32_t now);
+
+  ENetSocket listener = ENET_SOCKET_NULL;
+  std::vector<Client> clients;
+};
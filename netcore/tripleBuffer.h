@@ -0,0 +1,48 @@
+#pragma once
+#include <atomic>
+#include <cstdint>
+
+// The newest of the values one thread keeps producing, for another thread
+// that reads whenever it likes, without locks and without either side ever
+// waiting for the other. The writer fills the back buffer and publishes it;
+// the reader swaps in the newest published one when it wants to and reads it
+// for as long as it likes. Values published in between are skipped, not
+// queued.
+//
+// The back buffer holds whatever was published two swaps ago, the writer
+// fills all of it each time (reusing what it allocated, as vectors do).
+//
+//   TripleBuffer<WorldView> views;
+//   fill(views.get_back()); views.publish();     // writer
+//   views.update(); draw(views.get_front());     // reader
+template<typename T>
+class TripleBuffer
+{
+public:
+  // writer only
+  T &get_back() { return buffers[back]; }
+  void publish()
+  {
+    back = middle.exchange(uint8_t(back | freshBit), std::memory_order_acq_rel) & indexMask;
+  }
+
+  // reader only: takes the newest published value, false (and the front
+  // stays as it was) if nothing was published since the last update
+  bool update()
+  {
+    if ((middle.load(std::memory_order_relaxed) & freshBit) == 0)
+      return false;
+    front = middle.exchange(front, std::memory_order_acq_rel) & indexMask;
+    return true;
+  }
+  const T &get_front() const { return buffers[front]; }
+
+private:
+  static constexpr uint8_t indexMask = 3;
+  static constexpr uint8_t freshBit = 4;
+
+  T buffers[3];
+  alignas(64) uint8_t back = 0;
+  alignas(64) std::atomic<uint8_t> middle{ 1 };
+  alignas(64) uint8_t front = 2;
+};
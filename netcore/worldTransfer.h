@@ -0,0 +1,215 @@
+#pragma once
+#include <cstdint>
+#include <cstddef>
+#include <cstring>
+#include <algorithm>
+#include <vector>
+#include "messageSchema.h"
+#include "rangeCoder.h"
+#include "snapshotDelta.h"
+
+// The whole world for a client that joins, as one transfer instead of a
+// reliable message per entity. The server codes every entity at once (a
+// world delta against nothing, range coded), cuts the bytes into chunks that
+// each fit a packet and streams them on a channel of their own, never more
+// than worldTransferWindow of them unacknowledged. So a join with thousands
+// of entities neither floods the reliable window of the game's channel nor
+// stalls the other peers, and the client applies the world in one pass once
+// the last chunk is in.
+//
+// The channel is reliable and ordered, chunks arrive in order; the client
+// acks how many it has after every chunk. The transfer id tells chunks and
+// acks of an abandoned transfer (the peer joined again) from the current one.
+//
+//   server: if (write_world_state(schema, world, data)) sender.start(++id, data.data(), data.size());
+//           while (sender.next_chunk(chunk)) send(chunk);     // every tick
+//           sender.on_ack(ack.transfer, ack.received);        // on every ack
+//   client: if (receiver.add(chunk)) read_world_state(schema, ..., world);
+//           send_ack(chunk.transfer, receiver.get_received());
+
+// Below ENet's MTU with the header and a seal, so a chunk is never fragmented
+constexpr uint16_t worldChunkSize = 1024;
+// 16 KB in flight per peer
+constexpr uint16_t worldTransferWindow = 16;
+
+// One chunk of a transfer. The schema is the protocol's, see make_world_chunk_schema.
+struct WorldChunkMsg
+{
+  uint16_t transfer = 0;
+  uint16_t index = 0;
+  uint16_t count = 0;
+  uint16_t size = 0;
+  uint8_t bytes[worldChunkSize] = {};
+};
+// received: the chunks of the transfer the client has, all of them once done
+struct WorldStateAckMsg
+{
+  uint16_t transfer = 0;
+  uint16_t received = 0;
+};
+
+template<uint8_t Type>
+constexpr auto make_world_chunk_schema()
+{
+  return make_message_schema<WorldChunkMsg>(Type,
+    bits_field(&WorldChunkMsg::transfer, 16),
+    bits_field(&WorldChunkMsg::index, 16),
+    bits_field(&WorldChunkMsg::count, 16),
+    array_field(&WorldChunkMsg::bytes, &WorldChunkMsg::size, 8));
+}
+
+template<uint8_t Type>
+constexpr auto make_world_state_ack_schema()
+{
+  return make_message_schema<WorldStateAckMsg>(Type,
+    bits_field(&WorldStateAckMsg::transfer, 16),
+    bits_field(&WorldStateAckMsg::received, 16));
+}
+
+// Server side, one per peer
+class WorldTransferSender
+{
+public:
+  // Sends data as transfer id from the first chunk, whatever was being sent is dropped
+  void start(uint16_t id, const uint8_t *data, size_t size)
+  {
+    transfer = id;
+    bytes.assign(data, data + size);
+    count = uint16_t((size + worldChunkSize - 1) / worldChunkSize);
+    // an empty world still takes a chunk, the client waits for one
+    if (count == 0)
+      count = 1;
+    sent = 0;
+    acked = 0;
+    active = true;
+    done = false;
+  }
+
+  // The next chunk the window lets out, false if there is none now
+  bool next_chunk(WorldChunkMsg &chunk)
+  {
+    if (!active || sent == count || sent - acked >= worldTransferWindow)
+      return false;
+    const size_t offset = size_t(sent) * worldChunkSize;
+    const size_t size = offset < bytes.size() ? std::min(bytes.size() - offset, size_t(worldChunkSize)) : 0;
+    chunk.transfer = transfer;
+    chunk.index = sent++;
+    chunk.count = count;
+    chunk.size = uint16_t(size);
+    if (size > 0)
+      memcpy(chunk.bytes, bytes.data() + offset, size);
+    return true;
+  }
+
+  void on_ack(uint16_t id, uint16_t received)
+  {
+    if (!active || id != transfer || received > sent || received <= acked)
+      return;
+    acked = received;
+    if (acked < count)
+      return;
+    reset();
+    done = true;
+  }
+
+  // True from start() until the client has acked every chunk
+  bool is_active() const { return active; }
+  // True once the client has the whole world, until the next start() or reset()
+  bool is_done() const { return done; }
+
+  void reset()
+  {
+    active = false;
+    done = false;
+    bytes.clear();
+    count = sent = acked = 0;
+  }
+
+private:
+  std::vector<uint8_t> bytes;
+  uint16_t transfer = 0;
+  uint16_t count = 0;
+  uint16_t sent = 0;
+  uint16_t acked = 0;
+  bool active = false;
+  bool done = false;
+};
+
+// Client side
+class WorldTransferReceiver
+{
+public:
+  // True when chunk completed its transfer, get_data() has it all then.
+  // A chunk of a newer transfer starts over, anything out of order is dropped.
+  bool add(const WorldChunkMsg &chunk)
+  {
+    if (chunk.transfer != transfer || chunk.index == 0)
+    {
+      if (chunk.index != 0)
+        return false;
+      transfer = chunk.transfer;
+      bytes.clear();
+      received = 0;
+    }
+    if (chunk.index != received || chunk.count == 0 || received == chunk.count)
+      return false;
+    bytes.insert(bytes.end(), chunk.bytes, chunk.bytes + chunk.size);
+    ++received;
+    return received == chunk.count;
+  }
+
+  uint16_t get_transfer() const { return transfer; }
+  uint16_t get_received() const { return received; }
+  const std::vector<uint8_t> &get_data() const { return bytes; }
+
+  void reset()
+  {
+    bytes.clear();
+    transfer = 0;
+    received = 0;
+  }
+
+private:
+  std::vector<uint8_t> bytes;
+  uint16_t transfer = 0;
+  uint16_t received = 0;
+};
+
+// Every message of world (sorted by eid) range coded with schema into data,
+// the bytes a transfer sends. False (and data empty) only if even room for
+// the coder's worst case didn't take it, no transfer may start then.
+template<typename Schema, typename Msg>
+bool write_world_state(const Schema &schema, const std::vector<Msg> &world, std::vector<uint8_t> &data)
+{
+  constexpr uint32_t contexts = Schema::get_context_count() + worldDeltaContexts;
+  const size_t plainBytes = (get_max_world_delta_bits(schema, 0, world.size()) + 7) / 8;
+  // coded is hardly ever larger than plain, a few bytes of flush aside; when
+  // it is, it is coded again into room for every bit at its highest cost
+  for (size_t capacity : { plainBytes + 16, plainBytes * rangeMaxBitsPerBit + 16 })
+  {
+    BitValueModel<contexts> model;
+    data.assign(capacity, 0);
+    RangeEncoder encoder(data.data(), data.size());
+    RangeBitWriter<contexts> writer(encoder, model);
+    write_world_delta(writer, schema, (const std::vector<Msg>*)nullptr, world);
+    const size_t size = encoder.finish();
+    if (!encoder.is_overflowed())
+    {
+      data.resize(size);
+      return true;
+    }
+  }
+  data.clear();
+  return false;
+}
+
+// False on a malformed or truncated state, world is garbage then
+template<typename Schema, typename Msg>
+bool read_world_state(const Schema &schema, const uint8_t *data, size_t size, std::vector<Msg> &world)
+{
+  constexpr uint32_t contexts = Schema::get_context_count() + worldDeltaContexts;
+  BitValueModel<contexts> model;
+  RangeDecoder decoder(data, size);
+  RangeBitReader<contexts> reader(decoder, model);
+  return read_world_delta(reader, schema, (const std::vector<Msg>*)nullptr, world);
+}
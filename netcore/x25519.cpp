@@ -0,0 +1,167 @@
+#include "x25519.h"
+
+// Field arithmetic mod 2^255 - 19 in 16 limbs of 16 bits, as in TweetNaCl.
+// Slow (about a millisecond per scalar multiplication) but small and constant
+// time, which is all a handshake once per connection needs.
+typedef int64_t Fe[16];
+
+static void carry(Fe o)
+{
+  for (int i = 0; i < 16; ++i)
+  {
+    o[i] += int64_t(1) << 16;
+    const int64_t c = o[i] >> 16;
+    o[(i + 1) * (i < 15)] += c - 1 + 37 * (c - 1) * (i == 15);
+    o[i] -= c * (int64_t(1) << 16);
+  }
+}
+
+// Swaps p and q if b is 1, without branching on b
+static void select(Fe p, Fe q, int64_t b)
+{
+  const int64_t mask = ~(b - 1);
+  for (int i = 0; i < 16; ++i)
+  {
+    const int64_t t = mask & (p[i] ^ q[i]);
+    p[i] ^= t;
+    q[i] ^= t;
+  }
+}
+
+static void pack(uint8_t out[32], const Fe n)
+{
+  Fe m, t;
+  for (int i = 0; i < 16; ++i)
+    t[i] = n[i];
+  carry(t);
+  carry(t);
+  carry(t);
+  for (int j = 0; j < 2; ++j)
+  {
+    m[0] = t[0] - 0xffed;
+    for (int i = 1; i < 15; ++i)
+    {
+      m[i] = t[i] - 0xffff - ((m[i - 1] >> 16) & 1);
+      m[i - 1] &= 0xffff;
+    }
+    m[15] = t[15] - 0x7fff - ((m[14] >> 16) & 1);
+    const int64_t b = (m[15] >> 16) & 1;
+    m[14] &= 0xffff;
+    select(t, m, 1 - b);
+  }
+  for (int i = 0; i < 16; ++i)
+  {
+    out[2 * i] = uint8_t(t[i] & 0xff);
+    out[2 * i + 1] = uint8_t(t[i] >> 8);
+  }
+}
+
+static void unpack(Fe o, const uint8_t n[32])
+{
+  for (int i = 0; i < 16; ++i)
+    o[i] = n[2 * i] + (int64_t(n[2 * i + 1]) << 8);
+  o[15] &= 0x7fff;
+}
+
+static void add(Fe o, const Fe a, const Fe b)
+{
+  for (int i = 0; i < 16; ++i)
+    o[i] = a[i] + b[i];
+}
+
+static void sub(Fe o, const Fe a, const Fe b)
+{
+  for (int i = 0; i < 16; ++i)
+    o[i] = a[i] - b[i];
+}
+
+static void mul(Fe o, const Fe a, const Fe b)
+{
+  int64_t t[31] = {};
+  for (int i = 0; i < 16; ++i)
+    for (int j = 0; j < 16; ++j)
+      t[i + j] += a[i] * b[j];
+  for (int i = 0; i < 15; ++i)
+    t[i] += 38 * t[i + 16];
+  for (int i = 0; i < 16; ++i)
+    o[i] = t[i];
+  carry(o);
+  carry(o);
+}
+
+static void invert(Fe o, const Fe in)
+{
+  // in^(p - 2)
+  Fe c;
+  for (int i = 0; i < 16; ++i)
+    c[i] = in[i];
+  for (int a = 253; a >= 0; --a)
+  {
+    mul(c, c, c);
+    if (a != 2 && a != 4)
+      mul(c, c, in);
+  }
+  for (int i = 0; i < 16; ++i)
+    o[i] = c[i];
+}
+
+static void scalarmult(uint8_t out[32], const uint8_t scalar[32], const uint8_t point[32])
+{
+  static const Fe a24 = { 0xdb41, 1 }; // 121665
+  uint8_t z[32];
+  for (int i = 0; i < 32; ++i)
+    z[i] = scalar[i];
+  z[31] = (z[31] & 127) | 64;
+  z[0] &= 248;
+
+  // Montgomery ladder, (a : c) and (b : d) are x/z of the two running points
+  Fe x, a = {}, b, c = {}, d = {}, e, f;
+  unpack(x, point);
+  for (int i = 0; i < 16; ++i)
+    b[i] = x[i];
+  a[0] = d[0] = 1;
+  for (int i = 254; i >= 0; --i)
+  {
+    const int64_t bit = (z[i >> 3] >> (i & 7)) & 1;
+    select(a, b, bit);
+    select(c, d, bit);
+    add(e, a, c);
+    sub(a, a, c);
+    add(c, b, d);
+    sub(b, b, d);
+    mul(d, e, e);
+    mul(f, a, a);
+    mul(a, c, a);
+    mul(c, b, e);
+    add(e, a, c);
+    sub(a, a, c);
+    mul(b, a, a);
+    sub(c, d, f);
+    mul(a, c, a24);
+    add(a, a, d);
+    mul(c, c, a);
+    mul(a, d, f);
+    mul(d, b, x);
+    mul(b, e, e);
+    select(a, b, bit);
+    select(c, d, bit);
+  }
+  invert(c, c);
+  mul(a, a, c);
+  pack(out, a);
+}
+
+void x25519_public_key(uint8_t publicKey[x25519KeySize], const uint8_t secret[x25519KeySize])
+{
+  static const uint8_t basePoint[32] = { 9 };
+  scalarmult(publicKey, secret, basePoint);
+}
+
+bool x25519(uint8_t shared[x25519KeySize], const uint8_t secret[x25519KeySize], const uint8_t publicKey[x25519KeySize])
+{
+  scalarmult(shared, secret, publicKey);
+  uint8_t any = 0;
+  for (uint32_t i = 0; i < x25519KeySize; ++i)
+    any |= shared[i];
+  return any != 0;
+}
@@ -0,0 +1,13 @@
+#pragma once
+#include <cstdint>
+
+// X25519 Diffie-Hellman as in RFC 7748. Each side picks 32 random bytes as
+// its secret, sends x25519_public_key of it, and x25519 of its secret and
+// the other side's public key gives both the same shared secret.
+constexpr uint32_t x25519KeySize = 32;
+
+void x25519_public_key(uint8_t publicKey[x25519KeySize], const uint8_t secret[x25519KeySize]);
+
+// Returns false if the shared secret is all zeros, i.e. the other side sent
+// a low order point to force a known key.
+bool x25519(uint8_t shared[x25519KeySize], const uint8_t secret[x25519KeySize], const uint8_t publicKey[x25519KeySize]);
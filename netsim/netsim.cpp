@@ -0,0 +1,296 @@
+// UDP proxy that runs any client/server pair through a simulated network.
+//
+//   netsim --listen 10131 --server 127.0.0.1:10132 --latency 50 --jitter 20 --loss 5
+//
+// Clients connect to the listen port, the proxy forwards to the server from a
+// separate socket per client, so the server sees one address per client as
+// usual. Conditions apply to both directions, --up-<key> and --down-<key> set
+// one direction only (up is client to server). Keys: latency, jitter (ms),
+// loss, reorder, duplicate (percent), burst (packets), bandwidth (kbit/s),
+// queue (ms).
+//
+// --scenario file changes the conditions over time, one line per change:
+//   # seconds  direction  key=value...
+//   0   both  latency=50 jitter=10
+//   20  down  loss=10 burst=4
+//   40  up    bandwidth=64
+#include <enet/enet.h>
+#include "linkConditioner.h"
+#include <algorithm>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <vector>
+
+struct Session
+{
+  ENetAddress client;
+  ENetSocket upstream;
+  uint32_t lastActivity;
+};
+
+struct ScenarioStep
+{
+  uint32_t atMs;
+  bool up;
+  bool down;
+  std::string key;
+  std::string value;
+};
+
+constexpr uint32_t sessionTimeoutMs = 30000;
+constexpr size_t maxDatagramSize = 4096;
+
+static bool set_condition(LinkConditioner &up, LinkConditioner &down, bool toUp, bool toDown,
+                          const char *key, const char *value)
+{
+  LinkConditions upConditions = up.get_conditions();
+  LinkConditions downConditions = down.get_conditions();
+  if ((toUp && !parse_link_condition(upConditions, key, value)) ||
+      (toDown && !parse_link_condition(downConditions, key, value)))
+    return false;
+  up.set_conditions(upConditions);
+  down.set_conditions(downConditions);
+  return true;
+}
+
+static bool load_scenario(const char *path, std::vector<ScenarioStep> &steps)
+{
+  FILE *file = fopen(path, "r");
+  if (!file)
+    return false;
+  char line[512];
+  while (fgets(line, sizeof(line), file))
+  {
+    char *hash = strchr(line, '#');
+    if (hash)
+      *hash = '\0';
+    char *token = strtok(line, " \t\r\n");
+    if (!token)
+      continue;
+    uint32_t atMs = uint32_t(strtof(token, nullptr) * 1000.f);
+    const char *direction = strtok(nullptr, " \t\r\n");
+    if (!direction)
+      continue;
+    bool up = strcmp(direction, "up") == 0 || strcmp(direction, "both") == 0;
+    bool down = strcmp(direction, "down") == 0 || strcmp(direction, "both") == 0;
+    while ((token = strtok(nullptr, " \t\r\n")))
+    {
+      char *eq = strchr(token, '=');
+      if (!eq)
+        continue;
+      *eq = '\0';
+      steps.push_back({ atMs, up, down, token, eq + 1 });
+    }
+  }
+  fclose(file);
+  return true;
+}
+
+static ENetSocket create_socket(uint16_t port)
+{
+  ENetSocket socket = enet_socket_create(ENET_SOCKET_TYPE_DATAGRAM);
+  if (socket == ENET_SOCKET_NULL)
+    return socket;
+  ENetAddress address;
+  address.host = ENET_HOST_ANY;
+  address.port = port;
+  if (enet_socket_bind(socket, &address) < 0)
+  {
+    enet_socket_destroy(socket);
+    return ENET_SOCKET_NULL;
+  }
+  enet_socket_set_option(socket, ENET_SOCKOPT_NONBLOCK, 1);
+  return socket;
+}
+
+static void send_datagram(ENetSocket socket, const ENetAddress &to, const uint8_t *data, size_t size)
+{
+  ENetBuffer buffer;
+  buffer.data = (void*)data;
+  buffer.dataLength = size;
+  enet_socket_send(socket, &to, &buffer, 1);
+}
+
+int main(int argc, const char **argv)
+{
+  uint16_t listenPort = 10131;
+  const char *serverHost = "127.0.0.1";
+  uint16_t serverPort = 10132;
+  const char *scenarioPath = nullptr;
+  uint32_t seed = 1;
+  LinkConditions upConditions;
+  LinkConditions downConditions;
+
+  for (int i = 1; i + 1 < argc; ++i)
+  {
+    const char *arg = argv[i];
+    const char *value = argv[++i];
+    if (strcmp(arg, "--listen") == 0)
+      listenPort = uint16_t(atoi(value));
+    else if (strcmp(arg, "--server") == 0)
+    {
+      static std::string host;
+      host = value;
+      size_t colon = host.rfind(':');
+      if (colon != std::string::npos)
+      {
+        serverPort = uint16_t(atoi(host.c_str() + colon + 1));
+        host.resize(colon);
+      }
+      serverHost = host.c_str();
+    }
+    else if (strcmp(arg, "--scenario") == 0)
+      scenarioPath = value;
+    else if (strcmp(arg, "--seed") == 0)
+      seed = strtoul(value, nullptr, 10);
+    else
+    {
+      bool known = false;
+      if (strncmp(arg, "--up-", 5) == 0)
+        known = parse_link_condition(upConditions, arg + 5, value);
+      else if (strncmp(arg, "--down-", 7) == 0)
+        known = parse_link_condition(downConditions, arg + 7, value);
+      else if (strncmp(arg, "--", 2) == 0)
+        known = parse_link_condition(upConditions, arg + 2, value) &&
+                parse_link_condition(downConditions, arg + 2, value);
+      if (!known)
+      {
+        printf("Unknown option %s\n", arg);
+        return 1;
+      }
+    }
+  }
+  LinkConditioner up(seed);
+  LinkConditioner down(seed + 1);
+  up.set_conditions(upConditions);
+  down.set_conditions(downConditions);
+
+  std::vector<ScenarioStep> scenario;
+  if (scenarioPath && !load_scenario(scenarioPath, scenario))
+  {
+    printf("Cannot read scenario %s\n", scenarioPath);
+    return 1;
+  }
+
+  if (enet_initialize() != 0)
+  {
+    printf("Cannot init ENet");
+    return 1;
+  }
+
+  ENetAddress serverAddress;
+  enet_address_set_host(&serverAddress, serverHost);
+  serverAddress.port = serverPort;
+
+  ENetSocket listenSocket = create_socket(listenPort);
+  if (listenSocket == ENET_SOCKET_NULL)
+  {
+    printf("Cannot listen on port %u\n", listenPort);
+    return 1;
+  }
+  printf("Forwarding :%u -> %s:%u\n", listenPort, serverHost, serverPort);
+
+  // index into sessions is the conditioner tag
+  std::vector<Session> sessions;
+  const uint32_t startTime = enet_time_get();
+  size_t nextStep = 0;
+  uint32_t lastReport = startTime;
+  uint8_t data[maxDatagramSize];
+
+  while (true)
+  {
+    uint32_t now = enet_time_get();
+    for (; nextStep < scenario.size() && now - startTime >= scenario[nextStep].atMs; ++nextStep)
+    {
+      const ScenarioStep &step = scenario[nextStep];
+      if (!set_condition(up, down, step.up, step.down, step.key.c_str(), step.value.c_str()))
+        printf("Unknown scenario key %s\n", step.key.c_str());
+      else
+        printf("%.1fs: %s %s=%s\n", step.atMs * 0.001f, step.up && step.down ? "both" : step.up ? "up" : "down",
+               step.key.c_str(), step.value.c_str());
+    }
+
+    // wait for traffic, or until the next delayed datagram is due
+    uint32_t timeout = std::min(std::min(up.next_delivery(now), down.next_delivery(now)), 10u);
+    ENetSocketSet readSet;
+    ENET_SOCKETSET_EMPTY(readSet);
+    ENET_SOCKETSET_ADD(readSet, listenSocket);
+    ENetSocket maxSocket = listenSocket;
+    for (const Session &session : sessions)
+      if (session.upstream != ENET_SOCKET_NULL)
+      {
+        ENET_SOCKETSET_ADD(readSet, session.upstream);
+        maxSocket = session.upstream > maxSocket ? session.upstream : maxSocket;
+      }
+    enet_socketset_select(maxSocket, &readSet, nullptr, timeout);
+    now = enet_time_get();
+
+    ENetBuffer buffer;
+    buffer.data = data;
+    buffer.dataLength = sizeof(data);
+    ENetAddress from;
+    int received = 0;
+    while ((received = enet_socket_receive(listenSocket, &from, &buffer, 1)) > 0)
+    {
+      size_t slot = 0;
+      while (slot < sessions.size() && !(sessions[slot].upstream != ENET_SOCKET_NULL &&
+             sessions[slot].client.host == from.host && sessions[slot].client.port == from.port))
+        ++slot;
+      if (slot == sessions.size())
+      {
+        // without a socket there is no session, the client's next datagram tries again
+        const ENetSocket upstream = create_socket(0);
+        if (upstream == ENET_SOCKET_NULL)
+          continue;
+        // slots are never reused, so in-flight datagrams of a timed out session just get dropped
+        sessions.push_back({ from, upstream, now });
+        printf("New client %x:%u\n", from.host, from.port);
+      }
+      sessions[slot].lastActivity = now;
+      up.submit(now, data, size_t(received), uint32_t(slot));
+    }
+
+    for (size_t slot = 0; slot < sessions.size(); ++slot)
+    {
+      Session &session = sessions[slot];
+      if (session.upstream == ENET_SOCKET_NULL)
+        continue;
+      while ((received = enet_socket_receive(session.upstream, &from, &buffer, 1)) > 0)
+      {
+        session.lastActivity = now;
+        down.submit(now, data, size_t(received), uint32_t(slot));
+      }
+      if (now - session.lastActivity > sessionTimeoutMs)
+      {
+        printf("Client %x:%u timed out\n", session.client.host, session.client.port);
+        enet_socket_destroy(session.upstream);
+        session.upstream = ENET_SOCKET_NULL;
+      }
+    }
+
+    up.poll(now, [&](uint32_t tag, const uint8_t *payload, size_t size)
+    {
+      if (sessions[tag].upstream != ENET_SOCKET_NULL)
+        send_datagram(sessions[tag].upstream, serverAddress, payload, size);
+    });
+    down.poll(now, [&](uint32_t tag, const uint8_t *payload, size_t size)
+    {
+      if (sessions[tag].upstream != ENET_SOCKET_NULL)
+        send_datagram(listenSocket, sessions[tag].client, payload, size);
+    });
+
+    if (now - lastReport >= 5000)
+    {
+      lastReport = now;
+      printf("up: %u delivered %u lost %u dropped %u dup %u reordered | down: %u delivered %u lost %u dropped %u dup %u reordered\n",
+             up.get_delivered(), up.get_lost(), up.get_dropped(), up.get_duplicated(), up.get_reordered(),
+             down.get_delivered(), down.get_lost(), down.get_dropped(), down.get_duplicated(), down.get_reordered());
+    }
+  }
+
+  enet_socket_destroy(listenSocket);
+  atexit(enet_deinitialize);
+  return 0;
+}
@@ -1,5 +1,8 @@
 #pragma once
 #include <cstdint>
+#include <cstddef>
+#include <vector>
+#include "archetype.h"
 
 constexpr uint16_t invalid_entity = -1;
 struct Entity
@@ -14,5 +17,90 @@ struct Entity
   uint16_t eid = invalid_entity;
 };
 
+// Components of a w10 entity, see archetype.h. Every float the simulation
+// steps is a component of its own, one dense array that SIMD loads as it is,
+// and the color only matters to whoever draws or spawns it. Entity stays
+// what the wire and checkpoints carry.
+struct NetId { using Value = uint16_t; };
+struct EntityColor { using Value = uint32_t; };
+struct PosX { using Value = float; };
+struct PosY { using Value = float; };
+struct Ori { using Value = float; };
+struct Speed { using Value = float; };
+struct Thr { using Value = float; };
+struct Steer { using Value = float; };
+
+template<typename C, typename A, typename V>
+void set_component(A &archetype, uint32_t row, const V &value)
+{
+  if constexpr (A::template has<C>)
+    archetype.template get<C>(row) = value;
+}
+
+template<typename C, typename A, typename V>
+void get_component(const A &archetype, uint32_t row, V &value)
+{
+  if constexpr (A::template has<C>)
+    value = archetype.template get<C>(row);
+}
+
+// Whatever of e the archetype has, into its row
+template<typename A>
+void write_entity(A &archetype, uint32_t row, const Entity &e)
+{
+  set_component<NetId>(archetype, row, e.eid);
+  set_component<EntityColor>(archetype, row, e.color);
+  set_component<PosX>(archetype, row, e.x);
+  set_component<PosY>(archetype, row, e.y);
+  set_component<Ori>(archetype, row, e.ori);
+  set_component<Speed>(archetype, row, e.speed);
+  set_component<Thr>(archetype, row, e.thr);
+  set_component<Steer>(archetype, row, e.steer);
+}
+
+// The row as an Entity, defaults for what the archetype doesn't have
+template<typename A>
+Entity read_entity(const A &archetype, uint32_t row)
+{
+  Entity e;
+  get_component<NetId>(archetype, row, e.eid);
+  get_component<EntityColor>(archetype, row, e.color);
+  get_component<PosX>(archetype, row, e.x);
+  get_component<PosY>(archetype, row, e.y);
+  get_component<Ori>(archetype, row, e.ori);
+  get_component<Speed>(archetype, row, e.speed);
+  get_component<Thr>(archetype, row, e.thr);
+  get_component<Steer>(archetype, row, e.steer);
+  return e;
+}
+
 void simulate_entity(Entity &e, float dt);
 
+// count entities in structure-of-arrays form, for stepping many of them at once
+struct EntityLanes
+{
+  size_t count = 0;
+  float *x = nullptr;
+  float *y = nullptr;
+  float *speed = nullptr;
+  float *ori = nullptr;
+  const float *thr = nullptr;
+  const float *steer = nullptr;
+};
+
+// simulate_entity for every entity of the lanes, 8 (AVX2) or 4 (SSE2) at a
+// time with polynomial sin/cos. simulate_entity stays the reference; positions
+// agree with it to ~2e-5 after 1000 steps of random input, see check/simdCheck.cpp.
+void simulate_entities(const EntityLanes &lanes, float dt);
+
+// The same for every entity of world with all the components it steps,
+// straight on the archetypes' arrays
+template<typename World>
+void simulate_entities(World &world, float dt)
+{
+  world.template each_chunk<PosX, PosY, Speed, Ori, Thr, Steer>(
+    [dt](size_t count, float *x, float *y, float *speed, float *ori, float *thr, float *steer)
+    {
+      simulate_entities(EntityLanes{ count, x, y, speed, ori, thr, steer }, dt);
+    });
+}
@@ -1,63 +1,303 @@
 // initial skeleton is a clone from https://github.com/jpcy/bgfx-minimal-example
 //
+#include <algorithm>
+#include <atomic>
 #include <functional>
+#include <thread>
 #include "raylib.h"
 #include <enet/enet.h>
 #include <math.h>
+#include <stdlib.h>
+#include <string.h>
 
 #include <vector>
 #include "entity.h"
 #include "protocol.h"
+#include "eidIndex.h"
+#include "sequenceRing.h"
+#include "tripleBuffer.h"
 
 
-static std::vector<Entity> entities;
+// what the client draws of a ship, the server steps the rest
+typedef Archetype<NetId, EntityColor, PosX, PosY, Ori> ShownShip;
+static EntityWorld<ShownShip> entities;
+// the handle of every eid, entityHandles is indexed by entityIndex
+static EidIndex entityIndex;
+static std::vector<EntityHandle> entityHandles;
 static uint16_t my_entity = invalid_entity;
+static uint32_t inputSeq = 0;
+static InputWindow<InputCmd, inputWindowSize> sentInputs;
+static SequenceRing<ReplicatedSnapshot, snapshotHistorySize> receivedSnapshots;
+static uint32_t newestSnapshotSeq = 0;
+static uint32_t my_session_token = 0;
+// the world the server sends when we join, applied once it is all here
+static WorldTransferReceiver worldTransfer;
+static std::vector<Entity> transferredWorld;
+// despawns of entities that may still come with the world, until it is here
+static bool haveWorld = false;
+static std::vector<uint16_t> despawnedBeforeWorld;
+// keys of the current connection, serverPeer->data points here
+static SecureSession session;
+// the server may turn sealing off only if we were started with --allow-unsealed,
+// the key message saying so comes in the clear
+static bool allowUnsealed = false;
 
-void on_new_entity_packet(ENetPacket *packet)
+// Everything above is the network thread's. It services the host, sends an
+// input every tick and publishes what there is to draw; the render thread
+// only draws the newest view and samples the keys, so neither a slow frame
+// nor vsync holds up packets or inputs.
+struct DrawnShip
 {
-  Entity newEntity;
-  deserialize_new_entity(packet, newEntity);
-  // TODO: Direct adressing, of course!
-  for (const Entity &e : entities)
-    if (e.eid == newEntity.eid)
-      return; // don't need to do anything, we already have entity
-  entities.push_back(newEntity);
+  uint32_t color;
+  float x;
+  float y;
+  float ori;
+};
+struct WorldView
+{
+  std::vector<DrawnShip> ships;
+};
+static TripleBuffer<WorldView> views;
+
+enum HeldKey : uint8_t
+{
+  E_KEY_LEFT = 1 << 0,
+  E_KEY_RIGHT = 1 << 1,
+  E_KEY_UP = 1 << 2,
+  E_KEY_DOWN = 1 << 3
+};
+// the keys held at the last frame, raylib only polls them on the render thread
+static std::atomic<uint8_t> heldKeys{ 0 };
+static std::atomic<bool> quit{ false };
+
+void on_new_entity(const Entity &newEntity)
+{
+  // an entity we already have keeps its slot, invalid_entity gets none
+  if (entityIndex.insert(newEntity.eid) != entityHandles.size())
+    return;
+  const EntityHandle handle = entities.create<ShownShip>();
+  write_entity(entities.get_archetype<ShownShip>(), entities.get_row(handle), newEntity);
+  entityHandles.push_back(handle);
 }
 
-void on_set_controlled_entity(ENetPacket *packet)
+// Every entity at once when the last chunk is in, snapshots only start after
+void on_world_chunk(const WorldChunkMsg &chunk, ENetPeer *peer)
 {
-  deserialize_set_controlled_entity(packet, my_entity);
+  const bool done = worldTransfer.add(chunk);
+  if (chunk.transfer != worldTransfer.get_transfer() || chunk.index + 1 != worldTransfer.get_received())
+    return; // not the next chunk of the current transfer
+  send_world_state_ack(peer, chunk.transfer, worldTransfer.get_received());
+  const std::vector<uint8_t> &data = worldTransfer.get_data();
+  if (!done || !decode_world_state(data.data(), data.size(), transferredWorld))
+    return;
+  entities.get_archetype<ShownShip>().reserve(entities.size() + transferredWorld.size());
+  for (const Entity &e : transferredWorld)
+    if (std::find(despawnedBeforeWorld.begin(), despawnedBeforeWorld.end(), e.eid) == despawnedBeforeWorld.end())
+      on_new_entity(e);
+  haveWorld = true;
+  despawnedBeforeWorld.clear();
+}
+
+// The despawn goes on the reliable channel, the world on its own, so the
+// world may still bring an entity that is already gone
+void on_despawn(uint16_t eid)
+{
+  if (const EntityHandle *handle = entityIndex.get(entityHandles, eid))
+  {
+    entities.destroy(*handle);
+    entityIndex.erase(entityHandles, eid);
+  }
+  else if (!haveWorld)
+    despawnedBeforeWorld.push_back(eid);
+  if (eid == my_entity)
+    my_entity = invalid_entity;
 }
 
-void on_snapshot(ENetPacket *packet)
+// Rebuilds the world from the baseline the server picked, keeps it as a
+// baseline for later snapshots and acks it.
+void on_snapshot(ENetPacket *packet, ENetPeer *peer)
 {
-  uint16_t eid = invalid_entity;
-  float x = 0.f; float y = 0.f; float ori = 0.f;
-  deserialize_snapshot(packet, eid, x, y, ori);
-  // TODO: Direct adressing, of course!
-  for (Entity &e : entities)
-    if (e.eid == eid)
+  uint32_t seq = 0;
+  uint32_t baselineSeq = 0;
+  if (!read_world_snapshot_header(packet, seq, baselineSeq) || receivedSnapshots.find(seq))
+    return;
+  const ReplicatedSnapshot *baseline = nullptr;
+  if (baselineSeq != 0 && !(baseline = receivedSnapshots.find(baselineSeq)))
+    return;
+  // decoded aside, inserting seq may evict the baseline
+  static ReplicatedSnapshot snapshot;
+  if (!read_world_snapshot(packet, baseline, snapshot))
+    return;
+  receivedSnapshots.insert(seq) = snapshot;
+  send_snapshot_ack(peer, seq);
+  if (seq < newestSnapshotSeq)
+    return; // late, we already show a newer one
+  newestSnapshotSeq = seq;
+  ShownShip &ships = entities.get_archetype<ShownShip>();
+  for (const EntitySnapshot &state : snapshot.world)
+    if (const EntityHandle *handle = entityIndex.get(entityHandles, state.eid))
     {
-      e.x = x;
-      e.y = y;
-      e.ori = ori;
+      const uint32_t row = entities.get_row(*handle);
+      ships.get<PosX>(row) = state.x;
+      ships.get<PosY>(row) = state.y;
+      ships.get<Ori>(row) = state.ori;
     }
 }
 
-void on_key(ENetPacket *packet)
+void start_key_exchange(ENetPeer *peer)
 {
-  deserialize_and_set_key(packet);
+  uint8_t secret[x25519KeySize];
+  generate_session_secret(secret);
+  session.start(secret);
+  peer->data = &session;
+  send_client_key(peer, session.get_public_key());
+}
+
+// Keys are set, everything from here on is sealed
+void on_server_key(const ServerKeyMsg &msg, ENetPeer *peer)
+{
+  if (!msg.sealed && !allowUnsealed)
+  {
+    printf("Server doesn't seal packets, start with --allow-unsealed to connect anyway\n");
+    enet_peer_disconnect_now(peer, 0);
+    quit = true;
+    return;
+  }
+  if (!session.establish(msg.publicKey, false, msg.sealed))
+  {
+    enet_peer_disconnect(peer, 0);
+    return;
+  }
+  session.set_enabled(msg.sealed);
+  if (my_session_token != 0)
+    send_reattach(peer, my_entity, my_session_token);
+  else
+    send_join(peer);
+}
+
+// What each message from the server does, see ServerToClientMessages
+struct ServerMessageHandler
+{
+  ENetPeer *peer;
+
+  void operator()(const ServerKeyMsg &msg) { on_server_key(msg, peer); }
+  void operator()(const Entity &msg) { on_new_entity(msg); }
+  void operator()(const SetControlledEntityMsg &msg) { my_entity = msg.eid; }
+  void operator()(const SessionTokenMsg &msg) { my_session_token = msg.token; }
+  void operator()(const WorldSnapshotMsg &msg) { on_snapshot(msg.packet, peer); }
+  void operator()(const WorldChunkMsg &msg) { on_world_chunk(msg, peer); }
+  void operator()(const DespawnMsg &msg) { on_despawn(msg.eid); }
+};
+
+static void publish_view()
+{
+  WorldView &view = views.get_back();
+  view.ships.clear();
+  entities.each<EntityColor, PosX, PosY, Ori>([&view](uint32_t color, float x, float y, float ori)
+  {
+    view.ships.push_back({ color, x, y, ori });
+  });
+  views.publish();
+}
+
+// One input per tick, as the server steps one per tick
+static void send_input(ENetHost *client, ENetPeer *serverPeer)
+{
+  if (my_entity == invalid_entity || !entityIndex.contains(my_entity))
+    return;
+  const uint8_t keys = heldKeys.load(std::memory_order_relaxed);
+  float thr = ((keys & E_KEY_UP) ? 1.f : 0.f) + ((keys & E_KEY_DOWN) ? -1.f : 0.f);
+  float steer = ((keys & E_KEY_LEFT) ? -1.f : 0.f) + ((keys & E_KEY_RIGHT) ? 1.f : 0.f);
+
+  // Send, together with the inputs before it in case some were lost
+  sentInputs.push(++inputSeq, { thr, steer });
+  send_entity_input(serverPeer, my_entity, sentInputs);
+  // out now, not at the next service
+  enet_host_flush(client);
+}
+
+static void run_network(ENetHost *client, ENetAddress address, ENetPeer *serverPeer, uint32_t room, uint32_t tickMs)
+{
+  uint32_t nextTick = enet_time_get();
+  while (!quit.load(std::memory_order_relaxed))
+  {
+    // sleep in the service until a packet comes or the next tick is due
+    const int32_t untilTick = int32_t(nextTick - enet_time_get());
+    ENetEvent event;
+    bool changed = false;
+    for (uint32_t timeout = uint32_t(std::max(untilTick, 0)); enet_host_service(client, &event, timeout) > 0; timeout = 0)
+    {
+      switch (event.type)
+      {
+      case ENET_EVENT_TYPE_CONNECT:
+        printf("Connection with %x:%u established\n", event.peer->address.host, event.peer->address.port);
+        start_key_exchange(serverPeer);
+        break;
+      case ENET_EVENT_TYPE_DISCONNECT:
+        // server crashed or restarted, keep reconnecting and reattach to our entity
+        printf("Disconnected, reconnecting\n");
+        // the new server session numbers its snapshots from scratch
+        receivedSnapshots.clear();
+        newestSnapshotSeq = 0;
+        worldTransfer.reset();
+        // what despawned meanwhile is missing from the world we get on reattaching
+        entities.clear();
+        entityIndex.clear();
+        entityHandles.clear();
+        haveWorld = false;
+        despawnedBeforeWorld.clear();
+        serverPeer = enet_host_connect(client, &address, channelCount, room);
+        break;
+      case ENET_EVENT_TYPE_RECEIVE:
+      {
+        ServerMessageHandler handler{ event.peer };
+        receive_packet<ServerToClientMessages>(event.packet, event.peer, event.channelID, handler);
+        enet_packet_destroy(event.packet);
+        changed = true;
+        break;
+      }
+      default:
+        break;
+      };
+    }
+    const uint32_t now = enet_time_get();
+    // don't try to catch up after a long stall, just resume from now
+    if (int32_t(now - nextTick) > int32_t(10 * tickMs))
+      nextTick = now;
+    for (; int32_t(now - nextTick) >= 0; nextTick += tickMs)
+      send_input(client, serverPeer);
+    if (changed)
+      publish_view();
+  }
+  // the server despawns our entity now rather than keeping it for a reattach
+  send_leave(serverPeer);
+  enet_host_flush(client);
+  enet_peer_disconnect_now(serverPeer, 0);
 }
 
 int main(int argc, const char **argv)
 {
+  // the server puts us in this room (from 1), 0 lets it choose
+  uint32_t room = 0;
+  // inputs go out at the server's tick rate, see w10_server --tick
+  uint32_t tickMs = 10;
+  for (int i = 1; i < argc; ++i)
+  {
+    if (strcmp(argv[i], "--room") == 0 && i + 1 < argc)
+      room = uint32_t(atoi(argv[++i]));
+    else if (strcmp(argv[i], "--tick") == 0 && i + 1 < argc)
+      tickMs = uint32_t(std::max(1, atoi(argv[++i])));
+    else if (strcmp(argv[i], "--allow-unsealed") == 0)
+      allowUnsealed = true;
+  }
+
   if (enet_initialize() != 0)
   {
     printf("Cannot init ENet");
     return 1;
   }
 
-  ENetHost *client = enet_host_create(nullptr, 1, 2, 0, 0);
+  ENetHost *client = enet_host_create(nullptr, 1, channelCount, 0, 0);
   if (!client)
   {
     printf("Cannot create ENet client\n");
@@ -68,7 +308,7 @@ int main(int argc, const char **argv)
   enet_address_set_host(&address, "localhost");
   address.port = 10131;
 
-  ENetPeer *serverPeer = enet_host_connect(client, &address, 2, 0);
+  ENetPeer *serverPeer = enet_host_connect(client, &address, channelCount, room);
   if (!serverPeer)
   {
     printf("Cannot connect to server");
@@ -98,68 +338,22 @@ int main(int argc, const char **argv)
 
   SetTargetFPS(60);               // Set our game to run at 60 frames-per-second
 
-  bool connected = false;
-  while (!WindowShouldClose())
+  std::thread network(run_network, client, address, serverPeer, room, tickMs);
+  while (!WindowShouldClose() && !quit.load(std::memory_order_relaxed))
   {
-    float dt = GetFrameTime();
-    ENetEvent event;
-    while (enet_host_service(client, &event, 0) > 0)
-    {
-      switch (event.type)
-      {
-      case ENET_EVENT_TYPE_CONNECT:
-        printf("Connection with %x:%u established\n", event.peer->address.host, event.peer->address.port);
-        send_join(serverPeer);
-        connected = true;
-        break;
-      case ENET_EVENT_TYPE_RECEIVE:
-        switch (get_packet_type(event.packet))
-        {
-        case E_SERVER_TO_CLIENT_NEW_ENTITY:
-          on_new_entity_packet(event.packet);
-          break;
-        case E_SERVER_TO_CLIENT_SET_CONTROLLED_ENTITY:
-          on_set_controlled_entity(event.packet);
-          break;
-        case E_SERVER_TO_CLIENT_SNAPSHOT:
-          on_snapshot(event.packet);
-          break;
-        case E_SERVER_TO_CLIENT_KEY:
-          on_key(event.packet);
-          break;
-        };
-        break;
-      default:
-        break;
-      };
-    }
-    if (my_entity != invalid_entity)
-    {
-      bool left = IsKeyDown(KEY_LEFT);
-      bool right = IsKeyDown(KEY_RIGHT);
-      bool up = IsKeyDown(KEY_UP);
-      bool down = IsKeyDown(KEY_DOWN);
-      // TODO: Direct adressing, of course!
-      for (Entity &e : entities)
-        if (e.eid == my_entity)
-        {
-          // Update
-          float thr = (up ? 1.f : 0.f) + (down ? -1.f : 0.f);
-          float steer = (left ? -1.f : 0.f) + (right ? 1.f : 0.f);
-
-          // Send
-          send_entity_input(serverPeer, my_entity, thr, steer);
-        }
-    }
+    const uint8_t keys = (IsKeyDown(KEY_LEFT) ? E_KEY_LEFT : 0) | (IsKeyDown(KEY_RIGHT) ? E_KEY_RIGHT : 0) |
+                         (IsKeyDown(KEY_UP) ? E_KEY_UP : 0) | (IsKeyDown(KEY_DOWN) ? E_KEY_DOWN : 0);
+    heldKeys.store(keys, std::memory_order_relaxed);
+    views.update();
 
     BeginDrawing();
       ClearBackground(GRAY);
       BeginMode2D(camera);
         DrawRectangleLines(-16, -8, 32, 16, GetColor(0xff00ffff));
-        for (const Entity &e : entities)
+        for (const DrawnShip &ship : views.get_front().ships)
         {
-          const Rectangle rect = {e.x, e.y, 3.f, 1.f};
-          DrawRectanglePro(rect, {0.f, 0.5f}, e.ori * 180.f / PI, GetColor(e.color));
+          const Rectangle rect = {ship.x, ship.y, 3.f, 1.f};
+          DrawRectanglePro(rect, {0.f, 0.5f}, ship.ori * 180.f / PI, GetColor(ship.color));
         }
 
 
@@ -167,6 +361,8 @@ int main(int argc, const char **argv)
     EndDrawing();
   }
 
+  quit = true;
+  network.join();
   CloseWindow();
   return 0;
 }
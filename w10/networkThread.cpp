@@ -0,0 +1,239 @@
+#include "networkThread.h"
+#include "profiler.h"
+#include <stdio.h>
+#include <chrono>
+
+// how long a service waits for packets before the outbound ring is looked at again
+constexpr uint32_t serviceTimeoutMs = 1;
+constexpr uint32_t linkIntervalMs = 100;
+constexpr uint32_t telemetryIntervalMs = 1000;
+
+// Key messages are answered here, everything else goes to the simulation
+struct NetworkThread::InboundHandler
+{
+  NetworkThread &network;
+  ENetPeer *peer;
+  NetworkEvent &event;
+  bool forward = false;
+
+  void operator()(const ClientKeyMsg &msg) { network.on_client_key(msg, peer); }
+  template<typename Msg>
+  void operator()(const Msg &msg)
+  {
+    event.message = msg;
+    forward = true;
+  }
+};
+
+NetworkThread::NetworkThread(ENetHost *host, bool sealPackets, size_t inboundCapacity, size_t outboundCapacity)
+  : host(host), sealPackets(sealPackets), inbound(inboundCapacity), outbound(outboundCapacity),
+    connections(host->peerCount, 0), knownConnections(host->peerCount, 0)
+{
+}
+
+NetworkThread::~NetworkThread()
+{
+  stop();
+}
+
+void NetworkThread::start(TelemetryServer *server)
+{
+  stop();
+  telemetryServer = server;
+  quit = false;
+  thread = std::thread(&NetworkThread::run, this);
+}
+
+void NetworkThread::stop()
+{
+  quit = true;
+  if (!thread.joinable())
+    return;
+  thread.join();
+  OutgoingPacket out;
+  while (outbound.pop(out))
+    enet_packet_destroy(out.packet);
+}
+
+bool NetworkThread::poll(NetworkEvent &event)
+{
+  if (!inbound.pop(event))
+    return false;
+  if (event.type == E_NETWORK_CONNECT)
+    knownConnections[event.peer - host->peers] = event.connection;
+  return true;
+}
+
+void NetworkThread::send(PacketOutbox &outbox)
+{
+  size_t kept = 0;
+  for (OutgoingPacket &out : outbox)
+  {
+    // made for a connection the simulation has since seen replaced, nothing
+    // of it may go to the peer now in that slot
+    if (out.connection != knownConnections[out.peer - host->peers])
+    {
+      get_net_telemetry().count_drop(E_TELEMETRY_SENT, out.channel, uint8_t(get_packet_type(out.packet)));
+      enet_packet_destroy(out.packet);
+      continue;
+    }
+    if (outbound.push(out))
+      continue;
+    // a snapshot is sent again, against an older baseline, if it is lost
+    if ((out.packet->flags & ENET_PACKET_FLAG_RELIABLE) == 0)
+    {
+      get_net_telemetry().count_queue_full(E_TELEMETRY_SENT, true);
+      enet_packet_destroy(out.packet);
+      continue;
+    }
+    get_net_telemetry().count_queue_full(E_TELEMETRY_SENT, false);
+    outbox[kept++] = out;
+  }
+  outbox.resize(kept);
+}
+
+void NetworkThread::run()
+{
+  set_profile_thread_name("network");
+  NetTelemetry &telemetry = get_net_telemetry();
+  lastTelemetrySample = lastLinkTime = enet_time_get();
+  telemetry.sample(host, lastTelemetrySample);
+  while (!quit.load(std::memory_order_relaxed))
+  {
+    service();
+    send_outbound();
+    const uint32_t now = enet_time_get();
+    if (now - lastLinkTime >= linkIntervalMs)
+    {
+      lastLinkTime = now;
+      push_links();
+    }
+    PROFILE_ZONE("telemetry");
+    if (now - lastTelemetrySample >= telemetryIntervalMs)
+    {
+      lastTelemetrySample = now;
+      telemetry.sample(host, now);
+    }
+    if (telemetryServer)
+      telemetryServer->poll(telemetry, now);
+  }
+}
+
+void NetworkThread::service()
+{
+  ENetEvent event;
+  for (uint32_t timeout = serviceTimeoutMs; enet_host_service(host, &event, timeout) > 0; timeout = 0)
+  {
+    PROFILE_ZONE("receive");
+    const size_t i = event.peer - host->peers;
+    NetworkEvent out;
+    out.peer = event.peer;
+    switch (event.type)
+    {
+    case ENET_EVENT_TYPE_CONNECT:
+      printf("Connection with %x:%u established\n", event.peer->address.host, event.peer->address.port);
+      event.peer->data = new SecureSession;
+      out.type = E_NETWORK_CONNECT;
+      out.connection = ++connections[i];
+      out.data = event.data;
+      push_waiting(out);
+      break;
+    case ENET_EVENT_TYPE_DISCONNECT:
+      printf("Disconnected %x:%u \n", event.peer->address.host, event.peer->address.port);
+      out.type = E_NETWORK_DISCONNECT;
+      push_waiting(out);
+      delete (SecureSession*)event.peer->data;
+      event.peer->data = nullptr;
+      break;
+    case ENET_EVENT_TYPE_RECEIVE:
+      on_receive(event.packet, event.peer, event.channelID);
+      enet_packet_destroy(event.packet);
+      break;
+    default:
+      break;
+    };
+  }
+}
+
+void NetworkThread::on_receive(ENetPacket *packet, ENetPeer *peer, uint8_t channel)
+{
+  NetworkEvent event;
+  event.peer = peer;
+  InboundHandler handler{ *this, peer, event };
+  if (!receive_packet<ClientToServerMessages>(packet, peer, channel, handler) || !handler.forward)
+    return;
+  if ((packet->flags & ENET_PACKET_FLAG_RELIABLE) != 0)
+    push_waiting(event);
+  // the next input packet repeats this one's inputs, the next ack a newer seq
+  else if (!inbound.push(event))
+    get_net_telemetry().count_queue_full(E_TELEMETRY_RECEIVED, true);
+}
+
+void NetworkThread::on_client_key(const ClientKeyMsg &msg, ENetPeer *peer)
+{
+  SecureSession *session = (SecureSession*)peer->data;
+  // open_packet drops those, one exchange per connection
+  if (session->is_established())
+    return;
+  uint8_t secret[x25519KeySize];
+  generate_session_secret(secret);
+  session->start(secret);
+  if (!session->establish(msg.publicKey, true, sealPackets))
+  {
+    enet_peer_disconnect(peer, 0);
+    return;
+  }
+  session->set_enabled(sealPackets);
+  send_server_key(peer, session->get_public_key(), sealPackets);
+}
+
+void NetworkThread::push_waiting(const NetworkEvent &event)
+{
+  if (inbound.push(event))
+    return;
+  get_net_telemetry().count_queue_full(E_TELEMETRY_RECEIVED, false);
+  PROFILE_ZONE("inbound_full");
+  while (!inbound.push(event) && !quit.load(std::memory_order_relaxed))
+    std::this_thread::sleep_for(std::chrono::microseconds(100));
+}
+
+void NetworkThread::send_outbound()
+{
+  PROFILE_ZONE("send");
+  OutgoingPacket out;
+  bool sent = false;
+  while (outbound.pop(out))
+  {
+    // the peer left (and maybe another took its slot) since this was sent
+    if (out.connection != connections[out.peer - host->peers] || out.peer->state != ENET_PEER_STATE_CONNECTED)
+    {
+      get_net_telemetry().count_drop(E_TELEMETRY_SENT, out.channel, uint8_t(get_packet_type(out.packet)));
+      enet_packet_destroy(out.packet);
+      continue;
+    }
+    send_outgoing_packet(out);
+    sent = true;
+  }
+  if (sent)
+    enet_host_flush(host);
+}
+
+void NetworkThread::push_links()
+{
+  NetworkEvent event;
+  event.type = E_NETWORK_LINK;
+  for (size_t i = 0; i < host->peerCount; ++i)
+  {
+    const ENetPeer &peer = host->peers[i];
+    if (peer.state != ENET_PEER_STATE_CONNECTED)
+      continue;
+    event.peer = &host->peers[i];
+    event.link.incomingBandwidth = peer.incomingBandwidth;
+    event.link.packetThrottle = peer.packetThrottle;
+    event.link.packetLoss = peer.packetLoss;
+    event.link.roundTripTime = peer.roundTripTime;
+    // the next one is no more than linkIntervalMs away
+    if (!inbound.push(event))
+      get_net_telemetry().count_queue_full(E_TELEMETRY_RECEIVED, true);
+  }
+}
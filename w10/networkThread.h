@@ -0,0 +1,107 @@
+#pragma once
+#include <enet/enet.h>
+#include <atomic>
+#include <cstdint>
+#include <thread>
+#include <vector>
+#include "protocol.h"
+#include "spscRing.h"
+#include "telemetryServer.h"
+
+// How ENet measures the link of a peer, what its snapshots are sized by
+struct PeerLink
+{
+  uint32_t incomingBandwidth = 0;
+  uint32_t packetThrottle = ENET_PEER_PACKET_THROTTLE_SCALE;
+  uint32_t packetLoss = 0;
+  uint32_t roundTripTime = 0;
+};
+
+enum NetworkEventType : uint8_t
+{
+  E_NETWORK_CONNECT = 0,
+  E_NETWORK_DISCONNECT,
+  E_NETWORK_MESSAGE,
+  E_NETWORK_LINK
+};
+
+// What the network thread hands the simulation: a peer connected (with the
+// data it connected with) or left, one of its messages, opened and decoded,
+// or how its link measures now.
+struct NetworkEvent
+{
+  NetworkEventType type = E_NETWORK_MESSAGE;
+  ENetPeer *peer = nullptr;
+  // of a connect, which connection of peer it is
+  uint32_t connection = 0;
+  uint32_t data = 0;
+  ClientToServerMessages::MessageVariant message;
+  PeerLink link;
+};
+
+// A thread of its own owning the host, so acks and pings go out however long
+// a tick takes and a burst of packets doesn't hold up the simulation. It
+// services the host all the time, does the key exchange, opens and decodes
+// every packet and pushes what the simulation needs into one bounded ring;
+// the simulation pushes what it sends into another, which this thread seals
+// and hands to ENet. Nothing else is shared, every SecureSession, the peers
+// and the telemetry's samples are this thread's alone.
+//
+// When the ring to the simulation is full, inputs and acks (sent unreliably
+// anyway) are dropped and anything else waits for room; when the one back is
+// full, snapshots are dropped and reliable messages stay in the room's outbox
+// for the next try. Both count in the telemetry, see count_queue_full().
+//
+//   NetworkThread network(host, sealPackets);
+//   network.start(nullptr);
+//   NetworkEvent event;
+//   while (network.poll(event)) { ... }  // on the simulation's thread
+//   network.send(outbox);
+class NetworkThread
+{
+public:
+  NetworkThread(ENetHost *host, bool sealPackets, size_t inboundCapacity = 4096, size_t outboundCapacity = 16384);
+  NetworkThread(const NetworkThread &) = delete;
+  NetworkThread &operator=(const NetworkThread &) = delete;
+  ~NetworkThread();
+
+  // telemetryServer (may be null) is polled on the network thread
+  void start(TelemetryServer *telemetryServer);
+  void stop();
+
+  // On the simulation's thread. False once nothing is waiting.
+  bool poll(NetworkEvent &event);
+  // On the simulation's thread: moves what fits of outbox to the network
+  // thread, what stays is for the next call. Every packet must carry the
+  // connection of the E_NETWORK_CONNECT it was made for, one for an older
+  // connection of its peer is dropped.
+  void send(PacketOutbox &outbox);
+
+private:
+  void run();
+  void service();
+  void on_receive(ENetPacket *packet, ENetPeer *peer, uint8_t channel);
+  void on_client_key(const ClientKeyMsg &msg, ENetPeer *peer);
+  // for events the simulation can't do without, waits while the ring is full
+  void push_waiting(const NetworkEvent &event);
+  void send_outbound();
+  void push_links();
+
+  struct InboundHandler;
+
+  ENetHost *host;
+  const bool sealPackets;
+  SpscRing<NetworkEvent> inbound;
+  SpscRing<OutgoingPacket> outbound;
+  std::thread thread;
+  std::atomic<bool> quit{ false };
+  TelemetryServer *telemetryServer = nullptr;
+
+  // connections[i] counts the connections of host->peers[i], so that a
+  // packet meant for a peer that left doesn't go to the next one in its slot;
+  // knownConnections[i] is the last the simulation has seen
+  std::vector<uint32_t> connections;
+  std::vector<uint32_t> knownConnections;
+  uint32_t lastLinkTime = 0;
+  uint32_t lastTelemetrySample = 0;
+};
@@ -1,180 +1,376 @@
 #include "protocol.h"
 #include "quantisation.h"
+#include "messageSchema.h"
+#include "snapshotDelta.h"
+#include <algorithm>
 #include <cstring> // memcpy
 #include <iostream>
-#include <stdlib.h>
 
-static uint32_t xorCipherKey = 0;
+static thread_local PacketOutbox *packetOutbox = nullptr;
 
-void send_join(ENetPeer *peer)
+void set_packet_outbox(PacketOutbox *outbox)
 {
-  ENetPacket *packet = enet_packet_create(nullptr, sizeof(uint8_t), ENET_PACKET_FLAG_RELIABLE);
-  *packet->data = E_CLIENT_TO_SERVER_JOIN;
+  packetOutbox = outbox;
+}
 
-  enet_peer_send(peer, 0, packet);
+// Every packet goes out through here and is counted in the telemetry by the
+// type byte, which sealing leaves in the clear. Returns the bytes sent, 0 if
+// the send failed.
+static size_t send_counted(ENetPeer *peer, uint8_t channel, ENetPacket *packet)
+{
+  // ENet may be done with the packet once it is sent
+  const uint8_t type = uint8_t(get_packet_type(packet));
+  const size_t sentSize = packet->dataLength;
+  if (enet_peer_send(peer, channel, packet) < 0)
+  {
+    get_net_telemetry().count_drop(E_TELEMETRY_SENT, channel, type);
+    enet_packet_destroy(packet);
+    return 0;
+  }
+  get_net_telemetry().count(E_TELEMETRY_SENT, channel, type, sentSize);
+  return sentSize;
 }
 
-void send_new_entity(ENetPeer *peer, const Entity &ent)
+// Seals packet in place once the peer's session (peer->data) is established.
+// False if it can't grow to fit, the packet is destroyed and counted as dropped.
+static bool seal_packet(ENetPeer *peer, uint8_t channel, ENetPacket *packet)
+{
+  SecureSession *session = (SecureSession*)peer->data;
+  if (!session || !session->is_established() || !session->is_enabled())
+    return true;
+  const size_t size = packet->dataLength;
+  if (enet_packet_resize(packet, size + sealOverhead) < 0)
+  {
+    get_net_telemetry().count_drop(E_TELEMETRY_SENT, channel, uint8_t(get_packet_type(packet)));
+    enet_packet_destroy(packet);
+    return false;
+  }
+  packet->dataLength = session->seal(channel, packet->data, size);
+  return true;
+}
+
+size_t send_outgoing_packet(const OutgoingPacket &out)
+{
+  if (out.seal && !seal_packet(out.peer, out.channel, out.packet))
+    return 0;
+  return send_counted(out.peer, out.channel, out.packet);
+}
+
+// Every message but the key exchange is sent with this, sealed
+static size_t send_packet(ENetPeer *peer, uint8_t channel, ENetPacket *packet)
+{
+  OutgoingPacket out;
+  out.peer = peer;
+  out.channel = channel;
+  out.packet = packet;
+  if (!packetOutbox)
+    return send_outgoing_packet(out);
+  packetOutbox->push_back(out);
+  return packet->dataLength;
+}
+
+void send_join(ENetPeer *peer)
 {
-  ENetPacket *packet = enet_packet_create(nullptr, sizeof(uint8_t) + sizeof(Entity),
-                                                   ENET_PACKET_FLAG_RELIABLE);
-  uint8_t *ptr = packet->data;
-  *ptr = E_SERVER_TO_CLIENT_NEW_ENTITY; ptr += sizeof(uint8_t);
-  memcpy(ptr, &ent, sizeof(Entity)); ptr += sizeof(Entity);
+  send_packet(peer, 0, create_message_packet(joinSchema, {}, ENET_PACKET_FLAG_RELIABLE));
+}
 
-  enet_peer_send(peer, 0, packet);
+void send_new_entity(ENetPeer *peer, const Entity &ent)
+{
+  send_packet(peer, 0, create_message_packet(newEntitySchema, ent, ENET_PACKET_FLAG_RELIABLE));
 }
 
 void send_set_controlled_entity(ENetPeer *peer, uint16_t eid)
 {
-  ENetPacket *packet = enet_packet_create(nullptr, sizeof(uint8_t) + sizeof(uint16_t),
-                                                   ENET_PACKET_FLAG_RELIABLE);
-  uint8_t *ptr = packet->data;
-  *ptr = E_SERVER_TO_CLIENT_SET_CONTROLLED_ENTITY; ptr += sizeof(uint8_t);
-  memcpy(ptr, &eid, sizeof(uint16_t)); ptr += sizeof(uint16_t);
+  send_packet(peer, 0, create_message_packet(setControlledEntitySchema, { eid }, ENET_PACKET_FLAG_RELIABLE));
+}
 
-  enet_peer_send(peer, 0, packet);
+void send_despawn(ENetPeer *peer, uint16_t eid)
+{
+  send_packet(peer, 0, create_message_packet(despawnSchema, { eid }, ENET_PACKET_FLAG_RELIABLE));
 }
 
-void send_cipher_key(ENetPeer *peer, uint32_t key)
+void send_leave(ENetPeer *peer)
 {
-  ENetPacket *packet = enet_packet_create(nullptr, sizeof(uint8_t) + sizeof(uint32_t),
-                                                   ENET_PACKET_FLAG_RELIABLE);
-  uint8_t *ptr = packet->data;
-  *ptr = E_SERVER_TO_CLIENT_KEY; ptr += sizeof(uint8_t);
-  memcpy(ptr, &key, sizeof(uint32_t)); ptr += sizeof(uint32_t);
+  send_packet(peer, 0, create_message_packet(leaveSchema, {}, ENET_PACKET_FLAG_RELIABLE));
+}
+
+// The key exchange itself always goes in the clear
+static void send_key_packet(ENetPeer *peer, ENetPacket *packet)
+{
+  OutgoingPacket out;
+  out.peer = peer;
+  out.packet = packet;
+  out.seal = false;
+  if (packetOutbox)
+    packetOutbox->push_back(out);
+  else
+    send_outgoing_packet(out);
+}
 
-  enet_peer_send(peer, 0, packet);
+void send_client_key(ENetPeer *peer, const uint8_t publicKey[x25519KeySize])
+{
+  ClientKeyMsg msg;
+  memcpy(msg.publicKey, publicKey, x25519KeySize);
+  send_key_packet(peer, create_message_packet(clientKeySchema, msg, ENET_PACKET_FLAG_RELIABLE));
 }
 
-void fuzz_packet_data(ENetPacket *packet)
+void send_server_key(ENetPeer *peer, const uint8_t publicKey[x25519KeySize], bool sealed)
 {
-  packet->data[rand() % packet->dataLength] = (uint8_t)rand();
+  ServerKeyMsg msg;
+  memcpy(msg.publicKey, publicKey, x25519KeySize);
+  msg.sealed = sealed;
+  send_key_packet(peer, create_message_packet(serverKeySchema, msg, ENET_PACKET_FLAG_RELIABLE));
 }
 
-void send_entity_input(ENetPeer *peer, uint16_t eid, float thr, float ori)
+void send_session_token(ENetPeer *peer, uint16_t eid, uint32_t token)
 {
-  ENetPacket *packet = enet_packet_create(nullptr, sizeof(uint8_t) + sizeof(uint16_t) +
-                                                   sizeof(float) * 2,
-                                                   //sizeof(uint8_t),
-                                                   ENET_PACKET_FLAG_UNSEQUENCED);
-  uint8_t *ptr = packet->data;
-  *ptr = E_CLIENT_TO_SERVER_INPUT; ptr += sizeof(uint8_t);
-  memcpy(ptr, &eid, sizeof(uint16_t)); ptr += sizeof(uint16_t);
-  memcpy(ptr, &thr, sizeof(float)); ptr += sizeof(float);
-  memcpy(ptr, &ori, sizeof(float)); ptr += sizeof(float);
-  /*
-  float4bitsQuantized thrPacked(thr, -1.f, 1.f);
-  float4bitsQuantized oriPacked(ori, -1.f, 1.f);
-  uint8_t thrSteerPacked = (thrPacked.packedVal << 4) | oriPacked.packedVal;
-  memcpy(ptr, &thrSteerPacked, sizeof(uint8_t)); ptr += sizeof(uint8_t);
-  */
-  /*
-  memcpy(ptr, &thrPacked, sizeof(uint8_t)); ptr += sizeof(uint8_t);
-  memcpy(ptr, &oriPacked, sizeof(uint8_t)); ptr += sizeof(uint8_t);
-  */
+  send_packet(peer, 0, create_message_packet(sessionTokenSchema, { eid, token }, ENET_PACKET_FLAG_RELIABLE));
+}
 
-  fuzz_packet_data(packet);
-  cipher_data(packet);
+void send_reattach(ENetPeer *peer, uint16_t eid, uint32_t token)
+{
+  send_packet(peer, 0, create_message_packet(reattachSchema, { eid, token }, ENET_PACKET_FLAG_RELIABLE));
+}
 
-  enet_peer_send(peer, 1, packet);
+// thr and steer in 4 bits each, neutral unpacks to exactly 0
+static uint8_t pack_input(const InputCmd &cmd)
+{
+  float4bitsQuantized thrPacked(cmd.thr, -1.f, 1.f);
+  float4bitsQuantized steerPacked(cmd.steer, -1.f, 1.f);
+  return (thrPacked.packedVal << 4) | steerPacked.packedVal;
 }
 
-void send_snapshot(ENetPeer *peer, uint16_t eid, float x, float y, float ori)
+// All 16 values unpacked once, the server unpacks 8 inputs per packet
+struct UnpackedInputTable
 {
-  ENetPacket *packet = enet_packet_create(nullptr, sizeof(uint8_t) + sizeof(uint16_t) +
-                                                   sizeof(uint16_t) +
-                                                   sizeof(uint16_t) +
-                                                   sizeof(uint8_t),
-                                                   ENET_PACKET_FLAG_UNSEQUENCED);
-  uint8_t *ptr = packet->data;
-  *ptr = E_SERVER_TO_CLIENT_SNAPSHOT; ptr += sizeof(uint8_t);
-  memcpy(ptr, &eid, sizeof(uint16_t)); ptr += sizeof(uint16_t);
-  uint16_t xPacked = pack_float<uint16_t>(x, -16.f, 16.f, 11);
-  uint16_t yPacked = pack_float<uint16_t>(y, -8.f, 8.f, 10);
-  uint8_t oriPacked = pack_float<uint8_t>(ori, -PI, PI, 8);
-  //printf("xPacked/unpacked %d %f\n", xPacked, x);
-  memcpy(ptr, &xPacked, sizeof(uint16_t)); ptr += sizeof(uint16_t);
-  memcpy(ptr, &yPacked, sizeof(uint16_t)); ptr += sizeof(uint16_t);
-  memcpy(ptr, &oriPacked, sizeof(uint8_t)); ptr += sizeof(uint8_t);
+  float values[16];
 
-  enet_peer_send(peer, 1, packet);
+  UnpackedInputTable()
+  {
+    const uint8_t neutralPackedValue = pack_float<uint8_t>(0.f, -1.f, 1.f, 4);
+    for (uint8_t i = 0; i < 16; ++i)
+      values[i] = i == neutralPackedValue ? 0.f : float4bitsQuantized(i).unpack(-1.f, 1.f);
+  }
+};
+static const UnpackedInputTable unpackedInputs;
+
+static InputCmd unpack_input(uint8_t thrSteerPacked)
+{
+  InputCmd cmd;
+  cmd.thr = unpackedInputs.values[thrSteerPacked >> 4];
+  cmd.steer = unpackedInputs.values[thrSteerPacked & 0x0f];
+  return cmd;
 }
 
-MessageType get_packet_type(ENetPacket *packet)
+void send_entity_input(ENetPeer *peer, uint16_t eid, const InputWindow<InputCmd, inputWindowSize> &inputs)
 {
-  return (MessageType)*packet->data;
+  EntityInputMsg msg;
+  msg.eid = eid;
+  msg.firstSeq = inputs.get_first_seq();
+  msg.count = uint8_t(inputs.get_count());
+  for (uint32_t i = 0; i < msg.count; ++i)
+    msg.packedInputs[i] = pack_input(inputs.get(msg.firstSeq + i));
+
+  send_packet(peer, 1, create_message_packet(entityInputSchema, msg, ENET_PACKET_FLAG_UNSEQUENCED));
 }
 
-void deserialize_new_entity(ENetPacket *packet, Entity &ent)
+// x, y, ori in 11, 10 and 8 bits, small changes as 8, 8 and 4 bit deltas
+static constexpr auto snapshotSchema = make_message_schema<EntitySnapshot>(E_SERVER_TO_CLIENT_SNAPSHOT,
+  range_field(&EntitySnapshot::x, -16.f, 16.f, 11, 8),
+  range_field(&EntitySnapshot::y, -8.f, 8.f, 10, 8),
+  range_field(&EntitySnapshot::ori, -PI, PI, 8, 4));
+static_assert(snapshotSchema.is_valid());
+static_assert(snapshotHistorySize < 256, "baseline age is sent in 8 bits");
+static_assert(get_world_delta_context_count(snapshotSchema) == snapshotCoderContexts);
+
+// [8: type][32: seq][8: seq - baseline seq, 0 for none][8: flags], then the
+// world delta, range coded from the first byte after the header if flagged
+constexpr uint32_t snapshotHeaderBits = 8 + 32 + 8 + 8;
+constexpr size_t snapshotHeaderSize = snapshotHeaderBits / 8;
+constexpr uint32_t snapshotCodedFlag = 1;
+
+void finish_world_snapshot(WorldSnapshot &world)
 {
-  uint8_t *ptr = packet->data; ptr += sizeof(uint8_t);
-  ent = *(Entity*)(ptr); ptr += sizeof(Entity);
+  for (EntitySnapshot &state : world)
+    snapshotSchema.quantize(state);
+  std::sort(world.begin(), world.end(),
+            [](const EntitySnapshot &a, const EntitySnapshot &b) { return a.eid < b.eid; });
+}
+
+void make_world_snapshot(const std::vector<Entity> &entities, WorldSnapshot &world)
+{
+  world.resize(entities.size());
+  for (size_t i = 0; i < entities.size(); ++i)
+  {
+    const Entity &e = entities[i];
+    world[i] = { e.eid, e.x, e.y, e.ori };
+  }
+  finish_world_snapshot(world);
 }
 
-void deserialize_set_controlled_entity(ENetPacket *packet, uint16_t &eid)
+static void write_world_snapshot_header(BitWriter &writer, uint32_t seq, uint32_t baselineSeq, bool hasBaseline,
+                                        uint32_t flags)
 {
-  uint8_t *ptr = packet->data; ptr += sizeof(uint8_t);
-  eid = *(uint16_t*)(ptr); ptr += sizeof(uint16_t);
+  writer.write(E_SERVER_TO_CLIENT_SNAPSHOT, 8);
+  writer.write(seq, 32);
+  writer.write(hasBaseline ? seq - baselineSeq : 0, 8);
+  writer.write(flags, 8);
 }
 
-void xor_packet_data(ENetPacket *packet, uint8_t *key_ptr)
+size_t encode_world_snapshot(std::vector<uint8_t> &buffer, uint32_t seq, uint32_t baselineSeq,
+                             const ReplicatedSnapshot *baseline, const WorldSnapshot &world, bool coded,
+                             ReplicatedSnapshot &sent)
 {
-  uint8_t *ptr = packet->data; ptr += sizeof(uint8_t);
-  uint8_t *end = packet->data + packet->dataLength;
-  for (int i = 0; ptr < end; ++ptr, ++i)
+  const WorldSnapshot *baselineWorld = baseline ? &baseline->world : nullptr;
+  const size_t maxBits = snapshotHeaderBits +
+                         get_max_world_delta_bits(snapshotSchema, baseline ? baseline->world.size() : 0, world.size());
+  buffer.assign((maxBits + 7) / 8, 0);
+  sent.world = world;
+  if (baseline)
+    sent.model = baseline->model;
+  else
+    sent.model.reset();
+
+  if (coded)
   {
-    i = i % 4;
-    *ptr ^= key_ptr[i];
+    // the model adapts while coding, what it ends as goes with the snapshot
+    SnapshotModel model = sent.model;
+    RangeEncoder encoder(buffer.data() + snapshotHeaderSize, buffer.size() - snapshotHeaderSize);
+    RangeBitWriter<snapshotCoderContexts> writer(encoder, model);
+    if (write_world_delta(writer, snapshotSchema, baselineWorld, world) == 0 && baseline)
+      return 0;
+    const size_t size = encoder.finish();
+    if (!encoder.is_overflowed())
+    {
+      BitWriter header(buffer.data(), snapshotHeaderSize);
+      write_world_snapshot_header(header, seq, baselineSeq, baseline != nullptr, snapshotCodedFlag);
+      sent.model = model;
+      return snapshotHeaderSize + size;
+    }
+    buffer.assign(buffer.size(), 0);
   }
+
+  BitWriter writer(buffer.data(), buffer.size());
+  write_world_snapshot_header(writer, seq, baselineSeq, baseline != nullptr, 0);
+  if (write_world_delta(writer, snapshotSchema, baselineWorld, world) == 0 && baseline)
+    return 0;
+  return writer.get_byte_count();
 }
 
-void cipher_data(ENetPacket *packet)
+size_t send_world_snapshot(ENetPeer *peer, uint32_t seq, uint32_t baselineSeq, const ReplicatedSnapshot *baseline,
+                           const WorldSnapshot &world, bool coded, ReplicatedSnapshot &sent)
 {
-  xor_packet_data(packet, (uint8_t*)&xorCipherKey);
+  // one per thread, rooms send snapshots from several
+  static thread_local std::vector<uint8_t> buffer;
+  const size_t size = encode_world_snapshot(buffer, seq, baselineSeq, baseline, world, coded, sent);
+  if (size == 0)
+    return 0;
+
+  ENetPacket *packet = enet_packet_create(buffer.data(), size, ENET_PACKET_FLAG_UNSEQUENCED);
+  return send_packet(peer, 1, packet);
 }
 
-void decipher_data(ENetPacket *packet, ENetPeer *peer)
+uint32_t get_entity_snapshot_bits(const EntitySnapshot *baseline, const EntitySnapshot &state)
 {
-  xor_packet_data(packet, (uint8_t*)peer->data);
+  return get_world_delta_record_bits(snapshotSchema, baseline, state);
 }
 
-void deserialize_entity_input(ENetPacket *packet, uint16_t &eid, float &thr, float &steer)
+void send_snapshot_ack(ENetPeer *peer, uint32_t seq)
 {
-  uint8_t *ptr = packet->data; ptr += sizeof(uint8_t);
+  send_packet(peer, 1, create_message_packet(snapshotAckSchema, { seq }, ENET_PACKET_FLAG_UNSEQUENCED));
+}
+
+// A new entity's fields but the eid, the world delta's records carry that
+static constexpr auto worldStateSchema = make_message_schema<Entity>(E_SERVER_TO_CLIENT_WORLD_CHUNK,
+  bits_field(&Entity::color, 32),
+  float_field(&Entity::x),
+  float_field(&Entity::y),
+  float_field(&Entity::speed),
+  float_field(&Entity::ori),
+  float_field(&Entity::thr),
+  float_field(&Entity::steer));
 
-  eid = *(uint16_t*)(ptr); ptr += sizeof(uint16_t);
-  thr = *(float*)(ptr); ptr += sizeof(float);
-  steer = *(float*)(ptr); ptr += sizeof(float);
-  //uint8_t thrSteerPacked = *(uint8_t*)(ptr); ptr += sizeof(uint8_t);
-  /*
-  uint8_t thrPacked = *(uint8_t*)(ptr); ptr += sizeof(uint8_t);
-  uint8_t oriPacked = *(uint8_t*)(ptr); ptr += sizeof(uint8_t);
-  */
-  /*
-  static uint8_t neutralPackedValue = pack_float<uint8_t>(0.f, -1.f, 1.f, 4);
-  float4bitsQuantized thrPacked(thrSteerPacked >> 4);
-  float4bitsQuantized steerPacked(thrSteerPacked & 0x0f);
-  thr = thrPacked.packedVal == neutralPackedValue ? 0.f : thrPacked.unpack(-1.f, 1.f);
-  steer = steerPacked.packedVal == neutralPackedValue ? 0.f : steerPacked.unpack(-1.f, 1.f);
-  */
+bool encode_world_state(const std::vector<Entity> &world, std::vector<uint8_t> &data)
+{
+  return write_world_state(worldStateSchema, world, data);
+}
+
+bool decode_world_state(const uint8_t *data, size_t size, std::vector<Entity> &world)
+{
+  return read_world_state(worldStateSchema, data, size, world);
 }
 
-void deserialize_snapshot(ENetPacket *packet, uint16_t &eid, float &x, float &y, float &ori)
+void send_world_chunk(ENetPeer *peer, const WorldChunkMsg &chunk)
 {
-  uint8_t *ptr = packet->data; ptr += sizeof(uint8_t);
-  eid = *(uint16_t*)(ptr); ptr += sizeof(uint16_t);
-  uint16_t xPacked = *(uint16_t*)(ptr); ptr += sizeof(uint16_t);
-  uint16_t yPacked = *(uint16_t*)(ptr); ptr += sizeof(uint16_t);
-  uint8_t oriPacked = *(uint8_t*)(ptr); ptr += sizeof(uint8_t);
-  x = unpack_float<uint16_t>(xPacked, -16.f, 16.f, 11);
-  y = unpack_float<uint16_t>(yPacked, -8.f, 8.f, 10);
-  ori = unpack_float<uint8_t>(oriPacked, -PI, PI, 8);
+  send_packet(peer, worldTransferChannel, create_message_packet(worldChunkSchema, chunk, ENET_PACKET_FLAG_RELIABLE));
 }
 
-void deserialize_and_set_key(ENetPacket *packet)
+void send_world_state_ack(ENetPeer *peer, uint16_t transfer, uint16_t received)
 {
-  uint8_t *ptr = packet->data; ptr += sizeof(uint8_t);
-  xorCipherKey = *(uint32_t*)(ptr); ptr += sizeof(uint32_t);
+  send_packet(peer, worldTransferChannel,
+              create_message_packet(worldStateAckSchema, { transfer, received }, ENET_PACKET_FLAG_RELIABLE));
 }
 
+MessageType get_packet_type(ENetPacket *packet)
+{
+  return packet->dataLength > 0 ? (MessageType)*packet->data : E_INVALID_MESSAGE;
+}
+
+bool open_packet(ENetPacket *packet, ENetPeer *peer, uint8_t channel)
+{
+  if (packet->dataLength == 0)
+    return false;
+  const MessageType type = get_packet_type(packet);
+  SecureSession *session = (SecureSession*)peer->data;
+  // Keys only go in the clear until the session has them, a key message
+  // after that would restart it with keys of whoever sent it
+  if (type == E_CLIENT_TO_SERVER_KEY || type == E_SERVER_TO_CLIENT_KEY)
+    return session && !session->is_established();
+  if (!session || !session->is_established())
+    return false;
+  size_t size = packet->dataLength;
+  if (!session->open(channel, packet->data, size))
+    return false;
+  packet->dataLength = size;
+  return true;
+}
+
+uint32_t unpack_entity_input(const EntityInputMsg &msg, InputCmd *cmds)
+{
+  // a received count is never over inputWindowSize, one set locally might be
+  const uint32_t count = std::min<uint32_t>(msg.count, inputWindowSize);
+  for (uint32_t i = 0; i < count; ++i)
+    cmds[i] = unpack_input(msg.packedInputs[i]);
+  return count;
+}
+
+bool read_world_snapshot_header(ENetPacket *packet, uint32_t &seq, uint32_t &baselineSeq)
+{
+  BitReader reader(packet->data, packet->dataLength);
+  reader.read(8);
+  seq = reader.read(32);
+  const uint32_t age = reader.read(8);
+  const uint32_t flags = reader.read(8);
+  baselineSeq = age != 0 ? seq - age : 0;
+  return !reader.is_overflowed() && (age == 0 || baselineSeq != 0) && (flags & ~snapshotCodedFlag) == 0;
+}
+
+bool read_world_snapshot(ENetPacket *packet, const ReplicatedSnapshot *baseline, ReplicatedSnapshot &snapshot)
+{
+  if (packet->dataLength < snapshotHeaderSize)
+    return false;
+  const WorldSnapshot *baselineWorld = baseline ? &baseline->world : nullptr;
+  if (baseline)
+    snapshot.model = baseline->model;
+  else
+    snapshot.model.reset();
+  if ((packet->data[snapshotHeaderSize - 1] & snapshotCodedFlag) == 0)
+  {
+    BitReader reader(packet->data, packet->dataLength);
+    reader.skip(snapshotHeaderBits);
+    return read_world_delta(reader, snapshotSchema, baselineWorld, snapshot.world);
+  }
+  RangeDecoder decoder(packet->data + snapshotHeaderSize, packet->dataLength - snapshotHeaderSize);
+  RangeBitReader<snapshotCoderContexts> reader(decoder, snapshot.model);
+  return read_world_delta(reader, snapshotSchema, baselineWorld, snapshot.world);
+}
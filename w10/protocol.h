@@ -2,6 +2,56 @@
 #include <enet/enet.h>
 #include <cstdint>
 #include "entity.h"
+#include "inputWindow.h"
+#include "messageRegistry.h"
+#include "netTelemetry.h"
+#include "secureSession.h"
+#include "rangeCoder.h"
+#include "worldTransfer.h"
+#include <vector>
+
+struct InputCmd
+{
+  float thr = 0.f;
+  float steer = 0.f;
+};
+
+// Every input packet repeats the last inputWindowSize inputs
+constexpr uint32_t inputWindowSize = 8;
+
+// One entity of a world snapshot, quantized the way the wire carries it
+struct EntitySnapshot
+{
+  uint16_t eid = invalid_entity;
+  float x = 0.f;
+  float y = 0.f;
+  float ori = 0.f;
+};
+
+// Every entity, sorted by eid. The server sends each client only what changed
+// since the newest snapshot that client acked, both ends keep the last
+// snapshotHistorySize snapshots as possible baselines.
+typedef std::vector<EntitySnapshot> WorldSnapshot;
+constexpr uint32_t snapshotHistorySize = 32;
+
+// Snapshots may be range coded. The coder's model adapts to the snapshots of
+// one connection: a coded snapshot starts from the model its baseline ended
+// with (a fresh one for full state), so both ends keep the model next to each
+// snapshot and stay in step whatever gets lost.
+// 4 for each of x, y, ori and 3 for the records, checked against the schema
+constexpr uint32_t snapshotCoderContexts = 15;
+typedef BitValueModel<snapshotCoderContexts> SnapshotModel;
+
+struct ReplicatedSnapshot
+{
+  WorldSnapshot world;
+  SnapshotModel model;
+};
+
+// Reliable messages go on channel 0, snapshots, inputs and acks on 1, and the
+// world a client gets when it joins on a channel of its own, see worldTransfer.h
+constexpr uint8_t worldTransferChannel = 2;
+constexpr size_t channelCount = 3;
 
 enum MessageType : uint8_t
 {
@@ -10,24 +60,179 @@ enum MessageType : uint8_t
   E_SERVER_TO_CLIENT_SET_CONTROLLED_ENTITY,
   E_CLIENT_TO_SERVER_INPUT,
   E_SERVER_TO_CLIENT_SNAPSHOT,
-  E_SERVER_TO_CLIENT_KEY
+  E_SERVER_TO_CLIENT_KEY,
+  E_SERVER_TO_CLIENT_SESSION_TOKEN,
+  E_CLIENT_TO_SERVER_REATTACH,
+  E_CLIENT_TO_SERVER_SNAPSHOT_ACK,
+  E_CLIENT_TO_SERVER_KEY,
+  E_SERVER_TO_CLIENT_WORLD_CHUNK,
+  E_CLIENT_TO_SERVER_WORLD_STATE_ACK,
+  E_SERVER_TO_CLIENT_DESPAWN,
+  E_CLIENT_TO_SERVER_LEAVE,
+  E_INVALID_MESSAGE = 0xff // what get_packet_type returns for an empty packet
 };
 
+// Every message but the world snapshot as its schema sends it, see
+// messageRegistry.h. New entities go as the Entity itself.
+struct JoinMsg {};
+// the client quits, its entity goes at once instead of waiting for it to reattach
+struct LeaveMsg {};
+struct SetControlledEntityMsg { uint16_t eid = invalid_entity; };
+// the entity is gone, its eid may come back later for another one
+struct DespawnMsg { uint16_t eid = invalid_entity; };
+struct ClientKeyMsg { uint8_t publicKey[x25519KeySize] = {}; };
+// sealed: whether packets after the key exchange are sealed
+struct ServerKeyMsg { uint8_t publicKey[x25519KeySize] = {}; bool sealed = true; };
+struct SessionTokenMsg { uint16_t eid = invalid_entity; uint32_t token = 0; };
+struct ReattachMsg { uint16_t eid = invalid_entity; uint32_t token = 0; };
+// The window of inputs firstSeq .. firstSeq + count - 1, thr and steer of
+// each packed in 4 bits by send_entity_input
+struct EntityInputMsg
+{
+  uint16_t eid = invalid_entity;
+  uint32_t firstSeq = 0;
+  uint8_t count = 0;
+  uint8_t packedInputs[inputWindowSize] = {};
+};
+struct SnapshotAckMsg { uint32_t seq = 0; };
+// framed by send_world_snapshot, read with read_world_snapshot_header/read_world_snapshot
+typedef RawMessage<E_SERVER_TO_CLIENT_SNAPSHOT> WorldSnapshotMsg;
+
+inline constexpr auto joinSchema = make_message_schema<JoinMsg>(E_CLIENT_TO_SERVER_JOIN);
+inline constexpr auto leaveSchema = make_message_schema<LeaveMsg>(E_CLIENT_TO_SERVER_LEAVE);
+inline constexpr auto newEntitySchema = make_message_schema<Entity>(E_SERVER_TO_CLIENT_NEW_ENTITY,
+  bits_field(&Entity::color, 32),
+  float_field(&Entity::x),
+  float_field(&Entity::y),
+  float_field(&Entity::speed),
+  float_field(&Entity::ori),
+  float_field(&Entity::thr),
+  float_field(&Entity::steer),
+  bits_field(&Entity::eid, 16));
+inline constexpr auto setControlledEntitySchema = make_message_schema<SetControlledEntityMsg>(
+  E_SERVER_TO_CLIENT_SET_CONTROLLED_ENTITY,
+  bits_field(&SetControlledEntityMsg::eid, 16));
+inline constexpr auto clientKeySchema = make_message_schema<ClientKeyMsg>(E_CLIENT_TO_SERVER_KEY,
+  bytes_field(&ClientKeyMsg::publicKey));
+inline constexpr auto serverKeySchema = make_message_schema<ServerKeyMsg>(E_SERVER_TO_CLIENT_KEY,
+  bytes_field(&ServerKeyMsg::publicKey),
+  bits_field(&ServerKeyMsg::sealed, 1));
+inline constexpr auto sessionTokenSchema = make_message_schema<SessionTokenMsg>(E_SERVER_TO_CLIENT_SESSION_TOKEN,
+  bits_field(&SessionTokenMsg::eid, 16),
+  bits_field(&SessionTokenMsg::token, 32));
+inline constexpr auto reattachSchema = make_message_schema<ReattachMsg>(E_CLIENT_TO_SERVER_REATTACH,
+  bits_field(&ReattachMsg::eid, 16),
+  bits_field(&ReattachMsg::token, 32));
+inline constexpr auto entityInputSchema = make_message_schema<EntityInputMsg>(E_CLIENT_TO_SERVER_INPUT,
+  bits_field(&EntityInputMsg::eid, 16),
+  bits_field(&EntityInputMsg::firstSeq, 32),
+  array_field(&EntityInputMsg::packedInputs, &EntityInputMsg::count, 8));
+inline constexpr auto snapshotAckSchema = make_message_schema<SnapshotAckMsg>(E_CLIENT_TO_SERVER_SNAPSHOT_ACK,
+  bits_field(&SnapshotAckMsg::seq, 32));
+inline constexpr auto worldSnapshotSchema = make_raw_message_schema<E_SERVER_TO_CLIENT_SNAPSHOT>();
+inline constexpr auto despawnSchema = make_message_schema<DespawnMsg>(E_SERVER_TO_CLIENT_DESPAWN,
+  bits_field(&DespawnMsg::eid, 16));
+inline constexpr auto worldChunkSchema = make_world_chunk_schema<E_SERVER_TO_CLIENT_WORLD_CHUNK>();
+inline constexpr auto worldStateAckSchema = make_world_state_ack_schema<E_CLIENT_TO_SERVER_WORLD_STATE_ACK>();
+
+// What each end receives, for MessageRegistry::dispatch
+typedef MessageRegistry<clientKeySchema, joinSchema, reattachSchema, entityInputSchema, snapshotAckSchema,
+                        worldStateAckSchema, leaveSchema>
+  ClientToServerMessages;
+typedef MessageRegistry<serverKeySchema, newEntitySchema, setControlledEntitySchema, sessionTokenSchema,
+                        worldSnapshotSchema, worldChunkSchema, despawnSchema>
+  ServerToClientMessages;
+
 void send_join(ENetPeer *peer);
 void send_new_entity(ENetPeer *peer, const Entity &ent);
 void send_set_controlled_entity(ENetPeer *peer, uint16_t eid);
-void send_cipher_key(ENetPeer *peer, uint32_t key);
-void send_entity_input(ENetPeer *peer, uint16_t eid, float thr, float steer);
-void send_snapshot(ENetPeer *peer, uint16_t eid, float x, float y, float ori);
+void send_despawn(ENetPeer *peer, uint16_t eid);
+void send_leave(ENetPeer *peer);
+// Key exchange on connect: the client sends its public key, the server
+// answers with its own and whether packets are sealed. Everything after is
+// sealed with the SecureSession in peer->data on both sides.
+void send_client_key(ENetPeer *peer, const uint8_t publicKey[x25519KeySize]);
+void send_server_key(ENetPeer *peer, const uint8_t publicKey[x25519KeySize], bool sealed);
+void send_session_token(ENetPeer *peer, uint16_t eid, uint32_t token);
+void send_reattach(ENetPeer *peer, uint16_t eid, uint32_t token);
+// seq numbers every input sent by the client, starting from 1. The packet
+// carries the whole window, oldest first, 4 bits per thr and steer.
+void send_entity_input(ENetPeer *peer, uint16_t eid, const InputWindow<InputCmd, inputWindowSize> &inputs);
+void make_world_snapshot(const std::vector<Entity> &entities, WorldSnapshot &world);
+// The states of world (eid, x, y, ori) quantized as the wire carries them and
+// sorted by eid, what make_world_snapshot does after copying them out
+void finish_world_snapshot(WorldSnapshot &world);
+// Writes what differs from baseline (nullptr for full state) as snapshot seq
+// into buffer and returns its size, 0 if there is no difference. sent gets
+// world and the model to keep with it. A coded snapshot that would not fit the
+// plain one's size goes plain.
+size_t encode_world_snapshot(std::vector<uint8_t> &buffer, uint32_t seq, uint32_t baselineSeq,
+                             const ReplicatedSnapshot *baseline, const WorldSnapshot &world, bool coded,
+                             ReplicatedSnapshot &sent);
+// Same, sent to peer. Returns the bytes handed to ENet (or to the outbox,
+// unsealed), 0 if there was nothing to send or the send failed.
+size_t send_world_snapshot(ENetPeer *peer, uint32_t seq, uint32_t baselineSeq, const ReplicatedSnapshot *baseline,
+                           const WorldSnapshot &world, bool coded, ReplicatedSnapshot &sent);
+// Plain bits of the record that sends state against the baseline's copy of
+// the entity (nullptr if it has none), 0 if the baseline is up to date. A
+// coded record is usually smaller.
+uint32_t get_entity_snapshot_bits(const EntitySnapshot *baseline, const EntitySnapshot &state);
+void send_snapshot_ack(ENetPeer *peer, uint32_t seq);
+// Every entity of world (sorted by eid) range coded as one block, what a
+// world transfer sends a joining client. False if it can't be coded, no
+// transfer may start then.
+bool encode_world_state(const std::vector<Entity> &world, std::vector<uint8_t> &data);
+// False on a malformed state, world is garbage then
+bool decode_world_state(const uint8_t *data, size_t size, std::vector<Entity> &world);
+void send_world_chunk(ENetPeer *peer, const WorldChunkMsg &chunk);
+void send_world_state_ack(ENetPeer *peer, uint16_t transfer, uint16_t received);
 
-MessageType get_packet_type(ENetPacket *packet);
-
-void deserialize_new_entity(ENetPacket *packet, Entity &ent);
-void deserialize_set_controlled_entity(ENetPacket *packet, uint16_t &eid);
-void deserialize_entity_input(ENetPacket *packet, uint16_t &eid, float &thr, float &steer);
-void deserialize_snapshot(ENetPacket *packet, uint16_t &eid, float &x, float &y, float &ori);
-void deserialize_and_set_key(ENetPacket *packet);
+// ENet isn't thread safe, so a thread other than the one that owns the host
+// sends into an outbox instead: packets are made there, and sealed, handed to
+// ENet and counted by send_outgoing_packet on the host's thread, which has no
+// outbox set. Sealing waits until then so that only the host's thread ever
+// touches a SecureSession.
+struct OutgoingPacket
+{
+  ENetPeer *peer = nullptr;
+  uint8_t channel = 0;
+  ENetPacket *packet = nullptr;
+  // false for the key exchange
+  bool seal = true;
+  // which connection of peer it was meant for, for whoever moves it between threads
+  uint32_t connection = 0;
+};
+typedef std::vector<OutgoingPacket> PacketOutbox;
+// Every send_* of the calling thread goes to outbox while it is set, nullptr
+// sends straight to ENet again. A send into an outbox returns the unsealed size.
+void set_packet_outbox(PacketOutbox *outbox);
+// Returns the bytes handed to ENet, 0 if the send failed (counted as a drop)
+size_t send_outgoing_packet(const OutgoingPacket &out);
 
-void cipher_data(ENetPacket *packet);
-void decipher_data(ENetPacket *packet, ENetPeer *peer);
+MessageType get_packet_type(ENetPacket *packet);
+// Opens a received packet in place with the peer's session, key exchange
+// messages pass as they are until the session is established. False means
+// drop it: forged, replayed, sent before the keys were exchanged, or a key
+// message after.
+bool open_packet(ENetPacket *packet, ENetPeer *peer, uint8_t channel);
+// Opens packet and dispatches it to handler through the Messages registry.
+// Counted in get_net_telemetry() as received, or as dropped if it doesn't
+// open or decode.
+template<typename Messages, typename Handler>
+bool receive_packet(ENetPacket *packet, ENetPeer *peer, uint8_t channel, Handler &handler)
+{
+  const uint8_t type = uint8_t(get_packet_type(packet));
+  const size_t size = packet->dataLength;
+  const bool handled = open_packet(packet, peer, channel) && Messages::dispatch(handler, packet);
+  if (handled)
+    get_net_telemetry().count(E_TELEMETRY_RECEIVED, channel, type, size);
+  else
+    get_net_telemetry().count_drop(E_TELEMETRY_RECEIVED, channel, type);
+  return handled;
+}
 
+// The inputs of msg into cmds (inputWindowSize of them), returns how many
+uint32_t unpack_entity_input(const EntityInputMsg &msg, InputCmd *cmds);
+// baselineSeq is 0 for a full snapshot, otherwise the baseline must be passed to read_world_snapshot
+bool read_world_snapshot_header(ENetPacket *packet, uint32_t &seq, uint32_t &baselineSeq);
+bool read_world_snapshot(ENetPacket *packet, const ReplicatedSnapshot *baseline, ReplicatedSnapshot &snapshot);
@@ -0,0 +1,515 @@
+#include "room.h"
+#include "profiler.h"
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <algorithm>
+#include <chrono>
+#include <variant>
+
+constexpr float minPeerBytesPerSecond = 2.f * 1024.f;
+// above this round trip a peer gets proportionally less
+constexpr uint32_t targetRoundTripMs = 150;
+constexpr size_t checkpointCapacity = 1 << 20;
+constexpr uint32_t checkpointIntervalMs = 1000;
+constexpr uint32_t worldStateVersion = 2;
+
+// What each message from a client does, see ClientToServerMessages
+struct ClientMessageHandler
+{
+  Room &room;
+  ENetPeer *peer;
+
+  // answered on the network thread, never handed on
+  void operator()(const ClientKeyMsg &) {}
+  void operator()(const JoinMsg &) { room.on_join(peer); }
+  void operator()(const ReattachMsg &msg) { room.on_reattach(msg, peer); }
+  void operator()(const EntityInputMsg &msg) { room.on_input(msg, peer); }
+  void operator()(const SnapshotAckMsg &msg) { room.on_snapshot_ack(msg, peer); }
+  void operator()(const WorldStateAckMsg &msg) { room.on_world_state_ack(msg, peer); }
+  void operator()(const LeaveMsg &) { room.on_leave(peer); }
+};
+
+Room::Room(const RoomSettings &settings, ENetHost *host, uint32_t firstTickTime)
+  : settings(settings), host(host), gen(std::random_device()()), members(host->peerCount, 0),
+    connections(host->peerCount, 0), replication(host->peerCount), bandwidth(host->peerCount), transfers(host->peerCount),
+    nextTickTime(firstTickTime)
+{
+}
+
+bool Room::start_checkpoints(const char *path)
+{
+  uint32_t loadStart = enet_time_get();
+  if (checkpoints.load(path, checkpointCapacity, checkpointState) &&
+      load_world(checkpointState.data(), checkpointState.size()))
+    printf("Resumed %zu entities from %s in %u ms\n", entities.size(), path, enet_time_get() - loadStart);
+  if (!checkpoints.start(path, checkpointCapacity))
+    return false;
+  checkpointPath = path;
+  lastCheckpoint = enet_time_get();
+  return true;
+}
+
+void Room::on_connect(ENetPeer *peer, uint32_t connection)
+{
+  const size_t i = peer - host->peers;
+  members[i] = 1;
+  connections[i] = connection;
+  ++peerCount;
+  replication[i].reset();
+  bandwidth[i].link = PeerLink();
+  bandwidth[i].budget.reset();
+  bandwidth[i].priorities.reset();
+  transfers[i].reset();
+}
+
+void Room::on_disconnect(ENetPeer *peer)
+{
+  members[peer - host->peers] = 0;
+  --peerCount;
+  transfers[peer - host->peers].reset();
+  // what the network thread hasn't taken yet was for this connection only
+  size_t kept = 0;
+  for (const OutgoingPacket &out : outbox)
+    if (out.peer == peer)
+      enet_packet_destroy(out.packet);
+    else
+      outbox[kept++] = out;
+  outbox.resize(kept);
+  // keep the entity a while, the client can reattach to it with its session token
+  for (auto &controlled : controlledMap)
+    if (controlled.second == peer)
+    {
+      controlled.second = nullptr;
+      detachedSince[controlled.first] = nextTickTime;
+    }
+}
+
+void Room::on_leave(ENetPeer *peer)
+{
+  std::vector<uint16_t> left;
+  for (const auto &controlled : controlledMap)
+    if (controlled.second == peer)
+      left.push_back(controlled.first);
+  for (uint16_t eid : left)
+    despawn(eid);
+}
+
+void Room::on_message(const ClientToServerMessages::MessageVariant &message, ENetPeer *peer)
+{
+  // what the room answers waits for the network thread like what it ticks
+  const size_t first = outbox.size();
+  set_packet_outbox(&outbox);
+  ClientMessageHandler handler{ *this, peer };
+  std::visit(handler, message);
+  set_packet_outbox(nullptr);
+  stamp_outbox(first);
+}
+
+void Room::stamp_outbox(size_t first)
+{
+  for (size_t i = first; i < outbox.size(); ++i)
+    outbox[i].connection = connections[outbox[i].peer - host->peers];
+}
+
+EntityHandle Room::spawn(const Entity &e)
+{
+  const EntityHandle handle = entities.create<ShipArchetype>();
+  write_entity(entities.get_archetype<ShipArchetype>(), entities.get_row(handle), e);
+  entityIndex.insert(e.eid);
+  entityHandles.push_back(handle);
+  return handle;
+}
+
+void Room::despawn(uint16_t eid)
+{
+  const EntityHandle *handle = find_entity(eid);
+  if (!handle || !eids.free(eid))
+    return;
+  // the last ship moves into the hole, and its priorities with it
+  const uint32_t row = entities.get_row(*handle);
+  for (PeerBandwidth &link : bandwidth)
+  {
+    link.priorities.resize(entities.get_archetype<ShipArchetype>().size());
+    link.priorities.erase(row);
+  }
+  entities.destroy(*handle);
+  entityIndex.erase(entityHandles, eid);
+  controlledMap.erase(eid);
+  sessionTokens.erase(eid);
+  detachedSince.erase(eid);
+  for (size_t i = 0; i < host->peerCount; ++i)
+    if (follows_world(i))
+      send_despawn(&host->peers[i], eid);
+}
+
+// The entities whose client dropped and didn't reattach in time
+void Room::despawn_detached(uint32_t now)
+{
+  for (auto it = detachedSince.begin(); it != detachedSince.end();)
+  {
+    // despawn erases it
+    const auto detached = *it++;
+    if (int32_t(now - detached.second) >= int32_t(settings.reattachTimeoutMs))
+      despawn(detached.first);
+  }
+}
+
+void Room::start_world_transfer(ENetPeer *peer)
+{
+  const ShipArchetype &ships = entities.get_archetype<ShipArchetype>();
+  transferWorld.resize(ships.size());
+  for (uint32_t row = 0; row < ships.size(); ++row)
+    transferWorld[row] = read_entity(ships, row);
+  std::sort(transferWorld.begin(), transferWorld.end(), [](const Entity &a, const Entity &b) { return a.eid < b.eid; });
+  if (!encode_world_state(transferWorld, transferData))
+  {
+    printf("Cannot code a world of %zu entities\n", transferWorld.size());
+    return;
+  }
+  transfers[peer - host->peers].start(++nextTransfer, transferData.data(), transferData.size());
+}
+
+// As many chunks as the window of each transfer lets out
+void Room::send_world_chunks()
+{
+  for (size_t i = 0; i < host->peerCount; ++i)
+    while (members[i] && transfers[i].next_chunk(chunk))
+      send_world_chunk(&host->peers[i], chunk);
+}
+
+void Room::on_join(ENetPeer *peer)
+{
+  uint16_t newEid = eids.allocate();
+  if (newEid == invalid_entity)
+  {
+    printf("No eid left for a new entity\n");
+    return;
+  }
+  uint32_t color = 0xff000000 +
+                   0x00440000 * (rand() % 5) +
+                   0x00004400 * (rand() % 5) +
+                   0x00000044 * (rand() % 5);
+  float x = (rand() % 4) * 2.f;
+  float y = (rand() % 4) * 2.f;
+  Entity ent = {color, x, y, 0.f, (rand() / RAND_MAX) * 3.141592654f, 0.f, 0.f, newEid};
+  spawn(ent);
+
+  controlledMap[newEid] = peer;
+  uint32_t token = std::uniform_int_distribution<uint32_t>(1)(gen);
+  sessionTokens[newEid] = token;
+
+  // the world, the new entity with it, goes to the peer in one transfer, the
+  // new entity alone to the others that have (or are getting) the world
+  start_world_transfer(peer);
+  send_world_chunks();
+  for (size_t i = 0; i < host->peerCount; ++i)
+    if (&host->peers[i] != peer && follows_world(i))
+      send_new_entity(&host->peers[i], ent);
+  // send info about controlled entity
+  send_set_controlled_entity(peer, newEid);
+  send_session_token(peer, newEid, token);
+}
+
+void Room::on_reattach(const ReattachMsg &msg, ENetPeer *peer)
+{
+  const uint16_t eid = msg.eid;
+  auto it = sessionTokens.find(eid);
+  if (it == sessionTokens.end() || it->second != msg.token || !entityIndex.contains(eid))
+  {
+    on_join(peer);
+    return;
+  }
+
+  start_world_transfer(peer);
+  send_world_chunks();
+  controlledMap[eid] = peer;
+  detachedSince.erase(eid);
+  // the client's input seqs kept running while it was away
+  entities.get<PendingInputs>(*find_entity(eid))->reset();
+  send_set_controlled_entity(peer, eid);
+}
+
+void Room::on_input(const EntityInputMsg &msg, ENetPeer *peer)
+{
+  // a client only steers the entity it controls
+  auto controlled = controlledMap.find(msg.eid);
+  if (controlled == controlledMap.end() || controlled->second != peer)
+    return;
+  InputCmd cmds[inputWindowSize];
+  const uint32_t count = unpack_entity_input(msg, cmds);
+  // inputs we already have (or applied) from earlier windows are dropped by the buffer
+  const EntityHandle *handle = find_entity(msg.eid);
+  if (InputBuffer<InputCmd> *input = handle ? entities.get<PendingInputs>(*handle) : nullptr)
+    for (uint32_t i = 0; i < count; ++i)
+      input->push(msg.firstSeq + i, cmds[i]);
+}
+
+void Room::on_snapshot_ack(const SnapshotAckMsg &msg, ENetPeer *peer)
+{
+  replication[peer - host->peers].ack(msg.seq);
+}
+
+void Room::on_world_state_ack(const WorldStateAckMsg &msg, ENetPeer *peer)
+{
+  WorldTransferSender &transfer = transfers[peer - host->peers];
+  transfer.on_ack(msg.transfer, msg.received);
+  // the window moved on, the next chunks go at once rather than next tick
+  send_world_chunks();
+}
+
+// Checkpoint of entities and session tokens of controlled entities, the eid
+// allocator is rebuilt from the eids. Peers don't survive a restart, clients
+// reattach with their token or their entity goes after reattachTimeoutMs.
+void Room::save_world(std::vector<uint8_t> &state) const
+{
+  state.clear();
+  checkpoint_write(state, worldStateVersion);
+  checkpoint_write(state, uint32_t(sizeof(Entity)));
+  const ShipArchetype &ships = entities.get_archetype<ShipArchetype>();
+  checkpoint_write(state, uint32_t(ships.size()));
+  for (uint32_t row = 0; row < ships.size(); ++row)
+  {
+    const Entity e = read_entity(ships, row);
+    checkpoint_write(state, &e, 1);
+  }
+  checkpoint_write(state, uint32_t(sessionTokens.size()));
+  for (const auto &token : sessionTokens)
+  {
+    checkpoint_write(state, token.first);
+    checkpoint_write(state, token.second);
+  }
+}
+
+bool Room::load_world(const uint8_t *data, size_t size)
+{
+  CheckpointReader reader(data, size);
+  uint32_t version = 0;
+  uint32_t entitySize = 0;
+  uint32_t count = 0;
+  if (!reader.read(version) || version != worldStateVersion ||
+      !reader.read(entitySize) || entitySize != sizeof(Entity) ||
+      !reader.read(count) || !reader.has<Entity>(count))
+    return false;
+
+  std::vector<Entity> loadedEntities(count);
+  if (!reader.read(loadedEntities.data(), count) || !reader.read(count))
+    return false;
+  std::vector<uint16_t> loadedEids;
+  for (const Entity &e : loadedEntities)
+    loadedEids.push_back(e.eid);
+  EidAllocator loadedAllocator;
+  if (!loadedAllocator.restore(loadedEids.data(), loadedEids.size()))
+    return false;
+
+  std::map<uint16_t, uint32_t> loadedTokens;
+  for (uint32_t i = 0; i < count; ++i)
+  {
+    uint16_t eid = invalid_entity;
+    uint32_t token = 0;
+    if (!reader.read(eid) || !reader.read(token))
+      return false;
+    loadedTokens[eid] = token;
+  }
+
+  sessionTokens.swap(loadedTokens);
+  eids = loadedAllocator;
+  for (PeerBandwidth &link : bandwidth)
+    link.priorities.reset();
+  entities.clear();
+  entityIndex.clear();
+  entityHandles.clear();
+  controlledMap.clear();
+  detachedSince.clear();
+  for (const Entity &e : loadedEntities)
+  {
+    spawn(e);
+    detachedSince[e.eid] = nextTickTime;
+  }
+  return true;
+}
+
+// What the peer's link is measured to take: ENet lowers packetThrottle when
+// the round trip rises above its mean, and loss or a long round trip mean
+// more of what is sent only waits in some queue.
+static float get_link_bytes_per_second(const PeerLink &link, float maxPeerBytesPerSecond)
+{
+  float rate = maxPeerBytesPerSecond;
+  // the client may have said it takes less
+  if (link.incomingBandwidth != 0)
+    rate = std::min(rate, float(link.incomingBandwidth));
+  rate *= float(link.packetThrottle) / float(ENET_PEER_PACKET_THROTTLE_SCALE);
+  rate *= 1.f - float(link.packetLoss) / float(ENET_PEER_PACKET_LOSS_SCALE);
+  if (link.roundTripTime > targetRoundTripMs)
+    rate *= float(targetRoundTripMs) / float(link.roundTripTime);
+  return std::max(rate, minPeerBytesPerSecond);
+}
+
+// How much a peer needs an entity, gained every tick it isn't sent: its own
+// entity before anything else, the others the more the closer they are.
+static float get_entity_priority(const EntitySnapshot &e, const EntitySnapshot *own)
+{
+  if (!own)
+    return 1.f;
+  if (e.eid == own->eid)
+    return 1e6f;
+  const float dx = e.x - own->x;
+  const float dy = e.y - own->y;
+  const float distance = sqrtf(dx * dx + dy * dy);
+  return 1.f / (1.f + distance * 0.25f);
+}
+
+// The world as the peer will have it after this tick's snapshot: the changed
+// entities that fit the peer's budget, highest priority first, at their state
+// in world and the rest as the baseline has them.
+void Room::select_world(PeerBandwidth &link, const EntitySnapshot *own, const ReplicatedSnapshot *baseline)
+{
+  // the baseline's copy of every entity of world, both are sorted by eid
+  from.assign(world.size(), nullptr);
+  chosen.assign(world.size(), 0);
+  if (baseline)
+    for (size_t i = 0, j = 0; i < baseline->world.size() && j < world.size();)
+    {
+      if (baseline->world[i].eid < world[j].eid)
+        ++i;
+      else if (world[j].eid < baseline->world[i].eid)
+        ++j;
+      else
+        from[j++] = &baseline->world[i++];
+    }
+
+  // by the states this tick sends, rather than the ships themselves
+  link.priorities.resize(worldIndex.size());
+  for (size_t row = 0; row < worldIndex.size(); ++row)
+    link.priorities.add(row, get_entity_priority(world[worldIndex[row]], own));
+  // a snapshot that overran is paid back before anything else goes
+  const float budgetBits = link.budget.get_allowance() * 8.f;
+  float usedBits = 0.f;
+  for (uint32_t row : link.priorities.sort())
+  {
+    const uint32_t j = worldIndex[row];
+    const uint32_t bits = get_entity_snapshot_bits(from[j], world[j]);
+    // smaller ones further down may still fit
+    if (bits > 0 && usedBits + float(bits) > budgetBits)
+      continue;
+    usedBits += float(bits);
+    chosen[j] = 1;
+    link.priorities.clear(row);
+  }
+
+  selected.clear();
+  for (size_t j = 0; j < world.size(); ++j)
+    if (chosen[j])
+      selected.push_back(world[j]);
+    else if (from[j])
+      selected.push_back(*from[j]);
+}
+
+// Applies the next input of every entity in seq order, an entity keeps its
+// last input until a newer one arrives. If inputs pile up (client sending
+// faster than the server ticks) the oldest are skipped to bound the latency.
+void Room::apply_inputs()
+{
+  entities.each<PendingInputs, Thr, Steer>([](InputBuffer<InputCmd> &input, float &thr, float &steer)
+  {
+    InputCmd cmd;
+    bool applied = input.pop(cmd);
+    while (applied && input.get_pending() > inputWindowSize)
+      input.pop(cmd);
+    if (!applied)
+      return;
+    thr = cmd.thr;
+    steer = cmd.steer;
+  });
+}
+
+// one snapshot of the world, every peer gets what changed since the one it
+// acked, as much of it as its link takes
+void Room::send_snapshots(float dt)
+{
+  world.clear();
+  entities.each<NetId, PosX, PosY, Ori>([this](uint16_t eid, float x, float y, float ori)
+  {
+    world.push_back({ eid, x, y, ori });
+  });
+  finish_world_snapshot(world);
+  worldIndex.resize(world.size());
+  for (uint32_t j = 0; j < world.size(); ++j)
+    worldIndex[entities.get_row(*find_entity(world[j].eid))] = j;
+  peerEntities.assign(host->peerCount, invalid_entity);
+  for (const auto &controlled : controlledMap)
+    if (controlled.second)
+      peerEntities[controlled.second - host->peers] = controlled.first;
+  // the peers left over when the coding budget runs out differ from tick to tick
+  firstPeer = host->peerCount > 0 ? (firstPeer + 1) % host->peerCount : 0;
+  // only range coded sends count against the budget, plain ones are cheap
+  const auto codingBudget = std::chrono::microseconds(settings.snapshotCodingBudgetUs);
+  std::chrono::steady_clock::duration codingTime{};
+  for (size_t n = 0; n < host->peerCount; ++n)
+  {
+    const size_t i = (firstPeer + n) % host->peerCount;
+    // the network thread drops what still goes to a peer that just left,
+    // and a client has nothing to apply a snapshot to before it has the world
+    if (!members[i] || !transfers[i].is_done())
+      continue;
+    PROFILE_ZONE("snapshot_peer");
+    uint32_t baselineSeq = 0;
+    const ReplicatedSnapshot *baseline = replication[i].get_baseline(baselineSeq);
+    PeerBandwidth &link = bandwidth[i];
+    link.budget.refill(get_link_bytes_per_second(link.link, settings.maxPeerBytesPerSecond) * dt);
+    const EntityHandle *own = find_entity(peerEntities[i]);
+    select_world(link, own ? &world[worldIndex[entities.get_row(*own)]] : nullptr, baseline);
+    const bool coded = settings.codeSnapshots && codingTime < codingBudget;
+    const auto sendStart = coded ? std::chrono::steady_clock::now() : std::chrono::steady_clock::time_point();
+    const size_t bytes = send_world_snapshot(&host->peers[i], replication[i].get_next_seq(), baselineSeq, baseline,
+                                             selected, coded, sent);
+    if (coded)
+      codingTime += std::chrono::steady_clock::now() - sendStart;
+    if (bytes)
+    {
+      replication[i].push(sent);
+      // sealed on the network thread
+      link.budget.spend(bytes + (settings.sealPackets ? sealOverhead : 0));
+    }
+  }
+}
+
+void Room::tick(float dt, uint32_t now)
+{
+  despawn_detached(now);
+  {
+    PROFILE_ZONE("simulate");
+    apply_inputs();
+    // straight on the ships' arrays of what it steps, 8 or 4 lanes at a time
+    simulate_entities(entities, dt);
+  }
+  {
+    PROFILE_ZONE("snapshots");
+    send_world_chunks();
+    send_snapshots(dt);
+  }
+  // world is copied here, the file is written on the checkpoint thread
+  if (checkpointPath && now - lastCheckpoint >= checkpointIntervalMs)
+  {
+    PROFILE_ZONE("checkpoint");
+    lastCheckpoint = now;
+    save_world(checkpointState);
+    checkpoints.submit(checkpointState);
+  }
+}
+
+uint32_t Room::update(uint32_t now)
+{
+  constexpr uint32_t maxTicksBehind = 5;
+  // a room that fell far behind (a stall, a debugger) drops the ticks it missed
+  if (int32_t(now - nextTickTime) > int32_t(settings.tickMs * maxTicksBehind))
+    nextTickTime = now - settings.tickMs * maxTicksBehind;
+  const size_t first = outbox.size();
+  set_packet_outbox(&outbox);
+  uint32_t ticks = 0;
+  for (; int32_t(now - nextTickTime) >= 0; nextTickTime += settings.tickMs, ++ticks)
+    tick(settings.tickMs * 0.001f, now);
+  set_packet_outbox(nullptr);
+  stamp_outbox(first);
+  return ticks;
+}
@@ -0,0 +1,161 @@
+#pragma once
+#include <enet/enet.h>
+#include <cstdint>
+#include <cstddef>
+#include <map>
+#include <random>
+#include <vector>
+#include "entity.h"
+#include "protocol.h"
+#include "eidIndex.h"
+#include "inputBuffer.h"
+#include "snapshotDelta.h"
+#include "checkpoint.h"
+#include "bandwidthBudget.h"
+#include "networkThread.h"
+#include "worldTransfer.h"
+#include "eidAllocator.h"
+
+struct RoomSettings
+{
+  // off to measure what sealing costs, clients then only connect if started
+  // with --allow-unsealed
+  bool sealPackets = true;
+  // Range coding of snapshots, and how long a tick may spend on it. Once the
+  // budget is used up the remaining peers get plain snapshots that tick.
+  bool codeSnapshots = true;
+  uint32_t snapshotCodingBudgetUs = 2000;
+  // Snapshot bytes a peer gets at most on a good link
+  float maxPeerBytesPerSecond = 64.f * 1024.f;
+  uint32_t tickMs = 10;
+  // How long the entity of a client that dropped (rather than left) waits for
+  // it to reattach before it is despawned
+  uint32_t reattachTimeoutMs = 30000;
+};
+
+// The inputs of an entity waiting for their ticks, only the server has them
+struct PendingInputs { using Value = InputBuffer<InputCmd>; };
+typedef Archetype<NetId, EntityColor, PosX, PosY, Ori, Speed, Thr, Steer, PendingInputs> ShipArchetype;
+typedef EntityWorld<ShipArchetype> RoomEntities;
+
+// What the link of a peer takes, as last measured, and which entities
+// (indexed like the rows of the room's ships) that peer needs most
+struct PeerBandwidth
+{
+  PeerLink link;
+  BandwidthBudget budget;
+  PriorityAccumulator priorities;
+};
+
+// One world: its entities, the peers routed to it and its fixed tick. A room
+// shares nothing mutable with other rooms, so rooms tick on different threads
+// at once. ENet is left to the network thread: what a room sends waits in its
+// outbox for the NetworkThread, and the room only learns of its peers through
+// the NetworkEvents handed to it while it doesn't tick.
+class Room
+{
+public:
+  // Per-peer state is indexed like host->peers. firstTickTime spreads the
+  // ticks of the rooms over the tick interval.
+  Room(const RoomSettings &settings, ENetHost *host, uint32_t firstTickTime);
+  Room(const Room &) = delete;
+  Room &operator=(const Room &) = delete;
+
+  // Resumes from the checkpoint at path if there is one, then writes one
+  // there every second
+  bool start_checkpoints(const char *path);
+
+  // connection is the id the network thread gave this connection of peer,
+  // every packet the room sends peer from now on is stamped with it
+  void on_connect(ENetPeer *peer, uint32_t connection);
+  // Also drops what still waits in the outbox for peer
+  void on_disconnect(ENetPeer *peer);
+  // A message of one of the room's peers, as the network thread decoded it
+  void on_message(const ClientToServerMessages::MessageVariant &message, ENetPeer *peer);
+  void on_link(const PeerLink &link, ENetPeer *peer) { bandwidth[peer - host->peers].link = link; }
+
+  // Runs every fixed tick due by now, returns how many. Safe on any thread.
+  uint32_t update(uint32_t now);
+  // What the room sent and the NetworkThread hasn't taken yet
+  PacketOutbox &get_outbox() { return outbox; }
+
+  uint32_t get_next_tick_time() const { return nextTickTime; }
+  size_t get_peer_count() const { return peerCount; }
+  size_t get_entity_count() const { return entities.size(); }
+  // nullptr if no entity has eid
+  const EntityHandle *find_entity(uint16_t eid) const { return entityIndex.get(entityHandles, eid); }
+
+  void on_join(ENetPeer *peer);
+  void on_reattach(const ReattachMsg &msg, ENetPeer *peer);
+  void on_input(const EntityInputMsg &msg, ENetPeer *peer);
+  void on_snapshot_ack(const SnapshotAckMsg &msg, ENetPeer *peer);
+  void on_world_state_ack(const WorldStateAckMsg &msg, ENetPeer *peer);
+  void on_leave(ENetPeer *peer);
+
+private:
+  void tick(float dt, uint32_t now);
+  void apply_inputs();
+  void send_snapshots(float dt);
+  // Every entity as it is now, to peer as a world transfer
+  void start_world_transfer(ENetPeer *peer);
+  void send_world_chunks();
+  EntityHandle spawn(const Entity &e);
+  // Removes the entity, from every peer too, and frees its eid
+  void despawn(uint16_t eid);
+  void despawn_detached(uint32_t now);
+  // Whether what changes in the world goes to host->peers[i] as messages: it
+  // has the world, or is getting it and the transfer may not have the change
+  bool follows_world(size_t i) const { return members[i] && (transfers[i].is_active() || transfers[i].is_done()); }
+  void select_world(PeerBandwidth &link, const EntitySnapshot *own, const ReplicatedSnapshot *baseline);
+  void save_world(std::vector<uint8_t> &state) const;
+  bool load_world(const uint8_t *data, size_t size);
+  // Stamps the packets of the outbox from first on with their peer's connection
+  void stamp_outbox(size_t first);
+
+  const RoomSettings settings;
+  ENetHost *host;
+
+  RoomEntities entities;
+  // the handle of every eid, entityHandles is indexed by entityIndex
+  EidIndex entityIndex;
+  std::vector<EntityHandle> entityHandles;
+  std::map<uint16_t, ENetPeer*> controlledMap;
+  std::map<uint16_t, uint32_t> sessionTokens;
+  // when the entities whose client dropped lost it, see reattachTimeoutMs
+  std::map<uint16_t, uint32_t> detachedSince;
+  EidAllocator eids;
+  std::mt19937 gen;
+
+  // members[i], replication[i], bandwidth[i] and transfers[i] belong to
+  // host->peers[i]. A peer gets snapshots once its world transfer is done.
+  std::vector<uint8_t> members;
+  // the connection of host->peers[i] the room knows of, see on_connect
+  std::vector<uint32_t> connections;
+  size_t peerCount = 0;
+  std::vector<DeltaBaselines<ReplicatedSnapshot, snapshotHistorySize>> replication;
+  std::vector<PeerBandwidth> bandwidth;
+  std::vector<WorldTransferSender> transfers;
+  uint16_t nextTransfer = 0;
+
+  uint32_t nextTickTime;
+  PacketOutbox outbox;
+
+  // what a tick reuses
+  WorldSnapshot world;
+  WorldSnapshot selected;
+  ReplicatedSnapshot sent;
+  size_t firstPeer = 0;
+  // worldIndex[row] is where the ship of that row is in world
+  std::vector<uint32_t> worldIndex;
+  std::vector<uint16_t> peerEntities;
+  std::vector<const EntitySnapshot*> from;
+  std::vector<uint8_t> chosen;
+  std::vector<Entity> transferWorld;
+  std::vector<uint8_t> transferData;
+  WorldChunkMsg chunk;
+
+  const char *checkpointPath = nullptr;
+  CheckpointWriter checkpoints;
+  std::vector<uint8_t> checkpointState;
+  uint32_t lastCheckpoint = 0;
+};
@@ -1,67 +1,78 @@
 #include <enet/enet.h>
 #include <iostream>
-#include "entity.h"
+#include "room.h"
+#include "networkThread.h"
 #include "protocol.h"
-#include "mathUtils.h"
+#include "telemetryServer.h"
+#include "profiler.h"
+#include "shardPool.h"
 #include <stdlib.h>
+#include <string.h>
+#include <memory>
+#include <string>
+#include <thread>
 #include <vector>
-#include <map>
-#include <random>
 
-static std::vector<Entity> entities;
-static std::map<uint16_t, ENetPeer*> controlledMap;
+// The rooms of this process. A peer is routed to its room on connect, by
+// the data it connects with (room + 1, 0 takes the emptiest), and stays in
+// it until it disconnects.
+static std::vector<std::unique_ptr<Room>> rooms;
+// peerRooms[i] is the room of server->peers[i], nullptr while it has none
+static std::vector<Room*> peerRooms;
 
-void on_join(ENetPacket *packet, ENetPeer *peer, ENetHost *host)
+static Room *pick_room(uint32_t requested)
 {
-  // send all entities
-  for (const Entity &ent : entities)
-    send_new_entity(peer, ent);
-
-  // find max eid
-  uint16_t maxEid = entities.empty() ? invalid_entity : entities[0].eid;
-  for (const Entity &e : entities)
-    maxEid = std::max(maxEid, e.eid);
-  uint16_t newEid = maxEid + 1;
-  uint32_t color = 0xff000000 +
-                   0x00440000 * (rand() % 5) +
-                   0x00004400 * (rand() % 5) +
-                   0x00000044 * (rand() % 5);
-  float x = (rand() % 4) * 2.f;
-  float y = (rand() % 4) * 2.f;
-  Entity ent = {color, x, y, 0.f, (rand() / RAND_MAX) * 3.141592654f, 0.f, 0.f, newEid};
-  entities.push_back(ent);
-
-  controlledMap[newEid] = peer;
-
-
-  // send info about new entity to everyone
-  for (size_t i = 0; i < host->peerCount; ++i)
-    send_new_entity(&host->peers[i], ent);
-  // send info about controlled entity
-  send_set_controlled_entity(peer, newEid);
-  uint32_t *keyPtr = (uint32_t*)peer->data;
-  std::random_device rd;  //Will be used to obtain a seed for the random number engine
-  std::mt19937 gen(rd()); //Standard mersenne_twister_engine seeded with rd()
-  std::uniform_int_distribution<uint32_t> distrib(0);
-  *keyPtr = distrib(gen);
-  send_cipher_key(peer, *keyPtr);
-}
-
-void on_input(ENetPacket *packet)
-{
-  uint16_t eid = invalid_entity;
-  float thr = 0.f; float steer = 0.f;
-  deserialize_entity_input(packet, eid, thr, steer);
-  for (Entity &e : entities)
-    if (e.eid == eid)
-    {
-      e.thr = thr;
-      e.steer = steer;
-    }
+  if (requested > 0 && requested <= rooms.size())
+    return rooms[requested - 1].get();
+  Room *emptiest = rooms.front().get();
+  for (const auto &room : rooms)
+    if (room->get_peer_count() < emptiest->get_peer_count())
+      emptiest = room.get();
+  return emptiest;
 }
 
 int main(int argc, const char **argv)
 {
+  RoomSettings settings;
+  const char *checkpointPath = nullptr;
+  // a different port lets netsim listen on the one clients connect to
+  uint16_t port = 10131;
+  // 0 serves no telemetry, see telemetryServer.h
+  uint16_t statsPort = 0;
+  // a tick slower than this saves the profiler's trace of the last second, 0 never does
+  float slowTickMs = 0.f;
+  const char *tracePath = "w10_server_trace.json";
+  // independent worlds, ticked by up to one thread per core
+  uint32_t roomCount = 1;
+  uint32_t threadCount = std::max(1u, std::thread::hardware_concurrency());
+  for (int i = 1; i + 1 < argc; ++i)
+  {
+    if (strcmp(argv[i], "--checkpoint") == 0)
+      checkpointPath = argv[++i];
+    else if (strcmp(argv[i], "--port") == 0)
+      port = uint16_t(atoi(argv[++i]));
+    else if (strcmp(argv[i], "--encryption") == 0)
+      settings.sealPackets = strcmp(argv[++i], "off") != 0;
+    else if (strcmp(argv[i], "--snapshot-coding") == 0)
+      settings.codeSnapshots = strcmp(argv[++i], "off") != 0;
+    else if (strcmp(argv[i], "--snapshot-coding-budget-us") == 0)
+      settings.snapshotCodingBudgetUs = uint32_t(atoi(argv[++i]));
+    else if (strcmp(argv[i], "--peer-bytes-per-second") == 0)
+      settings.maxPeerBytesPerSecond = float(atoi(argv[++i]));
+    else if (strcmp(argv[i], "--tick-ms") == 0)
+      settings.tickMs = uint32_t(std::max(1, atoi(argv[++i])));
+    else if (strcmp(argv[i], "--rooms") == 0)
+      roomCount = uint32_t(std::max(1, atoi(argv[++i])));
+    else if (strcmp(argv[i], "--threads") == 0)
+      threadCount = uint32_t(std::max(1, atoi(argv[++i])));
+    else if (strcmp(argv[i], "--stats-port") == 0)
+      statsPort = uint16_t(atoi(argv[++i]));
+    else if (strcmp(argv[i], "--slow-tick-ms") == 0)
+      slowTickMs = float(atof(argv[++i]));
+    else if (strcmp(argv[i], "--trace") == 0)
+      tracePath = argv[++i];
+  }
+
   if (enet_initialize() != 0)
   {
     printf("Cannot init ENet");
@@ -70,74 +81,106 @@ int main(int argc, const char **argv)
   ENetAddress address;
 
   address.host = ENET_HOST_ANY;
-  address.port = 10131;
+  address.port = port;
 
-  ENetHost *server = enet_host_create(&address, 32, 2, 0, 0);
+  ENetHost *server = enet_host_create(&address, 32, channelCount, 0, 0);
 
   if (!server)
   {
     printf("Cannot create ENet server\n");
     return 1;
   }
+  peerRooms.assign(server->peerCount, nullptr);
 
-  uint32_t lastTime = enet_time_get();
+  // with more than one room every room checkpoints to a file of its own
+  std::vector<std::string> checkpointPaths;
+  const uint32_t startTime = enet_time_get();
+  for (uint32_t r = 0; r < roomCount; ++r)
+  {
+    rooms.push_back(std::make_unique<Room>(settings, server, startTime + r * settings.tickMs / roomCount));
+    checkpointPaths.push_back(checkpointPath && roomCount > 1 ? std::string(checkpointPath) + "." + std::to_string(r) :
+                              checkpointPath ? checkpointPath : "");
+  }
+  for (uint32_t r = 0; r < roomCount && checkpointPath; ++r)
+    if (!rooms[r]->start_checkpoints(checkpointPaths[r].c_str()))
+    {
+      printf("Cannot open checkpoint %s\n", checkpointPaths[r].c_str());
+      return 1;
+    }
+  ShardPool pool;
+  pool.start(threadCount, roomCount);
+  printf("%u rooms on %u threads\n", roomCount, pool.get_thread_count());
+
+  NetTelemetry &telemetry = get_net_telemetry();
+  TelemetryServer telemetryServer;
+  if (statsPort != 0 && !telemetryServer.start(statsPort))
+    printf("Cannot serve telemetry on port %u\n", statsPort);
+
+  // from here on only the network thread touches the host
+  NetworkThread network(server, settings.sealPackets);
+  network.start(statsPort != 0 ? &telemetryServer : nullptr);
+
+  set_profile_thread_name("server");
+  SlowTickTrace slowTicks(tracePath, slowTickMs);
+
+  std::vector<uint32_t> roomTicks(roomCount, 0);
   while (true)
   {
+    slowTicks.begin();
     uint32_t curTime = enet_time_get();
-    float dt = (curTime - lastTime) * 0.001f;
-    lastTime = curTime;
-    ENetEvent event;
-    while (enet_host_service(server, &event, 0) > 0)
     {
-      switch (event.type)
+      PROFILE_ZONE("receive");
+      NetworkEvent event;
+      while (network.poll(event))
       {
-      case ENET_EVENT_TYPE_CONNECT:
-        printf("Connection with %x:%u established\n", event.peer->address.host, event.peer->address.port);
-        event.peer->data = new uint32_t;
-        *(uint32_t*)event.peer->data = 0;
-        break;
-      case ENET_EVENT_TYPE_DISCONNECT:
-        printf("Disconnected %x:%u \n", event.peer->address.host, event.peer->address.port);
-        delete event.peer->data;
-        break;
-      case ENET_EVENT_TYPE_RECEIVE:
-        switch (get_packet_type(event.packet))
+        Room *&room = peerRooms[event.peer - server->peers];
+        switch (event.type)
         {
-          case E_CLIENT_TO_SERVER_JOIN:
-            on_join(event.packet, event.peer, server);
-            break;
-          case E_CLIENT_TO_SERVER_INPUT:
-            decipher_data(event.packet, event.peer);
-            on_input(event.packet);
-            break;
+        case E_NETWORK_CONNECT:
+          room = pick_room(event.data);
+          room->on_connect(event.peer, event.connection);
+          break;
+        case E_NETWORK_DISCONNECT:
+          if (room)
+            room->on_disconnect(event.peer);
+          room = nullptr;
+          break;
+        case E_NETWORK_MESSAGE:
+          if (room)
+            room->on_message(event.message, event.peer);
+          break;
+        case E_NETWORK_LINK:
+          if (room)
+            room->on_link(event.link, event.peer);
+          break;
         };
-        enet_packet_destroy(event.packet);
-        break;
-      default:
-        break;
-      };
+      }
     }
-    static int t = 0;
-    for (Entity &e : entities)
+    // every room whose tick is due, each on its own thread
+    pool.run([&](uint32_t r) { roomTicks[r] = rooms[r]->update(curTime); });
     {
-      // simulate
-      simulate_entity(e, dt);
-      // send
-      for (size_t i = 0; i < server->peerCount; ++i)
+      PROFILE_ZONE("send");
+      for (uint32_t r = 0; r < roomCount; ++r)
       {
-        ENetPeer *peer = &server->peers[i];
-        // skip this here in this implementation
-        //if (controlledMap[e.eid] != peer)
-        send_snapshot(peer, e.eid, e.x, e.y, e.ori);
+        network.send(rooms[r]->get_outbox());
+        for (; roomTicks[r] > 0; --roomTicks[r])
+          telemetry.count_tick();
       }
     }
-    usleep(10000);
+    if (slowTicks.end(enet_time_get()))
+      printf("Tick took %.1f ms, trace in %s\n", slowTicks.get_tick_ms(), tracePath);
+    // until the next room is due
+    int32_t untilTick = int32_t(settings.tickMs);
+    const uint32_t now = enet_time_get();
+    for (const auto &room : rooms)
+      untilTick = std::min(untilTick, int32_t(room->get_next_tick_time() - now));
+    if (untilTick > 0)
+      usleep(uint32_t(untilTick) * 1000);
   }
 
+  network.stop();
   enet_host_destroy(server);
 
   atexit(enet_deinitialize);
   return 0;
 }
-
-
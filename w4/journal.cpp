@@ -0,0 +1,111 @@
+#include "journal.h"
+
+constexpr size_t journalFlushSize = 64 * 1024;
+
+JournalWriter::~JournalWriter()
+{
+    if (!file)
+        return;
+    flush();
+    fclose(file);
+}
+
+bool JournalWriter::open(const char* path, uint32_t seed, uint16_t fixedDtMs)
+{
+    file = fopen(path, "wb");
+    if (!file)
+        return false;
+    JournalHeader header;
+    header.fixedDtMs = fixedDtMs;
+    header.seed = seed;
+    fwrite(&header, sizeof(JournalHeader), 1, file);
+    buffer.reserve(journalFlushSize);
+    return true;
+}
+
+void JournalWriter::write_varint(uint32_t val)
+{
+    while (val >= 0x80)
+    {
+        buffer.push_back(uint8_t(val) | 0x80);
+        val >>= 7;
+    }
+    buffer.push_back(uint8_t(val));
+}
+
+void JournalWriter::record(uint32_t tick, JournalRecordType type, uint16_t peer, const uint8_t* data, size_t size)
+{
+    if (!file)
+        return;
+    write_varint(tick - lastTick);
+    lastTick = tick;
+    buffer.push_back(type);
+    write_varint(peer);
+    write_varint(uint32_t(size));
+    buffer.insert(buffer.end(), data, data + size);
+    if (buffer.size() >= journalFlushSize)
+        flush();
+}
+
+void JournalWriter::flush()
+{
+    if (!file || buffer.empty())
+        return;
+    fwrite(buffer.data(), 1, buffer.size(), file);
+    fflush(file);
+    buffer.clear();
+}
+
+JournalReader::~JournalReader()
+{
+    if (file)
+        fclose(file);
+}
+
+bool JournalReader::open(const char* path)
+{
+    file = fopen(path, "rb");
+    if (!file)
+        return false;
+    if (fread(&header, sizeof(JournalHeader), 1, file) != 1 ||
+        header.magic != journalMagic || header.version != journalVersion)
+    {
+        fclose(file);
+        file = nullptr;
+        return false;
+    }
+    return true;
+}
+
+bool JournalReader::read_varint(uint32_t& val)
+{
+    val = 0;
+    for (int shift = 0; shift < 35; shift += 7)
+    {
+        int c = fgetc(file);
+        if (c == EOF)
+            return false;
+        val |= uint32_t(c & 0x7f) << shift;
+        if (!(c & 0x80))
+            return true;
+    }
+    return false;
+}
+
+bool JournalReader::next(JournalRecord& rec)
+{
+    uint32_t tickDelta = 0;
+    uint32_t peer = 0;
+    uint32_t size = 0;
+    if (!file || !read_varint(tickDelta))
+        return false;
+    int type = fgetc(file);
+    if (type == EOF || !read_varint(peer) || !read_varint(size))
+        return false;
+    lastTick += tickDelta;
+    rec.tick = lastTick;
+    rec.type = JournalRecordType(type);
+    rec.peer = uint16_t(peer);
+    rec.data.resize(size);
+    return size == 0 || fread(rec.data.data(), 1, size, file) == size;
+}
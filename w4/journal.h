@@ -0,0 +1,78 @@
+#pragma once
+#include <cstdint>
+#include <cstdio>
+#include <vector>
+
+// Binary journal of everything that feeds the w4 simulation: the rng seed,
+// the fixed tick length, the session tokens and every inbound client message
+// tagged with the tick it was applied before. w4_replay re-runs a journal
+// headless.
+//
+// Layout: JournalHeader, then records of
+//   varint tick delta | uint8 JournalRecordType | varint peer | varint size | payload
+enum JournalRecordType : uint8_t
+{
+	E_JOURNAL_CONNECT = 0,
+	E_JOURNAL_DISCONNECT,
+	E_JOURNAL_RECEIVE,
+	E_JOURNAL_CHECKSUM,
+	// uint32 token for the next join, recorded before the packet it may go to
+	E_JOURNAL_SESSION_TOKEN
+};
+
+constexpr uint32_t journalMagic = 0x524a3457; // "W4JR"
+constexpr uint16_t journalVersion = 3;
+
+struct JournalHeader
+{
+	uint32_t magic = journalMagic;
+	uint16_t version = journalVersion;
+	uint16_t fixedDtMs = 0;
+	uint32_t seed = 0;
+};
+
+struct JournalRecord
+{
+	uint32_t tick = 0;
+	JournalRecordType type = E_JOURNAL_RECEIVE;
+	uint16_t peer = 0;
+	std::vector<uint8_t> data;
+};
+
+class JournalWriter
+{
+public:
+	~JournalWriter();
+
+	bool open(const char* path, uint32_t seed, uint16_t fixedDtMs);
+	bool is_open() const { return file != nullptr; }
+
+	void record(uint32_t tick, JournalRecordType type, uint16_t peer, const uint8_t* data, size_t size);
+	void flush();
+
+private:
+	void write_varint(uint32_t val);
+
+	FILE* file = nullptr;
+	uint32_t lastTick = 0;
+	std::vector<uint8_t> buffer;
+};
+
+class JournalReader
+{
+public:
+	~JournalReader();
+
+	bool open(const char* path);
+	const JournalHeader& get_header() const { return header; }
+
+	// Returns false at the end of the journal or on a truncated record.
+	bool next(JournalRecord& rec);
+
+private:
+	bool read_varint(uint32_t& val);
+
+	FILE* file = nullptr;
+	JournalHeader header;
+	uint32_t lastTick = 0;
+};
@@ -1,70 +1,201 @@
+#include <atomic>
 #include <functional>
 #include <algorithm>
+#include <thread>
 #include "raylib.h"
 #include <enet/enet.h>
 #include <vector>
 #include <map>
 #include "entity.h"
 #include "protocol.h"
-#include "bitstream.h"
+#include "eidIndex.h"
+#include "tripleBuffer.h"
+#include "world.h"
 
 #undef DrawText
 
 
 static std::vector<Entity> entities;
+static EidIndex entityIndex;
 static std::map<uint16_t, int> score;
 static uint16_t my_entity = invalid_entity;
+static uint32_t my_session_token = 0;
+// the world the server sends when we join, applied once it is all here
+static WorldTransferReceiver worldTransfer;
+static std::vector<Entity> transferredWorld;
+// Newest server tick we have seen, reported back for lag compensation.
+// Snapshots are drawn as soon as they arrive, so there is no interpolation delay.
+static uint32_t last_snapshot_tick = 0;
+constexpr uint16_t interpolation_delay_ms = 0;
 
-void on_new_entity_packet(ENetPacket* packet)
+// Everything above is the network thread's. It services the host, moves our
+// entity and sends its state every server tick, and publishes what there is
+// to draw; the render thread only draws the newest view and samples the
+// keys, so neither a slow frame nor vsync holds up packets or our state.
+struct DrawnEntity
 {
-    Entity newEntity;
-    deserialize_new_entity(packet, newEntity);
-    for (const Entity& e : entities)
-        if (e.eid == newEntity.eid)
-            return;
+    float x;
+    float y;
+    float size;
+    uint32_t color;
+};
+struct WorldView
+{
+    std::vector<DrawnEntity> entities;
+    std::vector<std::pair<uint16_t, int>> score;
+};
+static TripleBuffer<WorldView> views;
+
+enum HeldKey : uint8_t
+{
+    E_KEY_LEFT = 1 << 0,
+    E_KEY_RIGHT = 1 << 1,
+    E_KEY_UP = 1 << 2,
+    E_KEY_DOWN = 1 << 3
+};
+// the keys held at the last frame, raylib only polls them on the render thread
+static std::atomic<uint8_t> heldKeys{ 0 };
+static std::atomic<bool> quit{ false };
+
+void on_new_entity(const Entity& newEntity)
+{
+    // an entity we already have keeps its slot, invalid_entity gets none
+    if (entityIndex.insert(newEntity.eid) != entities.size())
+        return;
     entities.push_back(newEntity);
 }
 
-void on_set_controlled_entity(ENetPacket* packet)
+// Every entity at once when the last chunk is in, snapshots only start after
+void on_world_chunk(const WorldChunkMsg& chunk, ENetPeer* peer)
 {
-    deserialize_set_controlled_entity(packet, my_entity);
+    const bool done = worldTransfer.add(chunk);
+    if (chunk.transfer != worldTransfer.get_transfer() || chunk.index + 1 != worldTransfer.get_received())
+        return; // not the next chunk of the current transfer
+    send_world_state_ack(peer, chunk.transfer, worldTransfer.get_received());
+    const std::vector<uint8_t>& data = worldTransfer.get_data();
+    if (!done || !decode_world_state(data.data(), data.size(), transferredWorld))
+        return;
+    entities.reserve(entities.size() + transferredWorld.size());
+    for (const Entity& e : transferredWorld)
+        on_new_entity(e);
+    printf("got world of %zu entities\n", transferredWorld.size());
 }
 
-void on_snapshot(ENetPacket* packet)
+void on_snapshot(const SnapshotMsg& msg)
 {
-    uint16_t eid = invalid_entity;
-    float x = 0.f; float y = 0.f; float size = 1.f;
-    deserialize_snapshot(packet, eid, x, y, size);
-    for (Entity& e : entities)
-        if (e.eid == eid)
-        {
-            e.x = x;
-            e.y = y;
-            e.size = size;
-        }
+    last_snapshot_tick = std::max(last_snapshot_tick, msg.tick);
+    if (Entity* e = entityIndex.get(entities, msg.eid))
+    {
+        e->x = msg.x;
+        e->y = msg.y;
+        e->size = msg.size;
+    }
 }
 
-void on_score(ENetPacket* packet)
+void on_snapshot_self(const EntityUpdateMsg& msg)
 {
-    uint16_t eid = invalid_entity;
-    int _score = 0;
-    deserialize_score(packet, eid, _score);
-    score[eid] = _score;
+    if (Entity* e = entityIndex.get(entities, my_entity))
+    {
+        e->x = msg.x;
+        e->y = msg.y;
+        e->size = msg.size;
+    }
 }
 
+// What each message from the server does, see ServerToClientMessages
+struct ServerMessageHandler
+{
+    ENetPeer* peer;
 
-void on_snapshot_self(ENetPacket* packet)
+    void operator()(const Entity& msg)
+    {
+        on_new_entity(msg);
+        printf("got new entity\n");
+    }
+    void operator()(const SetControlledEntityMsg& msg)
+    {
+        my_entity = msg.eid;
+        printf("got controlled entity\n");
+    }
+    void operator()(const SnapshotMsg& msg) { on_snapshot(msg); }
+    void operator()(const EntityUpdateMsg& msg) { on_snapshot_self(msg); }
+    void operator()(const ScoreMsg& msg) { score[msg.eid] = msg.score; }
+    void operator()(const SessionTokenMsg& msg) { my_session_token = msg.token; }
+    void operator()(const WorldChunkMsg& msg) { on_world_chunk(msg, peer); }
+};
+
+static void publish_view()
+{
+    WorldView& view = views.get_back();
+    view.entities.clear();
+    for (const Entity& e : entities)
+        view.entities.push_back({ e.x, e.y, e.size, e.color });
+    view.score.assign(score.begin(), score.end());
+    views.publish();
+}
+
+// Moves our entity by the keys held and sends where it is, once per server tick
+static void send_state(ENetHost* client, ENetPeer* serverPeer)
 {
-    uint16_t eid = invalid_entity;
-    float x = 0.f; float y = 0.f; float size = 1.f;
-    deserialize_snapshot(packet, eid, x, y, size);
-    for (Entity& e : entities)
-        if (e.eid == my_entity)
+    Entity* e = my_entity != invalid_entity ? entityIndex.get(entities, my_entity) : nullptr;
+    if (!e)
+        return;
+    const uint8_t keys = heldKeys.load(std::memory_order_relaxed);
+    constexpr float dt = fixedDtMs * 0.001f;
+    e->x += (((keys & E_KEY_LEFT) ? -dt : 0.f) + ((keys & E_KEY_RIGHT) ? +dt : 0.f)) * 100.f;
+    e->y += (((keys & E_KEY_UP) ? -dt : 0.f) + ((keys & E_KEY_DOWN) ? +dt : 0.f)) * 100.f;
+
+    send_entity_state(serverPeer, my_entity, e->x, e->y, e->size, last_snapshot_tick, interpolation_delay_ms);
+    // out now, not at the next service
+    enet_host_flush(client);
+}
+
+static void run_network(ENetHost* client, ENetAddress address, ENetPeer* serverPeer)
+{
+    uint32_t nextTick = enet_time_get();
+    while (!quit.load(std::memory_order_relaxed))
+    {
+        // sleep in the service until a packet comes or the next tick is due
+        const int32_t untilTick = int32_t(nextTick - enet_time_get());
+        ENetEvent event;
+        for (uint32_t timeout = uint32_t(std::max(untilTick, 0)); enet_host_service(client, &event, timeout) > 0; timeout = 0)
         {
-            e.x = x;
-            e.y = y;
-            e.size = size;
+            switch (event.type)
+            {
+            case ENET_EVENT_TYPE_CONNECT:
+                printf("Connection with %x:%u established\n", event.peer->address.host, event.peer->address.port);
+                if (my_session_token != 0)
+                    send_reattach(serverPeer, my_entity, my_session_token);
+                else
+                    send_join(serverPeer);
+                break;
+            case ENET_EVENT_TYPE_DISCONNECT:
+                // Server went away (crash or restart), keep retrying and reattach to our entity
+                printf("Disconnected, reconnecting\n");
+                last_snapshot_tick = 0;
+                worldTransfer.reset();
+                serverPeer = enet_host_connect(client, &address, channelCount, 0);
+                break;
+            case ENET_EVENT_TYPE_RECEIVE:
+            {
+                ServerMessageHandler handler{ event.peer };
+                ServerToClientMessages::dispatch(handler, event.packet);
+                enet_packet_destroy(event.packet);
+                break;
+            }
+            default:
+                break;
+            };
         }
+        const uint32_t now = enet_time_get();
+        // don't try to catch up after a long stall, just resume from now
+        if (int32_t(now - nextTick) > int32_t(10 * fixedDtMs))
+            nextTick = now;
+        for (; int32_t(now - nextTick) >= 0; nextTick += fixedDtMs)
+            send_state(client, serverPeer);
+        // our own entity moves every tick, so there is always something new
+        publish_view();
+    }
 }
 
 int main(int argc, const char** argv)
@@ -75,7 +206,7 @@ int main(int argc, const char** argv)
         return 1;
     }
 
-    ENetHost* client = enet_host_create(nullptr, 1, 2, 0, 0);
+    ENetHost* client = enet_host_create(nullptr, 1, channelCount, 0, 0);
     if (!client)
     {
         printf("Cannot create ENet client\n");
@@ -86,7 +217,7 @@ int main(int argc, const char** argv)
     enet_address_set_host(&address, "127.0.0.1");
     address.port = 10131;
 
-    ENetPeer* serverPeer = enet_host_connect(client, &address, 2, 0);
+    ENetPeer* serverPeer = enet_host_connect(client, &address, channelCount, 0);
     if (!serverPeer)
     {
         printf("Cannot connect to server");
@@ -114,72 +245,24 @@ int main(int argc, const char** argv)
 
     SetTargetFPS(60);               
 
-    bool connected = false;
+    std::thread network(run_network, client, address, serverPeer);
     while (!WindowShouldClose())
     {
-        float dt = GetFrameTime();
-        ENetEvent event;
-        while (enet_host_service(client, &event, 0) > 0)
-        {
-            switch (event.type)
-            {
-            case ENET_EVENT_TYPE_CONNECT:
-                printf("Connection with %x:%u established\n", event.peer->address.host, event.peer->address.port);
-                send_join(serverPeer);
-                connected = true;
-                break;
-            case ENET_EVENT_TYPE_RECEIVE:
-                switch (get_packet_type(event.packet))
-                {
-                case E_SERVER_TO_CLIENT_NEW_ENTITY:
-                    on_new_entity_packet(event.packet);
-                    printf("got new entity\n");
-                    break;
-                case E_SERVER_TO_CLIENT_SET_CONTROLLED_ENTITY:
-                    on_set_controlled_entity(event.packet);
-                    printf("got controlled entity\n");
-                    break;
-                case E_SERVER_TO_CLIENT_SNAPSHOT:
-                    on_snapshot(event.packet);
-                    break;
-                case E_SERVER_TO_CLIENT_SCORE:
-                    on_score(event.packet);
-                    break;
-                case E_SERVER_TO_CLIENT_STATE:
-                    on_snapshot_self(event.packet);
-                    break;
-                };
-                break;
-            default:
-                break;
-            };
-        }
-        if (my_entity != invalid_entity)
-        {
-            bool left = IsKeyDown(KEY_LEFT);
-            bool right = IsKeyDown(KEY_RIGHT);
-            bool up = IsKeyDown(KEY_UP);
-            bool down = IsKeyDown(KEY_DOWN);
-            for (Entity& e : entities)
-                if (e.eid == my_entity)
-                {
-                    e.x += ((left ? -dt : 0.f) + (right ? +dt : 0.f)) * 100.f;
-                    e.y += ((up ? -dt : 0.f) + (down ? +dt : 0.f)) * 100.f;
-
-                    send_entity_state(serverPeer, my_entity, e.x, e.y, e.size);
-                }
-        }
-
+        const uint8_t keys = (IsKeyDown(KEY_LEFT) ? E_KEY_LEFT : 0) | (IsKeyDown(KEY_RIGHT) ? E_KEY_RIGHT : 0) |
+            (IsKeyDown(KEY_UP) ? E_KEY_UP : 0) | (IsKeyDown(KEY_DOWN) ? E_KEY_DOWN : 0);
+        heldKeys.store(keys, std::memory_order_relaxed);
+        views.update();
+        const WorldView& view = views.get_front();
 
         BeginDrawing();
         ClearBackground(BLACK);
         BeginMode2D(camera);
-        for (const Entity& e : entities)
+        for (const DrawnEntity& e : view.entities)
         {
             DrawCircle(e.x, e.y, e.size, GetColor(e.color));
         }
         int p = 0;
-        for (auto player : score) {
+        for (auto player : view.score) {
             DrawText(TextFormat("Score for player %d: %d", player.first, player.second), -width / 2, -height / 2 + p, 20, RED);
             p += 20;
         }
@@ -187,6 +270,8 @@ int main(int argc, const char** argv)
         EndMode2D();
         EndDrawing();
     }
+    quit = true;
+    network.join();
     printf("Done");
 
     CloseWindow();
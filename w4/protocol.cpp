@@ -1,136 +1,93 @@
 #include "protocol.h"
-#include "bitstream.h"
-#include <cstring>
 
-void send_join(ENetPeer* peer)
+// enet_peer_send only takes ownership of the packet on success, a packet for a
+// peer that is not connected (or a replayed one) has to be released here
+static void send_packet(ENetPeer* peer, uint8_t channel, ENetPacket* packet)
 {
-    ENetPacket* packet = enet_packet_create(nullptr, sizeof(uint8_t), ENET_PACKET_FLAG_RELIABLE);
-    Bitstream bs(packet->data, sizeof(uint8_t));
-    bs.write(E_CLIENT_TO_SERVER_JOIN);
+    if (enet_peer_send(peer, channel, packet) != 0)
+        enet_packet_destroy(packet);
+}
 
-    enet_peer_send(peer, 0, packet);
+void send_join(ENetPeer* peer)
+{
+    send_packet(peer, 0, create_message_packet(joinSchema, {}, ENET_PACKET_FLAG_RELIABLE));
 }
 
 void send_new_entity(ENetPeer* peer, const Entity& ent)
 {
-    uint8_t size = sizeof(uint8_t) + sizeof(Entity);
-    ENetPacket* packet = enet_packet_create(nullptr, size, ENET_PACKET_FLAG_RELIABLE);
-
-    Bitstream bs(packet->data, size);
-    bs.write(E_SERVER_TO_CLIENT_NEW_ENTITY);
-    bs.write(ent);
-
-    enet_peer_send(peer, 0, packet);
+    send_packet(peer, 0, create_message_packet(newEntitySchema, ent, ENET_PACKET_FLAG_RELIABLE));
 }
 
 void send_set_controlled_entity(ENetPeer* peer, uint16_t eid)
 {
-    uint8_t size = sizeof(uint8_t) + sizeof(uint16_t);
-    ENetPacket* packet = enet_packet_create(nullptr, size, ENET_PACKET_FLAG_RELIABLE);
-
-    Bitstream bs(packet->data, size);
-    bs.write(E_SERVER_TO_CLIENT_SET_CONTROLLED_ENTITY);
-    bs.write(eid);
-
-    enet_peer_send(peer, 0, packet);
+    send_packet(peer, 0, create_message_packet(setControlledEntitySchema, { eid }, ENET_PACKET_FLAG_RELIABLE));
 }
 
-void send_entity_state(ENetPeer* peer, uint16_t eid, float x, float y, float e_size)
+void send_entity_state(ENetPeer* peer, uint16_t eid, float x, float y, float e_size, uint32_t viewTick, uint16_t interpDelayMs)
 {
-    uint8_t size = sizeof(uint8_t) + sizeof(uint16_t) + 3 * sizeof(float);
-    ENetPacket* packet = enet_packet_create(nullptr, size, ENET_PACKET_FLAG_UNSEQUENCED);
-
-    Bitstream bs(packet->data, size);
-    bs.write(E_CLIENT_TO_SERVER_STATE);
-    bs.write(eid);
-    bs.write(x);
-    bs.write(y);
-    bs.write(e_size);
-
-    enet_peer_send(peer, 1, packet);
+    const EntityStateMsg msg = { eid, x, y, e_size, viewTick, interpDelayMs };
+    send_packet(peer, 1, create_message_packet(entityStateSchema, msg, ENET_PACKET_FLAG_UNSEQUENCED));
 }
 
 void send_player_score(ENetPeer* peer, uint16_t eid, int score)
 {
-    uint8_t size = sizeof(uint8_t) + sizeof(uint16_t) + sizeof(int);
-    ENetPacket* packet = enet_packet_create(nullptr, size, ENET_PACKET_FLAG_UNSEQUENCED);
-
-    Bitstream bs(packet->data, size);
-    bs.write(E_SERVER_TO_CLIENT_SCORE);
-    bs.write(eid);
-    bs.write(score);
-
-    enet_peer_send(peer, 0, packet);
+    send_packet(peer, 0, create_message_packet(scoreSchema, { eid, score }, ENET_PACKET_FLAG_UNSEQUENCED));
 }
 
-void send_entity_update(ENetPeer* peer, uint16_t eid, float x, float y, float e_size)
+void send_session_token(ENetPeer* peer, uint16_t eid, uint32_t token)
 {
-    uint8_t size = sizeof(uint8_t) + sizeof(uint16_t) + 3 * sizeof(float);
-    ENetPacket* packet = enet_packet_create(nullptr, size, ENET_PACKET_FLAG_RELIABLE);
-
-    Bitstream bs(packet->data, size);
-    bs.write(E_SERVER_TO_CLIENT_STATE);
-    bs.write(eid);
-    bs.write(x);
-    bs.write(y);
-    bs.write(e_size);
-
-    enet_peer_send(peer, 0, packet);
+    send_packet(peer, 0, create_message_packet(sessionTokenSchema, { eid, token }, ENET_PACKET_FLAG_RELIABLE));
 }
 
-void send_snapshot(ENetPeer* peer, uint16_t eid, float x, float y, float e_size)
+void send_reattach(ENetPeer* peer, uint16_t eid, uint32_t token)
 {
-    uint8_t size = sizeof(uint8_t) + sizeof(uint16_t) + 3 * sizeof(float);
-    ENetPacket* packet = enet_packet_create(nullptr, size, ENET_PACKET_FLAG_UNSEQUENCED);
-
-    Bitstream bs(packet->data, size);
-    bs.write(E_SERVER_TO_CLIENT_SNAPSHOT);
-    bs.write(eid);
-    bs.write(x);
-    bs.write(y);
-    bs.write(e_size);
+    send_packet(peer, 0, create_message_packet(reattachSchema, { eid, token }, ENET_PACKET_FLAG_RELIABLE));
+}
 
-    enet_peer_send(peer, 1, packet);
+void send_entity_update(ENetPeer* peer, uint16_t eid, float x, float y, float e_size, uint32_t tick)
+{
+    const EntityUpdateMsg msg = { eid, x, y, e_size, tick };
+    send_packet(peer, 0, create_message_packet(entityUpdateSchema, msg, ENET_PACKET_FLAG_RELIABLE));
 }
 
-MessageType get_packet_type(ENetPacket* packet)
+void send_snapshot(ENetPeer* peer, uint16_t eid, float x, float y, float e_size, uint32_t tick)
 {
-    return (MessageType)*packet->data;
+    const SnapshotMsg msg = { eid, x, y, e_size, tick };
+    send_packet(peer, 1, create_message_packet(snapshotSchema, msg, ENET_PACKET_FLAG_UNSEQUENCED));
 }
 
-void deserialize_new_entity(ENetPacket* packet, Entity& ent)
+// A new entity's fields but the eid, the world delta's records carry that
+static constexpr auto worldStateSchema = make_message_schema<Entity>(E_SERVER_TO_CLIENT_WORLD_CHUNK,
+    bits_field(&Entity::color, 32),
+    float_field(&Entity::x),
+    float_field(&Entity::y),
+    bits_field(&Entity::serverControlled, 1),
+    float_field(&Entity::targetX),
+    float_field(&Entity::targetY),
+    float_field(&Entity::size));
+
+bool encode_world_state(const std::vector<Entity>& world, std::vector<uint8_t>& data)
 {
-    Bitstream bs(packet->data + sizeof(uint8_t), 0);
-    bs.read(ent);
+    return write_world_state(worldStateSchema, world, data);
 }
 
-void deserialize_set_controlled_entity(ENetPacket* packet, uint16_t& eid)
+bool decode_world_state(const uint8_t* data, size_t size, std::vector<Entity>& world)
 {
-    Bitstream bs(packet->data + sizeof(uint8_t), 0);
-    bs.read(eid);
+    return read_world_state(worldStateSchema, data, size, world);
 }
 
-void deserialize_entity_state(ENetPacket* packet, uint16_t& eid, float& x, float& y, float& size)
+void send_world_chunk(ENetPeer* peer, const WorldChunkMsg& chunk)
 {
-    Bitstream bs(packet->data + sizeof(uint8_t), 0);
-    bs.read(eid);
-    bs.read(x);
-    bs.read(y);
-    bs.read(size);
+    send_packet(peer, worldTransferChannel, create_message_packet(worldChunkSchema, chunk, ENET_PACKET_FLAG_RELIABLE));
 }
 
-void deserialize_snapshot(ENetPacket* packet, uint16_t& eid, float& x, float& y, float& size)
+void send_world_state_ack(ENetPeer* peer, uint16_t transfer, uint16_t received)
 {
-    Bitstream bs(packet->data + sizeof(uint8_t), 0);
-    bs.read(eid);
-    bs.read(x);
-    bs.read(y);
-    bs.read(size);
+    send_packet(peer, worldTransferChannel,
+        create_message_packet(worldStateAckSchema, { transfer, received }, ENET_PACKET_FLAG_RELIABLE));
 }
 
-void deserialize_score(ENetPacket* packet, uint16_t& eid, int& score)
+MessageType get_packet_type(ENetPacket* packet)
 {
-    Bitstream bs(packet->data + sizeof(uint8_t), 0);
-    bs.read(eid);
-    bs.read(score);
+    return packet->dataLength > 0 ? (MessageType)*packet->data : E_INVALID_MESSAGE;
 }
@@ -1,7 +1,15 @@
 #pragma once
 #include <cstdint>
+#include <vector>
 #include <enet/enet.h>
 #include "entity.h"
+#include "messageRegistry.h"
+#include "worldTransfer.h"
+
+// Reliable messages go on channel 0, states and snapshots on 1, and the world
+// a client gets when it joins on a channel of its own, see worldTransfer.h
+constexpr uint8_t worldTransferChannel = 2;
+constexpr size_t channelCount = 3;
 
 enum MessageType : uint8_t
 {
@@ -11,22 +19,108 @@ enum MessageType : uint8_t
 	E_CLIENT_TO_SERVER_STATE,
 	E_SERVER_TO_CLIENT_STATE,
 	E_SERVER_TO_CLIENT_SNAPSHOT,
-	E_SERVER_TO_CLIENT_SCORE
+	E_SERVER_TO_CLIENT_SCORE,
+	E_SERVER_TO_CLIENT_SESSION_TOKEN,
+	E_CLIENT_TO_SERVER_REATTACH,
+	E_SERVER_TO_CLIENT_WORLD_CHUNK,
+	E_CLIENT_TO_SERVER_WORLD_STATE_ACK,
+	E_INVALID_MESSAGE = 0xff // what get_packet_type returns for an empty packet
+};
+
+// Every message as its schema sends it, see messageRegistry.h. New entities
+// go as the Entity itself.
+struct JoinMsg {};
+struct SetControlledEntityMsg { uint16_t eid = invalid_entity; };
+struct EntityStateMsg
+{
+	uint16_t eid = invalid_entity;
+	float x = 0.f;
+	float y = 0.f;
+	float size = 1.f;
+	uint32_t viewTick = 0;
+	uint16_t interpDelayMs = 0;
+};
+// Snapshots and the updates of a client's own entity share a layout, a type
+// of message each so a handler can tell them apart
+template <MessageType Type>
+struct EntityPositionMsg
+{
+	uint16_t eid = invalid_entity;
+	float x = 0.f;
+	float y = 0.f;
+	float size = 1.f;
+	uint32_t tick = 0;
 };
+typedef EntityPositionMsg<E_SERVER_TO_CLIENT_SNAPSHOT> SnapshotMsg;
+typedef EntityPositionMsg<E_SERVER_TO_CLIENT_STATE> EntityUpdateMsg;
+struct ScoreMsg { uint16_t eid = invalid_entity; int score = 0; };
+struct SessionTokenMsg { uint16_t eid = invalid_entity; uint32_t token = 0; };
+struct ReattachMsg { uint16_t eid = invalid_entity; uint32_t token = 0; };
+
+inline constexpr auto joinSchema = make_message_schema<JoinMsg>(E_CLIENT_TO_SERVER_JOIN);
+inline constexpr auto newEntitySchema = make_message_schema<Entity>(E_SERVER_TO_CLIENT_NEW_ENTITY,
+	bits_field(&Entity::color, 32),
+	float_field(&Entity::x),
+	float_field(&Entity::y),
+	bits_field(&Entity::eid, 16),
+	bits_field(&Entity::serverControlled, 1),
+	float_field(&Entity::targetX),
+	float_field(&Entity::targetY),
+	float_field(&Entity::size));
+inline constexpr auto setControlledEntitySchema = make_message_schema<SetControlledEntityMsg>(
+	E_SERVER_TO_CLIENT_SET_CONTROLLED_ENTITY,
+	bits_field(&SetControlledEntityMsg::eid, 16));
+inline constexpr auto entityStateSchema = make_message_schema<EntityStateMsg>(E_CLIENT_TO_SERVER_STATE,
+	bits_field(&EntityStateMsg::eid, 16),
+	float_field(&EntityStateMsg::x),
+	float_field(&EntityStateMsg::y),
+	float_field(&EntityStateMsg::size),
+	bits_field(&EntityStateMsg::viewTick, 32),
+	bits_field(&EntityStateMsg::interpDelayMs, 16));
+template <MessageType Type>
+inline constexpr auto entityPositionSchema = make_message_schema<EntityPositionMsg<Type>>(Type,
+	bits_field(&EntityPositionMsg<Type>::eid, 16),
+	float_field(&EntityPositionMsg<Type>::x),
+	float_field(&EntityPositionMsg<Type>::y),
+	float_field(&EntityPositionMsg<Type>::size),
+	bits_field(&EntityPositionMsg<Type>::tick, 32));
+inline constexpr auto snapshotSchema = entityPositionSchema<E_SERVER_TO_CLIENT_SNAPSHOT>;
+inline constexpr auto entityUpdateSchema = entityPositionSchema<E_SERVER_TO_CLIENT_STATE>;
+inline constexpr auto scoreSchema = make_message_schema<ScoreMsg>(E_SERVER_TO_CLIENT_SCORE,
+	bits_field(&ScoreMsg::eid, 16),
+	bits_field(&ScoreMsg::score, 32));
+inline constexpr auto sessionTokenSchema = make_message_schema<SessionTokenMsg>(E_SERVER_TO_CLIENT_SESSION_TOKEN,
+	bits_field(&SessionTokenMsg::eid, 16),
+	bits_field(&SessionTokenMsg::token, 32));
+inline constexpr auto reattachSchema = make_message_schema<ReattachMsg>(E_CLIENT_TO_SERVER_REATTACH,
+	bits_field(&ReattachMsg::eid, 16),
+	bits_field(&ReattachMsg::token, 32));
+inline constexpr auto worldChunkSchema = make_world_chunk_schema<E_SERVER_TO_CLIENT_WORLD_CHUNK>();
+inline constexpr auto worldStateAckSchema = make_world_state_ack_schema<E_CLIENT_TO_SERVER_WORLD_STATE_ACK>();
+
+// What each end receives, for MessageRegistry::dispatch
+typedef MessageRegistry<joinSchema, entityStateSchema, reattachSchema, worldStateAckSchema> ClientToServerMessages;
+typedef MessageRegistry<newEntitySchema, setControlledEntitySchema, snapshotSchema, entityUpdateSchema,
+	scoreSchema, sessionTokenSchema, worldChunkSchema> ServerToClientMessages;
 
 void send_join(ENetPeer* peer);
 void send_new_entity(ENetPeer* peer, const Entity& ent);
 void send_set_controlled_entity(ENetPeer* peer, uint16_t eid);
-void send_entity_state(ENetPeer* peer, uint16_t eid, float x, float y, float size);
-void send_entity_update(ENetPeer* peer, uint16_t eid, float x, float y, float size);
-void send_snapshot(ENetPeer* peer, uint16_t eid, float x, float y, float size);
+// viewTick is the newest server tick the client has seen, interpDelayMs how far
+// behind it renders. The server uses both to rewind other entities for lag compensation.
+void send_entity_state(ENetPeer* peer, uint16_t eid, float x, float y, float size, uint32_t viewTick, uint16_t interpDelayMs);
+void send_entity_update(ENetPeer* peer, uint16_t eid, float x, float y, float size, uint32_t tick);
+void send_snapshot(ENetPeer* peer, uint16_t eid, float x, float y, float size, uint32_t tick);
 void send_player_score(ENetPeer* peer, uint16_t eid, int score);
+void send_session_token(ENetPeer* peer, uint16_t eid, uint32_t token);
+void send_reattach(ENetPeer* peer, uint16_t eid, uint32_t token);
+// Every entity of world (sorted by eid) range coded as one block, what a
+// world transfer sends a joining client. False if it can't be coded, no
+// transfer may start then.
+bool encode_world_state(const std::vector<Entity>& world, std::vector<uint8_t>& data);
+// False on a malformed state, world is garbage then
+bool decode_world_state(const uint8_t* data, size_t size, std::vector<Entity>& world);
+void send_world_chunk(ENetPeer* peer, const WorldChunkMsg& chunk);
+void send_world_state_ack(ENetPeer* peer, uint16_t transfer, uint16_t received);
 
-MessageType get_packet_type(ENetPacket* packet);
-
-void deserialize_new_entity(ENetPacket* packet, Entity& ent);
-void deserialize_set_controlled_entity(ENetPacket* packet, uint16_t& eid);
-void deserialize_update_controlled_entity(ENetPacket* packet, uint16_t& eid);
-void deserialize_entity_state(ENetPacket* packet, uint16_t& eid, float& x, float& y, float& size);
-void deserialize_snapshot(ENetPacket* packet, uint16_t& eid, float& x, float& y, float& size);
-void deserialize_score(ENetPacket* packet, uint16_t& eid, int& score);
\ No newline at end of file
+MessageType get_packet_type(ENetPacket* packet);
\ No newline at end of file
@@ -0,0 +1,131 @@
+#include <enet/enet.h>
+#include "world.h"
+#include "journal.h"
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <chrono>
+#include <vector>
+
+// Headless replay of a journal recorded with `w4_server --record`.
+// Runs the simulation as fast as possible and checks the world checksum
+// recorded by the server every few ticks.
+//
+// usage: w4_replay <journal> [--slowest N]
+
+struct TickTime
+{
+    uint32_t tick;
+    double ms;
+};
+
+int main(int argc, const char** argv)
+{
+    if (argc < 2)
+    {
+        printf("usage: %s <journal> [--slowest N]\n", argv[0]);
+        return 1;
+    }
+    size_t numSlowest = 10;
+    for (int i = 2; i + 1 < argc; ++i)
+        if (strcmp(argv[i], "--slowest") == 0)
+            numSlowest = strtoul(argv[++i], nullptr, 10);
+
+    JournalReader journal;
+    if (!journal.open(argv[1]))
+    {
+        printf("Cannot open journal %s\n", argv[1]);
+        return 1;
+    }
+    if (enet_initialize() != 0)
+    {
+        printf("Cannot init ENet");
+        return 1;
+    }
+
+    // Peers are never connected, so everything the world sends is dropped
+    // while the simulation itself runs exactly as on the server.
+    ENetHost host = {};
+    std::vector<ENetPeer> peers(32);
+    for (ENetPeer& peer : peers)
+        peer.host = &host;
+    host.peers = peers.data();
+    host.peerCount = peers.size();
+
+    const JournalHeader& header = journal.get_header();
+    const float dt = header.fixedDtMs * 0.001f;
+    init_world(header.seed);
+
+    using Clock = std::chrono::steady_clock;
+    std::vector<TickTime> tickTimes;
+    uint32_t tick = 0;
+    uint32_t numChecks = 0;
+    auto start = Clock::now();
+
+    JournalRecord rec;
+    while (journal.next(rec))
+    {
+        while (tick < rec.tick)
+        {
+            auto tickStart = Clock::now();
+            update_world(&host, dt);
+            tickTimes.push_back({ tick, std::chrono::duration<double, std::milli>(Clock::now() - tickStart).count() });
+            ++tick;
+        }
+        if (rec.peer >= peers.size())
+        {
+            printf("Bad peer %u at tick %u\n", rec.peer, rec.tick);
+            return 1;
+        }
+        switch (rec.type)
+        {
+        case E_JOURNAL_RECEIVE:
+            if (!rec.data.empty())
+            {
+                ENetPacket* packet = enet_packet_create(rec.data.data(), rec.data.size(), 0);
+                on_packet(packet, &peers[rec.peer], &host);
+                enet_packet_destroy(packet);
+            }
+            break;
+        case E_JOURNAL_DISCONNECT:
+            on_disconnect(&peers[rec.peer]);
+            break;
+        case E_JOURNAL_SESSION_TOKEN:
+        {
+            uint32_t token = 0;
+            memcpy(&token, rec.data.data(), std::min(rec.data.size(), sizeof(uint32_t)));
+            queue_session_token(token);
+            break;
+        }
+        case E_JOURNAL_CHECKSUM:
+        {
+            uint32_t expected = 0;
+            memcpy(&expected, rec.data.data(), std::min(rec.data.size(), sizeof(uint32_t)));
+            uint32_t actual = world_checksum();
+            if (actual != expected)
+            {
+                printf("Diverged at tick %u: checksum %08x, recorded %08x\n", tick, actual, expected);
+                return 1;
+            }
+            ++numChecks;
+            break;
+        }
+        default:
+            break;
+        }
+    }
+
+    double wallMs = std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+    double simMs = double(tick) * header.fixedDtMs;
+    printf("Replayed %u ticks (%.1f s simulated) in %.1f ms, %.0fx real time, %u checksums ok\n",
+           tick, simMs * 0.001, wallMs, wallMs > 0.0 ? simMs / wallMs : 0.0, numChecks);
+
+    numSlowest = std::min(numSlowest, tickTimes.size());
+    std::partial_sort(tickTimes.begin(), tickTimes.begin() + numSlowest, tickTimes.end(),
+                      [](const TickTime& a, const TickTime& b) { return a.ms > b.ms; });
+    for (size_t i = 0; i < numSlowest; ++i)
+        printf("  tick %u: %.3f ms\n", tickTimes[i].tick, tickTimes[i].ms);
+
+    atexit(enet_deinitialize);
+    return 0;
+}
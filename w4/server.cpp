@@ -1,105 +1,41 @@
 #include <enet/enet.h>
 #include <iostream>
-#include "entity.h"
+#include "world.h"
 #include "protocol.h"
-#include "bitstream.h"
+#include "journal.h"
+#include "checkpoint.h"
+#include "profiler.h"
 #include <stdlib.h>
+#include <string.h>
+#include <random>
 #include <vector>
-#include <map>
 
-static std::vector<Entity> entities;
-static std::map<uint16_t, int> score;
-static std::map<uint16_t, ENetPeer*> controlledMap;
-
-static uint16_t create_random_entity()
-{
-    uint16_t newEid = entities.size();
-    uint32_t color = 0x44000000 * (1 + rand() % 4) +
-        0x00440000 * (1 + rand() % 4) +
-        0x00004400 * (1 + rand() % 4) +
-        0x000000ff;
-    float x = (rand() % 200 - 100) * 5.f;
-    float y = (rand() % 200 - 100) * 5.f;
-    float size = (rand() % 5 + 5.f);
-    Entity ent = { color, x, y, newEid, false, 0.f, 0.f, size };
-    entities.push_back(ent);
-    return newEid;
-}
-
-void on_score_update(ENetHost* server) {
-    for (Entity& e : entities)
-        if (controlledMap[e.eid] != nullptr)
-        {
-            for (size_t i = 0; i < server->connectedPeers; ++i)
-            {
-                send_player_score(&server->peers[i], e.eid, score[e.eid]);
-            }
-        }
-}
-
-void on_join(ENetPacket* packet, ENetPeer* peer, ENetHost* host)
-{
-    for (const Entity& ent : entities)
-        send_new_entity(peer, ent);
-
-    uint16_t newEid = create_random_entity();
-    const Entity& ent = entities[newEid];
-
-    controlledMap[newEid] = peer;
-
-    for (size_t i = 0; i < host->connectedPeers; ++i)
-        send_new_entity(&host->peers[i], ent);
-    
-    send_set_controlled_entity(peer, newEid);
-    on_score_update(host);
-}
-
-void on_state(ENetPacket* packet)
+int main(int argc, const char** argv)
 {
-    uint16_t eid = invalid_entity;
-    float x = 0.f; float y = 0.f; float size = 1.f;
-    deserialize_entity_state(packet, eid, x, y, size);
-    for (Entity& e : entities)
+    const char* journalPath = nullptr;
+    const char* checkpointPath = nullptr;
+    uint32_t seed = std::random_device()();
+    // a different port lets netsim listen on the one clients connect to
+    uint16_t port = 10131;
+    // a tick slower than this saves the profiler's trace of the last second, 0 never does
+    float slowTickMs = 0.f;
+    const char* tracePath = "w4_server_trace.json";
+    for (int i = 1; i + 1 < argc; ++i)
     {
-        if (e.eid == eid) {
-            e.x = x;
-            e.y = y;
-        }
+        if (strcmp(argv[i], "--record") == 0)
+            journalPath = argv[++i];
+        else if (strcmp(argv[i], "--seed") == 0)
+            seed = strtoul(argv[++i], nullptr, 10);
+        else if (strcmp(argv[i], "--checkpoint") == 0)
+            checkpointPath = argv[++i];
+        else if (strcmp(argv[i], "--port") == 0)
+            port = uint16_t(atoi(argv[++i]));
+        else if (strcmp(argv[i], "--slow-tick-ms") == 0)
+            slowTickMs = float(atof(argv[++i]));
+        else if (strcmp(argv[i], "--trace") == 0)
+            tracePath = argv[++i];
     }
-}
-
-void teleport_to_random_position(Entity& e) {
-    e.x = (rand() % 200 - 100) * 5.f;
-    e.y = (rand() % 200 - 100) * 5.f;
-}
 
-void on_collision(Entity& e1, Entity& e2) {
-    if (e1.size > e2.size) {
-        score[e1.eid] += 1;
-        e1.size += e2.size / 2;
-        e2.size /= 2;
-        teleport_to_random_position(e2);
-    }
-    else if (e1.size < e2.size) {
-        score[e2.eid] += 1;
-        e2.size += e1.size / 2;
-        e1.size /= 2;
-        teleport_to_random_position(e1);
-    }
-    else {
-        teleport_to_random_position(e1);
-        teleport_to_random_position(e2);
-    }
-    if (controlledMap[e1.eid] != nullptr) {
-        send_entity_update(controlledMap[e1.eid], e1.eid, e1.x, e1.y, e1.size);
-    }
-    if (controlledMap[e2.eid] != nullptr) {
-        send_entity_update(controlledMap[e2.eid], e2.eid, e2.x, e2.y, e2.size);
-    }
-}
-
-int main(int argc, const char** argv)
-{
     if (enet_initialize() != 0)
     {
         printf("Cannot init ENet");
@@ -108,9 +44,9 @@ int main(int argc, const char** argv)
     ENetAddress address;
 
     address.host = ENET_HOST_ANY;
-    address.port = 10131;
+    address.port = port;
 
-    ENetHost* server = enet_host_create(&address, 32, 2, 0, 0);
+    ENetHost* server = enet_host_create(&address, 32, channelCount, 0, 0);
 
     if (!server)
     {
@@ -118,82 +54,98 @@ int main(int argc, const char** argv)
         return 1;
     }
 
-    constexpr int numAi = 10;
+    // session tokens, the world rng is seeded and predictable
+    std::random_device tokenSource;
+    JournalWriter journal;
+    if (journalPath && !journal.open(journalPath, seed, fixedDtMs))
+    {
+        printf("Cannot open journal %s\n", journalPath);
+        return 1;
+    }
+    printf("World seed %u\n", seed);
 
-    for (int i = 0; i < numAi; ++i)
+    constexpr size_t checkpointCapacity = 1 << 20;
+    CheckpointWriter checkpoints;
+    std::vector<uint8_t> checkpointState;
+    if (checkpointPath)
     {
-        uint16_t eid = create_random_entity();
-        entities[eid].serverControlled = true;
-        controlledMap[eid] = nullptr;
-        score[eid] = 0;
+        uint32_t loadStart = enet_time_get();
+        if (checkpoints.load(checkpointPath, checkpointCapacity, checkpointState) &&
+            load_world(checkpointState.data(), checkpointState.size()))
+            printf("Resumed from checkpoint %s in %u ms\n", checkpointPath, enet_time_get() - loadStart);
+        if (!checkpoints.start(checkpointPath, checkpointCapacity))
+        {
+            printf("Cannot open checkpoint %s\n", checkpointPath);
+            return 1;
+        }
     }
 
+    init_world(seed);
+    set_profile_thread_name("server");
+    SlowTickTrace slowTicks(tracePath, slowTickMs);
+
+    constexpr uint32_t checksumInterval = 100;
+    constexpr uint32_t checkpointInterval = 100;
+    uint32_t tick = 0;
+    uint32_t accumulatedMs = 0;
     uint32_t lastTime = enet_time_get();
     while (true)
     {
         uint32_t curTime = enet_time_get();
-        float dt = (curTime - lastTime) * 0.001f;
+        accumulatedMs += curTime - lastTime;
         lastTime = curTime;
         ENetEvent event;
         while (enet_host_service(server, &event, 0) > 0)
         {
+            // per event, the loop spins without any most of the time
+            PROFILE_ZONE("receive");
+            uint16_t peerIdx = uint16_t(event.peer - server->peers);
             switch (event.type)
             {
             case ENET_EVENT_TYPE_CONNECT:
                 printf("Connection with %x:%u established\n", event.peer->address.host, event.peer->address.port);
+                journal.record(tick, E_JOURNAL_CONNECT, peerIdx, nullptr, 0);
+                break;
+            case ENET_EVENT_TYPE_DISCONNECT:
+                journal.record(tick, E_JOURNAL_DISCONNECT, peerIdx, nullptr, 0);
+                on_disconnect(event.peer);
                 break;
             case ENET_EVENT_TYPE_RECEIVE:
-                switch (get_packet_type(event.packet))
+                if (needs_session_token())
                 {
-                case E_CLIENT_TO_SERVER_JOIN:
-                    on_join(event.packet, event.peer, server);
-                    break;
-                case E_CLIENT_TO_SERVER_STATE:
-                    on_state(event.packet);
-                    break;
-                };
+                    const uint32_t token = tokenSource();
+                    journal.record(tick, E_JOURNAL_SESSION_TOKEN, peerIdx, (const uint8_t*)&token, sizeof(uint32_t));
+                    queue_session_token(token);
+                }
+                journal.record(tick, E_JOURNAL_RECEIVE, peerIdx, event.packet->data, event.packet->dataLength);
+                on_packet(event.packet, event.peer, server);
                 enet_packet_destroy(event.packet);
                 break;
             default:
                 break;
             };
         }
-        for (Entity& e : entities)
+        // Fixed ticks keep the simulation independent of wall-clock jitter, so a journal replays bit-identically
+        while (accumulatedMs >= fixedDtMs)
         {
-            if (e.serverControlled)
+            slowTicks.begin();
+            update_world(server, fixedDtMs * 0.001f);
+            accumulatedMs -= fixedDtMs;
+            ++tick;
+            if (journal.is_open() && tick % checksumInterval == 0)
             {
-                const float diffX = e.targetX - e.x;
-                const float diffY = e.targetY - e.y;
-                const float dirX = diffX > 0.f ? 1.f : -1.f;
-                const float dirY = diffY > 0.f ? 1.f : -1.f;
-                constexpr float spd = 50.f;
-                e.x += dirX * spd * dt;
-                e.y += dirY * spd * dt;
-                if (fabsf(diffX) < 10.f && fabsf(diffY) < 10.f)
-                {
-                    e.targetX = (rand() % 40 - 20) * 15.f;
-                    e.targetY = (rand() % 40 - 20) * 15.f;
-                }
+                uint32_t checksum = world_checksum();
+                journal.record(tick, E_JOURNAL_CHECKSUM, 0, (const uint8_t*)&checksum, sizeof(uint32_t));
+                journal.flush();
             }
-        }
-        for (const Entity& e : entities)
-        {
-            for (size_t i = 0; i < server->connectedPeers; ++i)
+            // Serializing is a copy of the world, the file is written on the checkpoint thread
+            if (checkpointPath && tick % checkpointInterval == 0)
             {
-                ENetPeer* peer = &server->peers[i];
-                if (controlledMap[e.eid] != peer)
-                    send_snapshot(peer, e.eid, e.x, e.y, e.size);
-            }
-        }
-        for (Entity& e1 : entities)
-        {
-            for (Entity& e2 : entities)
-            {
-                if (e1.eid != e2.eid && ((e1.x - e2.x) * (e1.x - e2.x) + (e1.y - e2.y) * (e1.y - e2.y)) < ((e1.size + e2.size) * (e1.size + e2.size)) + 2.f) {
-                    on_collision(e1, e2);
-                    on_score_update(server);
-                }
+                save_world(checkpointState);
+                checkpoints.submit(checkpointState);
             }
+            if (slowTicks.end(enet_time_get()))
+                printf("Tick %u took %.1f ms, trace in %s\n", tick, slowTicks.get_tick_ms(), tracePath);
         }
     }
 
@@ -0,0 +1,511 @@
+#include "world.h"
+#include "entity.h"
+#include "protocol.h"
+#include "eidIndex.h"
+#include "checkpoint.h"
+#include "entityHistory.h"
+#include "archetype.h"
+#include "profiler.h"
+#include <math.h>
+#include <stdio.h>
+#include <algorithm>
+#include <random>
+#include <vector>
+#include <map>
+
+// The components of the world's entities, see archetype.h. Bots have the
+// target their AI walks to, players the (fractional) tick their client was
+// looking at when it sent its last state, -1 when unknown.
+struct NetId { using Value = uint16_t; };
+struct EntityColor { using Value = uint32_t; };
+struct Position { float x = 0.f; float y = 0.f; };
+struct Size { using Value = float; };
+struct AiTarget { float x = 0.f; float y = 0.f; };
+struct ViewTick { float tick = -1.f; };
+
+typedef Archetype<NetId, EntityColor, Position, Size, AiTarget> BotArchetype;
+typedef Archetype<NetId, EntityColor, Position, Size, ViewTick> PlayerArchetype;
+// bots first, they are spawned first, so passes see entities in spawn order
+static EntityWorld<BotArchetype, PlayerArchetype> entities;
+// the handle of every eid, entityHandles is indexed by entityIndex
+static EidIndex entityIndex;
+static std::vector<EntityHandle> entityHandles;
+static std::map<uint16_t, int> score;
+static std::map<uint16_t, ENetPeer*> controlledMap;
+static std::map<uint16_t, uint32_t> sessionTokens;
+// tokens for the next joins, oldest first, see queue_session_token
+static std::vector<uint32_t> queuedTokens;
+static uint16_t nextEid = 0;
+static uint32_t worldTick = 0;
+
+// transfers[i] belongs to host->peers[i], grown with the first peer that needs
+// one. A peer gets snapshots once its world transfer is done.
+static std::vector<WorldTransferSender> transfers;
+static uint16_t nextTransfer = 0;
+static std::vector<Entity> transferWorld;
+static std::vector<uint8_t> transferData;
+static WorldChunkMsg chunk;
+
+// Lag compensation: a second of past positions per entity, by the slot of its
+// handle
+constexpr uint32_t historyTicks = 1000 / fixedDtMs;
+constexpr uint32_t maxHistoryEntities = 1024;
+static EntityHistory history(maxHistoryEntities, historyTicks);
+
+// minstd_rand is fully specified by the standard, unlike rand(), so a seed
+// reproduces the same spawns, AI targets and teleports on every platform.
+static std::minstd_rand rng;
+
+static int random_int(int n)
+{
+    return int(rng() % n);
+}
+
+static const EntityHandle* find_entity(uint16_t eid)
+{
+    return entityIndex.get(entityHandles, eid);
+}
+
+static void spawn(const Entity& ent)
+{
+    EntityHandle handle;
+    if (ent.serverControlled)
+    {
+        handle = entities.create<BotArchetype>();
+        *entities.get<AiTarget>(handle) = { ent.targetX, ent.targetY };
+    }
+    else
+        handle = entities.create<PlayerArchetype>();
+    *entities.get<NetId>(handle) = ent.eid;
+    *entities.get<EntityColor>(handle) = ent.color;
+    *entities.get<Position>(handle) = { ent.x, ent.y };
+    *entities.get<Size>(handle) = ent.size;
+    entityIndex.insert(ent.eid);
+    entityHandles.push_back(handle);
+}
+
+// The entity as the protocol and checkpoints have it
+static Entity get_entity(EntityHandle handle)
+{
+    const Position& pos = *entities.get<Position>(handle);
+    Entity ent = { *entities.get<EntityColor>(handle), pos.x, pos.y, *entities.get<NetId>(handle), false, 0.f, 0.f,
+        *entities.get<Size>(handle) };
+    if (const AiTarget* target = entities.get<AiTarget>(handle))
+    {
+        ent.serverControlled = true;
+        ent.targetX = target->x;
+        ent.targetY = target->y;
+    }
+    return ent;
+}
+
+static uint16_t create_random_entity(bool serverControlled)
+{
+    uint16_t newEid = nextEid++;
+    uint32_t color = 0x44000000 * (1 + random_int(4)) +
+        0x00440000 * (1 + random_int(4)) +
+        0x00004400 * (1 + random_int(4)) +
+        0x000000ff;
+    float x = (random_int(200) - 100) * 5.f;
+    float y = (random_int(200) - 100) * 5.f;
+    float size = (random_int(5) + 5.f);
+    spawn({ color, x, y, newEid, serverControlled, 0.f, 0.f, size });
+    return newEid;
+}
+
+void init_world(uint32_t seed)
+{
+    rng.seed(seed);
+    if (entities.size() != 0)
+        return;
+
+    constexpr int numAi = 10;
+
+    for (int i = 0; i < numAi; ++i)
+    {
+        uint16_t eid = create_random_entity(true);
+        controlledMap[eid] = nullptr;
+        score[eid] = 0;
+    }
+}
+
+static WorldTransferSender& get_transfer(ENetPeer* peer)
+{
+    ENetHost* host = peer->host;
+    if (transfers.size() < host->peerCount)
+        transfers.resize(host->peerCount);
+    return transfers[peer - host->peers];
+}
+
+// connectedPeers counts peers, it is no bound on the slots they are in
+static bool is_connected(const ENetHost* host, size_t i)
+{
+    return host->peers[i].state == ENET_PEER_STATE_CONNECTED;
+}
+
+static bool has_world(const ENetHost* host, size_t i)
+{
+    return is_connected(host, i) && i < transfers.size() && transfers[i].is_done();
+}
+
+static void on_score_update(ENetHost* server) {
+    entities.each<NetId>([server](uint16_t eid)
+    {
+        if (controlledMap[eid] != nullptr)
+        {
+            for (size_t i = 0; i < server->peerCount; ++i)
+            {
+                if (is_connected(server, i))
+                    send_player_score(&server->peers[i], eid, score[eid]);
+            }
+        }
+    });
+}
+
+static void send_world_chunks(ENetPeer* peer)
+{
+    WorldTransferSender& transfer = get_transfer(peer);
+    while (transfer.next_chunk(chunk))
+        send_world_chunk(peer, chunk);
+}
+
+// Every entity as it is now, to peer as a world transfer
+static void start_world_transfer(ENetPeer* peer)
+{
+    transferWorld.clear();
+    for (EntityHandle handle : entityHandles)
+        transferWorld.push_back(get_entity(handle));
+    std::sort(transferWorld.begin(), transferWorld.end(), [](const Entity& a, const Entity& b) { return a.eid < b.eid; });
+    if (!encode_world_state(transferWorld, transferData))
+    {
+        printf("Cannot code a world of %zu entities\n", transferWorld.size());
+        return;
+    }
+    get_transfer(peer).start(++nextTransfer, transferData.data(), transferData.size());
+    send_world_chunks(peer);
+}
+
+static void on_join(ENetPeer* peer, ENetHost* host)
+{
+    uint16_t newEid = create_random_entity(false);
+    const Entity ent = get_entity(*find_entity(newEid));
+
+    controlledMap[newEid] = peer;
+    // in the checksum, not left to the first score[] a live peer happens to read
+    score[newEid] = 0;
+    uint32_t token = 0;
+    if (!queuedTokens.empty())
+    {
+        token = queuedTokens.front();
+        queuedTokens.erase(queuedTokens.begin());
+    }
+    else
+        token = std::random_device()();
+    sessionTokens[newEid] = token;
+
+    // The joiner's world has the new entity, peers whose transfer was cut
+    // before it get it as a message like everyone else
+    start_world_transfer(peer);
+    for (size_t i = 0; i < host->peerCount; ++i)
+    {
+        ENetPeer* other = &host->peers[i];
+        if (other != peer && is_connected(host, i) && i < transfers.size() &&
+            (transfers[i].is_active() || transfers[i].is_done()))
+            send_new_entity(other, ent);
+    }
+
+    send_set_controlled_entity(peer, newEid);
+    send_session_token(peer, newEid, token);
+    on_score_update(host);
+}
+
+static void on_reattach(const ReattachMsg& msg, ENetPeer* peer, ENetHost* host)
+{
+    const uint16_t eid = msg.eid;
+    auto it = sessionTokens.find(eid);
+    if (it == sessionTokens.end() || it->second != msg.token || !entityIndex.contains(eid))
+    {
+        on_join(peer, host);
+        return;
+    }
+
+    start_world_transfer(peer);
+
+    controlledMap[eid] = peer;
+    send_set_controlled_entity(peer, eid);
+    on_score_update(host);
+}
+
+bool needs_session_token()
+{
+    return queuedTokens.empty();
+}
+
+void queue_session_token(uint32_t token)
+{
+    queuedTokens.push_back(token);
+}
+
+void on_disconnect(ENetPeer* peer)
+{
+    get_transfer(peer).reset();
+    // Keep the entity around so the client can reattach to it
+    for (auto& controlled : controlledMap)
+        if (controlled.second == peer)
+        {
+            controlled.second = nullptr;
+            if (const EntityHandle* handle = find_entity(controlled.first))
+                if (ViewTick* view = entities.get<ViewTick>(*handle))
+                    view->tick = -1.f;
+        }
+}
+
+static void on_world_state_ack(const WorldStateAckMsg& msg, ENetPeer* peer)
+{
+    get_transfer(peer).on_ack(msg.transfer, msg.received);
+    send_world_chunks(peer);
+}
+
+static void on_state(const EntityStateMsg& msg)
+{
+    const EntityHandle* handle = find_entity(msg.eid);
+    if (!handle)
+        return;
+    *entities.get<Position>(*handle) = { msg.x, msg.y };
+    if (ViewTick* view = entities.get<ViewTick>(*handle))
+        view->tick = history.view_tick(msg.viewTick, msg.interpDelayMs, fixedDtMs);
+}
+
+// What each message from a client does, see ClientToServerMessages
+struct ClientMessageHandler
+{
+    ENetPeer* peer;
+    ENetHost* host;
+
+    void operator()(const JoinMsg&) { on_join(peer, host); }
+    void operator()(const EntityStateMsg& msg) { on_state(msg); }
+    void operator()(const ReattachMsg& msg) { on_reattach(msg, peer, host); }
+    void operator()(const WorldStateAckMsg& msg) { on_world_state_ack(msg, peer); }
+};
+
+void on_packet(ENetPacket* packet, ENetPeer* peer, ENetHost* host)
+{
+    ClientMessageHandler handler{ peer, host };
+    ClientToServerMessages::dispatch(handler, packet);
+}
+
+// What a collision reads and changes of an entity
+struct CollisionBody
+{
+    EntityHandle handle;
+    uint16_t eid;
+    Position& pos;
+    float& size;
+};
+
+static void teleport_to_random_position(CollisionBody& e) {
+    e.pos.x = (random_int(200) - 100) * 5.f;
+    e.pos.y = (random_int(200) - 100) * 5.f;
+    history.clear(e.handle.index);
+}
+
+static void on_collision(CollisionBody& e1, CollisionBody& e2) {
+    if (e1.size > e2.size) {
+        score[e1.eid] += 1;
+        e1.size += e2.size / 2;
+        e2.size /= 2;
+        teleport_to_random_position(e2);
+    }
+    else if (e1.size < e2.size) {
+        score[e2.eid] += 1;
+        e2.size += e1.size / 2;
+        e1.size /= 2;
+        teleport_to_random_position(e1);
+    }
+    else {
+        teleport_to_random_position(e1);
+        teleport_to_random_position(e2);
+    }
+    if (controlledMap[e1.eid] != nullptr) {
+        send_entity_update(controlledMap[e1.eid], e1.eid, e1.pos.x, e1.pos.y, e1.size, worldTick);
+    }
+    if (controlledMap[e2.eid] != nullptr) {
+        send_entity_update(controlledMap[e2.eid], e2.eid, e2.pos.x, e2.pos.y, e2.size, worldTick);
+    }
+}
+
+// Every entity against every other, a player against where its client saw
+// the others
+static void collide_entities(ENetHost* server)
+{
+    PROFILE_ZONE("collide");
+    entities.each_entity<NetId, Position, Size>([server](EntityHandle h1, uint16_t eid1, Position& pos1, float& size1)
+    {
+        const ViewTick* view = entities.get<ViewTick>(h1);
+        const float viewTick = view ? view->tick : -1.f;
+        entities.each_entity<NetId, Position, Size>([&](EntityHandle h2, uint16_t eid2, Position& pos2, float& size2)
+        {
+            // A player collides with others where its client saw them, not where they are now
+            float x2 = pos2.x; float y2 = pos2.y; float s2 = size2;
+            if (viewTick >= 0.f)
+                history.sample(h2.index, viewTick, x2, y2, s2);
+            if (eid1 != eid2 && ((pos1.x - x2) * (pos1.x - x2) + (pos1.y - y2) * (pos1.y - y2)) < ((size1 + s2) * (size1 + s2)) + 2.f) {
+                CollisionBody e1 = { h1, eid1, pos1, size1 };
+                CollisionBody e2 = { h2, eid2, pos2, size2 };
+                on_collision(e1, e2);
+                on_score_update(server);
+            }
+        });
+    });
+}
+
+void update_world(ENetHost* server, float dt)
+{
+    ++worldTick;
+    {
+        PROFILE_ZONE("simulate");
+        entities.each<Position, AiTarget>([dt](Position& pos, AiTarget& target)
+        {
+            const float diffX = target.x - pos.x;
+            const float diffY = target.y - pos.y;
+            const float dirX = diffX > 0.f ? 1.f : -1.f;
+            const float dirY = diffY > 0.f ? 1.f : -1.f;
+            constexpr float spd = 50.f;
+            pos.x += dirX * spd * dt;
+            pos.y += dirY * spd * dt;
+            if (fabsf(diffX) < 10.f && fabsf(diffY) < 10.f)
+            {
+                target.x = (random_int(40) - 20) * 15.f;
+                target.y = (random_int(40) - 20) * 15.f;
+            }
+        });
+    }
+    {
+        PROFILE_ZONE("snapshots");
+        for (size_t i = 0; i < transfers.size(); ++i)
+            send_world_chunks(&server->peers[i]);
+        entities.each_entity<NetId, Position, Size>([server](EntityHandle handle, uint16_t eid, const Position& pos, float size)
+        {
+            // Record exactly what this tick's snapshots show
+            history.record(worldTick, handle.index, pos.x, pos.y, size);
+            for (size_t i = 0; i < server->peerCount; ++i)
+            {
+                ENetPeer* peer = &server->peers[i];
+                if (has_world(server, i) && controlledMap[eid] != peer)
+                    send_snapshot(peer, eid, pos.x, pos.y, size, worldTick);
+            }
+        });
+    }
+    collide_entities(server);
+}
+
+uint32_t world_checksum()
+{
+    uint32_t hash = 2166136261u;
+    auto mix = [&hash](const void* data, size_t size)
+    {
+        const uint8_t* bytes = (const uint8_t*)data;
+        for (size_t i = 0; i < size; ++i)
+            hash = (hash ^ bytes[i]) * 16777619u;
+    };
+    // a player mixes in a zero target, as it did when every entity had one
+    for (EntityHandle handle : entityHandles)
+    {
+        const Entity e = get_entity(handle);
+        mix(&e.eid, sizeof(e.eid));
+        mix(&e.x, sizeof(e.x));
+        mix(&e.y, sizeof(e.y));
+        mix(&e.size, sizeof(e.size));
+        mix(&e.targetX, sizeof(e.targetX));
+        mix(&e.targetY, sizeof(e.targetY));
+    }
+    for (const auto& s : score)
+    {
+        mix(&s.first, sizeof(s.first));
+        mix(&s.second, sizeof(s.second));
+    }
+    return hash;
+}
+
+constexpr uint32_t worldStateVersion = 1;
+
+void save_world(std::vector<uint8_t>& state)
+{
+    state.clear();
+    checkpoint_write(state, worldStateVersion);
+    checkpoint_write(state, uint32_t(sizeof(Entity)));
+    checkpoint_write(state, nextEid);
+    std::vector<Entity> saved;
+    saved.reserve(entityHandles.size());
+    for (EntityHandle handle : entityHandles)
+        saved.push_back(get_entity(handle));
+    checkpoint_write(state, uint32_t(saved.size()));
+    checkpoint_write(state, saved.data(), saved.size());
+    checkpoint_write(state, uint32_t(score.size()));
+    for (const auto& s : score)
+    {
+        checkpoint_write(state, s.first);
+        checkpoint_write(state, int32_t(s.second));
+    }
+    checkpoint_write(state, uint32_t(sessionTokens.size()));
+    for (const auto& token : sessionTokens)
+    {
+        checkpoint_write(state, token.first);
+        checkpoint_write(state, token.second);
+    }
+}
+
+bool load_world(const uint8_t* data, size_t size)
+{
+    CheckpointReader reader(data, size);
+    uint32_t version = 0;
+    uint32_t entitySize = 0;
+    uint32_t count = 0;
+    uint16_t loadedNextEid = 0;
+    if (!reader.read(version) || version != worldStateVersion ||
+        !reader.read(entitySize) || entitySize != sizeof(Entity) ||
+        !reader.read(loadedNextEid) || !reader.read(count) || !reader.has<Entity>(count))
+        return false;
+
+    std::vector<Entity> loadedEntities(count);
+    if (!reader.read(loadedEntities.data(), count))
+        return false;
+
+    std::map<uint16_t, int> loadedScore;
+    if (!reader.read(count))
+        return false;
+    for (uint32_t i = 0; i < count; ++i)
+    {
+        uint16_t eid = invalid_entity;
+        int32_t s = 0;
+        if (!reader.read(eid) || !reader.read(s))
+            return false;
+        loadedScore[eid] = s;
+    }
+
+    std::map<uint16_t, uint32_t> loadedTokens;
+    if (!reader.read(count))
+        return false;
+    for (uint32_t i = 0; i < count; ++i)
+    {
+        uint16_t eid = invalid_entity;
+        uint32_t token = 0;
+        if (!reader.read(eid) || !reader.read(token))
+            return false;
+        loadedTokens[eid] = token;
+    }
+
+    nextEid = loadedNextEid;
+    score.swap(loadedScore);
+    sessionTokens.swap(loadedTokens);
+    entities.clear();
+    entityIndex.clear();
+    entityHandles.clear();
+    controlledMap.clear();
+    for (const Entity& e : loadedEntities)
+    {
+        spawn(e);
+        controlledMap[e.eid] = nullptr;
+    }
+    return true;
+}
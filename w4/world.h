@@ -0,0 +1,30 @@
+#pragma once
+#include <cstdint>
+#include <vector>
+#include <enet/enet.h>
+
+// Simulation state of the w4 server. Everything that changes the world goes
+// through these functions, so the live server and w4_replay run the same code.
+constexpr uint32_t fixedDtMs = 10;
+
+// Seeds the world rng and spawns the AI, unless the world was loaded from a checkpoint.
+void init_world(uint32_t seed);
+void on_packet(ENetPacket* packet, ENetPeer* peer, ENetHost* host);
+void on_disconnect(ENetPeer* peer);
+void update_world(ENetHost* host, float dt);
+
+// FNV-1a over entity and score state, used to check that a replay stays bit-identical.
+uint32_t world_checksum();
+
+// Session tokens are not drawn from the world rng: its output is its state,
+// and spawns and AI targets show it to every client. The server draws them
+// from std::random_device and journals each one before the packet that may
+// use it, a replay queues the journaled ones, so joins get the same tokens.
+bool needs_session_token();
+void queue_session_token(uint32_t token);
+
+// Checkpoint of entities, scores, the eid allocator and the session tokens
+// of player-controlled entities. Peers do not survive a restart, clients get
+// their entity back by sending E_CLIENT_TO_SERVER_REATTACH with their token.
+void save_world(std::vector<uint8_t>& state);
+bool load_world(const uint8_t* data, size_t size);
@@ -1,5 +1,6 @@
 #include "entity.h"
 #include "mathUtils.h"
+#include "simdMath.h"
 
 void simulate_entity(Entity &e, float dt)
 {
@@ -11,3 +12,70 @@ void simulate_entity(Entity &e, float dt)
   e.y += sinf(e.ori) * e.speed * dt;
 }
 
+void EntityBatch::clear()
+{
+  x.clear();
+  y.clear();
+  speed.clear();
+  ori.clear();
+  thr.clear();
+  steer.clear();
+}
+
+void EntityBatch::push(const Entity &e)
+{
+  x.push_back(e.x);
+  y.push_back(e.y);
+  speed.push_back(e.speed);
+  ori.push_back(e.ori);
+  thr.push_back(e.thr);
+  steer.push_back(e.steer);
+}
+
+void EntityBatch::copy_to(size_t i, Entity &e) const
+{
+  e.x = x[i];
+  e.y = y[i];
+  e.speed = speed[i];
+  e.ori = ori[i];
+}
+
+// simulate_entity on lanes starting at i, F is simd_float or float for the tail
+template<typename F>
+static void simulate_lanes(EntityBatch &batch, size_t i, float dt)
+{
+  const F zero = simd_set(0.f, F{});
+  const F vdt = simd_set(dt, zero);
+  F speed = simd_load(&batch.speed[i], zero);
+  F ori = simd_load(&batch.ori[i], zero);
+  const F thr = simd_load(&batch.thr[i], zero);
+  const F steer = simd_load(&batch.steer[i], zero);
+
+  // sign(thr) != 0 && sign(thr) != sign(speed)
+  const auto isBraking = simd_or(simd_and(simd_gt(thr, zero), simd_not(simd_gt(speed, zero))),
+                                 simd_and(simd_lt(thr, zero), simd_not(simd_lt(speed, zero))));
+  const F d = simd_mul(simd_select(isBraking, simd_set(12.f, zero), simd_set(3.f, zero)), vdt);
+  const F target = simd_mul(simd_min(simd_max(thr, simd_set(-0.3f, zero)), simd_set(1.f, zero)), simd_set(10.f, zero));
+  const F stepped = simd_add(speed, simd_select(simd_lt(target, speed), simd_sub(zero, d), d));
+  speed = simd_select(simd_lt(simd_abs(simd_sub(speed, target)), d), target, stepped);
+
+  const F clampedSpeed = simd_min(simd_max(speed, simd_set(-2.f, zero)), simd_set(2.f, zero));
+  ori = simd_add(ori, simd_mul(simd_mul(simd_mul(steer, vdt), clampedSpeed), simd_set(0.3f, zero)));
+
+  F s, c;
+  simd_sincos(ori, s, c);
+  simd_store(&batch.x[i], simd_add(simd_load(&batch.x[i], zero), simd_mul(simd_mul(c, speed), vdt)));
+  simd_store(&batch.y[i], simd_add(simd_load(&batch.y[i], zero), simd_mul(simd_mul(s, speed), vdt)));
+  simd_store(&batch.speed[i], speed);
+  simd_store(&batch.ori[i], ori);
+}
+
+void simulate_entities(EntityBatch &batch, float dt)
+{
+  const size_t count = batch.size();
+  size_t i = 0;
+  for (; i + simd_width <= count; i += simd_width)
+    simulate_lanes<simd_float>(batch, i, dt);
+  for (; i < count; ++i)
+    simulate_lanes<float>(batch, i, dt);
+}
@@ -1,8 +1,15 @@
 #pragma once
 #include <cstdint>
-#include <enet/types.h>
+#include <cstddef>
+#include <vector>
 
 constexpr uint16_t invalid_entity = -1;
+
+// Client prediction and the server both step controlled entities with this
+// dt, one step per input, so replaying unacked inputs reproduces the server.
+constexpr uint32_t fixedDtMs = 20;
+constexpr float fixedDt = fixedDtMs * 0.001f;
+
 struct Entity
 {
   uint32_t color = 0xff00ffff;
@@ -15,9 +22,28 @@ struct Entity
   float steer = 0.f;
 
   uint16_t eid = invalid_entity;
-
-  enet_uint32 timeStamp = 0;
 };
 
 void simulate_entity(Entity &e, float dt);
 
+// Entities in structure-of-arrays form, for stepping many of them at once
+struct EntityBatch
+{
+  std::vector<float> x;
+  std::vector<float> y;
+  std::vector<float> speed;
+  std::vector<float> ori;
+  std::vector<float> thr;
+  std::vector<float> steer;
+
+  size_t size() const { return x.size(); }
+  void clear();
+  void push(const Entity &e);
+  void copy_to(size_t i, Entity &e) const;
+};
+
+// simulate_entity for every entity of the batch, 8 (AVX2) or 4 (SSE2) at a
+// time with polynomial sin/cos. simulate_entity stays the reference; positions
+// agree with it to ~2e-5 after 1000 steps of random input, see check/simdCheck.cpp.
+void simulate_entities(EntityBatch &batch, float dt);
+
@@ -1,6 +1,8 @@
 // initial skeleton is a clone from https://github.com/jpcy/bgfx-minimal-example
 //
+#include <atomic>
 #include <functional>
+#include <thread>
 #include "raylib.h"
 #include <enet/enet.h>
 #include <math.h>
@@ -8,181 +10,337 @@
 #include <vector>
 #include "entity.h"
 #include "protocol.h"
+#include "eidIndex.h"
+#include "sequenceRing.h"
+#include "snapshotBuffer.h"
+#include "tripleBuffer.h"
+#include <algorithm>
+#include <cstring>
 #include <iostream>
 
-class Interpolator;
+// Remote entities are drawn renderDelayMs behind the newest snapshot, between
+// the two snapshots around that time. The delay rides out a few lost or late
+// snapshots; when data runs out anyway, the entity keeps going along its last
+// heading and speed for at most maxExtrapolationMs, then holds still.
+struct RemoteState
+{
+  float x = 0.f;
+  float y = 0.f;
+  float ori = 0.f;
+  float speed = 0.f;
+};
 
-std::vector<Entity*> entities;
-std::vector<Interpolator*> interpolators;
+static uint32_t renderDelayMs = 5 * fixedDtMs;
+constexpr uint32_t maxExtrapolationMs = 250;
+
+std::vector<Entity> entities;
+// snapshots of remote entities, pushed together with entities so both share a slot
+std::vector<SnapshotBuffer<RemoteState>> snapshots;
+EidIndex entityIndex;
+// the world the server sends when we join, applied once it is all here
+static WorldTransferReceiver worldTransfer;
+static std::vector<Entity> transferredWorld;
+// despawns of entities that may still come with the world, until it is here
+static bool haveWorld = false;
+static std::vector<uint16_t> despawnedBeforeWorld;
+
+// Server tick being rendered, on the render thread. It advances with frame
+// time and is pulled gently towards the newest tick - delay, so arrival
+// jitter doesn't show up as stutter.
+static float renderTick = 0.f;
+static uint32_t newestTick = 0;
 static uint16_t my_entity = invalid_entity;
 
-constexpr enet_uint32 fixedDt = 100;
 enet_uint32 lastUpdate = enet_time_get();
 
-struct TickData
+// Predicted state of the controlled entity after each input we sent
+struct PredictedTick
 {
+    float thr = 0.f;
+    float steer = 0.f;
     float x = 0.f;
     float y = 0.f;
     float speed = 0.f;
     float ori = 0.f;
-    float thr = 0.f;
-    float steer = 0.f;
 };
 
-class History
+constexpr uint32_t predictionHistorySize = 128;
+static SequenceRing<PredictedTick, predictionHistorySize> prediction;
+static uint32_t inputSeq = 0;
+static InputWindow<InputCmd, inputWindowSize> sentInputs;
+static uint32_t lastAck = 0;
+
+// Everything above but renderTick is the network thread's. It services the
+// host, predicts and sends an input every tick and publishes what there is to
+// draw; the render thread samples remote entities from the published
+// snapshots at its own render tick and samples the keys, so neither a slow
+// frame nor vsync holds up packets or inputs.
+struct DrawnEntity
 {
-private:
-    size_t cur = 0;
-    TickData history[1000];
-public:
-    History()
-    {
-
-    }
-
-    void add(TickData td)
-    {
-        history[cur] = td;
-        cur = (cur + 1) % 1000;
-    }
-
-    TickData get(size_t Past)
-    {
-        size_t neededTick = cur - Past;
-
-        if (neededTick < 0)
-            neededTick += 1000;
-
-        if (neededTick < 0 || neededTick == 1000)
-        {
-            return history[(cur + 999) % 1000];
-        }
-
-        return history[neededTick];
-    }
-
-    void set(size_t Past, TickData td)
-    {
-        size_t neededTick = cur - Past;
-
-        if (neededTick < 0)
-            neededTick += 1000;
-
-        if (neededTick < 0 || neededTick == 1000)
-        {
-            return;
-        }
-
-        history[neededTick] = td;
-    }
+  uint32_t color = 0;
+  // our entity is drawn where it is predicted, the others are sampled from snapshots
+  bool predicted = false;
+  RemoteState state;
+  SnapshotBuffer<RemoteState> snapshots;
 };
-
-class Interpolator
+struct WorldView
 {
-private:
-    float duration;
-    enet_uint32 lastTimeStamp;
-    float initialX, initialY, initialOri;
-    float targetX, targetY, targetOri;
-
-public:
-    Interpolator(Entity* e)
-    {
-        ent = e;
-
-        initialX = ent->x;
-        initialY = ent->y;
-        initialOri = ent->ori;
+  std::vector<DrawnEntity> entities;
+  uint32_t newestTick = 0;
+};
+static TripleBuffer<WorldView> views;
 
-        targetX = ent->x;
-        targetY = ent->y;
-        targetOri = ent->ori;
+enum HeldKey : uint8_t
+{
+  E_KEY_LEFT = 1 << 0,
+  E_KEY_RIGHT = 1 << 1,
+  E_KEY_UP = 1 << 2,
+  E_KEY_DOWN = 1 << 3
+};
+// the keys held at the last frame, raylib only polls them on the render thread
+static std::atomic<uint8_t> heldKeys{ 0 };
+static std::atomic<bool> quit{ false };
 
-        duration = 10000;
-    }
+static void store_prediction(uint32_t seq, const Entity& e)
+{
+    PredictedTick& tick = prediction.insert(seq);
+    tick = { e.thr, e.steer, e.x, e.y, e.speed, e.ori };
+}
 
-    Entity* ent;
-    void updateInterpolation(float tX, float tY, float tOri, enet_uint32 timeStamp)
+// Server state in a snapshot is the result of applying input `ack`.
+// If our prediction for that input matches there is nothing to do, otherwise
+// rewind to the server state and replay the inputs it hasn't seen yet.
+static void reconcile(Entity& e, float x, float y, float ori, float speed, uint32_t ack)
+{
+    if (ack <= lastAck)
+        return; // nothing applied yet, or a late/duplicate snapshot
+    lastAck = ack;
+
+    constexpr float tolerance = 1e-3f;
+    const PredictedTick* predicted = prediction.find(ack);
+    if (predicted &&
+        fabsf(predicted->x - x) < tolerance && fabsf(predicted->y - y) < tolerance &&
+        fabsf(predicted->ori - ori) < tolerance && fabsf(predicted->speed - speed) < tolerance)
+        return;
+
+    e.x = x;
+    e.y = y;
+    e.ori = ori;
+    e.speed = speed;
+    uint32_t firstSeq = inputSeq - ack >= predictionHistorySize ? inputSeq - predictionHistorySize + 1 : ack + 1;
+    for (uint32_t seq = firstSeq; seq <= inputSeq; ++seq)
     {
-        initialX = ent->x;
-        initialY = ent->y;
-        initialOri = ent->ori;
-
-        targetX = tX;
-        targetY = tY;
-        targetOri = tOri;
-
-        duration = timeStamp - lastTimeStamp;
-        lastTimeStamp = timeStamp;
+        PredictedTick* tick = prediction.find(seq);
+        if (!tick)
+            continue;
+        e.thr = tick->thr;
+        e.steer = tick->steer;
+        simulate_entity(e, fixedDt);
+        store_prediction(seq, e);
     }
+}
 
-    void interpolate()
-    {
-        enet_uint32 currentTimeStamp = enet_time_get();
+static void advance_render_tick(float dt, uint32_t newest)
+{
+  if (newest == 0)
+    return;
+  const float target = float(newest) - float(renderDelayMs) / float(fixedDtMs);
+  renderTick += dt * 1000.f / float(fixedDtMs);
+  const float drift = target - renderTick;
+  // jump on the first snapshot or after a long stall, otherwise correct slowly
+  if (fabsf(drift) > 10.f)
+    renderTick = target;
+  else
+    renderTick += drift * 0.05f;
+}
 
-        ent->x = initialX + (targetX - initialX) * static_cast<float>(currentTimeStamp - lastTimeStamp) / duration;
-        ent->y = initialY + (targetY - initialY) * static_cast<float>(currentTimeStamp - lastTimeStamp) / duration;
-        ent->ori = initialOri + (targetOri - initialOri) * static_cast<float>(currentTimeStamp - lastTimeStamp) / duration;
-    }
+static void sample_remote(RemoteState& e, const SnapshotBuffer<RemoteState>& buffer)
+{
+  const uint32_t baseTick = renderTick > 0.f ? uint32_t(renderTick) : 0;
+  uint32_t fromTick = baseTick;
+  uint32_t toTick = baseTick;
+  const RemoteState* from = buffer.find_before(fromTick);
+  const RemoteState* to = buffer.find_after(toTick);
+  if (from && to)
+  {
+    const float t = (renderTick - float(fromTick)) / float(toTick - fromTick);
+    e.x = from->x + (to->x - from->x) * t;
+    e.y = from->y + (to->y - from->y) * t;
+    e.ori = from->ori + (to->ori - from->ori) * t;
+    e.speed = from->speed + (to->speed - from->speed) * t;
+  }
+  else if (from)
+  {
+    const float maxAhead = float(maxExtrapolationMs) / float(fixedDtMs);
+    const float ahead = std::min(renderTick - float(fromTick), maxAhead) * fixedDt;
+    e.x = from->x + cosf(from->ori) * from->speed * ahead;
+    e.y = from->y + sinf(from->ori) * from->speed * ahead;
+    e.ori = from->ori;
+    e.speed = from->speed;
+  }
+  else if (to)
+  {
+    // rendering before the oldest snapshot we have
+    e = *to;
+  }
+}
 
-    uint16_t getEid()
-    {
-        return ent->eid;
-    }
-};
+void on_new_entity(const Entity &ent)
+{
+  // an entity we already have keeps its slot, invalid_entity gets none
+  if (entityIndex.insert(ent.eid) != entities.size())
+    return;
+  entities.push_back(ent);
+  snapshots.emplace_back();
+}
 
+// Every entity at once when the last chunk is in, snapshots only start after
+void on_world_chunk(const WorldChunkMsg &chunk, ENetPeer *peer)
+{
+  const bool done = worldTransfer.add(chunk);
+  if (chunk.transfer != worldTransfer.get_transfer() || chunk.index + 1 != worldTransfer.get_received())
+    return; // not the next chunk of the current transfer
+  send_world_state_ack(peer, chunk.transfer, worldTransfer.get_received());
+  const std::vector<uint8_t> &data = worldTransfer.get_data();
+  if (!done || !decode_world_state(data.data(), data.size(), transferredWorld))
+    return;
+  entities.reserve(entities.size() + transferredWorld.size());
+  snapshots.reserve(entities.size() + transferredWorld.size());
+  for (const Entity &e : transferredWorld)
+    if (std::find(despawnedBeforeWorld.begin(), despawnedBeforeWorld.end(), e.eid) == despawnedBeforeWorld.end())
+      on_new_entity(e);
+  haveWorld = true;
+  despawnedBeforeWorld.clear();
+}
 
-void on_new_entity_packet(ENetPacket *packet)
+// The despawn goes on the reliable channel, the world on its own, so the
+// world may still bring an entity that is already gone
+void on_despawn(uint16_t eid)
 {
-  Entity* newEntity = new Entity();
-  deserialize_new_entity(packet, *newEntity);
-  for (const Entity* e : entities)
-    if (e->eid == newEntity->eid)
-      return; 
-  entities.push_back(newEntity);
-  interpolators.push_back(new Interpolator(newEntity));
+  if (!entityIndex.erase(entities, eid, snapshots) && !haveWorld)
+    despawnedBeforeWorld.push_back(eid);
+  if (eid == my_entity)
+    my_entity = invalid_entity;
 }
 
-void on_set_controlled_entity(ENetPacket *packet)
+void on_snapshot(const SnapshotMsg &msg)
 {
-  deserialize_set_controlled_entity(packet, my_entity);
+    uint32_t slot = entityIndex.find(msg.eid);
+    if (slot == EidIndex::invalid_slot)
+        return;
+    newestTick = std::max(newestTick, msg.tick);
+    if (msg.eid == my_entity)
+        reconcile(entities[slot], msg.x, msg.y, msg.ori, msg.speed, msg.ack);
+    else
+        snapshots[slot].push(msg.tick, { msg.x, msg.y, msg.ori, msg.speed });
 }
 
-void on_snapshot(ENetPacket* packet)
+// What each message from the server does, see ServerToClientMessages
+struct ServerMessageHandler
 {
-    uint16_t eid = invalid_entity;
-    float x = 0.f; float y = 0.f; float ori = 0.f; enet_uint32 timeStamp = 0;
+  ENetPeer *peer;
 
-    deserialize_snapshot(packet, eid, x, y, ori, timeStamp);
+  void operator()(const Entity &msg) { on_new_entity(msg); }
+  void operator()(const SetControlledEntityMsg &msg) { my_entity = msg.eid; }
+  void operator()(const SnapshotMsg &msg) { on_snapshot(msg); }
+  void operator()(const WorldChunkMsg &msg) { on_world_chunk(msg, peer); }
+  void operator()(const DespawnMsg &msg) { on_despawn(msg.eid); }
+};
+
+static void publish_view()
+{
+  WorldView &view = views.get_back();
+  // resized rather than rebuilt, the snapshot buffers are copied in place
+  view.entities.resize(entities.size());
+  for (size_t slot = 0; slot < entities.size(); ++slot)
+  {
+    const Entity &e = entities[slot];
+    DrawnEntity &drawn = view.entities[slot];
+    drawn.color = e.color;
+    drawn.predicted = e.eid == my_entity;
+    drawn.state = { e.x, e.y, e.ori, e.speed };
+    if (!drawn.predicted)
+      drawn.snapshots = snapshots[slot];
+  }
+  view.newestTick = newestTick;
+  views.publish();
+}
 
-    for (Interpolator* i : interpolators)
+static void run_network(ENetHost *client, ENetPeer *serverPeer)
+{
+  while (!quit.load(std::memory_order_relaxed))
+  {
+    // sleep in the service until a packet comes or the next input is due
+    const int32_t untilUpdate = int32_t(lastUpdate + fixedDtMs - enet_time_get());
+    ENetEvent event;
+    bool changed = false;
+    for (uint32_t timeout = uint32_t(std::max(untilUpdate, 0)); enet_host_service(client, &event, timeout) > 0; timeout = 0)
     {
-        if (i->getEid() == eid)
-        {
-            if (i->getEid() != my_entity)
-            {
-                i->updateInterpolation(x, y, ori, enet_time_get());
-            }
-            else
-            {
-                i->ent->x = x;
-                i->ent->y = y;
-                i->ent->ori = ori;
-                i->ent->timeStamp = timeStamp;
-            }
-        }
+      switch (event.type)
+      {
+      case ENET_EVENT_TYPE_CONNECT:
+        printf("Connection with %x:%u established\n", event.peer->address.host, event.peer->address.port);
+        send_join(serverPeer);
+        break;
+      case ENET_EVENT_TYPE_RECEIVE:
+      {
+        ServerMessageHandler handler{ event.peer };
+        ServerToClientMessages::dispatch(handler, event.packet);
+        enet_packet_destroy(event.packet);
+        changed = true;
+        break;
+      }
+      default:
+        break;
+      };
+    }
+    // don't try to catch up after a long stall, just resume from now
+    const uint32_t now = enet_time_get();
+    if (now - lastUpdate > 10 * fixedDtMs)
+      lastUpdate = now;
+    const uint8_t keys = heldKeys.load(std::memory_order_relaxed);
+    for (; now - lastUpdate >= fixedDtMs; lastUpdate += fixedDtMs)
+    {
+      Entity* e = my_entity != invalid_entity ? entityIndex.get(entities, my_entity) : nullptr;
+      if (!e)
+        continue;
+      float thr = ((keys & E_KEY_UP) ? 1.f : 0.f) + ((keys & E_KEY_DOWN) ? -1.f : 0.f);
+      float steer = ((keys & E_KEY_LEFT) ? -1.f : 0.f) + ((keys & E_KEY_RIGHT) ? 1.f : 0.f);
+
+      sentInputs.push(++inputSeq, { thr, steer });
+      send_entity_input(serverPeer, my_entity, sentInputs);
+      e->thr = thr;
+      e->steer = steer;
+      simulate_entity(*e, fixedDt);
+      store_prediction(inputSeq, *e);
+      changed = true;
+    }
+    if (changed)
+    {
+      // out now, not at the next service
+      enet_host_flush(client);
+      publish_view();
     }
+  }
+  // the server despawns our entity now rather than once we time out
+  enet_peer_disconnect_now(serverPeer, 0);
 }
 
 int main(int argc, const char **argv)
 {
+  for (int i = 1; i + 1 < argc; ++i)
+  {
+    if (strcmp(argv[i], "--render-delay") == 0)
+      renderDelayMs = strtoul(argv[++i], nullptr, 10);
+  }
+
   if (enet_initialize() != 0)
   {
     printf("Cannot init ENet");
     return 1;
   }
 
-  ENetHost *client = enet_host_create(nullptr, 1, 2, 0, 0);
+  ENetHost *client = enet_host_create(nullptr, 1, channelCount, 0, 0);
   if (!client)
   {
     printf("Cannot create ENet client\n");
@@ -193,7 +351,7 @@ int main(int argc, const char **argv)
   enet_address_set_host(&address, "localhost");
   address.port = 10131;
 
-  ENetPeer *serverPeer = enet_host_connect(client, &address, 2, 0);
+  ENetPeer *serverPeer = enet_host_connect(client, &address, channelCount, 0);
   if (!serverPeer)
   {
     printf("Cannot connect to server");
@@ -223,122 +381,34 @@ int main(int argc, const char **argv)
 
   SetTargetFPS(60);               
 
-  History history;
-  bool connected = false;
+  lastUpdate = enet_time_get();
+  std::thread network(run_network, client, serverPeer);
   while (!WindowShouldClose())
   {
-    float dt = GetFrameTime();
-    ENetEvent event;
-    while (enet_host_service(client, &event, 0) > 0)
-    {
-      switch (event.type)
-      {
-      case ENET_EVENT_TYPE_CONNECT:
-        printf("Connection with %x:%u established\n", event.peer->address.host, event.peer->address.port);
-        send_join(serverPeer);
-        connected = true;
-        break;
-      case ENET_EVENT_TYPE_RECEIVE:
-        switch (get_packet_type(event.packet))
-        {
-        case E_SERVER_TO_CLIENT_NEW_ENTITY:
-          on_new_entity_packet(event.packet);
-          break;
-        case E_SERVER_TO_CLIENT_SET_CONTROLLED_ENTITY:
-          on_set_controlled_entity(event.packet);
-          break;
-        case E_SERVER_TO_CLIENT_SNAPSHOT:
-          on_snapshot(event.packet);
-          break;
-        };
-        break;
-      default:
-        break;
-      };
-    }
-    if (my_entity != invalid_entity && enet_time_get() - lastUpdate >= fixedDt)
-    {
-      lastUpdate = enet_time_get();
-      bool left = IsKeyDown(KEY_LEFT);
-      bool right = IsKeyDown(KEY_RIGHT);
-      bool up = IsKeyDown(KEY_UP);
-      bool down = IsKeyDown(KEY_DOWN);
-      for (Entity* e : entities)
-        if (e->eid == my_entity)
-        {
-          float thr = (up ? 1.f : 0.f) + (down ? -1.f : 0.f);
-          float steer = (left ? -1.f : 0.f) + (right ? 1.f : 0.f);
-
-          send_entity_input(serverPeer, my_entity, thr, steer);
-          e->thr = thr;
-          e->steer = steer;
-          history.add({ e->x, e->y, e->speed, e->ori, e->thr, e->steer });
-          simulate_entity(*e, dt);
-        }
-    }
- 
-    for (Entity* e : entities)
-    {
-        if (e->eid == my_entity)
-        {
-            enet_uint32 tdt = enet_time_get() - e->timeStamp;
-            if (tdt >= fixedDt)
-            {
-                size_t ticks;
-
-                if (tdt / fixedDt == (tdt - 1) / fixedDt)
-                    ticks = tdt / fixedDt + 1;
-                else
-                    ticks = tdt / fixedDt;
-
-                TickData td = history.get(ticks);
-
-                e->x = td.x;
-                e->y = td.y;
-                e->ori = td.ori;
-                e->speed = td.speed;
-
-                for (size_t t = ticks - 1; t > 0; --t)
-                {
-                    simulate_entity(*e, fixedDt * 0.001);
-
-                    TickData controls = history.get(t);
-
-                    e->thr = controls.thr;
-                    e->steer = controls.steer;
-
-                    controls.x = e->x;
-                    controls.y = e->y;
-                    controls.ori = e->ori;
-                    controls.speed = e->speed;
-
-                    history.set(t, controls);
-                }
-
-                e->timeStamp = enet_time_get();
-            }
-
-            simulate_entity(*e, dt);
-        }
-    }
-
-
-    for (Interpolator* i : interpolators)
-        if (i->getEid() != my_entity)
-            i->interpolate();
+    const uint8_t keys = (IsKeyDown(KEY_LEFT) ? E_KEY_LEFT : 0) | (IsKeyDown(KEY_RIGHT) ? E_KEY_RIGHT : 0) |
+                         (IsKeyDown(KEY_UP) ? E_KEY_UP : 0) | (IsKeyDown(KEY_DOWN) ? E_KEY_DOWN : 0);
+    heldKeys.store(keys, std::memory_order_relaxed);
+    views.update();
+    const WorldView &view = views.get_front();
+    advance_render_tick(GetFrameTime(), view.newestTick);
 
     BeginDrawing();
       ClearBackground(BLACK);
       BeginMode2D(camera);
-      for (const Entity* e : entities)
+      for (const DrawnEntity& e : view.entities)
         {
-          const Rectangle rect = { e->x, e->y, 3.f, 1.f };
-          DrawRectanglePro(rect, { 0.f, 0.5f }, e->ori * 180.f / PI, GetColor(e->color));
+          RemoteState state = e.state;
+          if (!e.predicted)
+            sample_remote(state, e.snapshots);
+          const Rectangle rect = { state.x, state.y, 3.f, 1.f };
+          DrawRectanglePro(rect, { 0.f, 0.5f }, state.ori * 180.f / PI, GetColor(e.color));
         }
       EndMode2D();
     EndDrawing();
   }
 
+  quit = true;
+  network.join();
   CloseWindow();
   return 0;
 }
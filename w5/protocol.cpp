@@ -1,98 +1,116 @@
 #include "protocol.h"
-#include <cstring> // memcpy
+#include "quantisation.h"
+#include <algorithm>
 
 void send_join(ENetPeer *peer)
 {
-  ENetPacket *packet = enet_packet_create(nullptr, sizeof(uint8_t), ENET_PACKET_FLAG_RELIABLE);
-  *packet->data = E_CLIENT_TO_SERVER_JOIN;
-
-  enet_peer_send(peer, 0, packet);
+  enet_peer_send(peer, 0, create_message_packet(joinSchema, {}, ENET_PACKET_FLAG_RELIABLE));
 }
 
 void send_new_entity(ENetPeer *peer, const Entity &ent)
 {
-  ENetPacket *packet = enet_packet_create(nullptr, sizeof(uint8_t) + sizeof(Entity),
-                                                   ENET_PACKET_FLAG_RELIABLE);
-  uint8_t *ptr = packet->data;
-  *ptr = E_SERVER_TO_CLIENT_NEW_ENTITY; ptr += sizeof(uint8_t);
-  memcpy(ptr, &ent, sizeof(Entity)); ptr += sizeof(Entity);
-
-  enet_peer_send(peer, 0, packet);
+  enet_peer_send(peer, 0, create_message_packet(newEntitySchema, ent, ENET_PACKET_FLAG_RELIABLE));
 }
 
 void send_set_controlled_entity(ENetPeer *peer, uint16_t eid)
 {
-  ENetPacket *packet = enet_packet_create(nullptr, sizeof(uint8_t) + sizeof(uint16_t),
-                                                   ENET_PACKET_FLAG_RELIABLE);
-  uint8_t *ptr = packet->data;
-  *ptr = E_SERVER_TO_CLIENT_SET_CONTROLLED_ENTITY; ptr += sizeof(uint8_t);
-  memcpy(ptr, &eid, sizeof(uint16_t)); ptr += sizeof(uint16_t);
+  enet_peer_send(peer, 0, create_message_packet(setControlledEntitySchema, { eid }, ENET_PACKET_FLAG_RELIABLE));
+}
 
-  enet_peer_send(peer, 0, packet);
+void send_despawn(ENetPeer *peer, uint16_t eid)
+{
+  enet_peer_send(peer, 0, create_message_packet(despawnSchema, { eid }, ENET_PACKET_FLAG_RELIABLE));
 }
 
-void send_entity_input(ENetPeer *peer, uint16_t eid, float thr, float steer)
+// thr and steer in 4 bits each, neutral unpacks to exactly 0
+static uint8_t pack_input(const InputCmd &cmd)
 {
-  ENetPacket *packet = enet_packet_create(nullptr, sizeof(uint8_t) + sizeof(uint16_t) +
-                                                   2 * sizeof(float),
-                                                   ENET_PACKET_FLAG_UNSEQUENCED);
-  uint8_t *ptr = packet->data;
-  *ptr = E_CLIENT_TO_SERVER_INPUT; ptr += sizeof(uint8_t);
-  memcpy(ptr, &eid, sizeof(uint16_t)); ptr += sizeof(uint16_t);
-  memcpy(ptr, &thr, sizeof(float)); ptr += sizeof(float);
-  memcpy(ptr, &steer, sizeof(float)); ptr += sizeof(float);
-
-  enet_peer_send(peer, 1, packet);
+  float4bitsQuantized thrPacked(cmd.thr, -1.f, 1.f);
+  float4bitsQuantized steerPacked(cmd.steer, -1.f, 1.f);
+  return (thrPacked.packedVal << 4) | steerPacked.packedVal;
 }
 
-void send_snapshot(ENetPeer *peer, uint16_t eid, float x, float y, float ori, enet_uint32 timeStamp)
+// All 16 values unpacked once, the server unpacks 8 inputs per packet
+struct UnpackedInputTable
 {
-  ENetPacket *packet = enet_packet_create(nullptr, sizeof(uint8_t) + sizeof(uint16_t) +
-                                                   3 * sizeof(float) + sizeof(enet_uint32),
-                                                   ENET_PACKET_FLAG_UNSEQUENCED);
-  uint8_t *ptr = packet->data;
-  *ptr = E_SERVER_TO_CLIENT_SNAPSHOT; ptr += sizeof(uint8_t);
-  memcpy(ptr, &eid, sizeof(uint16_t)); ptr += sizeof(uint16_t);
-  memcpy(ptr, &x, sizeof(float)); ptr += sizeof(float);
-  memcpy(ptr, &y, sizeof(float)); ptr += sizeof(float);
-  memcpy(ptr, &ori, sizeof(float)); ptr += sizeof(float);
-  memcpy(ptr, &timeStamp, sizeof(enet_uint32));
-
-  enet_peer_send(peer, 1, packet);
+  float values[16];
+
+  UnpackedInputTable()
+  {
+    const uint8_t neutralPackedValue = pack_float<uint8_t>(0.f, -1.f, 1.f, 4);
+    for (uint8_t i = 0; i < 16; ++i)
+      values[i] = i == neutralPackedValue ? 0.f : float4bitsQuantized(i).unpack(-1.f, 1.f);
+  }
+};
+static const UnpackedInputTable unpackedInputs;
+
+static InputCmd unpack_input(uint8_t thrSteerPacked)
+{
+  InputCmd cmd;
+  cmd.thr = unpackedInputs.values[thrSteerPacked >> 4];
+  cmd.steer = unpackedInputs.values[thrSteerPacked & 0x0f];
+  return cmd;
 }
 
-MessageType get_packet_type(ENetPacket *packet)
+void send_entity_input(ENetPeer *peer, uint16_t eid, const InputWindow<InputCmd, inputWindowSize> &inputs)
 {
-  return (MessageType)*packet->data;
+  EntityInputMsg msg;
+  msg.eid = eid;
+  msg.firstSeq = inputs.get_first_seq();
+  msg.count = uint8_t(inputs.get_count());
+  for (uint32_t i = 0; i < msg.count; ++i)
+    msg.packedInputs[i] = pack_input(inputs.get(msg.firstSeq + i));
+
+  enet_peer_send(peer, 1, create_message_packet(entityInputSchema, msg, ENET_PACKET_FLAG_UNSEQUENCED));
 }
 
-void deserialize_new_entity(ENetPacket *packet, Entity &ent)
+void send_snapshot(ENetPeer *peer, uint16_t eid, float x, float y, float ori, float speed, uint32_t tick, uint32_t ack)
 {
-  uint8_t *ptr = packet->data; ptr += sizeof(uint8_t);
-  ent = *(Entity*)(ptr); ptr += sizeof(Entity);
+  const SnapshotMsg msg = { eid, x, y, ori, speed, tick, ack };
+  enet_peer_send(peer, 1, create_message_packet(snapshotSchema, msg, ENET_PACKET_FLAG_UNSEQUENCED));
 }
 
-void deserialize_set_controlled_entity(ENetPacket *packet, uint16_t &eid)
+// A new entity's fields but the eid, the world delta's records carry that
+static constexpr auto worldStateSchema = make_message_schema<Entity>(E_SERVER_TO_CLIENT_WORLD_CHUNK,
+  bits_field(&Entity::color, 32),
+  float_field(&Entity::x),
+  float_field(&Entity::y),
+  float_field(&Entity::speed),
+  float_field(&Entity::ori),
+  float_field(&Entity::thr),
+  float_field(&Entity::steer));
+
+bool encode_world_state(const std::vector<Entity> &world, std::vector<uint8_t> &data)
 {
-  uint8_t *ptr = packet->data; ptr += sizeof(uint8_t);
-  eid = *(uint16_t*)(ptr); ptr += sizeof(uint16_t);
+  return write_world_state(worldStateSchema, world, data);
 }
 
-void deserialize_entity_input(ENetPacket *packet, uint16_t &eid, float &thr, float &steer)
+bool decode_world_state(const uint8_t *data, size_t size, std::vector<Entity> &world)
 {
-  uint8_t *ptr = packet->data; ptr += sizeof(uint8_t);
-  eid = *(uint16_t*)(ptr); ptr += sizeof(uint16_t);
-  thr = *(float*)(ptr); ptr += sizeof(float);
-  steer = *(float*)(ptr); ptr += sizeof(float);
+  return read_world_state(worldStateSchema, data, size, world);
 }
 
-void deserialize_snapshot(ENetPacket *packet, uint16_t &eid, float &x, float &y, float &ori, enet_uint32& timeStamp)
+void send_world_chunk(ENetPeer *peer, const WorldChunkMsg &chunk)
 {
-  uint8_t *ptr = packet->data; ptr += sizeof(uint8_t);
-  eid = *(uint16_t*)(ptr); ptr += sizeof(uint16_t);
-  x = *(float*)(ptr); ptr += sizeof(float);
-  y = *(float*)(ptr); ptr += sizeof(float);
-  ori = *(float*)(ptr); ptr += sizeof(float);
-  timeStamp = *(enet_uint32*)(ptr);
+  enet_peer_send(peer, worldTransferChannel, create_message_packet(worldChunkSchema, chunk, ENET_PACKET_FLAG_RELIABLE));
 }
 
+void send_world_state_ack(ENetPeer *peer, uint16_t transfer, uint16_t received)
+{
+  enet_peer_send(peer, worldTransferChannel,
+                 create_message_packet(worldStateAckSchema, { transfer, received }, ENET_PACKET_FLAG_RELIABLE));
+}
+
+MessageType get_packet_type(ENetPacket *packet)
+{
+  return packet->dataLength > 0 ? (MessageType)*packet->data : E_INVALID_MESSAGE;
+}
+
+uint32_t unpack_entity_input(const EntityInputMsg &msg, InputCmd *cmds)
+{
+  // a received count is never over inputWindowSize, one set locally might be
+  const uint32_t count = std::min<uint32_t>(msg.count, inputWindowSize);
+  for (uint32_t i = 0; i < count; ++i)
+    cmds[i] = unpack_input(msg.packedInputs[i]);
+  return count;
+}
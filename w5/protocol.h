@@ -2,6 +2,24 @@
 #include <enet/enet.h>
 #include <cstdint>
 #include "entity.h"
+#include "inputWindow.h"
+#include "messageRegistry.h"
+#include "worldTransfer.h"
+#include <vector>
+
+struct InputCmd
+{
+  float thr = 0.f;
+  float steer = 0.f;
+};
+
+// Every input packet repeats the last inputWindowSize inputs
+constexpr uint32_t inputWindowSize = 8;
+
+// Reliable messages go on channel 0, inputs and snapshots on 1, and the world
+// a client gets when it joins on a channel of its own, see worldTransfer.h
+constexpr uint8_t worldTransferChannel = 2;
+constexpr size_t channelCount = 3;
 
 enum MessageType : uint8_t
 {
@@ -9,19 +27,94 @@ enum MessageType : uint8_t
   E_SERVER_TO_CLIENT_NEW_ENTITY,
   E_SERVER_TO_CLIENT_SET_CONTROLLED_ENTITY,
   E_CLIENT_TO_SERVER_INPUT,
-  E_SERVER_TO_CLIENT_SNAPSHOT
+  E_SERVER_TO_CLIENT_SNAPSHOT,
+  E_SERVER_TO_CLIENT_WORLD_CHUNK,
+  E_CLIENT_TO_SERVER_WORLD_STATE_ACK,
+  E_SERVER_TO_CLIENT_DESPAWN,
+  E_INVALID_MESSAGE = 0xff // what get_packet_type returns for an empty packet
 };
 
+// Every message as its schema sends it, see messageRegistry.h. New entities
+// go as the Entity itself.
+struct JoinMsg {};
+struct SetControlledEntityMsg { uint16_t eid = invalid_entity; };
+// the entity is gone, its eid may come back later for another one
+struct DespawnMsg { uint16_t eid = invalid_entity; };
+// The window of inputs firstSeq .. firstSeq + count - 1, thr and steer of
+// each packed in 4 bits by send_entity_input
+struct EntityInputMsg
+{
+  uint16_t eid = invalid_entity;
+  uint32_t firstSeq = 0;
+  uint8_t count = 0;
+  uint8_t packedInputs[inputWindowSize] = {};
+};
+struct SnapshotMsg
+{
+  uint16_t eid = invalid_entity;
+  float x = 0.f;
+  float y = 0.f;
+  float ori = 0.f;
+  float speed = 0.f;
+  uint32_t tick = 0;
+  uint32_t ack = 0;
+};
+
+inline constexpr auto joinSchema = make_message_schema<JoinMsg>(E_CLIENT_TO_SERVER_JOIN);
+inline constexpr auto newEntitySchema = make_message_schema<Entity>(E_SERVER_TO_CLIENT_NEW_ENTITY,
+  bits_field(&Entity::color, 32),
+  float_field(&Entity::x),
+  float_field(&Entity::y),
+  float_field(&Entity::speed),
+  float_field(&Entity::ori),
+  float_field(&Entity::thr),
+  float_field(&Entity::steer),
+  bits_field(&Entity::eid, 16));
+inline constexpr auto setControlledEntitySchema = make_message_schema<SetControlledEntityMsg>(
+  E_SERVER_TO_CLIENT_SET_CONTROLLED_ENTITY,
+  bits_field(&SetControlledEntityMsg::eid, 16));
+inline constexpr auto entityInputSchema = make_message_schema<EntityInputMsg>(E_CLIENT_TO_SERVER_INPUT,
+  bits_field(&EntityInputMsg::eid, 16),
+  bits_field(&EntityInputMsg::firstSeq, 32),
+  array_field(&EntityInputMsg::packedInputs, &EntityInputMsg::count, 8));
+inline constexpr auto snapshotSchema = make_message_schema<SnapshotMsg>(E_SERVER_TO_CLIENT_SNAPSHOT,
+  bits_field(&SnapshotMsg::eid, 16),
+  float_field(&SnapshotMsg::x),
+  float_field(&SnapshotMsg::y),
+  float_field(&SnapshotMsg::ori),
+  float_field(&SnapshotMsg::speed),
+  bits_field(&SnapshotMsg::tick, 32),
+  bits_field(&SnapshotMsg::ack, 32));
+inline constexpr auto despawnSchema = make_message_schema<DespawnMsg>(E_SERVER_TO_CLIENT_DESPAWN,
+  bits_field(&DespawnMsg::eid, 16));
+inline constexpr auto worldChunkSchema = make_world_chunk_schema<E_SERVER_TO_CLIENT_WORLD_CHUNK>();
+inline constexpr auto worldStateAckSchema = make_world_state_ack_schema<E_CLIENT_TO_SERVER_WORLD_STATE_ACK>();
+
+// What each end receives, for MessageRegistry::dispatch
+typedef MessageRegistry<joinSchema, entityInputSchema, worldStateAckSchema> ClientToServerMessages;
+typedef MessageRegistry<newEntitySchema, setControlledEntitySchema, snapshotSchema, worldChunkSchema, despawnSchema>
+  ServerToClientMessages;
+
 void send_join(ENetPeer *peer);
 void send_new_entity(ENetPeer *peer, const Entity &ent);
 void send_set_controlled_entity(ENetPeer *peer, uint16_t eid);
-void send_entity_input(ENetPeer *peer, uint16_t eid, float thr, float steer);
-void send_snapshot(ENetPeer *peer, uint16_t eid, float x, float y, float ori, enet_uint32 timeStamp);
+void send_despawn(ENetPeer *peer, uint16_t eid);
+// seq numbers every input sent by the client, starting from 1. The packet
+// carries the whole window, oldest first, 4 bits per thr and steer.
+void send_entity_input(ENetPeer *peer, uint16_t eid, const InputWindow<InputCmd, inputWindowSize> &inputs);
+// ack is the seq of the last input applied to the entity, 0 if there was none
+void send_snapshot(ENetPeer *peer, uint16_t eid, float x, float y, float ori, float speed, uint32_t tick, uint32_t ack);
+// Every entity of world (sorted by eid) range coded as one block, what a
+// world transfer sends a joining client. False if it can't be coded, no
+// transfer may start then.
+bool encode_world_state(const std::vector<Entity> &world, std::vector<uint8_t> &data);
+// False on a malformed state, world is garbage then
+bool decode_world_state(const uint8_t *data, size_t size, std::vector<Entity> &world);
+void send_world_chunk(ENetPeer *peer, const WorldChunkMsg &chunk);
+void send_world_state_ack(ENetPeer *peer, uint16_t transfer, uint16_t received);
 
 MessageType get_packet_type(ENetPacket *packet);
 
-void deserialize_new_entity(ENetPacket *packet, Entity &ent);
-void deserialize_set_controlled_entity(ENetPacket *packet, uint16_t &eid);
-void deserialize_entity_input(ENetPacket *packet, uint16_t &eid, float &thr, float &steer);
-void deserialize_snapshot(ENetPacket *packet, uint16_t &eid, float &x, float &y, float &ori, enet_uint32& timeStamp);
+// The inputs of msg into cmds (inputWindowSize of them), returns how many
+uint32_t unpack_entity_input(const EntityInputMsg &msg, InputCmd *cmds);
 
@@ -0,0 +1,32 @@
+#pragma once
+#include "mathUtils.h"
+#include <limits>
+
+template<typename T>
+T pack_float(float v, float lo, float hi, int num_bits)
+{
+  T range = (1 << num_bits) - 1;//std::numeric_limits<T>::max();
+  return range * ((clamp(v, lo, hi) - lo) / (hi - lo));
+}
+
+template<typename T>
+float unpack_float(T c, float lo, float hi, int num_bits)
+{
+  T range = (1 << num_bits) - 1;//std::numeric_limits<T>::max();
+  return float(c) / range * (hi - lo) + lo;
+}
+
+template<typename T, int num_bits>
+struct PackedFloat
+{
+  T packedVal;
+
+  PackedFloat(float v, float lo, float hi) { pack(v, lo, hi); }
+  PackedFloat(T compressed_val) : packedVal(compressed_val) {}
+
+  void pack(float v, float lo, float hi) { packedVal = pack_float<T>(v, lo, hi, num_bits); }
+  float unpack(float lo, float hi) { return unpack_float<T>(packedVal, lo, hi, num_bits); }
+};
+
+typedef PackedFloat<uint8_t, 4> float4bitsQuantized;
+
@@ -3,53 +3,176 @@
 #include "./entity.h"
 #include "protocol.h"
 #include "mathUtils.h"
+#include "eidIndex.h"
+#include "eidAllocator.h"
+#include "inputBuffer.h"
 #include <stdlib.h>
+#include <string.h>
+#include <algorithm>
 #include <vector>
 #include <map>
 
 static std::vector<Entity> entities;
+// inputs[slot] belongs to entities[slot]
+static std::vector<InputBuffer<InputCmd>> inputs;
+static EidIndex entityIndex;
+static EidAllocator eids;
 static std::map<uint16_t, ENetPeer*> controlledMap;
+// transfers[i] sends the world to host->peers[i] when it joins, it gets
+// snapshots once that is done
+static std::vector<WorldTransferSender> transfers;
+static uint16_t nextTransfer = 0;
 
-void on_join(ENetPacket *packet, ENetPeer *peer, ENetHost *host)
+// As many chunks as the window of each transfer lets out
+static void send_world_chunks(ENetHost *host)
 {
-  for (const Entity &ent : entities)
-    send_new_entity(peer, ent);
+  static WorldChunkMsg chunk;
+  for (size_t i = 0; i < host->peerCount; ++i)
+    while (transfers[i].next_chunk(chunk))
+      send_world_chunk(&host->peers[i], chunk);
+}
+
+// Whether what changes in the world goes to host->peers[i] as messages: it has
+// the world, or is getting it and the transfer may not have the change
+static bool follows_world(ENetHost *host, size_t i)
+{
+  return host->peers[i].state == ENET_PEER_STATE_CONNECTED &&
+         (transfers[i].is_active() || transfers[i].is_done());
+}
 
-  uint16_t maxEid = entities.empty() ? invalid_entity : entities[0].eid;
-  for (const Entity &e : entities)
-    maxEid = std::max(maxEid, e.eid);
-  uint16_t newEid = maxEid + 1;
+void on_join(ENetPeer *peer, ENetHost *host)
+{
+  uint16_t newEid = eids.allocate();
+  if (newEid == invalid_entity)
+  {
+    printf("No eid left for a new entity\n");
+    return;
+  }
   uint32_t color = 0xff000000 +
                    0x00440000 * (rand() % 5) +
                    0x00004400 * (rand() % 5) +
                    0x00000044 * (rand() % 5);
   float x = (rand() % 4) * 5.f;
   float y = (rand() % 4) * 5.f;
-  Entity ent = {color, x, y, 0.f, (rand() / RAND_MAX) * 3.141592654f, 0.f, 0.f, newEid, enet_time_get() };
+  Entity ent = {color, x, y, 0.f, (rand() / RAND_MAX) * 3.141592654f, 0.f, 0.f, newEid };
+  entityIndex.insert(newEid);
   entities.push_back(ent);
+  inputs.emplace_back();
 
   controlledMap[newEid] = peer;
 
+  // the world, the new entity with it, goes to the peer in one transfer, the
+  // new entity alone to the others that have (or are getting) the world
+  static std::vector<Entity> world;
+  static std::vector<uint8_t> data;
+  world = entities;
+  std::sort(world.begin(), world.end(), [](const Entity &a, const Entity &b) { return a.eid < b.eid; });
+  if (encode_world_state(world, data))
+    transfers[peer - host->peers].start(++nextTransfer, data.data(), data.size());
+  send_world_chunks(host);
   for (size_t i = 0; i < host->peerCount; ++i)
-    send_new_entity(&host->peers[i], ent);
+    if (&host->peers[i] != peer && follows_world(host, i))
+      send_new_entity(&host->peers[i], ent);
   send_set_controlled_entity(peer, newEid);
 }
 
-void on_input(ENetPacket *packet)
+// The entity goes from the world and from every peer that has it, its eid
+// back to the allocator
+static void despawn(uint16_t eid, ENetHost *host)
 {
-  uint16_t eid = invalid_entity;
-  float thr = 0.f; float steer = 0.f;
-  deserialize_entity_input(packet, eid, thr, steer);
-  for (Entity &e : entities)
-    if (e.eid == eid)
+  if (!eids.free(eid))
+    return;
+  entityIndex.erase(entities, eid, inputs);
+  controlledMap.erase(eid);
+  for (size_t i = 0; i < host->peerCount; ++i)
+    if (follows_world(host, i))
+      send_despawn(&host->peers[i], eid);
+}
+
+// A peer that leaves takes its entities with it
+void on_disconnect(ENetPeer *peer, ENetHost *host)
+{
+  transfers[peer - host->peers].reset();
+  static std::vector<uint16_t> left;
+  left.clear();
+  for (const auto &controlled : controlledMap)
+    if (controlled.second == peer)
+      left.push_back(controlled.first);
+  for (uint16_t eid : left)
+    despawn(eid, host);
+}
+
+void on_world_state_ack(const WorldStateAckMsg &msg, ENetPeer *peer, ENetHost *host)
+{
+  transfers[peer - host->peers].on_ack(msg.transfer, msg.received);
+  send_world_chunks(host);
+}
+
+void on_input(const EntityInputMsg &msg, ENetPeer *peer)
+{
+  // a client only steers the entity it controls
+  auto controlled = controlledMap.find(msg.eid);
+  if (controlled == controlledMap.end() || controlled->second != peer)
+    return;
+  InputCmd cmds[inputWindowSize];
+  const uint32_t count = unpack_entity_input(msg, cmds);
+  // inputs we already have (or applied) from earlier windows are dropped by the buffer
+  if (InputBuffer<InputCmd> *input = entityIndex.get(inputs, msg.eid))
+    for (uint32_t i = 0; i < count; ++i)
+      input->push(msg.firstSeq + i, cmds[i]);
+}
+
+// What each message from a client does, see ClientToServerMessages
+struct ClientMessageHandler
+{
+  ENetPeer *peer;
+  ENetHost *host;
+
+  void operator()(const JoinMsg &) { on_join(peer, host); }
+  void operator()(const EntityInputMsg &msg) { on_input(msg, peer); }
+  void operator()(const WorldStateAckMsg &msg) { on_world_state_ack(msg, peer, host); }
+};
+
+// Advance every entity by one fixed step per input, exactly like the client
+// prediction does, catching up a little if inputs bunched up in transit.
+// Each round pops one input for every entity that still has one and steps
+// them as a batch.
+static void simulate_inputs()
+{
+  constexpr int maxInputsPerTick = 3;
+  static EntityBatch batch;
+  static std::vector<size_t> batchSlots;
+  for (int round = 0; round < maxInputsPerTick; ++round)
+  {
+    batch.clear();
+    batchSlots.clear();
+    for (size_t slot = 0; slot < entities.size(); ++slot)
     {
-      e.thr = thr;
-      e.steer = steer;
+      Entity &e = entities[slot];
+      InputCmd cmd;
+      if (!inputs[slot].pop(cmd))
+        continue;
+      e.thr = cmd.thr;
+      e.steer = cmd.steer;
+      batch.push(e);
+      batchSlots.push_back(slot);
     }
+    if (batchSlots.empty())
+      break;
+    simulate_entities(batch, fixedDt);
+    for (size_t i = 0; i < batchSlots.size(); ++i)
+      batch.copy_to(i, entities[batchSlots[i]]);
+  }
 }
 
 int main(int argc, const char **argv)
 {
+  // a different port lets netsim listen on the one clients connect to
+  uint16_t port = 10131;
+  for (int i = 1; i + 1 < argc; ++i)
+    if (strcmp(argv[i], "--port") == 0)
+      port = uint16_t(atoi(argv[++i]));
+
   if (enet_initialize() != 0)
   {
     printf("Cannot init ENet");
@@ -58,57 +181,68 @@ int main(int argc, const char **argv)
   ENetAddress address;
 
   address.host = ENET_HOST_ANY;
-  address.port = 10131;
+  address.port = port;
 
-  ENetHost *server = enet_host_create(&address, 32, 2, 0, 0);
+  ENetHost *server = enet_host_create(&address, 32, channelCount, 0, 0);
 
   if (!server)
   {
     printf("Cannot create ENet server\n");
     return 1;
   }
+  transfers.resize(server->peerCount);
 
-  uint32_t lastTime = enet_time_get();
+  uint32_t tick = 0;
+  uint32_t nextTickTime = enet_time_get();
   while (true)
   {
-    uint32_t curTime = enet_time_get();
-    float dt = (curTime - lastTime) * 0.001f;
-    lastTime = curTime;
+    // wait for packets until the next tick is due
+    int32_t untilTick = int32_t(nextTickTime - enet_time_get());
+    enet_uint32 timeout = untilTick > 0 ? enet_uint32(untilTick) : 0;
     ENetEvent event;
-    while (enet_host_service(server, &event, 0) > 0)
+    while (enet_host_service(server, &event, timeout) > 0)
     {
+      timeout = 0;
       switch (event.type)
       {
       case ENET_EVENT_TYPE_CONNECT:
         printf("Connection with %x:%u established\n", event.peer->address.host, event.peer->address.port);
+        transfers[event.peer - server->peers].reset();
+        break;
+      case ENET_EVENT_TYPE_DISCONNECT:
+        on_disconnect(event.peer, server);
         break;
       case ENET_EVENT_TYPE_RECEIVE:
-        switch (get_packet_type(event.packet))
-        {
-          case E_CLIENT_TO_SERVER_JOIN:
-            on_join(event.packet, event.peer, server);
-            break;
-          case E_CLIENT_TO_SERVER_INPUT:
-            on_input(event.packet);
-            break;
-        };
+      {
+        ClientMessageHandler handler{ event.peer, server };
+        ClientToServerMessages::dispatch(handler, event.packet);
         enet_packet_destroy(event.packet);
         break;
+      }
       default:
         break;
       };
     }
-    static int t = 0;
-    for (Entity &e : entities)
+    if (int32_t(enet_time_get() - nextTickTime) < 0)
+      continue;
+    nextTickTime += fixedDtMs;
+    ++tick;
+
+    simulate_inputs();
+    send_world_chunks(server);
+    for (size_t slot = 0; slot < entities.size(); ++slot)
     {
-      simulate_entity(e, dt);
+      const Entity &e = entities[slot];
+      uint32_t ack = inputs[slot].get_last_applied();
       for (size_t i = 0; i < server->peerCount; ++i)
       {
+        // nothing to apply a snapshot to before the client has the world
+        if (!transfers[i].is_done())
+          continue;
         ENetPeer *peer = &server->peers[i];
-        send_snapshot(peer, e.eid, e.x, e.y, e.ori, enet_time_get());
+        send_snapshot(peer, e.eid, e.x, e.y, e.ori, e.speed, tick, ack);
       }
     }
-    Sleep(100);
   }
 
   enet_host_destroy(server);
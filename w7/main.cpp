@@ -8,42 +8,64 @@
 #include <vector>
 #include "entity.h"
 #include "protocol.h"
+#include "eidIndex.h"
+#include "sequenceRing.h"
 
 
 static std::vector<Entity> entities;
+static EidIndex entityIndex;
 static uint16_t my_entity = invalid_entity;
+static uint32_t inputSeq = 0;
+static InputWindow<InputCmd, inputWindowSize> sentInputs;
+static SequenceRing<WorldSnapshot, snapshotHistorySize> receivedSnapshots;
+static uint32_t newestSnapshotSeq = 0;
 
-void on_new_entity_packet(ENetPacket *packet)
+void on_new_entity(const Entity &newEntity)
 {
-  Entity newEntity;
-  deserialize_new_entity(packet, newEntity);
-  // TODO: Direct adressing, of course!
-  for (const Entity &e : entities)
-    if (e.eid == newEntity.eid)
-      return; // don't need to do anything, we already have entity
+  // an entity we already have keeps its slot, invalid_entity gets none
+  if (entityIndex.insert(newEntity.eid) != entities.size())
+    return;
   entities.push_back(newEntity);
 }
 
-void on_set_controlled_entity(ENetPacket *packet)
+// Rebuilds the world from the baseline the server picked, keeps it as a
+// baseline for later snapshots and acks it.
+void on_snapshot(ENetPacket *packet, ENetPeer *peer)
 {
-  deserialize_set_controlled_entity(packet, my_entity);
-}
-
-void on_snapshot(ENetPacket *packet)
-{
-  uint16_t eid = invalid_entity;
-  float x = 0.f; float y = 0.f; float ori = 0.f;
-  deserialize_snapshot(packet, eid, x, y, ori);
-  // TODO: Direct adressing, of course!
-  for (Entity &e : entities)
-    if (e.eid == eid)
+  uint32_t seq = 0;
+  uint32_t baselineSeq = 0;
+  if (!read_world_snapshot_header(packet, seq, baselineSeq) || receivedSnapshots.find(seq))
+    return;
+  const WorldSnapshot *baseline = nullptr;
+  if (baselineSeq != 0 && !(baseline = receivedSnapshots.find(baselineSeq)))
+    return;
+  static WorldSnapshot world;
+  if (!read_world_snapshot(packet, baseline, world))
+    return;
+  receivedSnapshots.insert(seq) = world;
+  send_snapshot_ack(peer, seq);
+  if (seq < newestSnapshotSeq)
+    return; // late, we already show a newer one
+  newestSnapshotSeq = seq;
+  for (const EntitySnapshot &snapshot : world)
+    if (Entity *e = entityIndex.get(entities, snapshot.eid))
     {
-      e.x = x;
-      e.y = y;
-      e.ori = ori;
+      e->x = snapshot.x;
+      e->y = snapshot.y;
+      e->ori = snapshot.ori;
     }
 }
 
+// What each message from the server does, see ServerToClientMessages
+struct ServerMessageHandler
+{
+  ENetPeer *peer;
+
+  void operator()(const Entity &msg) { on_new_entity(msg); }
+  void operator()(const SetControlledEntityMsg &msg) { my_entity = msg.eid; }
+  void operator()(const WorldSnapshotMsg &msg) { on_snapshot(msg.packet, peer); }
+};
+
 int main(int argc, const char **argv)
 {
   if (enet_initialize() != 0)
@@ -108,19 +130,12 @@ int main(int argc, const char **argv)
         connected = true;
         break;
       case ENET_EVENT_TYPE_RECEIVE:
-        switch (get_packet_type(event.packet))
-        {
-        case E_SERVER_TO_CLIENT_NEW_ENTITY:
-          on_new_entity_packet(event.packet);
-          break;
-        case E_SERVER_TO_CLIENT_SET_CONTROLLED_ENTITY:
-          on_set_controlled_entity(event.packet);
-          break;
-        case E_SERVER_TO_CLIENT_SNAPSHOT:
-          on_snapshot(event.packet);
-          break;
-        };
+      {
+        ServerMessageHandler handler{ event.peer };
+        ServerToClientMessages::dispatch(handler, event.packet);
+        enet_packet_destroy(event.packet);
         break;
+      }
       default:
         break;
       };
@@ -131,17 +146,16 @@ int main(int argc, const char **argv)
       bool right = IsKeyDown(KEY_RIGHT);
       bool up = IsKeyDown(KEY_UP);
       bool down = IsKeyDown(KEY_DOWN);
-      // TODO: Direct adressing, of course!
-      for (Entity &e : entities)
-        if (e.eid == my_entity)
-        {
-          // Update
-          float thr = (up ? 1.f : 0.f) + (down ? -1.f : 0.f);
-          float steer = (left ? -1.f : 0.f) + (right ? 1.f : 0.f);
-
-          // Send
-          send_entity_input(serverPeer, my_entity, thr, steer);
-        }
+      if (entityIndex.contains(my_entity))
+      {
+        // Update
+        float thr = (up ? 1.f : 0.f) + (down ? -1.f : 0.f);
+        float steer = (left ? -1.f : 0.f) + (right ? 1.f : 0.f);
+
+        // Send, together with the inputs before it in case some were lost
+        sentInputs.push(++inputSeq, { thr, steer });
+        send_entity_input(serverPeer, my_entity, sentInputs);
+      }
     }
 
     BeginDrawing();
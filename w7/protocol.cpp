@@ -1,127 +1,147 @@
 #include "protocol.h"
 #include "quantisation.h"
+#include "messageSchema.h"
+#include "snapshotDelta.h"
+#include <algorithm>
 #include <cstring> // memcpy
 #include <iostream>
 
 void send_join(ENetPeer *peer)
 {
-  ENetPacket *packet = enet_packet_create(nullptr, sizeof(uint8_t), ENET_PACKET_FLAG_RELIABLE);
-  *packet->data = E_CLIENT_TO_SERVER_JOIN;
-
-  enet_peer_send(peer, 0, packet);
+  enet_peer_send(peer, 0, create_message_packet(joinSchema, {}, ENET_PACKET_FLAG_RELIABLE));
 }
 
 void send_new_entity(ENetPeer *peer, const Entity &ent)
 {
-  ENetPacket *packet = enet_packet_create(nullptr, sizeof(uint8_t) + sizeof(Entity),
-                                                   ENET_PACKET_FLAG_RELIABLE);
-  uint8_t *ptr = packet->data;
-  *ptr = E_SERVER_TO_CLIENT_NEW_ENTITY; ptr += sizeof(uint8_t);
-  memcpy(ptr, &ent, sizeof(Entity)); ptr += sizeof(Entity);
-
-  enet_peer_send(peer, 0, packet);
+  enet_peer_send(peer, 0, create_message_packet(newEntitySchema, ent, ENET_PACKET_FLAG_RELIABLE));
 }
 
 void send_set_controlled_entity(ENetPeer *peer, uint16_t eid)
 {
-  ENetPacket *packet = enet_packet_create(nullptr, sizeof(uint8_t) + sizeof(uint16_t),
-                                                   ENET_PACKET_FLAG_RELIABLE);
-  uint8_t *ptr = packet->data;
-  *ptr = E_SERVER_TO_CLIENT_SET_CONTROLLED_ENTITY; ptr += sizeof(uint8_t);
-  memcpy(ptr, &eid, sizeof(uint16_t)); ptr += sizeof(uint16_t);
+  enet_peer_send(peer, 0, create_message_packet(setControlledEntitySchema, { eid }, ENET_PACKET_FLAG_RELIABLE));
+}
 
-  enet_peer_send(peer, 0, packet);
+// thr and steer in 4 bits each, neutral unpacks to exactly 0
+static uint8_t pack_input(const InputCmd &cmd)
+{
+  float4bitsQuantized thrPacked(cmd.thr, -1.f, 1.f);
+  float4bitsQuantized steerPacked(cmd.steer, -1.f, 1.f);
+  return (thrPacked.packedVal << 4) | steerPacked.packedVal;
 }
 
-void send_entity_input(ENetPeer *peer, uint16_t eid, float thr, float ori)
+// All 16 values unpacked once, the server unpacks 8 inputs per packet
+struct UnpackedInputTable
 {
-  ENetPacket *packet = enet_packet_create(nullptr, sizeof(uint8_t) + sizeof(uint16_t) +
-                                                   sizeof(uint8_t),
-                                                   ENET_PACKET_FLAG_UNSEQUENCED);
-  uint8_t *ptr = packet->data;
-  *ptr = E_CLIENT_TO_SERVER_INPUT; ptr += sizeof(uint8_t);
-  memcpy(ptr, &eid, sizeof(uint16_t)); ptr += sizeof(uint16_t);
-  float4bitsQuantized thrPacked(thr, -1.f, 1.f);
-  float4bitsQuantized oriPacked(ori, -1.f, 1.f);
-  uint8_t thrSteerPacked = (thrPacked.packedVal << 4) | oriPacked.packedVal;
-  memcpy(ptr, &thrSteerPacked, sizeof(uint8_t)); ptr += sizeof(uint8_t);
-  /*
-  memcpy(ptr, &thrPacked, sizeof(uint8_t)); ptr += sizeof(uint8_t);
-  memcpy(ptr, &oriPacked, sizeof(uint8_t)); ptr += sizeof(uint8_t);
-  */
-
-  enet_peer_send(peer, 1, packet);
+  float values[16];
+
+  UnpackedInputTable()
+  {
+    const uint8_t neutralPackedValue = pack_float<uint8_t>(0.f, -1.f, 1.f, 4);
+    for (uint8_t i = 0; i < 16; ++i)
+      values[i] = i == neutralPackedValue ? 0.f : float4bitsQuantized(i).unpack(-1.f, 1.f);
+  }
+};
+static const UnpackedInputTable unpackedInputs;
+
+static InputCmd unpack_input(uint8_t thrSteerPacked)
+{
+  InputCmd cmd;
+  cmd.thr = unpackedInputs.values[thrSteerPacked >> 4];
+  cmd.steer = unpackedInputs.values[thrSteerPacked & 0x0f];
+  return cmd;
 }
 
-typedef PackedFloat<uint16_t, 11> PositionXQuantized;
-typedef PackedFloat<uint16_t, 10> PositionYQuantized;
+void send_entity_input(ENetPeer *peer, uint16_t eid, const InputWindow<InputCmd, inputWindowSize> &inputs)
+{
+  EntityInputMsg msg;
+  msg.eid = eid;
+  msg.firstSeq = inputs.get_first_seq();
+  msg.count = uint8_t(inputs.get_count());
+  for (uint32_t i = 0; i < msg.count; ++i)
+    msg.packedInputs[i] = pack_input(inputs.get(msg.firstSeq + i));
+
+  enet_peer_send(peer, 1, create_message_packet(entityInputSchema, msg, ENET_PACKET_FLAG_UNSEQUENCED));
+}
 
-void send_snapshot(ENetPeer *peer, uint16_t eid, float x, float y, float ori)
+// x, y, ori in 11, 10 and 8 bits, small changes as 8, 8 and 4 bit deltas
+static constexpr auto snapshotSchema = make_message_schema<EntitySnapshot>(E_SERVER_TO_CLIENT_SNAPSHOT,
+  range_field(&EntitySnapshot::x, -16.f, 16.f, 11, 8),
+  range_field(&EntitySnapshot::y, -8.f, 8.f, 10, 8),
+  range_field(&EntitySnapshot::ori, -PI, PI, 8, 4));
+static_assert(snapshotSchema.is_valid());
+static_assert(snapshotHistorySize < 256, "baseline age is sent in 8 bits");
+
+// [8: type][32: seq][8: seq - baseline seq, 0 for none], then the world delta
+constexpr uint32_t snapshotHeaderBits = 8 + 32 + 8;
+
+void make_world_snapshot(const std::vector<Entity> &entities, WorldSnapshot &world)
 {
-  ENetPacket *packet = enet_packet_create(nullptr, sizeof(uint8_t) + sizeof(uint16_t) +
-                                                   sizeof(uint16_t) +
-                                                   sizeof(uint16_t) +
-                                                   sizeof(uint8_t),
-                                                   ENET_PACKET_FLAG_UNSEQUENCED);
-  uint8_t *ptr = packet->data;
-  *ptr = E_SERVER_TO_CLIENT_SNAPSHOT; ptr += sizeof(uint8_t);
-  memcpy(ptr, &eid, sizeof(uint16_t)); ptr += sizeof(uint16_t);
-  PositionXQuantized xPacked(x, -16, 16);
-  PositionYQuantized yPacked(y, -8, 8);
-  uint8_t oriPacked = pack_float<uint8_t>(ori, -PI, PI, 8);
-  //printf("xPacked/unpacked %d %f\n", xPacked, x);
-  memcpy(ptr, &xPacked.packedVal, sizeof(uint16_t)); ptr += sizeof(uint16_t);
-  memcpy(ptr, &yPacked.packedVal, sizeof(uint16_t)); ptr += sizeof(uint16_t);
-  memcpy(ptr, &oriPacked, sizeof(uint8_t)); ptr += sizeof(uint8_t);
-
-  enet_peer_send(peer, 1, packet);
+  world.resize(entities.size());
+  for (size_t i = 0; i < entities.size(); ++i)
+  {
+    const Entity &e = entities[i];
+    world[i] = { e.eid, e.x, e.y, e.ori };
+    snapshotSchema.quantize(world[i]);
+  }
+  std::sort(world.begin(), world.end(),
+            [](const EntitySnapshot &a, const EntitySnapshot &b) { return a.eid < b.eid; });
 }
 
-MessageType get_packet_type(ENetPacket *packet)
+bool send_world_snapshot(ENetPeer *peer, uint32_t seq, uint32_t baselineSeq, const WorldSnapshot *baseline,
+                         const WorldSnapshot &world)
 {
-  return (MessageType)*packet->data;
+  static std::vector<uint8_t> buffer;
+  const size_t maxBits = snapshotHeaderBits +
+                         get_max_world_delta_bits(snapshotSchema, baseline ? baseline->size() : 0, world.size());
+  buffer.assign((maxBits + 7) / 8, 0);
+  BitWriter writer(buffer.data(), buffer.size());
+  writer.write(E_SERVER_TO_CLIENT_SNAPSHOT, 8);
+  writer.write(seq, 32);
+  writer.write(baseline ? seq - baselineSeq : 0, 8);
+  if (write_world_delta(writer, snapshotSchema, baseline, world) == 0 && baseline)
+    return false;
+
+  ENetPacket *packet = enet_packet_create(buffer.data(), writer.get_byte_count(), ENET_PACKET_FLAG_UNSEQUENCED);
+  if (enet_peer_send(peer, 1, packet) < 0)
+  {
+    enet_packet_destroy(packet);
+    return false;
+  }
+  return true;
 }
 
-void deserialize_new_entity(ENetPacket *packet, Entity &ent)
+void send_snapshot_ack(ENetPeer *peer, uint32_t seq)
 {
-  uint8_t *ptr = packet->data; ptr += sizeof(uint8_t);
-  ent = *(Entity*)(ptr); ptr += sizeof(Entity);
+  enet_peer_send(peer, 1, create_message_packet(snapshotAckSchema, { seq }, ENET_PACKET_FLAG_UNSEQUENCED));
 }
 
-void deserialize_set_controlled_entity(ENetPacket *packet, uint16_t &eid)
+MessageType get_packet_type(ENetPacket *packet)
 {
-  uint8_t *ptr = packet->data; ptr += sizeof(uint8_t);
-  eid = *(uint16_t*)(ptr); ptr += sizeof(uint16_t);
+  return packet->dataLength > 0 ? (MessageType)*packet->data : E_INVALID_MESSAGE;
 }
 
-void deserialize_entity_input(ENetPacket *packet, uint16_t &eid, float &thr, float &steer)
+uint32_t unpack_entity_input(const EntityInputMsg &msg, InputCmd *cmds)
 {
-  uint8_t *ptr = packet->data; ptr += sizeof(uint8_t);
-  eid = *(uint16_t*)(ptr); ptr += sizeof(uint16_t);
-  uint8_t thrSteerPacked = *(uint8_t*)(ptr); ptr += sizeof(uint8_t);
-  /*
-  uint8_t thrPacked = *(uint8_t*)(ptr); ptr += sizeof(uint8_t);
-  uint8_t oriPacked = *(uint8_t*)(ptr); ptr += sizeof(uint8_t);
-  */
-  static uint8_t neutralPackedValue = pack_float<uint8_t>(0.f, -1.f, 1.f, 4);
-  static uint8_t nominalPackedValue = pack_float<uint8_t>(1.f, 0.f, 1.2f, 4);
-  float4bitsQuantized thrPacked(thrSteerPacked >> 4);
-  float4bitsQuantized steerPacked(thrSteerPacked & 0x0f);
-  thr = thrPacked.packedVal == neutralPackedValue ? 0.f : thrPacked.unpack(-1.f, 1.f);
-  steer = steerPacked.packedVal == neutralPackedValue ? 0.f : steerPacked.unpack(-1.f, 1.f);
+  // a received count is never over inputWindowSize, one set locally might be
+  const uint32_t count = std::min<uint32_t>(msg.count, inputWindowSize);
+  for (uint32_t i = 0; i < count; ++i)
+    cmds[i] = unpack_input(msg.packedInputs[i]);
+  return count;
 }
 
-void deserialize_snapshot(ENetPacket *packet, uint16_t &eid, float &x, float &y, float &ori)
+bool read_world_snapshot_header(ENetPacket *packet, uint32_t &seq, uint32_t &baselineSeq)
 {
-  uint8_t *ptr = packet->data; ptr += sizeof(uint8_t);
-  eid = *(uint16_t*)(ptr); ptr += sizeof(uint16_t);
-  uint16_t xPacked = *(uint16_t*)(ptr); ptr += sizeof(uint16_t);
-  uint16_t yPacked = *(uint16_t*)(ptr); ptr += sizeof(uint16_t);
-  PositionXQuantized xPackedVal(xPacked);
-  PositionYQuantized yPackedVal(yPacked);
-  uint8_t oriPacked = *(uint8_t*)(ptr); ptr += sizeof(uint8_t);
-  x = xPackedVal.unpack(-16, 16);
-  y = yPackedVal.unpack(-8, 8);
-  ori = unpack_float<uint8_t>(oriPacked, -PI, PI, 8);
+  BitReader reader(packet->data, packet->dataLength);
+  reader.read(8);
+  seq = reader.read(32);
+  const uint32_t age = reader.read(8);
+  baselineSeq = age != 0 ? seq - age : 0;
+  return !reader.is_overflowed() && (age == 0 || baselineSeq != 0);
 }
 
+bool read_world_snapshot(ENetPacket *packet, const WorldSnapshot *baseline, WorldSnapshot &world)
+{
+  BitReader reader(packet->data, packet->dataLength);
+  reader.skip(snapshotHeaderBits);
+  return read_world_delta(reader, snapshotSchema, baseline, world);
+}
@@ -2,6 +2,33 @@
 #include <enet/enet.h>
 #include <cstdint>
 #include "entity.h"
+#include "inputWindow.h"
+#include "messageRegistry.h"
+#include <vector>
+
+struct InputCmd
+{
+  float thr = 0.f;
+  float steer = 0.f;
+};
+
+// Every input packet repeats the last inputWindowSize inputs
+constexpr uint32_t inputWindowSize = 8;
+
+// One entity of a world snapshot, quantized the way the wire carries it
+struct EntitySnapshot
+{
+  uint16_t eid = invalid_entity;
+  float x = 0.f;
+  float y = 0.f;
+  float ori = 0.f;
+};
+
+// Every entity, sorted by eid. The server sends each client only what changed
+// since the newest snapshot that client acked, both ends keep the last
+// snapshotHistorySize snapshots as possible baselines.
+typedef std::vector<EntitySnapshot> WorldSnapshot;
+constexpr uint32_t snapshotHistorySize = 32;
 
 enum MessageType : uint8_t
 {
@@ -9,19 +36,71 @@ enum MessageType : uint8_t
   E_SERVER_TO_CLIENT_NEW_ENTITY,
   E_SERVER_TO_CLIENT_SET_CONTROLLED_ENTITY,
   E_CLIENT_TO_SERVER_INPUT,
-  E_SERVER_TO_CLIENT_SNAPSHOT
+  E_SERVER_TO_CLIENT_SNAPSHOT,
+  E_CLIENT_TO_SERVER_SNAPSHOT_ACK,
+  E_INVALID_MESSAGE = 0xff // what get_packet_type returns for an empty packet
+};
+
+// Every message but the world snapshot as its schema sends it, see
+// messageRegistry.h. New entities go as the Entity itself.
+struct JoinMsg {};
+struct SetControlledEntityMsg { uint16_t eid = invalid_entity; };
+// The window of inputs firstSeq .. firstSeq + count - 1, thr and steer of
+// each packed in 4 bits by send_entity_input
+struct EntityInputMsg
+{
+  uint16_t eid = invalid_entity;
+  uint32_t firstSeq = 0;
+  uint8_t count = 0;
+  uint8_t packedInputs[inputWindowSize] = {};
 };
+struct SnapshotAckMsg { uint32_t seq = 0; };
+// framed by send_world_snapshot, read with read_world_snapshot_header/read_world_snapshot
+typedef RawMessage<E_SERVER_TO_CLIENT_SNAPSHOT> WorldSnapshotMsg;
+
+inline constexpr auto joinSchema = make_message_schema<JoinMsg>(E_CLIENT_TO_SERVER_JOIN);
+inline constexpr auto newEntitySchema = make_message_schema<Entity>(E_SERVER_TO_CLIENT_NEW_ENTITY,
+  bits_field(&Entity::color, 32),
+  float_field(&Entity::x),
+  float_field(&Entity::y),
+  float_field(&Entity::speed),
+  float_field(&Entity::ori),
+  float_field(&Entity::thr),
+  float_field(&Entity::steer),
+  bits_field(&Entity::eid, 16));
+inline constexpr auto setControlledEntitySchema = make_message_schema<SetControlledEntityMsg>(
+  E_SERVER_TO_CLIENT_SET_CONTROLLED_ENTITY,
+  bits_field(&SetControlledEntityMsg::eid, 16));
+inline constexpr auto entityInputSchema = make_message_schema<EntityInputMsg>(E_CLIENT_TO_SERVER_INPUT,
+  bits_field(&EntityInputMsg::eid, 16),
+  bits_field(&EntityInputMsg::firstSeq, 32),
+  array_field(&EntityInputMsg::packedInputs, &EntityInputMsg::count, 8));
+inline constexpr auto snapshotAckSchema = make_message_schema<SnapshotAckMsg>(E_CLIENT_TO_SERVER_SNAPSHOT_ACK,
+  bits_field(&SnapshotAckMsg::seq, 32));
+inline constexpr auto worldSnapshotSchema = make_raw_message_schema<E_SERVER_TO_CLIENT_SNAPSHOT>();
+
+// What each end receives, for MessageRegistry::dispatch
+typedef MessageRegistry<joinSchema, entityInputSchema, snapshotAckSchema> ClientToServerMessages;
+typedef MessageRegistry<newEntitySchema, setControlledEntitySchema, worldSnapshotSchema> ServerToClientMessages;
 
 void send_join(ENetPeer *peer);
 void send_new_entity(ENetPeer *peer, const Entity &ent);
 void send_set_controlled_entity(ENetPeer *peer, uint16_t eid);
-void send_entity_input(ENetPeer *peer, uint16_t eid, float thr, float steer);
-void send_snapshot(ENetPeer *peer, uint16_t eid, float x, float y, float ori);
+// seq numbers every input sent by the client, starting from 1. The packet
+// carries the whole window, oldest first, 4 bits per thr and steer.
+void send_entity_input(ENetPeer *peer, uint16_t eid, const InputWindow<InputCmd, inputWindowSize> &inputs);
+void make_world_snapshot(const std::vector<Entity> &entities, WorldSnapshot &world);
+// Sends what differs from baseline (nullptr for full state) as snapshot seq.
+// Returns false without sending if there is no difference or the send fails.
+bool send_world_snapshot(ENetPeer *peer, uint32_t seq, uint32_t baselineSeq, const WorldSnapshot *baseline,
+                         const WorldSnapshot &world);
+void send_snapshot_ack(ENetPeer *peer, uint32_t seq);
 
 MessageType get_packet_type(ENetPacket *packet);
 
-void deserialize_new_entity(ENetPacket *packet, Entity &ent);
-void deserialize_set_controlled_entity(ENetPacket *packet, uint16_t &eid);
-void deserialize_entity_input(ENetPacket *packet, uint16_t &eid, float &thr, float &steer);
-void deserialize_snapshot(ENetPacket *packet, uint16_t &eid, float &x, float &y, float &ori);
+// The inputs of msg into cmds (inputWindowSize of them), returns how many
+uint32_t unpack_entity_input(const EntityInputMsg &msg, InputCmd *cmds);
+// baselineSeq is 0 for a full snapshot, otherwise the baseline must be passed to read_world_snapshot
+bool read_world_snapshot_header(ENetPacket *packet, uint32_t &seq, uint32_t &baselineSeq);
+bool read_world_snapshot(ENetPacket *packet, const WorldSnapshot *baseline, WorldSnapshot &world);
 
@@ -3,14 +3,24 @@
 #include "entity.h"
 #include "protocol.h"
 #include "mathUtils.h"
+#include "eidIndex.h"
+#include "inputBuffer.h"
+#include "snapshotDelta.h"
+#include "profiler.h"
 #include <stdlib.h>
+#include <string.h>
 #include <vector>
 #include <map>
 
 static std::vector<Entity> entities;
+// inputs[slot] belongs to entities[slot]
+static std::vector<InputBuffer<InputCmd>> inputs;
+static EidIndex entityIndex;
+// replication[i] belongs to server->peers[i]
+static std::vector<DeltaBaselines<WorldSnapshot, snapshotHistorySize>> replication;
 static std::map<uint16_t, ENetPeer*> controlledMap;
 
-void on_join(ENetPacket *packet, ENetPeer *peer, ENetHost *host)
+void on_join(ENetPeer *peer, ENetHost *host)
 {
   // send all entities
   for (const Entity &ent : entities)
@@ -21,6 +31,11 @@ void on_join(ENetPacket *packet, ENetPeer *peer, ENetHost *host)
   for (const Entity &e : entities)
     maxEid = std::max(maxEid, e.eid);
   uint16_t newEid = maxEid + 1;
+  if (newEid == invalid_entity)
+  {
+    printf("No eid left for a new entity\n");
+    return;
+  }
   uint32_t color = 0xff000000 +
                    0x00440000 * (rand() % 5) +
                    0x00004400 * (rand() % 5) +
@@ -28,7 +43,9 @@ void on_join(ENetPacket *packet, ENetPeer *peer, ENetHost *host)
   float x = (rand() % 4) * 5.f;
   float y = (rand() % 4) * 5.f;
   Entity ent = {color, x, y, 0.f, (rand() / RAND_MAX) * 3.141592654f, 0.f, 0.f, newEid};
+  entityIndex.insert(newEid);
   entities.push_back(ent);
+  inputs.emplace_back();
 
   controlledMap[newEid] = peer;
 
@@ -40,21 +57,66 @@ void on_join(ENetPacket *packet, ENetPeer *peer, ENetHost *host)
   send_set_controlled_entity(peer, newEid);
 }
 
-void on_input(ENetPacket *packet)
+void on_input(const EntityInputMsg &msg, ENetPeer *peer)
 {
-  uint16_t eid = invalid_entity;
-  float thr = 0.f; float steer = 0.f;
-  deserialize_entity_input(packet, eid, thr, steer);
-  for (Entity &e : entities)
-    if (e.eid == eid)
-    {
-      e.thr = thr;
-      e.steer = steer;
-    }
+  // a client only steers the entity it controls
+  auto controlled = controlledMap.find(msg.eid);
+  if (controlled == controlledMap.end() || controlled->second != peer)
+    return;
+  InputCmd cmds[inputWindowSize];
+  const uint32_t count = unpack_entity_input(msg, cmds);
+  // inputs we already have (or applied) from earlier windows are dropped by the buffer
+  if (InputBuffer<InputCmd> *input = entityIndex.get(inputs, msg.eid))
+    for (uint32_t i = 0; i < count; ++i)
+      input->push(msg.firstSeq + i, cmds[i]);
+}
+
+// What each message from a client does, see ClientToServerMessages
+struct ClientMessageHandler
+{
+  ENetPeer *peer;
+  ENetHost *host;
+
+  void operator()(const JoinMsg &) { on_join(peer, host); }
+  void operator()(const EntityInputMsg &msg) { on_input(msg, peer); }
+  void operator()(const SnapshotAckMsg &msg) { replication[peer - host->peers].ack(msg.seq); }
+};
+
+// Applies the next input of every entity in seq order, an entity keeps its
+// last input until a newer one arrives. If inputs pile up (client sending
+// faster than the server ticks) the oldest are skipped to bound the latency.
+static void apply_inputs()
+{
+  for (size_t slot = 0; slot < entities.size(); ++slot)
+  {
+    InputCmd cmd;
+    bool applied = inputs[slot].pop(cmd);
+    while (applied && inputs[slot].get_pending() > inputWindowSize)
+      inputs[slot].pop(cmd);
+    if (!applied)
+      continue;
+    entities[slot].thr = cmd.thr;
+    entities[slot].steer = cmd.steer;
+  }
 }
 
 int main(int argc, const char **argv)
 {
+  // a different port lets netsim listen on the one clients connect to
+  uint16_t port = 10131;
+  // a tick slower than this saves the profiler's trace of the last second, 0 never does
+  float slowTickMs = 0.f;
+  const char *tracePath = "w7_server_trace.json";
+  for (int i = 1; i + 1 < argc; ++i)
+  {
+    if (strcmp(argv[i], "--port") == 0)
+      port = uint16_t(atoi(argv[++i]));
+    else if (strcmp(argv[i], "--slow-tick-ms") == 0)
+      slowTickMs = float(atof(argv[++i]));
+    else if (strcmp(argv[i], "--trace") == 0)
+      tracePath = argv[++i];
+  }
+
   if (enet_initialize() != 0)
   {
     printf("Cannot init ENet");
@@ -63,7 +125,7 @@ int main(int argc, const char **argv)
   ENetAddress address;
 
   address.host = ENET_HOST_ANY;
-  address.port = 10131;
+  address.port = port;
 
   ENetHost *server = enet_host_create(&address, 32, 2, 0, 0);
 
@@ -72,51 +134,65 @@ int main(int argc, const char **argv)
     printf("Cannot create ENet server\n");
     return 1;
   }
+  replication.resize(server->peerCount);
 
   uint32_t lastTime = enet_time_get();
+  set_profile_thread_name("server");
+  SlowTickTrace slowTicks(tracePath, slowTickMs);
   while (true)
   {
+    slowTicks.begin();
     uint32_t curTime = enet_time_get();
     float dt = (curTime - lastTime) * 0.001f;
     lastTime = curTime;
-    ENetEvent event;
-    while (enet_host_service(server, &event, 0) > 0)
     {
-      switch (event.type)
+      PROFILE_ZONE("receive");
+      ENetEvent event;
+      while (enet_host_service(server, &event, 0) > 0)
       {
-      case ENET_EVENT_TYPE_CONNECT:
-        printf("Connection with %x:%u established\n", event.peer->address.host, event.peer->address.port);
-        break;
-      case ENET_EVENT_TYPE_RECEIVE:
-        switch (get_packet_type(event.packet))
+        switch (event.type)
         {
-          case E_CLIENT_TO_SERVER_JOIN:
-            on_join(event.packet, event.peer, server);
-            break;
-          case E_CLIENT_TO_SERVER_INPUT:
-            on_input(event.packet);
-            break;
+        case ENET_EVENT_TYPE_CONNECT:
+          printf("Connection with %x:%u established\n", event.peer->address.host, event.peer->address.port);
+          replication[event.peer - server->peers].reset();
+          break;
+        case ENET_EVENT_TYPE_RECEIVE:
+        {
+          ClientMessageHandler handler{ event.peer, server };
+          ClientToServerMessages::dispatch(handler, event.packet);
+          enet_packet_destroy(event.packet);
+          break;
+        }
+        default:
+          break;
         };
-        enet_packet_destroy(event.packet);
-        break;
-      default:
-        break;
-      };
+      }
+    }
+    {
+      PROFILE_ZONE("simulate");
+      apply_inputs();
+      static int t = 0;
+      for (Entity &e : entities)
+        simulate_entity(e, dt);
     }
-    static int t = 0;
-    for (Entity &e : entities)
     {
-      // simulate
-      simulate_entity(e, dt);
-      // send
+      PROFILE_ZONE("snapshots");
+      // one snapshot of the world, every peer gets what changed since the one it acked
+      static WorldSnapshot world;
+      make_world_snapshot(entities, world);
       for (size_t i = 0; i < server->peerCount; ++i)
       {
         ENetPeer *peer = &server->peers[i];
-        // skip this here in this implementation
-        //if (controlledMap[e.eid] != peer)
-        send_snapshot(peer, e.eid, e.x, e.y, e.ori);
+        if (peer->state != ENET_PEER_STATE_CONNECTED)
+          continue;
+        uint32_t baselineSeq = 0;
+        const WorldSnapshot *baseline = replication[i].get_baseline(baselineSeq);
+        if (send_world_snapshot(peer, replication[i].get_next_seq(), baselineSeq, baseline, world))
+          replication[i].push(world);
       }
     }
+    if (slowTicks.end(enet_time_get()))
+      printf("Tick took %.1f ms, trace in %s\n", slowTicks.get_tick_ms(), tracePath);
     usleep(10000);
   }
 